@@ -29,6 +29,7 @@
 #include <sweep/sweep_undo.h>
 #include <sweep/sweep_sample.h>
 #include <sweep/sweep_sounddata.h>
+#include <sweep/sweep_analysis.h>
 #include <sweep/sweep_selection.h>
 #include <sweep/sweep_filter.h>
 
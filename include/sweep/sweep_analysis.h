@@ -0,0 +1,94 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SWEEP_ANALYSIS_H__
+#define __SWEEP_ANALYSIS_H__
+
+/*
+ * sounddata_get_analysis (sounddata, window)
+ *
+ * returns the per-window RMS, mean absolute value, peak and zero
+ * crossing counts of sounddata for the given window size. The result is
+ * computed on first use and cached on sounddata, so later callers asking
+ * for the same window size share it; only windows touched by edits since
+ * are recomputed. Release the result with analysis_unref().
+ */
+sw_analysis *
+sounddata_get_analysis (sw_sounddata * sounddata, sw_framecount_t window);
+
+/*
+ * sounddata_get_cached_analysis (sounddata, window)
+ *
+ * returns the cached analysis of sounddata for the given window size if
+ * it is already up to date, without computing anything; otherwise NULL.
+ * A window of 0 takes the up to date analysis with the smallest window,
+ * for callers such as peak finding which can use any. Release the
+ * result with analysis_unref().
+ */
+sw_analysis *
+sounddata_get_cached_analysis (sw_sounddata * sounddata,
+			       sw_framecount_t window);
+
+void
+analysis_unref (sw_analysis * analysis);
+
+/*
+ * sounddata_invalidate_analysis (sounddata, start, end)
+ *
+ * marks frames [start, end) of sounddata as modified, so that cached
+ * analyses covering them are recomputed on next use, and so that they
+ * are counted by sounddata_take_changes(). Anything which modifies
+ * sample data in place must call this.
+ */
+void
+sounddata_invalidate_analysis (sw_sounddata * sounddata,
+			       sw_framecount_t start, sw_framecount_t end);
+
+/*
+ * sounddata_drop_analysis (sounddata)
+ *
+ * discards all cached analyses of sounddata.
+ */
+void
+sounddata_drop_analysis (sw_sounddata * sounddata);
+
+/*
+ * sounddata_take_changes (sounddata, start, tail)
+ *
+ * returns in *start the first frame modified since the last call, and
+ * in *tail the nr. of frames at the end left unmodified since then, and
+ * starts counting afresh. Before the first call all data counts as
+ * modified. There is one count per sounddata, kept for the journal.
+ */
+void
+sounddata_take_changes (sw_sounddata * sounddata, sw_framecount_t * start,
+			sw_framecount_t * tail);
+
+/*
+ * sounddata_restore_changes (sounddata, start, tail)
+ *
+ * adds back changes taken by sounddata_take_changes() which could not
+ * be dealt with after all.
+ */
+void
+sounddata_restore_changes (sw_sounddata * sounddata, sw_framecount_t start,
+			   sw_framecount_t tail);
+
+#endif /* __SWEEP_ANALYSIS_H__ */
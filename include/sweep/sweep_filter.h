@@ -22,9 +22,26 @@
 #ifndef __SWEEP_FILTER_H__
 #define __SWEEP_FILTER_H__
 
-typedef void (*SweepFilterRegion) (gpointer data, sw_format * format,
-				   sw_framecount_t nr_frames,
-				   sw_param_set pset, gpointer custom_data);
+typedef struct _sw_filter_chain sw_filter_chain;
+
+sw_filter_chain *
+filter_chain_new (void);
+
+void
+filter_chain_append_region (sw_filter_chain * chain, SweepFilterRegion func,
+			    sw_param_set pset, gpointer custom_data);
+
+void
+filter_chain_append_processor (sw_filter_chain * chain,
+			       sw_processor * processor);
+
+void
+filter_chain_free (sw_filter_chain * chain);
+
+sw_op_instance *
+perform_filter_chain_op (sw_sample * sample, char * desc,
+			 sw_filter_chain * chain);
+
 sw_op_instance *
 perform_filter_region_op (sw_sample * sample, char * desc,
 			  SweepFilterRegion func, sw_param_set pset,
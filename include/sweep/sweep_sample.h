@@ -57,6 +57,9 @@ sample_bank_add (sw_sample * s);
 void
 sample_bank_remove (sw_sample * s);
 
+void
+sample_bank_refresh_proc_menus (void);
+
 void
 sample_refresh_views (sw_sample * s);
 
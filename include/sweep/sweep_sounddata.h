@@ -24,6 +24,70 @@
 sw_sounddata *
 sounddata_new_empty(gint nr_channels, gint sample_rate, gint sample_length);
 
+sw_sounddata *
+sounddata_new_compact (gint nr_channels, gint sample_rate,
+		       gint sample_length, sw_storage_t storage);
+
+/*
+ * sounddata_compact_store_int (sounddata, offset, ibuf, n)
+ *
+ * store n interleaved frames of left-justified 32 bit integers into the
+ * compact storage of sounddata, starting at frame offset.
+ */
+void
+sounddata_compact_store_int (sw_sounddata * sounddata, sw_framecount_t offset,
+			     const gint32 * ibuf, sw_framecount_t n);
+
+/*
+ * sounddata_copy_frames (sounddata, offset, n, buf)
+ *
+ * copy n frames starting at offset into buf as float, whatever the
+ * storage of sounddata. Frames past the end of the data are zeroed.
+ */
+void
+sounddata_copy_frames (sw_sounddata * sounddata, sw_framecount_t offset,
+		       sw_framecount_t n, gfloat * buf);
+
+/*
+ * sounddata_peek_frames (sounddata, offset, n, buf)
+ *
+ * as sounddata_copy_frames (), but without counting as a use of the
+ * data, for housekeeping such as compressing it once it is idle.
+ */
+void
+sounddata_peek_frames (sw_sounddata * sounddata, sw_framecount_t offset,
+		       sw_framecount_t n, gfloat * buf);
+
+/*
+ * sounddata_get_sample (sounddata, frame, channel)
+ *
+ * get a single sample value as float, whatever the storage of sounddata.
+ */
+gfloat
+sounddata_get_sample (sw_sounddata * sounddata, sw_framecount_t frame,
+		      gint channel);
+
+/*
+ * sounddata_read_frames (sounddata, offset, n, buf)
+ *
+ * get a pointer to n float frames starting at offset. For float data
+ * this points directly into sounddata->data and buf is unused;
+ * otherwise the frames are converted into buf, which must have room
+ * for n frames.
+ */
+const gfloat *
+sounddata_read_frames (sw_sounddata * sounddata, sw_framecount_t offset,
+		       sw_framecount_t n, gfloat * buf);
+
+/*
+ * sounddata_promote (sounddata)
+ *
+ * convert compact data to float so that it can be modified in place.
+ * Returns FALSE if the float data could not be allocated.
+ */
+gboolean
+sounddata_promote (sw_sounddata * sounddata);
+
 void
 sounddata_destroy (sw_sounddata * sounddata);
 
@@ -36,6 +100,34 @@ sounddata_unlock_selection (sw_sounddata * sounddata);
 void
 sounddata_clear_selection (sw_sounddata * sounddata);
 
+/*
+ * sounddata_selection_changed (sounddata)
+ *
+ * must be called after modifying the regions of sounddata->sels in place,
+ * or after replacing the list directly, so that the selection index is
+ * rebuilt.
+ */
+void
+sounddata_selection_changed (sw_sounddata * sounddata);
+
+/*
+ * sounddata_selection_seek (sounddata, offset)
+ *
+ * returns the first link of sounddata->sels whose region ends after
+ * offset, or NULL. Walk forward from here to visit the regions
+ * overlapping a range.
+ */
+GList *
+sounddata_selection_seek (sw_sounddata * sounddata, sw_framecount_t offset);
+
+/*
+ * sounddata_selection_find (sounddata, offset)
+ *
+ * returns the selected region containing offset, or NULL.
+ */
+sw_sel *
+sounddata_selection_find (sw_sounddata * sounddata, sw_framecount_t offset);
+
 /*
  * sounddata_normalise_selection(sounddata)
  *
@@ -63,7 +155,7 @@ sounddata_selection_nr_regions (sw_sounddata * sounddata);
 gint
 sounddata_selection_nr_frames (sw_sounddata * sounddata);
 
-gint
+sw_framecount_t
 sounddata_selection_width (sw_sounddata * sounddata);
 
 void
@@ -55,6 +55,10 @@ typedef int64_t sw_framecount_t;
 typedef struct _sw_sel sw_sel;
 typedef struct _sw_format sw_format;
 typedef struct _sw_sounddata sw_sounddata;
+typedef struct _sw_peaks sw_peaks;
+typedef struct _sw_sel_index sw_sel_index;
+typedef struct _sw_analysis_window sw_analysis_window;
+typedef struct _sw_analysis sw_analysis;
 typedef struct _sw_sample sw_sample;
 
 /*
@@ -84,6 +88,21 @@ struct _sw_format {
   gint rate;      /* sampling rate (Hz) */
 };
 
+/*
+ * sw_storage_t: how the samples of a sounddata are held in memory.
+ *
+ * Data loaded from 16 or 24 bit files is kept in that width until it
+ * is first modified, and the data of idle samples may be compressed
+ * (SW_STORAGE_PACKED). Compact data lives in sounddata->compact, and
+ * sounddata->data is NULL until the sounddata is promoted to float.
+ */
+typedef enum {
+  SW_STORAGE_FLOAT = 0,
+  SW_STORAGE_INT16,
+  SW_STORAGE_INT24,
+  SW_STORAGE_PACKED
+} sw_storage_t;
+
 struct _sw_sounddata {
   int refcount;
 
@@ -91,10 +110,49 @@ struct _sw_sounddata {
   sw_framecount_t nr_frames;    /* nr frames */
 
   gpointer data;
+  sw_storage_t storage;
+  gpointer compact; /* packed samples, if storage is not SW_STORAGE_FLOAT */
+  gint accesses; /* bumped atomically by reads, to tell when idle */
   GMutex data_mutex; /* Mutex for access to sample data */
 
   GList * sels;     /* selection: list of sw_sels */
   GMutex sels_mutex; /* Mutex for access to sels */
+  sw_sel_index * sels_index; /* search index over sels, or NULL */
+  GMutex sels_index_mutex; /* Mutex for access to sels_index */
+
+  sw_peaks * peaks; /* summary for overview drawing, or NULL */
+
+  GList * analyses; /* cached sw_analysis, one per window size */
+  GMutex analysis_mutex; /* Mutex for access to analyses and changes */
+
+  /* Frames changed since sounddata_take_changes () was last called */
+  sw_framecount_t changed_start; /* first frame changed */
+  sw_framecount_t changed_tail; /* nr. frames at the end unchanged */
+};
+
+/*
+ * sw_analysis_window: loudness measurements over one window of frames,
+ * taken across all channels.
+ */
+struct _sw_analysis_window {
+  gfloat rms;      /* root mean square sample value */
+  gfloat mean_abs; /* mean absolute sample value */
+  gfloat peak;     /* greatest absolute sample value */
+  guint32 zero_crossings; /* sign changes, summed over all channels */
+};
+
+/*
+ * sw_analysis: per-window measurements of a whole sounddata, as returned
+ * by sounddata_get_analysis(). Window w covers frames
+ * [w * window, (w+1) * window); the last window may be shorter.
+ * Read-only once returned.
+ */
+struct _sw_analysis {
+  gint refcount;
+  sw_framecount_t window;    /* nr frames per window */
+  sw_framecount_t nr_frames; /* nr frames analysed */
+  sw_framecount_t nr_windows;
+  sw_analysis_window * windows;
 };
 
 #define SW_DIR_LEN 256
@@ -392,6 +450,41 @@ struct _sw_param_spec {
 
 typedef struct _sw_procedure sw_procedure;
 typedef struct _sw_plugin sw_plugin;
+typedef struct _sw_processor sw_processor;
+
+/* A region filter modifies nr_frames of data in place, a block at a time */
+typedef void (*SweepFilterRegion) (gpointer data, sw_format * format,
+				   sw_framecount_t nr_frames,
+				   sw_param_set pset, gpointer custom_data);
+
+/*
+ * sw_processor: a procedure applied to audio as it is played, without
+ * modifying the sample. Processors are inserted into the chain of a
+ * playback head, so that changes to parameters can be heard at once.
+ */
+struct _sw_processor {
+  /* The nr. of interleaved channels process expects */
+  gint channels;
+
+  /* process applies the processor in place to n interleaved frames
+   * of buf, which are in the format the processor was created for.
+   *
+   * This is called in the audio thread: it must not allocate memory,
+   * block on locks held by the interface, or do any other I/O.
+   */
+  void (*process) (sw_processor * processor, gfloat * buf,
+		   sw_framecount_t n);
+
+  /* set_params changes the parameters being applied; called from the
+   * interface thread while process may be running.
+   */
+  void (*set_params) (sw_processor * processor, sw_param_set pset);
+
+  /* destroy frees the processor, once it is no longer in any chain */
+  void (*destroy) (sw_processor * processor);
+
+  gpointer data;
+};
 
 struct _sw_procedure {
   gchar * name;
@@ -430,6 +523,23 @@ struct _sw_procedure {
 
   /* custom data to pass to the suggest and apply functions */
   gpointer custom_data;
+
+  /* realtime creates a processor applying pset to audio of the given
+   * format as it is played, so that the effect can be auditioned.
+   *
+   * If this function is NULL then the procedure cannot be previewed.
+   */
+  sw_processor * (*realtime) (sw_format * format, sw_param_set pset,
+			      gpointer custom_data);
+
+  /* region is the region filter which apply runs over the selection,
+   * if apply is just a call to perform_filter_region_op(). Setting it
+   * lets the procedure be run in a chain with others.
+   *
+   * If this function is NULL then the procedure can only be chained
+   * if it has a realtime processor.
+   */
+  SweepFilterRegion region;
 };
 
 struct _sw_plugin {
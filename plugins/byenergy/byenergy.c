@@ -26,7 +26,7 @@
 
 #include <sweep/sweep.h>
 
-#define NR_PARAMS 5
+#define NR_PARAMS 7
 
 static sw_param_range resolution_range = {
   SW_RANGE_LOWER_BOUND_VALID|SW_RANGE_STEP_VALID,
@@ -53,6 +53,13 @@ static sw_param_range max_interruption_range = {
   step:  {f: 0.01}
 };
 
+static sw_param_range hysteresis_range = {
+  SW_RANGE_ALL_VALID,
+  lower: {f: 0.0},
+  upper: {f: 1.0},
+  step:  {f: 0.01}
+};
+
 static sw_param_spec param_specs[] = {
   {
     N_("Select regions above threshold"),
@@ -89,6 +96,22 @@ static sw_param_spec param_specs[] = {
     SWEEP_TYPE_FLOAT,
     SW_PARAM_CONSTRAINED_RANGE,
     {range: &max_interruption_range}
+  },
+  {
+    N_("Hysteresis"),
+    N_("Fraction of the threshold by which the energy must fall back "
+       "before a detected region ends [0.0 - 1.0]"),
+    SWEEP_TYPE_FLOAT,
+    SW_PARAM_CONSTRAINED_RANGE,
+    {range: &hysteresis_range}
+  },
+  {
+    N_("Search within selection"),
+    N_("Whether to detect regions only within the current selection, "
+       "rather than across the whole sample."),
+    SWEEP_TYPE_BOOL,
+    SW_PARAM_CONSTRAINED_NOT,
+    {NULL},
   }
 };
 
@@ -100,6 +123,8 @@ by_energy_suggest (sw_sample * sample, sw_param_set pset, gpointer custom_data)
   pset[2].f = 0.2;
   pset[3].f = 0.2;
   pset[4].f = 0.06;
+  pset[5].f = 0.0;
+  pset[6].b = FALSE;
 }
 
 static void
@@ -110,87 +135,85 @@ select_by_energy (sw_sample * s, sw_param_set pset, gpointer custom_data)
   gfloat threshold = pset[2].f;
   gfloat min_duration_f = pset[3].f;
   gfloat max_interruption_f = pset[4].f;
+  gfloat hysteresis = pset[5].f;
+  gboolean within_selection = pset[6].b;
 
   sw_sounddata * sounddata;
-  float * d;
-  glong window, win_s;
-  gint i, doff;
+  sw_analysis * analysis;
+  glong window, w, nr_windows;
   glong min_duration, max_interruption;
-  glong length, loc=0;
+  glong loc;
   glong start=-1, end=-1;
-  double di, energy, max_energy=0, factor=1.0;
+  double energy, max_energy=0, release;
+  gboolean met = FALSE;
+  GList * osels = NULL, * gl;
+  sw_sel * sel;
 
   sounddata = sample_get_sounddata (s);
 
   window = (glong)(resolution * (gfloat)sounddata->format->rate);
-  length = sounddata->nr_frames;
+  window = MAX (window, 1);
   min_duration = (glong)(min_duration_f * (gfloat)sounddata->format->rate);
 
   /* check (end-1 - (start+1)) > 0 */
   min_duration = MAX(2*window, min_duration);
   max_interruption = (glong)(max_interruption_f * (gfloat)sounddata->format->rate);
 
-  d = (float *)sounddata->data;
-
-  sounddata_lock_selection (sounddata);
-
-  sounddata_clear_selection (sounddata);
-
-  /* Find max for normalisation */
-
-  length = sounddata->nr_frames;
-  doff = 0;
-  while (length > 0) {
-    energy = 0;
+  /* The energy of each window is the square root of its mean absolute
+   * sample value. The analysis is cached on the sounddata, so running
+   * again with other thresholds need not read the data at all. */
+  analysis = sounddata_get_analysis (sounddata, window);
+  nr_windows = analysis->nr_windows;
 
-    win_s = frames_to_samples (sounddata->format, MIN(length, window));
-
-    /* calculate avg. for this window */
-    for (i=0; i<win_s; i++) {
-      di = (double)(d[doff+i] * factor);
-      energy += fabs(di);
-    }
-    doff += win_s;
-
-    energy /= (double)win_s;
-    energy = sqrt(energy);
-
-    max_energy = MAX(energy, max_energy);
-
-    length -= window;
+  for (w = 0; w < nr_windows; w++) {
+    max_energy = MAX(sqrt (analysis->windows[w].mean_abs), max_energy);
   }
 
-  factor = SW_AUDIO_MAX / max_energy;
-
 #ifdef DEBUG
-  g_print ("factor: %f\tmax_energy: %f\n", factor, max_energy);
+  g_print ("max_energy: %f\n", max_energy);
 #endif
 
   threshold *= (gfloat)max_energy;
 
-  length = sounddata->nr_frames;
-  doff = 0;
-  while (length > 0) {
-    energy = 0;
+  /* Once a region has started, it continues until the energy passes back
+   * beyond the threshold by the hysteresis fraction */
+  if (select_above) {
+    release = threshold * (1.0 - hysteresis);
+  } else {
+    release = threshold * (1.0 + hysteresis);
+  }
 
-    win_s = frames_to_samples (sounddata->format, MIN(length, window));
+  sounddata_lock_selection (sounddata);
 
-    /* calculate RMS energy for this window */
-    for (i=0; i<win_s; i++) {
-      di = (double)(d[doff+i]);
-      energy += fabs(di);
-    }
-    doff += win_s;
+  if (within_selection) {
+    osels = sels_copy (sounddata->sels);
+  }
 
-    energy /= (double)win_s;
-    energy = sqrt(energy);
+  sounddata_clear_selection (sounddata);
+
+  gl = osels;
+
+  for (w = 0; w < nr_windows; w++) {
+    loc = w * window;
+    energy = sqrt (analysis->windows[w].mean_abs);
 
 #ifdef DEBUG
     g_print ("%ld\tenergy: %f\tthreshold: %f\n", loc, energy, threshold);
 #endif
 
     /* Check if threshold condition is met */
-    if (select_above ? (energy >= threshold) : (energy <= threshold)) {
+    if (select_above) {
+      met = (energy >= (met ? release : threshold));
+    } else {
+      met = (energy <= (met ? release : threshold));
+    }
+
+    if (within_selection) {
+      while (gl && ((sw_sel *)gl->data)->sel_end <= loc) gl = gl->next;
+      if (gl == NULL || ((sw_sel *)gl->data)->sel_start > loc) met = FALSE;
+    }
+
+    if (met) {
       if (start == -1) {
 	/* Not in possible selection; initialise start,end */
 	end = start = loc;
@@ -206,9 +229,6 @@ select_by_energy (sw_sample * s, sw_param_set pset, gpointer custom_data)
       }
       /* else do nothing: keep start, end where they are */
     }
-
-    loc += window;
-    length -= window;
   }
 
   if (start != -1) {
@@ -218,6 +238,14 @@ select_by_energy (sw_sample * s, sw_param_set pset, gpointer custom_data)
   }
 
   sounddata_unlock_selection (sounddata);
+
+  for (gl = osels; gl; gl = gl->next) {
+    sel = (sw_sel *)gl->data;
+    sel_free (sel);
+  }
+  g_list_free (osels);
+
+  analysis_unref (analysis);
 }
 
 static sw_op_instance *
@@ -123,6 +123,8 @@ static sw_procedure proc_echo = {
   echo_suggest, /* suggests() */
   echo_apply,
   NULL, /* custom_data */
+  NULL, /* realtime */
+  (SweepFilterRegion)region_echo, /* region */
 };
 
 static GList *
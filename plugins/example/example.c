@@ -139,6 +139,8 @@ static sw_procedure proc_example_filter_region = {
   example_filter_region_suggest, /* suggests() */
   example_filter_region_apply,
   NULL, /* custom_data */
+  NULL, /* realtime */
+  (SweepFilterRegion)example_filter_region_func, /* region */
 };
 
 static GList *
@@ -27,8 +27,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
 #include <math.h> /* for ceil() */
 
 #include <glib.h>
@@ -60,21 +64,30 @@
 
 static char * default_ladspa_path = "/usr/lib/ladspa:/usr/local/lib/ladspa:/opt/ladspa/lib";
 
-static GList * modules_list = NULL;
+#define LADSPA_CACHE_HEADER "SWEEP-LADSPA-CACHE 2"
+
+/* Seconds before a file which failed to load is tried again, in case
+ * what it was missing has been installed since */
+#define LADSPA_RETRY_SECS (24*60*60)
+
+static GList * libraries_list = NULL;
 static GList * proc_list = NULL;
 
+/* Whether any library had to be scanned, ie. the cache is out of date */
+static gboolean cache_dirty = FALSE;
+
 static gboolean ladspa_meta_initialised = FALSE;
 
 /*
- * is_usable (d)
+ * has_usable_ports (d)
  *
- * Determine if a LADSPA_Descriptor * d is usable by this ladspameta
- * sweep plugin. Currently this means that:
+ * Determine if the ports of a LADSPA_Descriptor * d are usable by this
+ * ladspameta sweep plugin. Currently this means that:
  *   1. there is at least one audio output
  *   2. the number of audio inputs must equal the number of audio outputs.
  */
 static gboolean
-is_usable(const LADSPA_Descriptor * d)
+has_usable_ports (const LADSPA_Descriptor * d)
 {
   LADSPA_PortDescriptor pd;
   gint i;
@@ -92,12 +105,24 @@ is_usable(const LADSPA_Descriptor * d)
 
   if (nr_ao == 0) return FALSE;
 
+  return (nr_ai == nr_ao);
+}
+
+/*
+ * is_usable (d)
+ *
+ * Determine if a LADSPA_Descriptor * d is usable by this ladspameta
+ * sweep plugin: its ports must be usable, and it must be runnable.
+ */
+static gboolean
+is_usable(const LADSPA_Descriptor * d)
+{
   /* Sanity checks */
   if (! d->run) return FALSE; /* plugin does nothing! */
   if (! d->instantiate) return FALSE; /* plugin cannot be instantiated */
   if (! d->connect_port) return FALSE; /* plugin cannot be wired up */
 
-  return (nr_ai == nr_ao);
+  return has_usable_ports (d);
 }
 
 static sw_param_type
@@ -162,27 +187,199 @@ convert_constraint ( /* sw_format * format, */
   return pr;
 }
 
+typedef struct _lm_library lm_library;
 typedef struct _lm_custom lm_custom;
 
+/*
+ * A LADSPA shared library found on LADSPA_PATH. Its descriptors are
+ * described from the cache (or from one scan of the library when the
+ * cache is stale), and the library itself is only dlopen()ed when one
+ * of its procedures is first applied.
+ */
+struct _lm_library {
+  gchar * path;
+  glong mtime;
+  glong size;
+  glong failed_at; /* when it last failed to load, or 0 */
+  GList * customs; /* lm_custom for each usable descriptor */
+  void * module; /* NULL until first needed */
+};
+
 struct _lm_custom {
+  lm_library * library;
+  unsigned long index; /* index passed to ladspa_descriptor() */
+
+  /* Copy of the descriptor's names and ports; its callbacks are unset */
+  LADSPA_Descriptor cached;
+
+  /* The library's own descriptor, once the library is loaded */
   const LADSPA_Descriptor * d;
+
   sw_param_spec * param_specs;
 };
 
 static lm_custom *
-lm_custom_new (const LADSPA_Descriptor * d, sw_param_spec * param_specs)
+lm_custom_new (lm_library * library, unsigned long index,
+	       unsigned long nr_ports)
 {
   lm_custom * lmc;
 
-  lmc = g_malloc (sizeof (*lmc));
-  if (lmc) {
-    lmc->d = d;
-    lmc->param_specs = param_specs;
+  lmc = g_malloc0 (sizeof (*lmc));
+  lmc->library = library;
+  lmc->index = index;
+  lmc->cached.PortCount = nr_ports;
+  lmc->cached.PortDescriptors =
+    g_malloc0 (MAX (nr_ports, 1) * sizeof (LADSPA_PortDescriptor));
+  lmc->cached.PortNames = g_malloc0 (MAX (nr_ports, 1) * sizeof (char *));
+  lmc->cached.PortRangeHints =
+    g_malloc0 (MAX (nr_ports, 1) * sizeof (LADSPA_PortRangeHint));
+
+  return lmc;
+}
+
+/*
+ * lm_custom_copy (library, index, d)
+ *
+ * copy the names and port layout of descriptor d, so that it can be
+ * described after its library is closed.
+ */
+static lm_custom *
+lm_custom_copy (lm_library * library, unsigned long index,
+		const LADSPA_Descriptor * d)
+{
+  lm_custom * lmc;
+  unsigned long j;
+
+  lmc = lm_custom_new (library, index, d->PortCount);
+
+  lmc->cached.UniqueID = d->UniqueID;
+  lmc->cached.Properties = d->Properties;
+  lmc->cached.Label = g_strdup (d->Label ? d->Label : "");
+  lmc->cached.Name = g_strdup (d->Name ? d->Name : "");
+  lmc->cached.Maker = g_strdup (d->Maker ? d->Maker : "");
+  lmc->cached.Copyright = g_strdup (d->Copyright ? d->Copyright : "");
+
+  for (j = 0; j < d->PortCount; j++) {
+    ((LADSPA_PortDescriptor *)lmc->cached.PortDescriptors)[j] =
+      d->PortDescriptors[j];
+    ((char **)lmc->cached.PortNames)[j] =
+      g_strdup (d->PortNames[j] ? d->PortNames[j] : "");
+    ((LADSPA_PortRangeHint *)lmc->cached.PortRangeHints)[j] =
+      d->PortRangeHints[j];
   }
 
   return lmc;
 }
 
+static void
+lm_custom_free (lm_custom * lmc)
+{
+  unsigned long j;
+
+  g_free ((char *)lmc->cached.Label);
+  g_free ((char *)lmc->cached.Name);
+  g_free ((char *)lmc->cached.Maker);
+  g_free ((char *)lmc->cached.Copyright);
+
+  for (j = 0; j < lmc->cached.PortCount; j++) {
+    g_free ((char *)lmc->cached.PortNames[j]);
+  }
+
+  g_free ((LADSPA_PortDescriptor *)lmc->cached.PortDescriptors);
+  g_free ((char **)lmc->cached.PortNames);
+  g_free ((LADSPA_PortRangeHint *)lmc->cached.PortRangeHints);
+
+  g_free (lmc);
+}
+
+static lm_library *
+lm_library_new (const gchar * path, glong mtime, glong size)
+{
+  lm_library * lib;
+
+  lib = g_malloc0 (sizeof (*lib));
+  lib->path = g_strdup (path);
+  lib->mtime = mtime;
+  lib->size = size;
+
+  return lib;
+}
+
+static void
+lm_library_free (lm_library * lib)
+{
+  GList * gl;
+
+  for (gl = lib->customs; gl; gl = gl->next) {
+    lm_custom_free ((lm_custom *)gl->data);
+  }
+  g_list_free (lib->customs);
+
+  if (lib->module) dlclose (lib->module);
+
+  g_free (lib->path);
+  g_free (lib);
+}
+
+/*
+ * lm_custom_resolve (lmc)
+ *
+ * load the library of lmc if it is not yet loaded, and find its own
+ * descriptor. The descriptor is looked up by unique ID if the library
+ * has changed since it was described, and refused if its ports no
+ * longer match the parameters offered to the user.
+ */
+static const LADSPA_Descriptor *
+lm_custom_resolve (lm_custom * lmc)
+{
+  static GMutex resolve_mutex;
+  lm_library * lib = lmc->library;
+  LADSPA_Descriptor_Function desc_func = NULL;
+  const LADSPA_Descriptor * d;
+  unsigned long i;
+  gboolean match;
+
+  g_mutex_lock (&resolve_mutex);
+
+  if (lmc->d == NULL) {
+    if (lib->module == NULL) {
+      lib->module = dlopen (lib->path, RTLD_NOW);
+      if (lib->module == NULL)
+	g_warning ("LADSPA: %s", dlerror ());
+    }
+
+    if (lib->module != NULL)
+      desc_func = (LADSPA_Descriptor_Function)
+	dlsym (lib->module, "ladspa_descriptor");
+
+    if (desc_func != NULL) {
+      d = desc_func (lmc->index);
+      if (d == NULL || d->UniqueID != lmc->cached.UniqueID) {
+	for (i = 0; (d = desc_func (i)) != NULL; i++) {
+	  if (d->UniqueID == lmc->cached.UniqueID) break;
+	}
+      }
+
+      match = (d != NULL && is_usable (d) &&
+	       d->PortCount == lmc->cached.PortCount);
+      for (i = 0; match && i < d->PortCount; i++) {
+	match = (d->PortDescriptors[i] == lmc->cached.PortDescriptors[i]);
+      }
+
+      if (match) {
+	lmc->d = d;
+      } else {
+	g_warning ("LADSPA: %s no longer provides %s",
+		   lib->path, lmc->cached.Name);
+      }
+    }
+  }
+
+  g_mutex_unlock (&resolve_mutex);
+
+  return lmc->d;
+}
+
 static sw_param
 convert_default (sw_format * format, const LADSPA_PortRangeHint * prh)
 {
@@ -261,7 +458,7 @@ ladspa_meta_suggest (sw_sample * sample, sw_param_set pset,
 {
   sw_sounddata * sounddata;
   lm_custom * lm = (lm_custom *)custom_data;
-  const LADSPA_Descriptor * d = lm->d;
+  const LADSPA_Descriptor * d = &lm->cached;
 
   LADSPA_PortDescriptor pd;
   int i, pset_i = 0;
@@ -281,12 +478,184 @@ ladspa_meta_suggest (sw_sample * sample, sw_param_set pset,
 
 #define BLOCK_SIZE 1024
 
+/*
+ * control_values (param_specs, nr_params, pset, controls)
+ *
+ * convert the nr_params values of pset to LADSPA control values.
+ */
+static void
+control_values (sw_param_spec * param_specs, gint nr_params,
+		sw_param_set pset, LADSPA_Data * controls)
+{
+  gint j;
+
+  for (j=0; j < nr_params; j++) {
+    switch (param_specs[j].type) {
+    case SWEEP_TYPE_BOOL:
+      /* from ladspa.h:
+       * Data less than or equal to zero should be considered
+       * `off' or `false,'
+       * and data above zero should be considered `on' or `true.'
+       */
+      controls[j] = pset[j].b ? 1.0 : 0.0;
+      break;
+    case SWEEP_TYPE_INT:
+      controls[j] = (LADSPA_Data)pset[j].i;
+      break;
+    case SWEEP_TYPE_FLOAT:
+      controls[j] = pset[j].f;
+      break;
+    default:
+      /* This plugin should produce no other types */
+      g_assert_not_reached ();
+      break;
+    }
+  }
+}
+
+/* Nr. of BLOCK_SIZE blocks each channel group processes per dispatch
+ * to the thread pool, between checks for cancellation */
+#define SPAN_BLOCKS 16
+
+/* Most threads to run channel groups on */
+#define MAX_THREADS 16
+
+typedef struct _lm_run lm_run;
+
+/*
+ * The state shared by all channel groups of a multichannel run.
+ * Group h is handle h, which takes the channels
+ * [h * nr_ao, (h+1) * nr_ao) of the interleaved data; its buffers
+ * are used by no other group, so groups can be run concurrently.
+ */
+struct _lm_run {
+  const LADSPA_Descriptor * d;
+  LADSPA_Handle * handles;
+  LADSPA_Data ** input_buffers, ** output_buffers;
+  gint nr_ao;
+  gint nr_channels;
+
+  /* The span of interleaved frames currently being processed */
+  LADSPA_Data * pcmdata;
+  sw_framecount_t span;
+
+  GMutex mutex;
+  GCond cond;
+  gint pending; /* groups yet to finish the span */
+};
+
+/*
+ * deinterleave (src, nr_channels, c, dest, n)
+ *
+ * copy channel c of n interleaved frames into dest. The common strides
+ * are spelt out so that the compiler can vectorise them.
+ */
+static void
+deinterleave (const LADSPA_Data * restrict src, gint nr_channels, gint c,
+	      LADSPA_Data * restrict dest, sw_framecount_t n)
+{
+  sw_framecount_t i;
+
+  src += c;
+
+  switch (nr_channels) {
+  case 2:
+    for (i = 0; i < n; i++) dest[i] = src[i*2];
+    break;
+  case 4:
+    for (i = 0; i < n; i++) dest[i] = src[i*4];
+    break;
+  default:
+    for (i = 0; i < n; i++) dest[i] = src[i*nr_channels];
+    break;
+  }
+}
+
+static void
+interleave (const LADSPA_Data * restrict src, gint nr_channels, gint c,
+	    LADSPA_Data * restrict dest, sw_framecount_t n)
+{
+  sw_framecount_t i;
+
+  dest += c;
+
+  switch (nr_channels) {
+  case 2:
+    for (i = 0; i < n; i++) dest[i*2] = src[i];
+    break;
+  case 4:
+    for (i = 0; i < n; i++) dest[i*4] = src[i];
+    break;
+  default:
+    for (i = 0; i < n; i++) dest[i*nr_channels] = src[i];
+    break;
+  }
+}
+
+/*
+ * lm_run_group (h, run)
+ *
+ * run channel group h over the current span, one BLOCK_SIZE at a time.
+ * Called from the thread pool, or directly when there is one group.
+ */
+static void
+lm_run_group (gint h, lm_run * run)
+{
+  sw_framecount_t offset, n;
+  LADSPA_Data * p;
+  gint c, c0, c1;
+
+  c0 = h * run->nr_ao;
+  c1 = MIN (c0 + run->nr_ao, run->nr_channels);
+
+  for (offset = 0; offset < run->span; offset += n) {
+    n = MIN (run->span - offset, BLOCK_SIZE);
+    p = run->pcmdata + offset * run->nr_channels;
+
+    for (c = c0; c < c1; c++) {
+      deinterleave (p, run->nr_channels, c, run->input_buffers[c], n);
+    }
+
+    run->d->run (run->handles[h], n);
+
+    for (c = c0; c < c1; c++) {
+      interleave (run->output_buffers[c], run->nr_channels, c, p, n);
+    }
+  }
+}
+
+static void
+lm_run_group_pooled (gpointer data, gpointer user_data)
+{
+  lm_run * run = (lm_run *)user_data;
+
+  lm_run_group (GPOINTER_TO_INT (data) - 1, run);
+
+  g_mutex_lock (&run->mutex);
+  if (--run->pending == 0) g_cond_signal (&run->cond);
+  g_mutex_unlock (&run->mutex);
+}
+
+/*
+ * lm_nr_threads (nr_handles)
+ *
+ * number of threads to run nr_handles channel groups on: one per
+ * online CPU, and no more than there are groups.
+ */
+static gint
+lm_nr_threads (gint nr_handles)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  return (gint)CLAMP (MIN (n, nr_handles), 1, MAX_THREADS);
+}
+
 static sw_sample *
 ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
 			  gpointer custom_data)
 {
   lm_custom * lm = (lm_custom *)custom_data;
-  const LADSPA_Descriptor * d = lm->d;
+  const LADSPA_Descriptor * d = lm_custom_resolve (lm);
   sw_param_spec * param_specs = lm->param_specs;
 
   sw_sounddata * sounddata;
@@ -306,16 +675,15 @@ ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
    */
   gint nr_handles;
 
-  LADSPA_Handle ** handles;
+  LADSPA_Handle * handles;
   LADSPA_Data ** input_buffers, ** output_buffers;
   LADSPA_Data * mono_input_buffers[1], * mono_output_buffers[1];
-  LADSPA_Data * p;
   LADSPA_Data * control_inputs;
-  LADSPA_Data dummy_control_output;
+  LADSPA_Data * dummy_control_outputs;
   LADSPA_PortDescriptor pd;
   glong length_b;
   gulong port_i; /* counter for iterating over ports */
-  gint h, i, j, c;
+  gint h, i, j;
 
   /* Enumerate the numbers of each type of port on the ladspa plugin */
   gint
@@ -333,6 +701,13 @@ ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
   /* Counters for allocating input and output buffers */
   gint ibi=0, obi=0;
 
+  /* Processing a mono sample with a mono filter, in place */
+  gboolean mono;
+
+  /* Channel groups, and the threads to run them on if more than one */
+  lm_run run;
+  GThreadPool * pool = NULL;
+
   gboolean active = TRUE;
 
   g_return_val_if_fail (d != NULL, NULL);
@@ -378,9 +753,11 @@ ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
   nr_i = nr_handles * nr_ai;
   nr_o = nr_handles * nr_ao;
 
+  mono = ((nr_channels == 1) && (nr_ai == 1) && (nr_ao >= 1));
+
   /* Create all input and output buffers */
 
-  if ((nr_channels == 1) && (nr_ai == 1) && (nr_ao >= 1)) {
+  if (mono) {
     /*
      * Processing a mono sample with a mono filter.
      * Attempt to do this in place.
@@ -435,39 +812,20 @@ ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
   }
 
   /* instantiate the ladspa plugin */
-  handles = g_malloc (sizeof (LADSPA_Handle *) * nr_handles);
+  handles = g_malloc (sizeof (LADSPA_Handle) * nr_handles);
   for (h = 0; h < nr_handles; h++) {
     handles[h] = d->instantiate (d, (long)format->rate);
   }
 
-  /* connect control ports */
+  /* connect control ports; each handle gets its own dummy control
+   * output, as handles may be run concurrently */
   control_inputs = g_malloc (nr_ci * sizeof(LADSPA_Data));
+  control_values (param_specs, nr_ci, pset, control_inputs);
+  dummy_control_outputs = g_malloc (nr_handles * sizeof(LADSPA_Data));
   j=0;
   for (port_i=0; port_i < d->PortCount; port_i++) {
     pd = d->PortDescriptors[(int)port_i];
     if (LADSPA_IS_CONTROL_INPUT(pd)) {
-      /* do something with pset! */
-      switch (param_specs[j].type) {
-      case SWEEP_TYPE_BOOL:
-	/* from ladspa.h:
-	 * Data less than or equal to zero should be considered
-	 * `off' or `false,'
-	 * and data above zero should be considered `on' or `true.'
-	 */
-	control_inputs[j] = pset[j].b ? 1.0 : 0.0;
-	break;
-      case SWEEP_TYPE_INT:
-	control_inputs[j] = (LADSPA_Data)pset[j].i;
-	break;
-      case SWEEP_TYPE_FLOAT:
-	control_inputs[j] = pset[j].f;
-	break;
-      default:
-	/* This plugin should produce no other types */
-	g_assert_not_reached ();
-	break;
-      }
-
       for (h = 0; h < nr_handles; h++) {
 	d->connect_port (handles[h], port_i, &control_inputs[j]);
       }
@@ -476,9 +834,40 @@ ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
     }
     if (LADSPA_IS_CONTROL_OUTPUT(pd)) {
       for (h = 0; h < nr_handles; h++) {
-	d->connect_port (handles[h], port_i, &dummy_control_output);
+	d->connect_port (handles[h], port_i, &dummy_control_outputs[h]);
+      }
+    }
+  }
+
+  /* The buffers of a multichannel run are fixed, so connect its audio
+   * ports once */
+  if (!mono) {
+    ibi = 0; obi = 0;
+    for (h = 0; h < nr_handles; h++) {
+      for (port_i=0; port_i < d->PortCount; port_i++) {
+	pd = d->PortDescriptors[(int)port_i];
+	if (LADSPA_IS_AUDIO_INPUT(pd)) {
+	  d->connect_port (handles[h], port_i, input_buffers[ibi++]);
+	}
+	if (LADSPA_IS_AUDIO_OUTPUT(pd)) {
+	  d->connect_port (handles[h], port_i, output_buffers[obi++]);
+	}
       }
     }
+
+    run.d = d;
+    run.handles = handles;
+    run.input_buffers = input_buffers;
+    run.output_buffers = output_buffers;
+    run.nr_ao = nr_ao;
+    run.nr_channels = nr_channels;
+    g_mutex_init (&run.mutex);
+    g_cond_init (&run.cond);
+
+    if (nr_handles > 1 && lm_nr_threads (nr_handles) > 1) {
+      pool = g_thread_pool_new (lm_run_group_pooled, &run,
+				lm_nr_threads (nr_handles), TRUE, NULL);
+    }
   }
 
   /* activate the ladspa plugin */
@@ -500,77 +889,71 @@ ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
 
       if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
 	active = FALSE;
-      } else { /* cancel */
+      } else if (mono) {
 	pcmdata = sounddata->data +
 	  frames_to_bytes (format, sel->sel_start + offset);
 
 	n = MIN(remaining, BLOCK_SIZE);
 
 	/* Copy data into input buffers */
-	if (nr_channels == 1) {
-	  if (LADSPA_META_IS_INPLACE_BROKEN(d->Properties)) {
-	    length_b = frames_to_bytes (format, n);
-	    memcpy (input_buffers[0], pcmdata, length_b);
-	  } else {
-	    /* we're processing in-place, so we haven't needed to set
-	     * up a separate input buffer; input_buffers[0] actually
-	     * points to pcmdata hence we don't do any copying here.
-	     */
-	    input_buffers[0] = (LADSPA_Data *)pcmdata;
-	  }
-
-	  output_buffers[0] = (LADSPA_Data *)pcmdata;
-
+	if (LADSPA_META_IS_INPLACE_BROKEN(d->Properties)) {
+	  length_b = frames_to_bytes (format, n);
+	  memcpy (input_buffers[0], pcmdata, length_b);
 	} else {
-	  /* de-interleave multichannel data */
-
-	  p = (LADSPA_Data *)pcmdata;
-
-	  for (i=0; i < n; i++) {
-	    for (c=0; c < nr_channels; c++) {
-	      input_buffers[c][i] = *p++;
-	    }
-	  }
+	  /* we're processing in-place, so we haven't needed to set
+	   * up a separate input buffer; input_buffers[0] actually
+	   * points to pcmdata hence we don't do any copying here.
+	   */
+	  input_buffers[0] = (LADSPA_Data *)pcmdata;
 	}
 
-	g_assert (input_buffers[0] != NULL);
-	g_assert (output_buffers[0] != NULL);
+	output_buffers[0] = (LADSPA_Data *)pcmdata;
 
 	/* connect input and output audio buffers to the
 	 * audio ports of the ladspa plugin */
-	ibi = 0; obi = 0;
-	for (h = 0; h < nr_handles; h++) {
-	  for (port_i=0; port_i < d->PortCount; port_i++) {
-	    pd = d->PortDescriptors[(int)port_i];
-	    if (LADSPA_IS_AUDIO_INPUT(pd)) {
-	      d->connect_port (handles[h], port_i, input_buffers[ibi++]);
-	    }
-	    if (LADSPA_IS_AUDIO_OUTPUT(pd)) {
-	      d->connect_port (handles[h], port_i, output_buffers[obi++]);
-	    }
+	for (port_i=0; port_i < d->PortCount; port_i++) {
+	  pd = d->PortDescriptors[(int)port_i];
+	  if (LADSPA_IS_AUDIO_INPUT(pd)) {
+	    d->connect_port (handles[0], port_i, input_buffers[0]);
+	  }
+	  if (LADSPA_IS_AUDIO_OUTPUT(pd)) {
+	    d->connect_port (handles[0], port_i, output_buffers[0]);
 	  }
 	}
 
 	/* run the ladspa plugin */
-	for (h = 0; h < nr_handles; h++) {
-	  d->run (handles[h], n);
-	}
+	d->run (handles[0], n);
+
+	remaining -= n;
+	offset += n;
 
-	/* re-interleave data */
-	if (nr_channels > 1) {
-	  p = (LADSPA_Data *)pcmdata;
+	run_total += n;
+	sample_set_progress_percent (sample, run_total / op_total);
+      } else {
+	/* run each channel group over the next span */
+	run.pcmdata = (LADSPA_Data *)(sounddata->data +
+	  frames_to_bytes (format, sel->sel_start + offset));
+	run.span = MIN(remaining, SPAN_BLOCKS * BLOCK_SIZE);
+
+	if (pool != NULL) {
+	  run.pending = nr_handles;
+	  for (h = 0; h < nr_handles; h++) {
+	    g_thread_pool_push (pool, GINT_TO_POINTER (h + 1), NULL);
+	  }
 
-	  for (i=0; i < n; i++) {
-	    for (c=0; c < nr_channels; c++) {
-	      *p++ = output_buffers[c][i];
-	    }
+	  g_mutex_lock (&run.mutex);
+	  while (run.pending > 0) g_cond_wait (&run.cond, &run.mutex);
+	  g_mutex_unlock (&run.mutex);
+	} else {
+	  for (h = 0; h < nr_handles; h++) {
+	    lm_run_group (h, &run);
 	  }
 	}
 
-	remaining -= n;
-	offset += n;
+	remaining -= run.span;
+	offset += run.span;
 
-	run_total += n;
+	run_total += run.span;
 	sample_set_progress_percent (sample, run_total / op_total);
       }
 
@@ -578,6 +961,13 @@ ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
     }
   }
 
+  if (pool != NULL) g_thread_pool_free (pool, FALSE, TRUE);
+
+  if (!mono) {
+    g_mutex_clear (&run.mutex);
+    g_cond_clear (&run.cond);
+  }
+
   /* deactivate the ladspa plugin */
   if (d->deactivate) {
     for (h = 0; h < nr_handles; h++) {
@@ -597,8 +987,9 @@ ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
 
   /* free the input and output buffers */
   if (control_inputs) g_free (control_inputs);
+  g_free (dummy_control_outputs);
 
-  if ((nr_channels == 1) && (nr_ai == 1) && (nr_ao >= 1)) {
+  if (mono) {
     if (LADSPA_META_IS_INPLACE_BROKEN(d->Properties)) {
       g_free (mono_input_buffers[0]);
     }
@@ -634,106 +1025,628 @@ ladspa_meta_apply (sw_sample * sample,
 		   sw_param_set pset, gpointer custom_data)
 {
   lm_custom * lm = (lm_custom *)custom_data;
-  const LADSPA_Descriptor * d = lm->d;
+
+  /* Load the library now, rather than in the filter thread */
+  if (lm_custom_resolve (lm) == NULL) return NULL;
 
   return
-    perform_filter_op (sample, (char *)d->Name,
+    perform_filter_op (sample, (char *)lm->cached.Name,
 		       (SweepFilter)ladspa_meta_apply_filter,
 		       pset, custom_data);
 }
 
 /*
- * ladspa_meta_add_procs (dir, name, gl)
+ * Realtime preview
  *
- * form sweep procs to describe the ladspa plugin functions that
- * are in the shared library file "dir/name",
- * and add these procs to the GList * (*gl)
+ * A processor keeps its plugin instances activated for as long as it is
+ * in a play head's chain. Its buffers are allocated and all its ports
+ * connected when it is created, so that processing a block does no more
+ * than copy audio through the plugin.
+ */
+
+typedef struct _lm_processor lm_processor;
+
+struct _lm_processor {
+  const LADSPA_Descriptor * d;
+  sw_param_spec * param_specs;
+  gint nr_ci;
+  gint nr_channels;
+
+  gint nr_handles;
+  LADSPA_Handle * handles;
+
+  gint nr_i, nr_o;
+  LADSPA_Data ** input_buffers, ** output_buffers;
+
+  LADSPA_Data * control_inputs; /* connected to the handles */
+  LADSPA_Data dummy_control_output;
+
+  /* Controls waiting to be taken up by the audio thread */
+  GMutex controls_mutex;
+  LADSPA_Data * pending_controls;
+  gboolean pending;
+};
+
+static void
+lm_processor_process (sw_processor * processor, gfloat * buf,
+		      sw_framecount_t count)
+{
+  lm_processor * lp = (lm_processor *)processor->data;
+  const LADSPA_Descriptor * d = lp->d;
+  sw_framecount_t i, n;
+  gint c, h;
+  gfloat * p;
+
+  /* Take up new controls, unless the interface is setting them just now */
+  if (g_mutex_trylock (&lp->controls_mutex)) {
+    if (lp->pending) {
+      memcpy (lp->control_inputs, lp->pending_controls,
+	      lp->nr_ci * sizeof (LADSPA_Data));
+      lp->pending = FALSE;
+    }
+    g_mutex_unlock (&lp->controls_mutex);
+  }
+
+  while (count > 0) {
+    n = MIN (count, BLOCK_SIZE);
+
+    /* de-interleave */
+    p = buf;
+    for (i=0; i < n; i++) {
+      for (c=0; c < lp->nr_channels; c++) {
+	lp->input_buffers[c][i] = *p++;
+      }
+    }
+
+    for (h = 0; h < lp->nr_handles; h++) {
+      d->run (lp->handles[h], n);
+    }
+
+    /* re-interleave */
+    p = buf;
+    for (i=0; i < n; i++) {
+      for (c=0; c < lp->nr_channels; c++) {
+	*p++ = lp->output_buffers[c][i];
+      }
+    }
+
+    buf += n * lp->nr_channels;
+    count -= n;
+  }
+}
+
+static void
+lm_processor_set_params (sw_processor * processor, sw_param_set pset)
+{
+  lm_processor * lp = (lm_processor *)processor->data;
+
+  g_mutex_lock (&lp->controls_mutex);
+
+  control_values (lp->param_specs, lp->nr_ci, pset, lp->pending_controls);
+  lp->pending = TRUE;
+
+  g_mutex_unlock (&lp->controls_mutex);
+}
+
+static void
+lm_processor_destroy (sw_processor * processor)
+{
+  lm_processor * lp = (lm_processor *)processor->data;
+  const LADSPA_Descriptor * d = lp->d;
+  gint h, i;
+
+  for (h = 0; h < lp->nr_handles; h++) {
+    if (lp->handles[h] == NULL) continue;
+    if (d->deactivate) d->deactivate (lp->handles[h]);
+    if (d->cleanup) d->cleanup (lp->handles[h]);
+  }
+  g_free (lp->handles);
+
+  for (i=0; i < lp->nr_i; i++) {
+    g_free (lp->input_buffers[i]);
+  }
+  g_free (lp->input_buffers);
+
+  for (i=0; i < lp->nr_o; i++) {
+    g_free (lp->output_buffers[i]);
+  }
+  g_free (lp->output_buffers);
+
+  g_free (lp->control_inputs);
+  g_free (lp->pending_controls);
+  g_mutex_clear (&lp->controls_mutex);
+
+  g_free (lp);
+  g_free (processor);
+}
+
+/*
+ * ladspa_meta_realtime (format, pset, custom_data)
+ *
+ * create a processor which runs the plugin over audio of the given
+ * format as it is played. The plugin is instantiated at the sample's
+ * rate, which is the rate the device is opened at for this sample.
  */
+static sw_processor *
+ladspa_meta_realtime (sw_format * format, sw_param_set pset,
+		      gpointer custom_data)
+{
+  lm_custom * lm = (lm_custom *)custom_data;
+  const LADSPA_Descriptor * d;
+  lm_processor * lp;
+  sw_processor * processor;
+  LADSPA_PortDescriptor pd;
+  gulong port_i;
+  gint nr_ai = 0, nr_ao = 0;
+  gint h, i, j, ai, ao;
+
+  if ((d = lm_custom_resolve (lm)) == NULL) return NULL;
+
+  lp = g_malloc0 (sizeof (*lp));
+  lp->d = d;
+  lp->param_specs = lm->param_specs;
+  lp->nr_channels = format->channels;
+
+  for (port_i=0; port_i < d->PortCount; port_i++) {
+    pd = d->PortDescriptors[(int)port_i];
+    if (LADSPA_IS_CONTROL_INPUT(pd))
+      lp->nr_ci++;
+    if (LADSPA_IS_AUDIO_INPUT(pd))
+      nr_ai++;
+    if (LADSPA_IS_AUDIO_OUTPUT(pd))
+      nr_ao++;
+  }
+
+  /* As for ladspa_meta_apply_filter(), run enough handles to cover
+   * all channels. Input buffers beyond the last channel stay zeroed,
+   * and output buffers are always separate from the inputs.
+   */
+  lp->nr_handles = (gint) ceil(((double)lp->nr_channels) / ((double)nr_ao));
+  lp->nr_i = lp->nr_handles * nr_ai;
+  lp->nr_o = lp->nr_handles * nr_ao;
+
+  lp->input_buffers = g_malloc (sizeof (LADSPA_Data *) * lp->nr_i);
+  for (i=0; i < lp->nr_i; i++) {
+    lp->input_buffers[i] = g_malloc0 (LADSPA_frames_to_bytes (BLOCK_SIZE));
+  }
+
+  lp->output_buffers = g_malloc (sizeof (LADSPA_Data *) * lp->nr_o);
+  for (i=0; i < lp->nr_o; i++) {
+    lp->output_buffers[i] = g_malloc0 (LADSPA_frames_to_bytes (BLOCK_SIZE));
+  }
+
+  lp->control_inputs = g_malloc0 (MAX (lp->nr_ci, 1) * sizeof (LADSPA_Data));
+  lp->pending_controls =
+    g_malloc0 (MAX (lp->nr_ci, 1) * sizeof (LADSPA_Data));
+  control_values (lp->param_specs, lp->nr_ci, pset, lp->control_inputs);
+  g_mutex_init (&lp->controls_mutex);
+
+  processor = g_malloc0 (sizeof (*processor));
+  processor->channels = lp->nr_channels;
+  processor->process = lm_processor_process;
+  processor->set_params = lm_processor_set_params;
+  processor->destroy = lm_processor_destroy;
+  processor->data = lp;
+
+  lp->handles = g_malloc0 (sizeof (LADSPA_Handle) * lp->nr_handles);
+
+  for (h = 0; h < lp->nr_handles; h++) {
+    lp->handles[h] = d->instantiate (d, (long)format->rate);
+    if (lp->handles[h] == NULL) {
+      lm_processor_destroy (processor);
+      return NULL;
+    }
+
+    j = 0; ai = h * nr_ai; ao = h * nr_ao;
+    for (port_i=0; port_i < d->PortCount; port_i++) {
+      pd = d->PortDescriptors[(int)port_i];
+      if (LADSPA_IS_CONTROL_INPUT(pd)) {
+	d->connect_port (lp->handles[h], port_i, &lp->control_inputs[j++]);
+      } else if (LADSPA_IS_CONTROL_OUTPUT(pd)) {
+	d->connect_port (lp->handles[h], port_i, &lp->dummy_control_output);
+      } else if (LADSPA_IS_AUDIO_INPUT(pd)) {
+	d->connect_port (lp->handles[h], port_i, lp->input_buffers[ai++]);
+      } else if (LADSPA_IS_AUDIO_OUTPUT(pd)) {
+	d->connect_port (lp->handles[h], port_i, lp->output_buffers[ao++]);
+      }
+    }
+
+    if (d->activate) d->activate (lp->handles[h]);
+  }
+
+  return processor;
+}
+
+/*
+ * ladspa_cache_filename ()
+ *
+ * the descriptor cache lives in ~/.sweep/ladspa.cache, so that sweep
+ * can build its menus at startup without loading every LADSPA library.
+ */
+static gchar *
+ladspa_cache_filename (void)
+{
+  return g_strconcat (g_get_home_dir (), "/.sweep/ladspa.cache", NULL);
+}
+
+/*
+ * ladspa_cache_read_line (f, line)
+ *
+ * read one whole line of f into line, without its newline.
+ * Returns NULL at end of file.
+ */
+static gchar *
+ladspa_cache_read_line (FILE * f, GString * line)
+{
+  char buf[256];
+
+  g_string_truncate (line, 0);
+
+  while (fgets (buf, sizeof (buf), f) != NULL) {
+    g_string_append (line, buf);
+    if (line->str[line->len - 1] == '\n') {
+      g_string_truncate (line, line->len - 1);
+      return line->str;
+    }
+  }
+
+  return (line->len > 0) ? line->str : NULL;
+}
+
+/*
+ * ladspa_cache_read ()
+ *
+ * read the descriptor cache into a table of lm_library, keyed by path.
+ * The file holds one line per library, descriptor and port:
+ *
+ *   L  mtime  size  path
+ *   F  mtime  size  failed-at  path
+ *   D  index  unique-id  properties  nr-ports  label  name  maker  copyright
+ *   P  port-descriptor  hint-descriptor  lower-bound  upper-bound  name
+ *
+ * with fields separated by tabs and strings escaped. F lines are for
+ * files which could not be loaded. A cache which cannot be parsed, or
+ * which describes ports that could not have been used, is ignored as
+ * a whole.
+ */
+static GHashTable *
+ladspa_cache_read (void)
+{
+  GHashTable * libraries;
+  gchar * filename;
+  FILE * f;
+  GString * line;
+  gchar ** fields;
+  gint nr_fields;
+  struct stat statbuf;
+  lm_library * lib = NULL;
+  lm_custom * lmc = NULL;
+  unsigned long nr_ports, port_i = 0;
+  LADSPA_PortRangeHint * prh;
+  gboolean ok = TRUE;
+
+  libraries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+				     (GDestroyNotify)lm_library_free);
+
+  filename = ladspa_cache_filename ();
+  f = fopen (filename, "r");
+  g_free (filename);
+
+  if (f == NULL) return libraries;
+
+  if (fstat (fileno (f), &statbuf) == -1) {
+    fclose (f);
+    return libraries;
+  }
+
+  line = g_string_new (NULL);
+
+  if (ladspa_cache_read_line (f, line) == NULL ||
+      strcmp (line->str, LADSPA_CACHE_HEADER))
+    ok = FALSE;
+
+  while (ok && ladspa_cache_read_line (f, line) != NULL) {
+    fields = g_strsplit (line->str, "\t", -1);
+    nr_fields = g_strv_length (fields);
+
+    /* A library or descriptor must not start before the last
+     * descriptor's ports are complete */
+    if (strcmp (fields[0], "P") && lmc && port_i < lmc->cached.PortCount)
+      ok = FALSE;
+
+    /* Once they are, they must be usable, as they were when scanned */
+    if (strcmp (fields[0], "P") && lmc && !has_usable_ports (&lmc->cached))
+      ok = FALSE;
+
+    if (!ok) {
+    } else if ((!strcmp (fields[0], "L") && nr_fields == 4) ||
+	       (!strcmp (fields[0], "F") && nr_fields == 5)) {
+      gchar * path = g_strcompress (fields[nr_fields - 1]);
+
+      lib = lm_library_new (path, strtol (fields[1], NULL, 10),
+			    strtol (fields[2], NULL, 10));
+      if (nr_fields == 5)
+	lib->failed_at = MAX (1, strtol (fields[3], NULL, 10));
+      lmc = NULL;
+      g_free (path);
+
+      if (g_hash_table_lookup (libraries, lib->path)) {
+	/* Listed twice; keep the first */
+	lm_library_free (lib);
+	lib = NULL;
+      } else {
+	g_hash_table_insert (libraries, lib->path, lib);
+      }
+    } else if (!strcmp (fields[0], "D") && nr_fields == 9 && lib &&
+	       lib->failed_at == 0 &&
+	       (nr_ports = strtoul (fields[4], NULL, 10)) > 0 &&
+	       nr_ports < (unsigned long)statbuf.st_size) {
+      /* Each port takes a line of its own, which bounds their number
+       * before the ports are allocated */
+      lmc = lm_custom_new (lib, strtoul (fields[1], NULL, 10), nr_ports);
+      lmc->cached.UniqueID = strtoul (fields[2], NULL, 10);
+      lmc->cached.Properties = strtol (fields[3], NULL, 10);
+      lmc->cached.Label = g_strcompress (fields[5]);
+      lmc->cached.Name = g_strcompress (fields[6]);
+      lmc->cached.Maker = g_strcompress (fields[7]);
+      lmc->cached.Copyright = g_strcompress (fields[8]);
+      lib->customs = g_list_append (lib->customs, lmc);
+      port_i = 0;
+    } else if (!strcmp (fields[0], "P") && nr_fields == 6 && lmc &&
+	       port_i < lmc->cached.PortCount) {
+      ((LADSPA_PortDescriptor *)lmc->cached.PortDescriptors)[port_i] =
+	strtol (fields[1], NULL, 10);
+      prh = &((LADSPA_PortRangeHint *)lmc->cached.PortRangeHints)[port_i];
+      prh->HintDescriptor = strtol (fields[2], NULL, 10);
+      prh->LowerBound = (LADSPA_Data)g_ascii_strtod (fields[3], NULL);
+      prh->UpperBound = (LADSPA_Data)g_ascii_strtod (fields[4], NULL);
+      ((char **)lmc->cached.PortNames)[port_i] = g_strcompress (fields[5]);
+      port_i++;
+    } else {
+      ok = FALSE;
+    }
+
+    g_strfreev (fields);
+  }
+
+  if (lmc && port_i < lmc->cached.PortCount) ok = FALSE;
+  if (lmc && !has_usable_ports (&lmc->cached)) ok = FALSE;
+
+  g_string_free (line, TRUE);
+  fclose (f);
+
+  if (!ok) {
+#ifdef DEBUG
+    g_print ("ladspameta: ignoring malformed cache\n");
+#endif
+    g_hash_table_remove_all (libraries);
+  }
+
+  return libraries;
+}
+
 static void
-ladspa_meta_add_procs (gchar * dir, gchar * name)
+ladspa_cache_write_string (FILE * f, const char * string)
+{
+  gchar * escaped;
+
+  escaped = g_strescape (string ? string : "", NULL);
+  fprintf (f, "\t%s", escaped);
+  g_free (escaped);
+}
+
+/*
+ * ladspa_cache_write ()
+ *
+ * write out the descriptors of all libraries found. The cache is
+ * written to a temporary file and renamed into place, so a crash
+ * while writing cannot leave a truncated cache behind.
+ */
+static void
+ladspa_cache_write (void)
+{
+  gchar * dirname, * filename, * tmpname;
+  gchar lower[G_ASCII_DTOSTR_BUF_SIZE], upper[G_ASCII_DTOSTR_BUF_SIZE];
+  FILE * f;
+  GList * gl, * cl;
+  lm_library * lib;
+  lm_custom * lmc;
+  const LADSPA_PortRangeHint * prh;
+  unsigned long j;
+  gboolean ok;
+
+  dirname = g_strconcat (g_get_home_dir (), "/.sweep", NULL);
+  if (mkdir (dirname, S_IRWXU) == -1 && errno != EEXIST) {
+    g_free (dirname);
+    return;
+  }
+  g_free (dirname);
+
+  filename = ladspa_cache_filename ();
+  tmpname = g_strconcat (filename, ".tmp", NULL);
+
+  if ((f = fopen (tmpname, "w")) != NULL) {
+    fprintf (f, "%s\n", LADSPA_CACHE_HEADER);
+
+    for (gl = libraries_list; gl; gl = gl->next) {
+      lib = (lm_library *)gl->data;
+
+      if (lib->failed_at != 0) {
+	fprintf (f, "F\t%ld\t%ld\t%ld", lib->mtime, lib->size,
+		 lib->failed_at);
+      } else {
+	fprintf (f, "L\t%ld\t%ld", lib->mtime, lib->size);
+      }
+      ladspa_cache_write_string (f, lib->path);
+      fprintf (f, "\n");
+
+      for (cl = lib->customs; cl; cl = cl->next) {
+	lmc = (lm_custom *)cl->data;
+
+	fprintf (f, "D\t%lu\t%lu\t%d\t%lu", lmc->index,
+		 lmc->cached.UniqueID, (int)lmc->cached.Properties,
+		 lmc->cached.PortCount);
+	ladspa_cache_write_string (f, lmc->cached.Label);
+	ladspa_cache_write_string (f, lmc->cached.Name);
+	ladspa_cache_write_string (f, lmc->cached.Maker);
+	ladspa_cache_write_string (f, lmc->cached.Copyright);
+	fprintf (f, "\n");
+
+	for (j = 0; j < lmc->cached.PortCount; j++) {
+	  prh = &lmc->cached.PortRangeHints[j];
+	  g_ascii_dtostr (lower, sizeof (lower), prh->LowerBound);
+	  g_ascii_dtostr (upper, sizeof (upper), prh->UpperBound);
+	  fprintf (f, "P\t%d\t%d\t%s\t%s",
+		   (int)lmc->cached.PortDescriptors[j],
+		   (int)prh->HintDescriptor, lower, upper);
+	  ladspa_cache_write_string (f, lmc->cached.PortNames[j]);
+	  fprintf (f, "\n");
+	}
+      }
+    }
+
+    ok = !ferror (f);
+    if (fclose (f) != 0) ok = FALSE;
+
+    if (!ok || rename (tmpname, filename) != 0) unlink (tmpname);
+  }
+
+  g_free (tmpname);
+  g_free (filename);
+}
+
+/*
+ * ladspa_meta_scan_library (path, mtime, size)
+ *
+ * load the shared library file "path" once to describe its usable
+ * descriptors, then close it again. A library without a LADSPA entry
+ * point is described as having none, so that it is not loaded again
+ * on the next startup. A file which cannot be loaded at all is noted
+ * as having failed, to be tried again later.
+ */
+static lm_library *
+ladspa_meta_scan_library (const gchar * path, glong mtime, glong size)
 {
-  gchar path[256];
+  lm_library * lib;
   void * module;
   LADSPA_Descriptor_Function desc_func;
   const LADSPA_Descriptor * d;
-  LADSPA_PortDescriptor pd;
-  gint i, j, k, nr_params;
-  int valid_mask;
-  sw_procedure * proc;
+  unsigned long i;
 
-  snprintf (path, sizeof (path), "%s/%s", dir, name);
+  lib = lm_library_new (path, mtime, size);
 
-  module = dlopen (path, RTLD_NOW);
-  if (!module) return;
+#ifdef DEBUG
+  g_print ("ladspameta: scanning %s\n", path);
+#endif
 
-  modules_list = g_list_append (modules_list, module);
+  module = dlopen (path, RTLD_NOW);
+  if (!module) {
+#ifdef DEBUG
+    g_print ("ladspameta: %s\n", dlerror ());
+#endif
+    lib->failed_at = MAX (1, (glong)time (NULL));
+    return lib;
+  }
 
   if ((desc_func = dlsym (module, "ladspa_descriptor"))) {
     for (i=0; (d = desc_func (i)) != NULL; i++) {
+      if (is_usable(d))
+	lib->customs = g_list_append (lib->customs,
+				      lm_custom_copy (lib, i, d));
+    }
+  }
 
-      if (!is_usable(d))
-	continue;
+  dlclose (module);
 
-      proc = g_malloc0 (sizeof (*proc));
-      proc->name = (gchar *)d->Name;
-      proc->author = (gchar *)d->Maker;
-      proc->copyright = (gchar *)d->Copyright;
+  return lib;
+}
 
-      nr_params=0;
-      for (j=0; j < d->PortCount; j++) {
-	pd = d->PortDescriptors[j];
-	if (LADSPA_IS_CONTROL_INPUT(pd)) {
-	  nr_params++;
-	}
+/*
+ * ladspa_meta_add_procs (lib)
+ *
+ * form sweep procs to describe the ladspa plugin functions that
+ * are in the library lib, and add these procs to proc_list
+ */
+static void
+ladspa_meta_add_procs (lm_library * lib)
+{
+  GList * cl;
+  lm_custom * lmc;
+  const LADSPA_Descriptor * d;
+  LADSPA_PortDescriptor pd;
+  gint j, k, nr_params;
+  int valid_mask;
+  sw_procedure * proc;
+
+  for (cl = lib->customs; cl; cl = cl->next) {
+    lmc = (lm_custom *)cl->data;
+    d = &lmc->cached;
+
+    proc = g_malloc0 (sizeof (*proc));
+    proc->name = (gchar *)d->Name;
+    proc->author = (gchar *)d->Maker;
+    proc->copyright = (gchar *)d->Copyright;
+
+    nr_params=0;
+    for (j=0; j < d->PortCount; j++) {
+      pd = d->PortDescriptors[j];
+      if (LADSPA_IS_CONTROL_INPUT(pd)) {
+	nr_params++;
       }
+    }
 
-      proc->nr_params = nr_params;
-      proc->param_specs =
-	(sw_param_spec *)g_malloc0 (nr_params * sizeof (sw_param_spec));
-
-      k=0;
-      for (j=0; j < d->PortCount; j++) {
-	pd = d->PortDescriptors[j];
-	if (LADSPA_IS_CONTROL_INPUT(pd)) {
-	  proc->param_specs[k].name = (gchar *)d->PortNames[j];
-	  proc->param_specs[k].desc = (gchar *)d->PortNames[j];
-	  proc->param_specs[k].type =
-	    convert_type (d->PortRangeHints[j].HintDescriptor);
-	  valid_mask = get_valid_mask (d->PortRangeHints[j].HintDescriptor);
-	  if (valid_mask == 0) {
-	    proc->param_specs[k].constraint_type = SW_PARAM_CONSTRAINED_NOT;
-	  } else {
-	    proc->param_specs[k].constraint_type = SW_PARAM_CONSTRAINED_RANGE;
-	    proc->param_specs[k].constraint.range =
-	      convert_constraint (&d->PortRangeHints[j]);
-	  }
-	  k++;
+    proc->nr_params = nr_params;
+    proc->param_specs =
+      (sw_param_spec *)g_malloc0 (nr_params * sizeof (sw_param_spec));
+
+    k=0;
+    for (j=0; j < d->PortCount; j++) {
+      pd = d->PortDescriptors[j];
+      if (LADSPA_IS_CONTROL_INPUT(pd)) {
+	proc->param_specs[k].name = (gchar *)d->PortNames[j];
+	proc->param_specs[k].desc = (gchar *)d->PortNames[j];
+	proc->param_specs[k].type =
+	  convert_type (d->PortRangeHints[j].HintDescriptor);
+	valid_mask = get_valid_mask (d->PortRangeHints[j].HintDescriptor);
+	if (valid_mask == 0) {
+	  proc->param_specs[k].constraint_type = SW_PARAM_CONSTRAINED_NOT;
+	} else {
+	  proc->param_specs[k].constraint_type = SW_PARAM_CONSTRAINED_RANGE;
+	  proc->param_specs[k].constraint.range =
+	    convert_constraint (&d->PortRangeHints[j]);
 	}
+	k++;
       }
+    }
 
-      proc->suggest = ladspa_meta_suggest;
+    proc->suggest = ladspa_meta_suggest;
 
-      proc->apply = ladspa_meta_apply;
+    proc->apply = ladspa_meta_apply;
 
-      proc->custom_data = lm_custom_new (d, proc->param_specs);
+    proc->realtime = ladspa_meta_realtime;
 
-      proc_list = g_list_append (proc_list, proc);
-    }
+    lmc->param_specs = proc->param_specs;
+    proc->custom_data = lmc;
+
+    proc_list = g_list_append (proc_list, proc);
   }
 }
 
 /*
- * ladspa_meta_init_dir (dir, gl)
+ * ladspa_meta_init_dir (dir, cached)
  *
- * scan a directory "dirname" for LADSPA plugins, and attempt to load
- * each of them.
+ * scan a directory "dirname" for LADSPA plugins, taking the description
+ * of each from the cache if it is unchanged there, or else scanning it.
  */
 static void
-ladspa_meta_init_dir (gchar * dirname)
+ladspa_meta_init_dir (gchar * dirname, GHashTable * cached)
 {
   DIR * dir;
   struct dirent * dirent;
+  struct stat statbuf;
   char * name;
+  gchar * path;
+  lm_library * lib;
 
   if (!dirname) return;
 
@@ -744,8 +1657,35 @@ ladspa_meta_init_dir (gchar * dirname)
 
   while ((dirent = readdir (dir)) != NULL) {
     name = dirent->d_name;
-    if (strcmp (name, ".") && strcmp (name, ".."))
-      ladspa_meta_add_procs (dirname, dirent->d_name);
+    if (!strcmp (name, ".") || !strcmp (name, ".."))
+      continue;
+
+    path = g_strdup_printf ("%s/%s", dirname, name);
+
+    if (stat (path, &statbuf) == -1 || !S_ISREG (statbuf.st_mode)) {
+      g_free (path);
+      continue;
+    }
+
+    lib = g_hash_table_lookup (cached, path);
+
+    /* A file which failed to load is only taken as failing still while
+     * it is unchanged and the failure is recent */
+    if (lib != NULL && lib->mtime == (glong)statbuf.st_mtime &&
+	lib->size == (glong)statbuf.st_size &&
+	(lib->failed_at == 0 ||
+	 ((glong)time (NULL) - lib->failed_at) < LADSPA_RETRY_SECS)) {
+      g_hash_table_steal (cached, path);
+    } else {
+      lib = ladspa_meta_scan_library (path, (glong)statbuf.st_mtime,
+				      (glong)statbuf.st_size);
+      cache_dirty = TRUE;
+    }
+
+    libraries_list = g_list_append (libraries_list, lib);
+    ladspa_meta_add_procs (lib);
+
+    g_free (path);
   }
 
   closedir (dir);
@@ -757,6 +1697,7 @@ ladspa_meta_init (void)
   char * ladspa_path=NULL;
   char * next_sep=NULL;
   char * saved_lp=NULL;
+  GHashTable * cached;
 
   /* If this ladspa_meta module has already been initialised, don't
    * initialise again until cleaned up.
@@ -768,16 +1709,25 @@ ladspa_meta_init (void)
   if (!ladspa_path)
     ladspa_path = saved_lp = strdup(default_ladspa_path);
 
+  cached = ladspa_cache_read ();
+  cache_dirty = FALSE;
+
   do {
     next_sep = strchr (ladspa_path, ':');
     if (next_sep != NULL) *next_sep = '\0';
 
-    ladspa_meta_init_dir (ladspa_path);
+    ladspa_meta_init_dir (ladspa_path, cached);
 
     if (next_sep != NULL) ladspa_path = ++next_sep;
 
   } while ((next_sep != NULL) && (*next_sep != '\0'));
 
+  /* Libraries left over in the cache have been removed */
+  if (cache_dirty || g_hash_table_size (cached) > 0)
+    ladspa_cache_write ();
+
+  g_hash_table_destroy (cached);
+
   ladspa_meta_initialised = TRUE;
 
   /* free string if dup'd for ladspa_path */
@@ -798,7 +1748,7 @@ ladspa_meta_cleanup (void)
     if (p && p->custom_data) {
       int j;
 
-      g_free (p->custom_data);
+      /* custom_data belongs to its library, freed below */
       p->custom_data =  NULL;
 
       for (j=0; j < p->nr_params; j++) {
@@ -817,13 +1767,14 @@ ladspa_meta_cleanup (void)
   g_list_free (proc_list);
   proc_list = NULL;
 
-  for (gl = modules_list; gl; gl = gl->next) {
-    dlclose(gl->data);
+  for (gl = libraries_list; gl; gl = gl->next) {
+    lm_library_free ((lm_library *)gl->data);
     gl->data = NULL;
   }
-  g_list_free (modules_list);
-  modules_list = NULL;
+  g_list_free (libraries_list);
+  libraries_list = NULL;
 
+  ladspa_meta_initialised = FALSE;
 }
 
 sw_plugin plugin = {
@@ -27,11 +27,57 @@
 
 #include <../src/sweep_app.h> /* XXX */
 
+/*
+ * region_peak (sample, start, end, run_total, op_total, active)
+ *
+ * scans frames [start, end) for their peak, a block at a time so that
+ * the scan can be cancelled and its progress shown.
+ */
+static float
+region_peak (sw_sample * sample, sw_framecount_t start, sw_framecount_t end,
+	     sw_framecount_t * run_total, sw_framecount_t op_total,
+	     gboolean * active)
+{
+  sw_sounddata * sounddata = sample_get_sounddata (sample);
+  sw_format * f = sounddata->format;
+  float * d;
+  float max = 0;
+  glong i;
+  sw_framecount_t n;
+
+  while (*active && start < end) {
+    g_mutex_lock (&sample->ops_mutex);
+
+    if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
+      *active = FALSE;
+    } else {
+      d = sounddata->data + frames_to_bytes (f, start);
+
+      n = MIN(end - start, 1024);
+
+      for (i=0; i < n * f->channels; i++) {
+	if(d[i]>=0) max = MAX(max, d[i]);
+	else max = MAX(max, -d[i]);
+      }
+
+      start += n;
+
+      *run_total += n;
+      sample_set_progress_percent (sample, *run_total / op_total);
+    }
+
+    g_mutex_unlock (&sample->ops_mutex);
+  }
+
+  return max;
+}
+
 static sw_sample *
 normalise (sw_sample * sample, sw_param_set pset, gpointer custom_data)
 {
   sw_sounddata * sounddata;
   sw_format * f;
+  sw_analysis * analysis;
   GList * gl;
   sw_sel * sel;
   float * d;
@@ -40,6 +86,7 @@ normalise (sw_sample * sample, sw_param_set pset, gpointer custom_data)
   sw_framecount_t op_total, run_total;
   glong i;
   sw_framecount_t offset, remaining, n;
+  sw_framecount_t window, w, w0, w1;
 
   gboolean active = TRUE;
 
@@ -50,40 +97,48 @@ normalise (sw_sample * sample, sw_param_set pset, gpointer custom_data)
   if (op_total == 0) op_total = 1;
   run_total = 0;
 
-  /* Find max */
+  /* Find max. If an up to date analysis is cached, as after selecting
+   * by energy, windows lying wholly inside a region take their peak
+   * from it and only the partial windows at the ends of each region are
+   * scanned here. Otherwise just the selection is scanned, rather than
+   * analysing the whole sample. */
+  analysis = sounddata_get_cached_analysis (sounddata, 0);
+
   for (gl = sounddata->sels; active && gl; gl = gl->next) {
     sel = (sw_sel *)gl->data;
 
-    offset = 0;
-    remaining = sel->sel_end - sel->sel_start;
+    if (analysis == NULL) {
+      max = MAX(max, region_peak (sample, sel->sel_start, sel->sel_end,
+				  &run_total, op_total, &active));
+      continue;
+    }
 
-    while (active && remaining > 0) {
-      g_mutex_lock (&sample->ops_mutex);
+    window = analysis->window;
 
-      if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
-	active = FALSE;
-      } else {
+    w0 = (sel->sel_start + window - 1) / window;
+    w1 = sel->sel_end / window;
 
-	d = sounddata->data + frames_to_bytes (f, sel->sel_start + offset);
-
-	n = MIN(remaining, 1024);
+    if (w0 >= w1) {
+      max = MAX(max, region_peak (sample, sel->sel_start, sel->sel_end,
+				  &run_total, op_total, &active));
+      continue;
+    }
 
-	for (i=0; i < n * f->channels; i++) {
-	  if(d[i]>=0) max = MAX(max, d[i]);
-	  else max = MAX(max, -d[i]);
-	}
+    max = MAX(max, region_peak (sample, sel->sel_start, w0 * window,
+				&run_total, op_total, &active));
 
-	remaining -= n;
-	offset += n;
+    for (w = w0; w < w1; w++) {
+      max = MAX(max, analysis->windows[w].peak);
+    }
 
-	run_total += n;
-	sample_set_progress_percent (sample, run_total / op_total);
-      }
+    run_total += (w1 - w0) * window;
 
-      g_mutex_unlock (&sample->ops_mutex);
-    }
+    max = MAX(max, region_peak (sample, w1 * window, sel->sel_end,
+				&run_total, op_total, &active));
   }
 
+  analysis_unref (analysis);
+
   if (max != 0) factor = SW_AUDIO_MAX / (gfloat)max;
 
   /* Scale */
@@ -111,7 +166,7 @@ normalise (sw_sample * sample, sw_param_set pset, gpointer custom_data)
 	offset += n;
 
 	run_total += n;
-	sample_set_progress_percent (sample, run_total * 100 / op_total);
+	sample_set_progress_percent (sample, run_total / op_total);
       }
 
       g_mutex_unlock (&sample->ops_mutex);
@@ -0,0 +1,869 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Headless batch processing.
+ *
+ *   sweep --batch script [--jobs n] files ...
+ *
+ * runs the steps of a script over each file, without a display. Files
+ * are read by the usual loaders, procedures are applied as from the
+ * Process menu and results are written out through libsndfile. With no
+ * main loop to hand operations over to, schedule_operation runs each
+ * one to completion in the calling thread, so each file is processed
+ * from start to finish by one worker, and n files are worked on at once.
+ *
+ * A script has one step per line. Words are split as by the shell, and
+ * blank lines and comments starting with '#' are ignored:
+ *
+ *   select all                  select the whole file; the default
+ *   select START END            select from START to END seconds,
+ *                               where END may be "end"
+ *   apply NAME [PARAM=VALUE]... apply the procedure NAME. Parameters
+ *                               not given take their suggested values
+ *   chain                       begin a chain of apply steps, which
+ *                               are run together in a single pass
+ *                               over the selection as one operation.
+ *                               Only procedures which can be previewed
+ *                               can be chained
+ *   end                         end a chain
+ *   resample RATE [QUALITY]     resample to RATE Hz
+ *   save PATTERN                write the file out to PATTERN, in which
+ *                               %d is the directory of the input file,
+ *                               %b its name without extension, %e its
+ *                               extension and %% is a '%'
+ *
+ * Errors are reported on stderr; a file with errors is not processed
+ * further, and the exit status is 1 if any file failed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <locale.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#ifdef HAVE_LIBSAMPLERATE
+#include <samplerate.h>
+#endif
+
+#include <sweep/sweep_i18n.h>
+#include <sweep/sweep_types.h>
+#include <sweep/sweep_typeconvert.h>
+#include <sweep/sweep_sample.h>
+#include <sweep/sweep_undo.h>
+#include <sweep/sweep_filter.h>
+
+#include "sample.h"
+#include "file_dialogs.h"
+#include "param.h"
+#include "plugin.h"
+#include "batch.h"
+
+/*#define DEBUG*/
+
+#ifdef HAVE_LIBSAMPLERATE
+extern void resample (sw_sample * sample, int new_rate, int quality);
+#endif
+
+extern GList * plugins;
+
+gboolean batch_mode = FALSE;
+
+typedef enum {
+  BATCH_SELECT,
+  BATCH_APPLY,
+  BATCH_CHAIN,
+  BATCH_RESAMPLE,
+  BATCH_SAVE
+} batch_step_t;
+
+typedef struct {
+  batch_step_t type;
+
+  /* select: in seconds; end < 0 is the end of the file */
+  gdouble start, end;
+
+  /* apply */
+  sw_procedure * proc;
+  gboolean * given;
+  sw_param * values;
+
+  /* chain: the apply steps to run together */
+  GList * stages;
+
+  /* resample */
+  gint rate;
+  gint quality;
+
+  /* save */
+  gchar * pattern;
+} batch_step;
+
+/* The file a worker thread is processing, and the errors found in it */
+typedef struct {
+  const gchar * pathname;
+  gint errors;
+} batch_job;
+
+static GPrivate current_job;
+
+static gint nr_failed = 0;
+
+/*
+ * batch_report (fmt, ...)
+ *
+ * reports an error in the file being processed by the calling thread,
+ * on a single line of stderr.
+ */
+void
+batch_report (const char * fmt, ...)
+{
+  batch_job * job = (batch_job *)g_private_get (&current_job);
+  va_list ap;
+  gchar * message;
+
+  va_start (ap, fmt);
+  message = g_strdup_vprintf (fmt, ap);
+  va_end (ap);
+
+  g_strdelimit (message, "\n", ' ');
+
+  if (job != NULL) {
+    job->errors++;
+    g_printerr ("%s: %s\n", job->pathname, message);
+  } else {
+    g_printerr ("%s\n", message);
+  }
+
+  g_free (message);
+}
+
+static void
+batch_script_error (const gchar * filename, gint line, const char * fmt, ...)
+{
+  va_list ap;
+  gchar * message;
+
+  va_start (ap, fmt);
+  message = g_strdup_vprintf (fmt, ap);
+  va_end (ap);
+
+  g_printerr ("%s:%d: %s\n", filename, line, message);
+
+  g_free (message);
+}
+
+static gboolean
+batch_parse_double (const gchar * text, gdouble * value)
+{
+  gchar * end;
+
+  *value = g_ascii_strtod (text, &end);
+
+  return (end != text && *end == '\0');
+}
+
+static gboolean
+batch_parse_int (const gchar * text, gint * value)
+{
+  gchar * end;
+
+  *value = (gint)strtol (text, &end, 10);
+
+  return (end != text && *end == '\0');
+}
+
+static sw_procedure *
+batch_find_procedure (const gchar * name)
+{
+  GList * gl;
+  sw_procedure * proc;
+
+  for (gl = plugins; gl; gl = gl->next) {
+    proc = (sw_procedure *)gl->data;
+    if (!g_ascii_strcasecmp (proc->name, name) ||
+	!g_ascii_strcasecmp (_(proc->name), name))
+      return proc;
+  }
+
+  return NULL;
+}
+
+/*
+ * batch_param_valid (spec, p)
+ *
+ * checks p against the constraint of spec.
+ */
+static gboolean
+batch_param_valid (sw_param_spec * spec, sw_param p)
+{
+  sw_param_range * range;
+  sw_param * list;
+  gint i;
+
+  if (spec->type == SWEEP_TYPE_BOOL) return TRUE;
+
+  switch (spec->constraint_type) {
+  case SW_PARAM_CONSTRAINED_RANGE:
+    range = spec->constraint.range;
+    if (spec->type == SWEEP_TYPE_INT) {
+      if ((range->valid_mask & SW_RANGE_LOWER_BOUND_VALID) &&
+	  p.i < range->lower.i) return FALSE;
+      if ((range->valid_mask & SW_RANGE_UPPER_BOUND_VALID) &&
+	  p.i > range->upper.i) return FALSE;
+    } else if (spec->type == SWEEP_TYPE_FLOAT) {
+      if ((range->valid_mask & SW_RANGE_LOWER_BOUND_VALID) &&
+	  p.f < range->lower.f) return FALSE;
+      if ((range->valid_mask & SW_RANGE_UPPER_BOUND_VALID) &&
+	  p.f > range->upper.f) return FALSE;
+    }
+    return TRUE;
+  case SW_PARAM_CONSTRAINED_LIST:
+    list = spec->constraint.list;
+    for (i = 1; i <= list[0].i; i++) {
+      switch (spec->type) {
+      case SWEEP_TYPE_INT:
+	if (list[i].i == p.i) return TRUE;
+	break;
+      case SWEEP_TYPE_FLOAT:
+	if (list[i].f == p.f) return TRUE;
+	break;
+      case SWEEP_TYPE_STRING:
+	if (!strcmp (list[i].s, p.s)) return TRUE;
+	break;
+      default:
+	break;
+      }
+    }
+    return FALSE;
+  default:
+    return TRUE;
+  }
+}
+
+static gboolean
+batch_parse_param (sw_param_spec * spec, const gchar * text, sw_param * p)
+{
+  gdouble f;
+
+  switch (spec->type) {
+  case SWEEP_TYPE_BOOL:
+    if (!g_ascii_strcasecmp (text, "true") ||
+	!g_ascii_strcasecmp (text, "yes") ||
+	!g_ascii_strcasecmp (text, "on") || !strcmp (text, "1")) {
+      p->b = TRUE;
+    } else if (!g_ascii_strcasecmp (text, "false") ||
+	       !g_ascii_strcasecmp (text, "no") ||
+	       !g_ascii_strcasecmp (text, "off") || !strcmp (text, "0")) {
+      p->b = FALSE;
+    } else {
+      return FALSE;
+    }
+    break;
+  case SWEEP_TYPE_INT:
+    if (!batch_parse_int (text, &p->i)) return FALSE;
+    break;
+  case SWEEP_TYPE_FLOAT:
+    if (!batch_parse_double (text, &f)) return FALSE;
+    p->f = (sw_float)f;
+    break;
+  case SWEEP_TYPE_STRING:
+    p->s = g_strdup (text);
+    break;
+  default:
+    return FALSE;
+  }
+
+  return batch_param_valid (spec, *p);
+}
+
+static void
+batch_step_free (batch_step * step)
+{
+  gint i;
+
+  if (step->type == BATCH_APPLY && step->values != NULL) {
+    for (i = 0; i < step->proc->nr_params; i++) {
+      if (step->given[i] &&
+	  step->proc->param_specs[i].type == SWEEP_TYPE_STRING)
+	g_free ((gchar *)step->values[i].s);
+    }
+  }
+
+  g_list_foreach (step->stages, (GFunc)batch_step_free, NULL);
+  g_list_free (step->stages);
+
+  g_free (step->given);
+  g_free (step->values);
+  g_free (step->pattern);
+  g_free (step);
+}
+
+static gboolean
+batch_parse_apply (batch_step * step, gint argc, gchar ** argv,
+		   const gchar * filename, gint line)
+{
+  sw_procedure * proc;
+  sw_param_spec * spec;
+  gchar * eq;
+  gint i, j;
+
+  if ((proc = batch_find_procedure (argv[1])) == NULL) {
+    batch_script_error (filename, line, _("No procedure named \"%s\""),
+			argv[1]);
+    return FALSE;
+  }
+
+  step->proc = proc;
+
+  if (proc->nr_params > 0) {
+    step->given = g_malloc0 (proc->nr_params * sizeof (gboolean));
+    step->values = sw_param_set_new (proc);
+  }
+
+  for (i = 2; i < argc; i++) {
+    if ((eq = strchr (argv[i], '=')) == NULL) {
+      batch_script_error (filename, line, _("Expected PARAM=VALUE, not \"%s\""),
+			  argv[i]);
+      return FALSE;
+    }
+
+    *eq = '\0';
+
+    for (j = 0; j < proc->nr_params; j++) {
+      if (!g_ascii_strcasecmp (proc->param_specs[j].name, argv[i]) ||
+	  !g_ascii_strcasecmp (_(proc->param_specs[j].name), argv[i]))
+	break;
+    }
+
+    if (j == proc->nr_params) {
+      batch_script_error (filename, line, _("%s has no parameter \"%s\""),
+			  proc->name, argv[i]);
+      return FALSE;
+    }
+
+    spec = &proc->param_specs[j];
+
+    if (step->given[j] && spec->type == SWEEP_TYPE_STRING)
+      g_free ((gchar *)step->values[j].s);
+
+    step->given[j] = TRUE;
+    step->values[j].s = NULL;
+
+    if (!batch_parse_param (spec, eq+1, &step->values[j])) {
+      batch_script_error (filename, line, _("Invalid value \"%s\" for %s"),
+			  eq+1, spec->name);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static batch_step *
+batch_step_parse (gint argc, gchar ** argv, const gchar * filename, gint line)
+{
+  batch_step * step;
+  gboolean ok = TRUE;
+
+  step = g_malloc0 (sizeof (batch_step));
+
+  if (!strcmp (argv[0], "select")) {
+    step->type = BATCH_SELECT;
+    if (argc == 2 && !strcmp (argv[1], "all")) {
+      step->start = 0.0;
+      step->end = -1.0;
+    } else if (argc == 3 && batch_parse_double (argv[1], &step->start) &&
+	       (!strcmp (argv[2], "end") ||
+		batch_parse_double (argv[2], &step->end))) {
+      if (!strcmp (argv[2], "end")) step->end = -1.0;
+      ok = (step->start >= 0.0 &&
+	    (step->end < 0.0 || step->end > step->start));
+    } else {
+      ok = FALSE;
+    }
+    if (!ok)
+      batch_script_error (filename, line,
+			  _("Usage: select all | select START END"));
+  } else if (!strcmp (argv[0], "apply")) {
+    step->type = BATCH_APPLY;
+    if (argc < 2) {
+      batch_script_error (filename, line,
+			  _("Usage: apply NAME [PARAM=VALUE]..."));
+      ok = FALSE;
+    } else {
+      ok = batch_parse_apply (step, argc, argv, filename, line);
+    }
+  } else if (!strcmp (argv[0], "resample")) {
+    step->type = BATCH_RESAMPLE;
+#ifdef HAVE_LIBSAMPLERATE
+    step->quality = SRC_SINC_MEDIUM_QUALITY;
+    ok = ((argc == 2 || argc == 3) &&
+	  batch_parse_int (argv[1], &step->rate) && step->rate > 0 &&
+	  (argc == 2 || (batch_parse_int (argv[2], &step->quality) &&
+			 src_get_name (step->quality) != NULL)));
+    if (!ok)
+      batch_script_error (filename, line,
+			  _("Usage: resample RATE [QUALITY]"));
+#else
+    batch_script_error (filename, line,
+			_("Resampling is not available in this build"));
+    ok = FALSE;
+#endif
+  } else if (!strcmp (argv[0], "save")) {
+    step->type = BATCH_SAVE;
+    if (argc == 2) {
+      step->pattern = g_strdup (argv[1]);
+    } else {
+      batch_script_error (filename, line, _("Usage: save PATTERN"));
+      ok = FALSE;
+    }
+  } else {
+    batch_script_error (filename, line, _("Unknown step \"%s\""), argv[0]);
+    ok = FALSE;
+  }
+
+  if (!ok) {
+    batch_step_free (step);
+    return NULL;
+  }
+
+  return step;
+}
+
+/*
+ * batch_script_read (filename)
+ *
+ * returns the list of steps in the script filename, or NULL if it could
+ * not be read or has no steps.
+ */
+static GList *
+batch_script_read (const gchar * filename)
+{
+  gchar * contents, ** lines, ** argv;
+  GError * error = NULL;
+  GList * steps = NULL;
+  batch_step * step, * chain = NULL;
+  gboolean ok = TRUE, saves = FALSE;
+  gint i, argc, chain_line = 0;
+
+  if (!g_file_get_contents (filename, &contents, NULL, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    return NULL;
+  }
+
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  for (i = 0; ok && lines[i] != NULL; i++) {
+    if (!g_shell_parse_argv (lines[i], &argc, &argv, &error)) {
+      /* Blank lines and comments parse to nothing */
+      if (!g_error_matches (error, G_SHELL_ERROR, G_SHELL_ERROR_EMPTY_STRING)) {
+	batch_script_error (filename, i+1, "%s", error->message);
+	ok = FALSE;
+      }
+      g_clear_error (&error);
+      continue;
+    }
+
+    if (!strcmp (argv[0], "chain")) {
+      if (argc != 1) {
+	batch_script_error (filename, i+1, _("Usage: chain"));
+	ok = FALSE;
+      } else if (chain != NULL) {
+	batch_script_error (filename, i+1, _("Chains cannot be nested"));
+	ok = FALSE;
+      } else {
+	chain = g_malloc0 (sizeof (batch_step));
+	chain->type = BATCH_CHAIN;
+	chain_line = i+1;
+	steps = g_list_append (steps, chain);
+      }
+    } else if (!strcmp (argv[0], "end")) {
+      if (chain == NULL) {
+	batch_script_error (filename, i+1, _("\"end\" without \"chain\""));
+	ok = FALSE;
+      } else if (chain->stages == NULL) {
+	batch_script_error (filename, i+1, _("Empty chain"));
+	ok = FALSE;
+      }
+      chain = NULL;
+    } else if ((step = batch_step_parse (argc, argv, filename, i+1)) == NULL) {
+      ok = FALSE;
+    } else if (chain == NULL) {
+      if (step->type == BATCH_SAVE) saves = TRUE;
+      steps = g_list_append (steps, step);
+    } else if (step->type != BATCH_APPLY) {
+      batch_script_error (filename, i+1, _("Only apply steps can be chained"));
+      batch_step_free (step);
+      ok = FALSE;
+    } else if (step->proc->realtime == NULL && step->proc->region == NULL) {
+      batch_script_error (filename, i+1, _("%s cannot be chained"),
+			  _(step->proc->name));
+      batch_step_free (step);
+      ok = FALSE;
+    } else {
+      chain->stages = g_list_append (chain->stages, step);
+    }
+
+    g_strfreev (argv);
+  }
+
+  g_strfreev (lines);
+
+  if (ok && chain != NULL) {
+    batch_script_error (filename, chain_line, _("\"chain\" without \"end\""));
+    ok = FALSE;
+  }
+
+  if (ok && !saves) {
+    g_printerr (_("%s: the script does not save its results\n"), filename);
+    ok = FALSE;
+  }
+
+  if (!ok) {
+    g_list_foreach (steps, (GFunc)batch_step_free, NULL);
+    g_list_free (steps);
+    return NULL;
+  }
+
+  return steps;
+}
+
+/*
+ * batch_output_path (pattern, pathname)
+ *
+ * expands the save pattern for the input file pathname.
+ */
+static gchar *
+batch_output_path (const gchar * pattern, const gchar * pathname)
+{
+  GString * out;
+  gchar * dir, * base, * dot;
+  const gchar * ext = "";
+  const gchar * p;
+
+  dir = g_path_get_dirname (pathname);
+  base = g_path_get_basename (pathname);
+
+  if ((dot = strrchr (base, '.')) != NULL && dot != base) {
+    *dot = '\0';
+    ext = dot+1;
+  }
+
+  out = g_string_new (NULL);
+
+  for (p = pattern; *p; p++) {
+    if (*p != '%' || p[1] == '\0') {
+      g_string_append_c (out, *p);
+      continue;
+    }
+
+    switch (*++p) {
+    case 'd': g_string_append (out, dir); break;
+    case 'b': g_string_append (out, base); break;
+    case 'e': g_string_append (out, ext); break;
+    case '%': g_string_append_c (out, '%'); break;
+    default:
+      g_string_append_c (out, '%');
+      g_string_append_c (out, *p);
+      break;
+    }
+  }
+
+  g_free (dir);
+  g_free (base);
+
+  return g_string_free (out, FALSE);
+}
+
+static void
+batch_save (sw_sample * sample, const gchar * pattern, const gchar * pathname)
+{
+  gchar * output, * dir;
+
+  output = batch_output_path (pattern, pathname);
+
+  dir = g_path_get_dirname (output);
+  if (g_mkdir_with_parents (dir, 0777) == -1) {
+    batch_report ("%s: %s", dir, g_strerror (errno));
+  } else {
+    sample_save_by_extension (sample, output);
+  }
+  g_free (dir);
+
+#ifdef DEBUG
+  g_print ("batch: %s -> %s\n", pathname, output);
+#endif
+
+  g_free (output);
+}
+
+/*
+ * batch_pset_new (step, sample)
+ *
+ * returns the parameters for an apply step: the values given in the
+ * script, and suggested values for the rest.
+ */
+static sw_param_set
+batch_pset_new (batch_step * step, sw_sample * sample)
+{
+  sw_param_set pset;
+  gint i;
+
+  if (step->proc->nr_params == 0) return NULL;
+
+  pset = sw_param_set_new (step->proc);
+  if (step->proc->suggest)
+    step->proc->suggest (sample, pset, step->proc->custom_data);
+  for (i = 0; i < step->proc->nr_params; i++) {
+    if (step->given[i]) pset[i] = step->values[i];
+  }
+
+  return pset;
+}
+
+/*
+ * batch_chain_run (step, sample)
+ *
+ * adds each procedure of the chain as its region filter, or else as a
+ * processor, and runs them all over the selection as a single filter
+ * chain.
+ */
+static void
+batch_chain_run (batch_step * step, sw_sample * sample)
+{
+  sw_filter_chain * chain;
+  sw_processor * processor;
+  batch_step * stage;
+  GList * gl, * psets = NULL;
+  sw_param_set pset;
+  GString * desc;
+
+  chain = filter_chain_new ();
+  desc = g_string_new (NULL);
+
+  for (gl = step->stages; gl; gl = gl->next) {
+    stage = (batch_step *)gl->data;
+
+    pset = batch_pset_new (stage, sample);
+    psets = g_list_prepend (psets, pset);
+
+    if (stage->proc->region != NULL) {
+      /* pset stays valid until the chain has run, below */
+      filter_chain_append_region (chain, stage->proc->region, pset,
+				  stage->proc->custom_data);
+    } else {
+      processor = stage->proc->realtime (sample->sounddata->format, pset,
+					 stage->proc->custom_data);
+      if (processor == NULL) {
+	batch_report (_("%s could not be started"), _(stage->proc->name));
+	filter_chain_free (chain);
+	chain = NULL;
+	break;
+      }
+
+      filter_chain_append_processor (chain, processor);
+    }
+
+    if (desc->len > 0) g_string_append (desc, " + ");
+    g_string_append (desc, _(stage->proc->name));
+  }
+
+  if (chain != NULL)
+    perform_filter_chain_op (sample, desc->str, chain);
+
+  g_list_foreach (psets, (GFunc)g_free, NULL);
+  g_list_free (psets);
+  g_string_free (desc, TRUE);
+}
+
+static void
+batch_step_run (batch_step * step, sw_sample * sample, const gchar * pathname)
+{
+  sw_sounddata * sounddata = sample->sounddata;
+  sw_framecount_t start, end;
+  sw_param_set pset;
+
+  switch (step->type) {
+  case BATCH_SELECT:
+    start = time_to_frames (sounddata->format, (sw_time_t)step->start);
+    end = (step->end < 0.0) ? sounddata->nr_frames :
+      time_to_frames (sounddata->format, (sw_time_t)step->end);
+    sample_set_selection_1 (sample, MIN (start, sounddata->nr_frames),
+			    MIN (end, sounddata->nr_frames));
+    break;
+  case BATCH_APPLY:
+    pset = batch_pset_new (step, sample);
+    step->proc->apply (sample, pset, step->proc->custom_data);
+    g_free (pset);
+    break;
+  case BATCH_CHAIN:
+    batch_chain_run (step, sample);
+    break;
+  case BATCH_RESAMPLE:
+#ifdef HAVE_LIBSAMPLERATE
+    if (step->rate != sounddata->format->rate)
+      resample (sample, step->rate, step->quality);
+#endif
+    break;
+  case BATCH_SAVE:
+    batch_save (sample, step->pattern, pathname);
+    break;
+  }
+
+  /* Nothing is undone in batch mode, so keep no history */
+  trim_registered_ops (sample, 0);
+}
+
+static void
+batch_process (gpointer data, gpointer user_data)
+{
+  gchar * pathname = (gchar *)data;
+  GList * steps = (GList *)user_data, * gl;
+  batch_job job;
+  sw_sample * sample;
+
+  job.pathname = pathname;
+  job.errors = 0;
+  g_private_set (&current_job, &job);
+
+  if (access (pathname, R_OK) == -1) {
+    batch_report ("%s", g_strerror (errno));
+  } else if ((sample = try_sample_load (pathname)) == NULL) {
+    if (job.errors == 0) batch_report (_("File format not recognised"));
+  } else {
+    sample_set_selection_1 (sample, 0, sample->sounddata->nr_frames);
+
+    for (gl = steps; gl && job.errors == 0; gl = gl->next) {
+      batch_step_run ((batch_step *)gl->data, sample, pathname);
+    }
+
+    trim_registered_ops (sample, 0);
+    sample_destroy (sample);
+  }
+
+  if (job.errors > 0) g_atomic_int_inc (&nr_failed);
+
+  g_private_set (&current_job, NULL);
+}
+
+/*
+ * batch_requested (argc, argv)
+ *
+ * whether the command line asks for batch mode, checked before any
+ * connection to the display is made.
+ */
+gboolean
+batch_requested (int argc, char ** argv)
+{
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (argv[i] != NULL && !strcmp (argv[i], "--batch")) return TRUE;
+  }
+
+  return FALSE;
+}
+
+static int
+batch_usage (const char * progname)
+{
+  g_printerr (_("Usage: %s --batch script [--jobs n] files ...\n"), progname);
+  return 1;
+}
+
+int
+batch_main (int argc, char ** argv)
+{
+  GList * steps, * files = NULL, * gl;
+  GThreadPool * pool;
+  GError * error = NULL;
+  const gchar * script = NULL;
+  gint i, jobs = 0;
+
+  batch_mode = TRUE;
+
+  setlocale (LC_ALL, "");
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp (argv[i], "--batch")) {
+      if (++i >= argc) return batch_usage (argv[0]);
+      script = argv[i];
+    } else if (!strcmp (argv[i], "--jobs") || !strcmp (argv[i], "-j")) {
+      if (++i >= argc || !batch_parse_int (argv[i], &jobs) || jobs < 1)
+	return batch_usage (argv[0]);
+    } else if (!strcmp (argv[i], "--ignore-failed-lock")) {
+      /* Preferences are not used in batch mode */
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      return batch_usage (argv[0]);
+    } else {
+      files = g_list_append (files, argv[i]);
+    }
+  }
+
+  if (jobs == 0) {
+    jobs = (gint)sysconf (_SC_NPROCESSORS_ONLN);
+    if (jobs < 1) jobs = 1;
+  }
+
+  /* Procedures named in the script must be loaded to be found */
+  init_plugins ();
+  plugins_wait_loaded ();
+
+  if ((steps = batch_script_read (script)) == NULL) {
+    release_plugins ();
+    g_list_free (files);
+    return 1;
+  }
+
+  pool = g_thread_pool_new (batch_process, steps, jobs, TRUE, &error);
+
+  if (pool == NULL) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    nr_failed = g_list_length (files);
+  } else {
+    for (gl = files; gl; gl = gl->next) {
+      g_thread_pool_push (pool, gl->data, NULL);
+    }
+
+    /* Wait for every file to be done */
+    g_thread_pool_free (pool, FALSE, TRUE);
+  }
+
+  g_list_foreach (steps, (GFunc)batch_step_free, NULL);
+  g_list_free (steps);
+  g_list_free (files);
+
+  release_plugins ();
+
+  return (nr_failed > 0) ? 1 : 0;
+}
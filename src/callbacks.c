@@ -111,8 +111,8 @@ view_init_repeater (sw_view * view, GtkFunction function, gpointer data)
 {
   function (data);
   if (view->repeater_tag <= 0) {
-    view->repeater_tag = g_timeout_add ((guint32)1000/ZOOM_FRAMERATE,
-					  (GSourceFunc) function, data);
+    view->repeater_tag = sweep_timeout_add ((guint32)1000/ZOOM_FRAMERATE,
+					    function, data);
   }
 }
 
@@ -122,7 +122,7 @@ repeater_released_cb (GtkWidget * widget, gpointer data)
   sw_view * view = (sw_view *)data;
 
   if (view->repeater_tag > 0) {
-    g_source_remove(view->repeater_tag);
+    sweep_timeout_remove (view->repeater_tag);
     view->repeater_tag = 0;
   }
 }
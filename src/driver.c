@@ -43,10 +43,12 @@
 #include "driver.h"
 #include "preferences.h"
 #include "pcmio.h"
+#include "mixer.h"
 
 #define ARRAY_LEN(x) ((int) (sizeof (x)) / (sizeof (x [0])))
 
 extern sw_driver * driver_alsa;
+extern sw_driver * driver_jack;
 extern sw_driver * driver_oss;
 extern sw_driver * driver_pulseaudio;
 extern sw_driver * driver_solaris;
@@ -145,12 +147,19 @@ pcmio_get_log_frags (void)
   return prefs_get_int (dialog_driver->log_frags_key, DEFAULT_LOG_FRAGS);
 }
 
+int
+pcmio_get_resample_quality (void)
+{
+  return prefs_get_int (RESAMPLE_QUALITY_KEY, MIXER_DEFAULT_QUALITY);
+}
+
 extern GtkStyle * style_bw;
 static GtkWidget * dialog = NULL;
 static GtkWidget * driver_combo;
 static GtkWidget * main_combo;
 static GtkWidget * monitor_combo;
 static GtkObject * adj;
+static GtkWidget * quality_combo;
 
 
 static gboolean
@@ -179,6 +188,9 @@ config_dev_dsp_dialog_ok_cb (GtkWidget * widget, gpointer data)
 
   prefs_set_int (dialog_driver->log_frags_key, adj->value);
 
+  prefs_set_int (RESAMPLE_QUALITY_KEY,
+		 gtk_combo_box_get_active (GTK_COMBO_BOX(quality_combo)));
+
   main_dev =
     gtk_entry_get_text (GTK_ENTRY(GTK_COMBO(main_combo)->entry));
 
@@ -197,6 +209,16 @@ config_dev_dsp_dialog_ok_cb (GtkWidget * widget, gpointer data)
   gtk_widget_hide (dialog);
 }
 
+static void
+set_quality_combo (gint quality)
+{
+  if (!mixer_quality_available (quality))
+    quality = MIXER_DEFAULT_QUALITY;
+
+  /* The available qualities are listed in order from the first */
+  gtk_combo_box_set_active (GTK_COMBO_BOX(quality_combo), quality);
+}
+
 static void
 update_pcmio_settings (void)
 {
@@ -207,6 +229,8 @@ update_pcmio_settings (void)
 		      pcmio_get_monitor_dev ());
 
   gtk_adjustment_set_value (GTK_ADJUSTMENT(adj), pcmio_get_log_frags ());
+
+  set_quality_combo (pcmio_get_resample_quality ());
 }
 
 static void
@@ -368,6 +392,7 @@ pcmio_buffering_reset_cb (GtkWidget * widget, gpointer data)
   GtkWidget * dialog = GTK_WIDGET (data);
 
   set_buff_adj (dialog, pcmio_get_log_frags());
+  set_quality_combo (pcmio_get_resample_quality ());
 }
 
 static void
@@ -376,6 +401,7 @@ pcmio_buffering_default_cb (GtkWidget * widget, gpointer data)
   GtkWidget * dialog = GTK_WIDGET (data);
 
   set_buff_adj (dialog, DEFAULT_LOG_FRAGS);
+  set_quality_combo (MIXER_DEFAULT_QUALITY);
 }
 
 static GtkWidget *
@@ -397,6 +423,22 @@ create_drivers_combo (void)
   return combo;
 }
 
+static GtkWidget *
+create_quality_combo (void)
+{
+  GtkWidget * combo;
+  int k;
+
+  combo = gtk_combo_box_new_text ();
+
+  for (k = 0; k < MIXER_NR_QUALITIES && mixer_quality_available (k); k++) {
+    gtk_combo_box_append_text (GTK_COMBO_BOX (combo),
+			       mixer_quality_name (k));
+  }
+
+  return combo;
+}
+
 static GtkWidget *
 create_devices_combo (void)
 {
@@ -678,6 +720,26 @@ device_config (void)
     gtk_box_pack_start (GTK_BOX(vbox), label, FALSE, FALSE, 8);
     gtk_widget_show (label);
 
+    /* Playback resampling */
+    hbox = gtk_hbox_new (FALSE, 8);
+    gtk_box_pack_start (GTK_BOX(vbox), hbox, FALSE, TRUE, 8);
+    gtk_widget_show (hbox);
+
+    label = gtk_label_new (_("Playback resampling:"));
+    gtk_box_pack_start (GTK_BOX(hbox), label, FALSE, FALSE, 8);
+    gtk_widget_show (label);
+
+    quality_combo = create_quality_combo ();
+    gtk_box_pack_start (GTK_BOX(hbox), quality_combo, TRUE, TRUE, 4);
+    gtk_widget_show (quality_combo);
+
+    tooltips = gtk_tooltips_new ();
+    gtk_tooltips_set_tip (tooltips, quality_combo,
+			  _("How sounds are converted to the rate of the "
+			    "device when they are played at another rate. "
+			    "Better conversion takes more processing."),
+			  NULL);
+
     /* Remember / Reset device buffering */
 
     hbox = gtk_hbox_new (FALSE, 4);
@@ -782,6 +844,22 @@ device_offset (sw_handle * handle)
     return -1;
 }
 
+sw_framecount_t
+device_latency (sw_handle * handle)
+{
+  sw_framecount_t latency;
+
+  if (handle == NULL || handle->driver_channels <= 0)
+    return 0;
+
+  if (current_driver->latency &&
+      (latency = current_driver->latency (handle)) >= 0)
+    return latency;
+
+  return LOGFRAGS_TO_FRAGS (pcmio_get_log_frags ()) *
+    (PBUF_SIZE / handle->driver_channels);
+}
+
 void
 device_reset (sw_handle * handle)
 {
@@ -823,6 +901,8 @@ init_devices (void)
   /* Populate the driver table, with all valid drivers (name field is non-NULL). */
   if (driver_alsa->name != NULL)
     driver_table [k++] = driver_alsa;
+  if (driver_jack->name != NULL)
+    driver_table [k++] = driver_jack;
   if (driver_oss->name != NULL)
     driver_table [k++] = driver_oss;
   if (driver_pulseaudio->name != NULL)
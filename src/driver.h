@@ -55,6 +55,9 @@ struct _sw_driver {
   char * primary_device_key;
   char * monitor_device_key;
   char * log_frags_key;
+
+  /* Optional: the nr. of frames the device actually buffers, or -1 */
+  sw_framecount_t (*latency) (sw_handle * handle);
 };
 
 void
@@ -98,6 +101,15 @@ device_write (sw_handle * handle, const float * buf, size_t count);
 sw_framecount_t
 device_offset (sw_handle * handle);
 
+/*
+ * The nr. of frames held in the buffers of the device, as reported by
+ * the driver or else as configured in the device preferences. Sound reaches the speaker about this long
+ * after it is written, and so a recording made while playing back lags
+ * what was heard by about this much.
+ */
+sw_framecount_t
+device_latency (sw_handle * handle);
+
 /*
  * Reset should stop the device immediately (ie. not bother emptying the
  * buffers, simply stop making any sound). The other half of what the RESET
@@ -68,6 +68,29 @@ static sw_handle alsa_handle = {
  0, -1, 0, 0, NULL
 };
 
+/*
+ * Playback can write straight into the device's own buffer, mapped with
+ * snd_pcm_mmap_begin (), in whichever of these formats the device takes
+ * natively. This saves alsa-lib copying, and converting in its plug
+ * layer, every period. Set SWEEP_ALSA_MMAP=0 in the environment to write
+ * through snd_pcm_writei () instead.
+ */
+static snd_pcm_format_t alsa_mmap_formats[] = {
+  SND_PCM_FORMAT_FLOAT,
+  SND_PCM_FORMAT_S32,
+  SND_PCM_FORMAT_S16
+};
+
+/* Playback was opened without format conversion, to try mmap */
+static gboolean alsa_try_mmap = FALSE;
+
+/* Playback is writing into the mapped buffer, in alsa_mmap_format */
+static gboolean alsa_mmap = FALSE;
+static snd_pcm_format_t alsa_mmap_format;
+
+/* Name of the device opened for playback, for reopening */
+static char alsa_playback_name[128];
+
 
 void print_pcm_state (snd_pcm_t * pcm)
 {
@@ -122,6 +145,17 @@ alsa_get_names (void)
   return names;
 }
 
+static gboolean
+alsa_mmap_wanted (void)
+{
+  char * env;
+
+  if ((env = getenv ("SWEEP_ALSA_MMAP")) != NULL)
+    return (atoi (env) != 0);
+
+  return TRUE;
+}
+
 static sw_handle *
 alsa_device_open (int monitoring, int flags)
 {
@@ -130,6 +164,7 @@ alsa_device_open (int monitoring, int flags)
   snd_pcm_t * pcm_handle;
   sw_handle * handle = &alsa_handle;
   snd_pcm_stream_t stream;
+  int mode = 0;
 
   if (monitoring) {
     if (pcmio_get_use_monitor())
@@ -148,7 +183,19 @@ alsa_device_open (int monitoring, int flags)
     return NULL;
   }
 
-  if ((err = snd_pcm_open(&pcm_handle, alsa_pcm_name, stream, 0)) < 0) {
+  /* For mmap playback, see what formats the device takes itself */
+  if (stream == SND_PCM_STREAM_PLAYBACK) {
+    alsa_try_mmap = alsa_mmap_wanted ();
+    alsa_mmap = FALSE;
+
+    if (alsa_try_mmap) {
+      mode = SND_PCM_NO_AUTO_FORMAT;
+      g_strlcpy (alsa_playback_name, alsa_pcm_name,
+		 sizeof (alsa_playback_name));
+    }
+  }
+
+  if ((err = snd_pcm_open(&pcm_handle, alsa_pcm_name, stream, mode)) < 0) {
     sweep_perror (errno,
 		  "Error opening ALSA device %s",
 		  alsa_pcm_name /*, snd_strerror (err)*/);
@@ -161,6 +208,59 @@ alsa_device_open (int monitoring, int flags)
   return handle;
 }
 
+/*
+ * alsa_setup_mmap (handle, hwparams)
+ *
+ * asks for mmap access in one of alsa_mmap_formats. If the device
+ * can't do that, it is reopened with alsa-lib's format conversion
+ * restored, for playback through snd_pcm_writei (). Returns the PCM
+ * to carry on setting up, or NULL if reopening failed.
+ */
+static snd_pcm_t *
+alsa_setup_mmap (sw_handle * handle, snd_pcm_hw_params_t * hwparams)
+{
+  snd_pcm_t * pcm_handle = (snd_pcm_t *)handle->custom_data;
+  int i, err;
+
+  if (snd_pcm_hw_params_set_access
+      (pcm_handle, hwparams, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0) {
+    for (i = 0; i < (int)G_N_ELEMENTS (alsa_mmap_formats); i++) {
+      if (snd_pcm_hw_params_set_format
+	  (pcm_handle, hwparams, alsa_mmap_formats[i]) == 0) {
+	alsa_mmap_format = alsa_mmap_formats[i];
+	alsa_mmap = TRUE;
+	return pcm_handle;
+      }
+    }
+  }
+
+#ifdef DEBUG
+  fprintf (stderr, "sweep: alsa_setup: no mmap access, using writei\n");
+#endif
+
+  snd_pcm_close (pcm_handle);
+  handle->custom_data = NULL;
+  alsa_try_mmap = FALSE;
+
+  if ((err = snd_pcm_open (&pcm_handle, alsa_playback_name,
+			   SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+    fprintf (stderr, "sweep: alsa_setup: can't reopen %s (%s)\n",
+	     alsa_playback_name, snd_strerror (err));
+    return NULL;
+  }
+
+  handle->custom_data = pcm_handle;
+
+  if ((err = snd_pcm_hw_params_any (pcm_handle, hwparams)) < 0) {
+    fprintf(stderr,
+	    "sweep: alsa_setup: can't get PCM hw params (%s)\n",
+	    snd_strerror(err));
+    return NULL;
+  }
+
+  return pcm_handle;
+}
+
   // /src/alsa/alsaplayer-0.99.72/output/alsa-final/alsa.c
   // /src/alsa/alsa-lib-0.9.0rc3/test/pcm.c
 static void
@@ -174,7 +274,7 @@ alsa_device_setup (sw_handle * handle, sw_format * format)
   unsigned int periods;
   snd_pcm_uframes_t period_size = PBUF_SIZE/format->channels;
 
-  if (handle->driver_flags != O_RDONLY && handle->driver_flags == O_WRONLY) {
+  if (handle->driver_flags != O_RDONLY && handle->driver_flags != O_WRONLY) {
     return;
   }
 
@@ -187,16 +287,24 @@ alsa_device_setup (sw_handle * handle, sw_format * format)
     return;
   }
 
-  if ((err = snd_pcm_hw_params_set_access
-       (pcm_handle, hwparams, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+  if (handle->driver_flags == O_WRONLY) {
+    alsa_mmap = FALSE;
+
+    if (alsa_try_mmap &&
+	(pcm_handle = alsa_setup_mmap (handle, hwparams)) == NULL)
+      return;
+  }
+
+  if (alsa_mmap) {
+    /* access and format were set by alsa_setup_mmap () */
+  } else if ((err = snd_pcm_hw_params_set_access
+	      (pcm_handle, hwparams, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
     fprintf(stderr,
 	    "sweep: alsa_setup: can't set interleaved access (%s)\n",
 	    snd_strerror(err));
     return;
-  }
-
-  if ((err = snd_pcm_hw_params_set_format
-       (pcm_handle, hwparams, SND_PCM_FORMAT_FLOAT)) < 0) {
+  } else if ((err = snd_pcm_hw_params_set_format
+	      (pcm_handle, hwparams, SND_PCM_FORMAT_FLOAT)) < 0) {
     fprintf (stderr,
 	     "sweep: alsa_setup: audio interface does not support "
 	     "host endian 32 bit float samples (%s)\n",
@@ -321,6 +429,145 @@ alsa_device_read (sw_handle * handle, float * buf, size_t count)
   return err;
 }
 
+/*
+ * Conversion into the device's format. Four samples at a time, with
+ * nothing carried from one to the next, so that gcc vectorises these.
+ */
+
+static void
+alsa_convert_s16 (gint16 * restrict d, const float * restrict s, size_t n)
+{
+  size_t i;
+  int k;
+  float x;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    for (k = 0; k < 4; k++) {
+      x = s[i+k] * 32767.0f;
+      d[i+k] = (gint16)CLAMP (x, -32768.0f, 32767.0f);
+    }
+  }
+  for (; i < n; i++) {
+    x = s[i] * 32767.0f;
+    d[i] = (gint16)CLAMP (x, -32768.0f, 32767.0f);
+  }
+}
+
+static void
+alsa_convert_s32 (gint32 * restrict d, const float * restrict s, size_t n)
+{
+  size_t i;
+  int k;
+  float x;
+
+  /* 2147483520 is the largest float below 2^31 */
+  for (i = 0; i + 4 <= n; i += 4) {
+    for (k = 0; k < 4; k++) {
+      x = s[i+k] * 2147483648.0f;
+      d[i+k] = (gint32)CLAMP (x, -2147483648.0f, 2147483520.0f);
+    }
+  }
+  for (; i < n; i++) {
+    x = s[i] * 2147483648.0f;
+    d[i] = (gint32)CLAMP (x, -2147483648.0f, 2147483520.0f);
+  }
+}
+
+/*
+ * alsa_mmap_write (handle, buf, count)
+ *
+ * converts count samples of buf straight into the device's buffer,
+ * waiting for room as snd_pcm_writei () would, and starts the device
+ * once there is something in it.
+ */
+static ssize_t
+alsa_mmap_write (sw_handle * handle, const float * buf, size_t count)
+{
+  snd_pcm_t * pcm_handle = (snd_pcm_t *)handle->custom_data;
+  const snd_pcm_channel_area_t * areas;
+  snd_pcm_uframes_t offset, frames;
+  snd_pcm_sframes_t avail, committed;
+  int channels = handle->driver_channels;
+  size_t remaining;
+  char * dest;
+  int err;
+
+  if (channels <= 0) return 0;
+
+  remaining = count / channels;
+
+  while (remaining > 0) {
+    avail = snd_pcm_avail_update (pcm_handle);
+    if (avail < 0) {
+      fprintf (stderr, "sweep: alsa_write: %s, recovering\n",
+	       snd_strerror (avail));
+      if ((err = snd_pcm_recover (pcm_handle, avail, 1)) < 0) {
+	fprintf (stderr, "sweep: alsa_write: %s\n", snd_strerror (err));
+	return 0;
+      }
+      continue;
+    }
+
+    if (avail == 0) {
+      /* Full: make sure it is playing, then wait for room */
+      if (snd_pcm_state (pcm_handle) == SND_PCM_STATE_PREPARED)
+	snd_pcm_start (pcm_handle);
+      if ((err = snd_pcm_wait (pcm_handle, 1000)) < 0 &&
+	  snd_pcm_recover (pcm_handle, err, 1) < 0) {
+	fprintf (stderr, "sweep: alsa_write: %s\n", snd_strerror (err));
+	return 0;
+      }
+      continue;
+    }
+
+    frames = MIN (remaining, (snd_pcm_uframes_t)avail);
+
+    if ((err = snd_pcm_mmap_begin (pcm_handle, &areas, &offset,
+				   &frames)) < 0) {
+      if (snd_pcm_recover (pcm_handle, err, 1) < 0) {
+	fprintf (stderr, "sweep: alsa_write: %s\n", snd_strerror (err));
+	return 0;
+      }
+      continue;
+    }
+
+    /* Interleaved, so every channel is in the first area */
+    dest = (char *)areas[0].addr +
+      (areas[0].first + offset * areas[0].step) / 8;
+
+    switch (alsa_mmap_format) {
+    case SND_PCM_FORMAT_S16:
+      alsa_convert_s16 ((gint16 *)dest, buf, frames * channels);
+      break;
+    case SND_PCM_FORMAT_S32:
+      alsa_convert_s32 ((gint32 *)dest, buf, frames * channels);
+      break;
+    default:
+      memcpy (dest, buf, frames * channels * sizeof (float));
+      break;
+    }
+
+    committed = snd_pcm_mmap_commit (pcm_handle, offset, frames);
+    if (committed < 0 || (snd_pcm_uframes_t)committed != frames) {
+      if (snd_pcm_recover (pcm_handle, committed >= 0 ? -EPIPE : committed,
+			   1) < 0) {
+	fprintf (stderr, "sweep: alsa_write: commit failed\n");
+	return 0;
+      }
+      continue;
+    }
+
+    buf += frames * channels;
+    remaining -= frames;
+
+    /* writei starts the device on the first write; so do we */
+    if (snd_pcm_state (pcm_handle) == SND_PCM_STATE_PREPARED)
+      snd_pcm_start (pcm_handle);
+  }
+
+  return 1;
+}
+
 static ssize_t
 alsa_device_write (sw_handle * handle, const float * buf, size_t count)
 {
@@ -331,6 +578,8 @@ alsa_device_write (sw_handle * handle, const float * buf, size_t count)
 
   /*printf ("sweep: alsa_write \n");*/
 
+  if (alsa_mmap) return alsa_mmap_write (handle, buf, count);
+
   uframes = handle->driver_channels > 0 ? count / handle->driver_channels : 0;
   //printf ("sweep: alsa_write 1\n");
 
@@ -0,0 +1,534 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <math.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include <sweep/sweep_types.h>
+#include <sweep/sweep_sample.h>
+
+#include "driver.h"
+#include "pcmio.h"
+
+#ifdef DRIVER_JACK
+
+/*
+ * JACK runs sweep's ports from its own process callback, which must
+ * neither block nor allocate. Each handle is a JACK client with one port
+ * per channel and a ring buffer of interleaved samples between the
+ * callback and the player (or capture) thread. The callback pulls as
+ * much as each period needs out of the ring, splitting it out to the
+ * ports, or pushes captured input into it; after each period it posts a
+ * semaphore which the other thread sleeps on when the ring is full (or
+ * empty). The ring is held to the buffering set in the device
+ * preferences, or one JACK period if that is longer.
+ */
+
+#include <jack/jack.h>
+#include <semaphore.h>
+
+#include "ringbuffer.h"
+
+/*#define DEBUG*/
+
+#define JACK_MAX_CHANNELS 32
+
+/* Frames moved between the ring and the ports at a time */
+#define JACK_CHUNK 256
+
+typedef struct _jack_data jack_data;
+
+struct _jack_data {
+  jack_client_t * client;
+  const char * device;
+  gboolean playback;
+  gint channels;
+  jack_port_t * ports[JACK_MAX_CHANNELS];
+
+  sw_ringbuffer * ring;
+  gsize limit;     /* most samples let into the ring */
+  gfloat * chunk;  /* interleaving space for the process callback */
+
+  sem_t period;    /* posted after each period */
+  gint running;    /* cleared if the server shuts us down */
+  gint primed;     /* set once the ring has first filled */
+  gint flush;      /* set to have the callback empty the ring */
+};
+
+static jack_data data_main, data_monitor, data_capture;
+
+static sw_handle handle_main = {
+ 0, -1, 0, 0, &data_main
+};
+
+static sw_handle handle_monitor = {
+ 0, -1, 0, 0, &data_monitor
+};
+
+static sw_handle handle_capture = {
+ 0, -1, 0, 0, &data_capture
+};
+
+static GList *
+jack_get_names (void)
+{
+  GList * names = NULL;
+
+  names = g_list_append (names, "system");
+
+  return names;
+}
+
+static sw_handle *
+jack_open (int monitoring, int flags)
+{
+  sw_handle * handle;
+  jack_data * jd;
+  jack_status_t status;
+  const char * client_name;
+
+  flags &= O_RDONLY|O_WRONLY|O_RDWR;
+
+  if (flags == O_RDONLY) {
+    handle = &handle_capture;
+    client_name = "sweep-capture";
+  } else if (flags != O_WRONLY) {
+    return NULL;
+  } else if (monitoring) {
+    if (!pcmio_get_use_monitor ()) return NULL;
+    handle = &handle_monitor;
+    client_name = "sweep-monitor";
+  } else {
+    handle = &handle_main;
+    client_name = "sweep";
+  }
+
+  jd = (jack_data *)handle->custom_data;
+
+  if ((jd->client = jack_client_open (client_name, JackNullOption,
+				      &status)) == NULL) {
+    fprintf (stderr, __FILE__": jack_client_open() failed, status 0x%x\n",
+	     status);
+    return NULL;
+  }
+
+  jd->device = monitoring ? pcmio_get_monitor_dev () : pcmio_get_main_dev ();
+  jd->playback = (flags == O_WRONLY);
+  jd->channels = 0;
+  jd->ring = NULL;
+  jd->chunk = NULL;
+
+  handle->driver_flags = flags;
+  handle->driver_channels = 0;
+
+  return handle;
+}
+
+/*
+ * jack_process (nframes, arg)
+ *
+ * the process callback, run in JACK's realtime thread.
+ */
+static int
+jack_process (jack_nframes_t nframes, void * arg)
+{
+  jack_data * jd = (jack_data *)arg;
+  gfloat * bufs[JACK_MAX_CHANNELS];
+  gfloat * d = jd->chunk;
+  jack_nframes_t done, n, got, i;
+  gint channels = jd->channels, k;
+  gsize space;
+
+  for (k = 0; k < channels; k++)
+    bufs[k] = (gfloat *)jack_port_get_buffer (jd->ports[k], nframes);
+
+  if (!jd->playback) {
+    for (done = 0; done < nframes; done += n) {
+      n = MIN (nframes - done, JACK_CHUNK);
+
+      for (i = 0; i < n; i++)
+	for (k = 0; k < channels; k++)
+	  d[i*channels + k] = bufs[k][done + i];
+
+      /* Only whole frames go into the ring; the rest is lost */
+      space = ringbuffer_write_space (jd->ring);
+      space -= space % channels;
+      ringbuffer_write (jd->ring, d, MIN (n * channels, space));
+    }
+
+    sem_post (&jd->period);
+    return 0;
+  }
+
+  if (g_atomic_int_get (&jd->flush)) {
+    for (space = ringbuffer_read_space (jd->ring); space > 0; space -= got)
+      got = ringbuffer_read (jd->ring, d, MIN (space, (gsize)JACK_CHUNK * channels));
+    g_atomic_int_set (&jd->primed, FALSE);
+    g_atomic_int_set (&jd->flush, FALSE);
+  }
+
+  /* Wait for the player to fill the ring before starting */
+  if (!g_atomic_int_get (&jd->primed)) {
+    for (k = 0; k < channels; k++)
+      memset (bufs[k], 0, nframes * sizeof (gfloat));
+
+    sem_post (&jd->period);
+    return 0;
+  }
+
+  for (done = 0; done < nframes; done += n) {
+    n = MIN (nframes - done, JACK_CHUNK);
+
+    /* The player writes whole frames, so only whole frames come out */
+    got = ringbuffer_read (jd->ring, d, n * channels) / channels;
+
+    for (i = 0; i < got; i++)
+      for (k = 0; k < channels; k++)
+	bufs[k][done + i] = d[i*channels + k];
+
+    /* Play silence while the player is behind */
+    for (k = 0; k < channels; k++)
+      memset (bufs[k] + done + got, 0, (n - got) * sizeof (gfloat));
+  }
+
+  sem_post (&jd->period);
+
+  return 0;
+}
+
+static void
+jack_shutdown (void * arg)
+{
+  jack_data * jd = (jack_data *)arg;
+
+  g_atomic_int_set (&jd->running, FALSE);
+  sem_post (&jd->period);
+}
+
+/*
+ * jack_connect_ports (jd)
+ *
+ * connects our ports in turn to the physical ports of the configured
+ * device, or to the first physical ports if it has none. A mono output
+ * goes to the first two.
+ */
+static void
+jack_connect_ports (jack_data * jd)
+{
+  const char ** ports;
+  unsigned long flags;
+  gchar * pattern;
+  gint k, nr_connect;
+
+  flags = JackPortIsPhysical |
+    (jd->playback ? JackPortIsInput : JackPortIsOutput);
+
+  pattern = g_strdup_printf ("^%s:", jd->device);
+  ports = jack_get_ports (jd->client, pattern, JACK_DEFAULT_AUDIO_TYPE, flags);
+  g_free (pattern);
+
+  if (ports == NULL)
+    ports = jack_get_ports (jd->client, NULL, JACK_DEFAULT_AUDIO_TYPE, flags);
+
+  if (ports == NULL) return;
+
+  nr_connect = jd->channels;
+  if (jd->playback && jd->channels == 1) nr_connect = 2;
+
+  for (k = 0; k < nr_connect && ports[k] != NULL; k++) {
+    if (jd->playback) {
+      jack_connect (jd->client, jack_port_name (jd->ports[k % jd->channels]),
+		    ports[k]);
+    } else {
+      jack_connect (jd->client, ports[k], jack_port_name (jd->ports[k]));
+    }
+  }
+
+  jack_free (ports);
+}
+
+static void
+jack_setup (sw_handle * handle, sw_format * format)
+{
+  jack_data * jd = (jack_data *)handle->custom_data;
+  sw_framecount_t frames;
+  char name[32];
+  gint k;
+
+  if (jd->client == NULL) return;
+
+  if (format->channels > JACK_MAX_CHANNELS) {
+    fprintf(stderr, __FILE__": jack_setup(): The maximum number of channels supported is %d, while %d have been requested.\n", JACK_MAX_CHANNELS, format->channels);
+    return;
+  }
+
+  jd->channels = format->channels;
+
+  for (k = 0; k < jd->channels; k++) {
+    snprintf (name, sizeof (name), jd->playback ? "out_%d" : "in_%d", k + 1);
+    jd->ports[k] =
+      jack_port_register (jd->client, name, JACK_DEFAULT_AUDIO_TYPE,
+			  jd->playback ? JackPortIsOutput : JackPortIsInput, 0);
+    if (jd->ports[k] == NULL) {
+      fprintf (stderr, __FILE__": jack_port_register() failed for %s\n", name);
+      jd->channels = 0;
+      return;
+    }
+  }
+
+  /* Hold as much as the device preferences ask for, but no less than
+   * a period; capture gets some slack for a slow reader */
+  frames = LOGFRAGS_TO_FRAGS (pcmio_get_log_frags ()) *
+    (PBUF_SIZE / jd->channels);
+  frames = MAX (frames, jack_get_buffer_size (jd->client));
+  if (!jd->playback) frames *= 2;
+
+  jd->limit = frames * jd->channels;
+  jd->ring = ringbuffer_new (jd->limit);
+  jd->chunk = g_malloc (JACK_CHUNK * jd->channels * sizeof (gfloat));
+
+  sem_init (&jd->period, 0, 0);
+  jd->running = TRUE;
+  jd->primed = FALSE;
+  jd->flush = FALSE;
+
+  jack_set_process_callback (jd->client, jack_process, jd);
+  jack_on_shutdown (jd->client, jack_shutdown, jd);
+
+  if (jack_activate (jd->client) != 0) {
+    fprintf (stderr, __FILE__": jack_activate() failed\n");
+    jd->running = FALSE;
+    return;
+  }
+
+  jack_connect_ports (jd);
+
+  handle->driver_rate = jack_get_sample_rate (jd->client);
+  handle->driver_channels = jd->channels;
+
+#ifdef DEBUG
+  fprintf (stderr, __FILE__": %d channels at %d Hz, ring of %ld frames\n",
+	   handle->driver_channels, handle->driver_rate, (long)frames);
+#endif
+}
+
+/*
+ * jack_wait (handle)
+ *
+ * sleeps until a playback ring has room for a fragment, or a capture
+ * ring holds one.
+ */
+static int
+jack_wait (sw_handle * handle)
+{
+  jack_data * jd = (jack_data *)handle->custom_data;
+  gsize fill, want;
+
+  if (jd->ring == NULL) return 0;
+
+  want = MIN (PBUF_SIZE, jd->limit);
+
+  while (g_atomic_int_get (&jd->running)) {
+    fill = ringbuffer_read_space (jd->ring);
+
+    if (jd->playback ? fill + want <= jd->limit : fill >= want)
+      break;
+
+    /* Full enough that the player would wait: start playing */
+    if (jd->playback) g_atomic_int_set (&jd->primed, TRUE);
+
+    sem_wait (&jd->period);
+  }
+
+  return 0;
+}
+
+static ssize_t
+jack_read (sw_handle * handle, float * buf, size_t count)
+{
+  jack_data * jd = (jack_data *)handle->custom_data;
+  size_t done = 0;
+
+  if (jd->ring == NULL) return -1;
+
+  while (done < count) {
+    done += ringbuffer_read (jd->ring, buf + done, count - done);
+
+    if (done < count) {
+      if (!g_atomic_int_get (&jd->running)) return -1;
+      sem_wait (&jd->period);
+    }
+  }
+
+  return count;
+}
+
+static ssize_t
+jack_write (sw_handle * handle, const float * buf, size_t count)
+{
+  jack_data * jd = (jack_data *)handle->custom_data;
+  size_t done = 0;
+  gsize fill, room;
+
+  if (jd->ring == NULL) return -1;
+
+  while (done < count) {
+    if (!g_atomic_int_get (&jd->running)) return -1;
+
+    /* Keep whole frames, and no more than the limit, in the ring */
+    fill = ringbuffer_read_space (jd->ring);
+    room = (fill < jd->limit) ? jd->limit - fill : 0;
+    room -= room % jd->channels;
+
+    if (room == 0) {
+      g_atomic_int_set (&jd->primed, TRUE);
+      sem_wait (&jd->period);
+      continue;
+    }
+
+    done += ringbuffer_write (jd->ring, buf + done, MIN (count - done, room));
+  }
+
+  return count;
+}
+
+sw_framecount_t
+jack_offset (sw_handle * handle)
+{
+  return -1;
+}
+
+/*
+ * jack_latency (handle)
+ *
+ * returns the frames held in the ring plus those JACK says lie between
+ * our ports and the hardware.
+ */
+static sw_framecount_t
+jack_latency (sw_handle * handle)
+{
+  jack_data * jd = (jack_data *)handle->custom_data;
+  jack_latency_range_t range;
+
+  if (jd->ring == NULL || jd->channels == 0) return -1;
+
+  jack_port_get_latency_range (jd->ports[0], jd->playback ?
+			       JackPlaybackLatency : JackCaptureLatency,
+			       &range);
+
+  return jd->limit / jd->channels + range.max;
+}
+
+static void
+jack_flush (sw_handle * handle)
+{
+  jack_data * jd = (jack_data *)handle->custom_data;
+
+  if (jd->ring == NULL || !jd->playback) return;
+
+  g_atomic_int_set (&jd->flush, TRUE);
+
+  while (g_atomic_int_get (&jd->running) && g_atomic_int_get (&jd->flush))
+    sem_wait (&jd->period);
+}
+
+static void
+jack_reset (sw_handle * handle)
+{
+  jack_flush (handle);
+}
+
+static void
+jack_drain (sw_handle * handle)
+{
+  jack_data * jd = (jack_data *)handle->custom_data;
+
+  if (jd->ring == NULL || !jd->playback) return;
+
+  g_atomic_int_set (&jd->primed, TRUE);
+
+  while (g_atomic_int_get (&jd->running) &&
+	 ringbuffer_read_space (jd->ring) > 0)
+    sem_wait (&jd->period);
+}
+
+static void
+jack_close (sw_handle * handle)
+{
+  jack_data * jd = (jack_data *)handle->custom_data;
+
+  if (jd->client == NULL) return;
+
+  jack_drain (handle);
+
+  /* After this the process callback is no longer run */
+  jack_client_close (jd->client);
+  jd->client = NULL;
+
+  if (jd->ring != NULL) {
+    sem_destroy (&jd->period);
+    ringbuffer_free (jd->ring);
+    jd->ring = NULL;
+  }
+
+  g_free (jd->chunk);
+  jd->chunk = NULL;
+  jd->channels = 0;
+}
+
+static sw_driver _driver_jack = {
+  "JACK",
+  jack_get_names,
+  jack_open,
+  jack_setup,
+  jack_wait,
+  jack_read,
+  jack_write,
+  jack_offset,
+  jack_reset,
+  jack_flush,
+  jack_drain,
+  jack_close,
+  "jack_primary_device",
+  "jack_monitor_device",
+  "jack_log_frags",
+  jack_latency
+};
+
+#else
+
+static sw_driver _driver_jack = {
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+#endif
+
+sw_driver * driver_jack = &_driver_jack;
@@ -43,8 +43,26 @@
 #include "question_dialogs.h"
 
 #ifdef DRIVER_PULSEAUDIO
-#include <pulse/simple.h>
-#include <pulse/error.h>
+#include <pulse/pulseaudio.h>
+
+/*
+ * Each open handle runs its own PulseAudio mainloop thread. The player
+ * and capture threads wait on that mainloop's condition until the
+ * stream wants or has data, rather than blocking inside the library,
+ * and the stream's buffering is set from the device preferences so
+ * that it can be made short enough for scrubbing.
+ */
+
+typedef struct _pulse_data pulse_data;
+
+struct _pulse_data {
+  pa_threaded_mainloop * mainloop;
+  pa_context * context;
+  pa_stream * stream;
+  size_t frame_size;
+  size_t read_offset;      /* bytes of the peeked fragment already read */
+  sw_framecount_t latency; /* frames buffered, as the server agreed */
+};
 
 static sw_handle handle_ro = {
  0, -1, 0, 0, NULL
@@ -85,12 +103,160 @@ pulse_open (int monitoring, int flags)
   return handle;
 }
 
+/* Callbacks, run in the mainloop thread: wake whoever is waiting */
+
+static void
+pulse_context_state_cb (pa_context * c, void * userdata)
+{
+  pulse_data * pd = (pulse_data *)userdata;
+
+  pa_threaded_mainloop_signal (pd->mainloop, 0);
+}
+
+static void
+pulse_stream_state_cb (pa_stream * s, void * userdata)
+{
+  pulse_data * pd = (pulse_data *)userdata;
+
+  pa_threaded_mainloop_signal (pd->mainloop, 0);
+}
+
+static void
+pulse_stream_request_cb (pa_stream * s, size_t nbytes, void * userdata)
+{
+  pulse_data * pd = (pulse_data *)userdata;
+
+  pa_threaded_mainloop_signal (pd->mainloop, 0);
+}
+
+static void
+pulse_stream_success_cb (pa_stream * s, int success, void * userdata)
+{
+  pulse_data * pd = (pulse_data *)userdata;
+
+  pa_threaded_mainloop_signal (pd->mainloop, 0);
+}
+
+static void
+pulse_data_free (pulse_data * pd)
+{
+  if (pd->mainloop) pa_threaded_mainloop_stop (pd->mainloop);
+
+  if (pd->stream) {
+    pa_stream_disconnect (pd->stream);
+    pa_stream_unref (pd->stream);
+  }
+
+  if (pd->context) {
+    pa_context_disconnect (pd->context);
+    pa_context_unref (pd->context);
+  }
+
+  if (pd->mainloop) pa_threaded_mainloop_free (pd->mainloop);
+
+  g_free (pd);
+}
+
+/*
+ * pulse_connect (pd, dir, ss)
+ *
+ * connects to the server and opens a stream on it, returning once the
+ * stream is ready. Called with the mainloop locked.
+ */
+static gboolean
+pulse_connect (pulse_data * pd, pa_stream_direction_t dir,
+	       pa_sample_spec * ss)
+{
+  pa_buffer_attr attr;
+  const pa_buffer_attr * got;
+  pa_context_state_t cstate;
+  pa_stream_state_t sstate;
+  pa_stream_flags_t flags;
+  size_t fragment;
+  int err;
+
+  pa_context_set_state_callback (pd->context, pulse_context_state_cb, pd);
+
+  if (pa_context_connect (pd->context, NULL, 0, NULL) < 0) {
+    fprintf(stderr, __FILE__": pa_context_connect() failed: %s\n",
+	    pa_strerror(pa_context_errno(pd->context)));
+    return FALSE;
+  }
+
+  while ((cstate = pa_context_get_state (pd->context)) != PA_CONTEXT_READY) {
+    if (!PA_CONTEXT_IS_GOOD (cstate)) {
+      fprintf(stderr, __FILE__": connecting to PulseAudio failed: %s\n",
+	      pa_strerror(pa_context_errno(pd->context)));
+      return FALSE;
+    }
+    pa_threaded_mainloop_wait (pd->mainloop);
+  }
+
+  if (!(pd->stream = pa_stream_new (pd->context, "Sweep Stream", ss, NULL))) {
+    fprintf(stderr, __FILE__": pa_stream_new() failed: %s\n",
+	    pa_strerror(pa_context_errno(pd->context)));
+    return FALSE;
+  }
+
+  pa_stream_set_state_callback (pd->stream, pulse_stream_state_cb, pd);
+  pa_stream_set_write_callback (pd->stream, pulse_stream_request_cb, pd);
+  pa_stream_set_read_callback (pd->stream, pulse_stream_request_cb, pd);
+
+  /* Ask for the buffering set in the device preferences, topped up a
+   * fragment at a time */
+  fragment = PBUF_SIZE * sizeof (float);
+
+  attr.maxlength = (uint32_t)-1;
+  attr.tlength = LOGFRAGS_TO_FRAGS (pcmio_get_log_frags ()) * fragment;
+  attr.prebuf = (uint32_t)-1;
+  attr.minreq = fragment;
+  attr.fragsize = fragment;
+
+  flags = PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING |
+    PA_STREAM_AUTO_TIMING_UPDATE;
+
+  if (dir == PA_STREAM_PLAYBACK) {
+    err = pa_stream_connect_playback (pd->stream, NULL, &attr, flags,
+				      NULL, NULL);
+  } else {
+    err = pa_stream_connect_record (pd->stream, NULL, &attr, flags);
+  }
+
+  if (err < 0) {
+    fprintf(stderr, __FILE__": connecting stream failed: %s\n",
+	    pa_strerror(pa_context_errno(pd->context)));
+    return FALSE;
+  }
+
+  while ((sstate = pa_stream_get_state (pd->stream)) != PA_STREAM_READY) {
+    if (!PA_STREAM_IS_GOOD (sstate)) {
+      fprintf(stderr, __FILE__": stream failed: %s\n",
+	      pa_strerror(pa_context_errno(pd->context)));
+      return FALSE;
+    }
+    pa_threaded_mainloop_wait (pd->mainloop);
+  }
+
+  /* The server may not have given us what we asked for */
+  if ((got = pa_stream_get_buffer_attr (pd->stream)) != NULL) {
+    pd->latency = (dir == PA_STREAM_PLAYBACK ? got->tlength : got->fragsize)
+      / pd->frame_size;
+  }
+
+#ifdef DEBUG
+  fprintf(stderr, __FILE__": buffering %ld frames\n", (long)pd->latency);
+#endif
+
+  return TRUE;
+}
+
 static void
 pulse_setup (sw_handle * handle, sw_format * format)
 {
   struct pa_sample_spec ss;
   pa_stream_direction_t dir;
-  int error;
+  pulse_data * pd;
+  gboolean ok;
 
   if (format->channels > PA_CHANNELS_MAX) {
     fprintf(stderr, __FILE__": pulse_setup(): The maximum number of channels supported is %d, while %d have been requested.\n", PA_CHANNELS_MAX, format->channels);
@@ -109,57 +275,177 @@ pulse_setup (sw_handle * handle, sw_format * format)
     return;
   }
 
-  if (!(handle->custom_data = pa_simple_new(NULL, "Sweep", dir, NULL, "Sweep Stream", &ss, NULL, NULL, &error))) {
-    fprintf(stderr, __FILE__": pa_simple_new() failed: %s\n", pa_strerror(error));
+  pd = g_malloc0 (sizeof (pulse_data));
+  pd->frame_size = pa_frame_size (&ss);
+
+  if (!(pd->mainloop = pa_threaded_mainloop_new ()) ||
+      !(pd->context =
+	pa_context_new (pa_threaded_mainloop_get_api (pd->mainloop),
+			"Sweep"))) {
+    fprintf(stderr, __FILE__": pulse_setup(): out of memory\n");
+    pulse_data_free (pd);
+    return;
+  }
+
+  pa_threaded_mainloop_lock (pd->mainloop);
+
+  if (pa_threaded_mainloop_start (pd->mainloop) < 0) {
+    fprintf(stderr, __FILE__": pa_threaded_mainloop_start() failed\n");
+    ok = FALSE;
+  } else {
+    ok = pulse_connect (pd, dir, &ss);
+  }
+
+  pa_threaded_mainloop_unlock (pd->mainloop);
+
+  if (!ok) {
+    pulse_data_free (pd);
     return;
   }
 
+  handle->custom_data = pd;
   handle->driver_rate = ss.rate;
   handle->driver_channels = ss.channels;
 }
 
+/*
+ * pulse_wait (handle)
+ *
+ * sleeps until a playback stream has room for more, or a recording
+ * stream has something to read.
+ */
 static int
 pulse_wait (sw_handle * handle)
 {
+  pulse_data * pd;
+  size_t n;
+
+  if ((pd = (pulse_data *)handle->custom_data) == NULL)
+    return 0;
+
+  pa_threaded_mainloop_lock (pd->mainloop);
+
+  for (;;) {
+    if (handle->driver_flags == O_WRONLY)
+      n = pa_stream_writable_size (pd->stream);
+    else
+      n = pa_stream_readable_size (pd->stream);
+
+    if (n != 0 || pa_stream_get_state (pd->stream) != PA_STREAM_READY)
+      break;
+
+    pa_threaded_mainloop_wait (pd->mainloop);
+  }
+
+  pa_threaded_mainloop_unlock (pd->mainloop);
+
   return 0;
 }
 
 static ssize_t
 pulse_read (sw_handle * handle, float * buf, size_t count)
 {
-  struct pa_simple * pa ;
-  int error;
-  size_t byte_count;
+  pulse_data * pd;
+  const void * data;
+  size_t nbytes, byte_count, n;
+  char * dest = (char *)buf;
 
-  if ((pa = (struct pa_simple *)handle->custom_data) == NULL)
+  if ((pd = (pulse_data *)handle->custom_data) == NULL)
     return 0;
 
   byte_count = count * sizeof (float);
 
-  if (pa_simple_read(pa, buf, byte_count, &error) < 0) {
-    fprintf(stderr, __FILE__": pa_simple_read() failed: %s\n", pa_strerror(error));
-    return 0;
+  pa_threaded_mainloop_lock (pd->mainloop);
+
+  while (byte_count > 0) {
+    if (pa_stream_peek (pd->stream, &data, &nbytes) < 0) {
+      fprintf(stderr, __FILE__": pa_stream_peek() failed: %s\n",
+	      pa_strerror(pa_context_errno(pd->context)));
+      pa_threaded_mainloop_unlock (pd->mainloop);
+      return 0;
+    }
+
+    if (nbytes == 0) {
+      if (pa_stream_get_state (pd->stream) != PA_STREAM_READY) {
+	pa_threaded_mainloop_unlock (pd->mainloop);
+	return 0;
+      }
+      pa_threaded_mainloop_wait (pd->mainloop);
+      continue;
+    }
+
+    /* Fragments need not line up with our reads: take what is wanted
+     * and leave the rest of the fragment for next time */
+    nbytes -= pd->read_offset;
+    n = MIN (nbytes, byte_count);
+
+    if (data == NULL) {
+      /* A hole in the recording */
+      memset (dest, 0, n);
+    } else {
+      memcpy (dest, (const char *)data + pd->read_offset, n);
+    }
+
+    if (n == nbytes) {
+      pa_stream_drop (pd->stream);
+      pd->read_offset = 0;
+    } else {
+      pd->read_offset += n;
+    }
+
+    dest += n;
+    byte_count -= n;
   }
+
+  pa_threaded_mainloop_unlock (pd->mainloop);
+
   return 1;
 }
 
 static ssize_t
 pulse_write (sw_handle * handle, const float * buf, size_t count)
 {
-  struct pa_simple * pa ;
-  int error;
-  size_t byte_count;
+  pulse_data * pd;
+  size_t byte_count, n;
+  const char * src = (const char *)buf;
 
-  if ((pa = (struct pa_simple *)handle->custom_data) == NULL)
+  if ((pd = (pulse_data *)handle->custom_data) == NULL)
     return 0;
 
   byte_count = count * sizeof (float);
 
-  if (pa_simple_write(pa, buf, byte_count, &error) < 0) {
-    fprintf(stderr, __FILE__": pa_simple_write() failed: %s\n", pa_strerror(error));
-    return 0;
+  pa_threaded_mainloop_lock (pd->mainloop);
+
+  while (byte_count > 0) {
+    n = pa_stream_writable_size (pd->stream);
+
+    if (n == (size_t)-1) {
+      fprintf(stderr, __FILE__": pa_stream_writable_size() failed: %s\n",
+	      pa_strerror(pa_context_errno(pd->context)));
+      pa_threaded_mainloop_unlock (pd->mainloop);
+      return 0;
+    }
+
+    if (n == 0) {
+      pa_threaded_mainloop_wait (pd->mainloop);
+      continue;
+    }
+
+    n = MIN (n, byte_count);
+
+    if (pa_stream_write (pd->stream, src, n, NULL, 0, PA_SEEK_RELATIVE) < 0) {
+      fprintf(stderr, __FILE__": pa_stream_write() failed: %s\n",
+	      pa_strerror(pa_context_errno(pd->context)));
+      pa_threaded_mainloop_unlock (pd->mainloop);
+      return 0;
+    }
+
+    src += n;
+    byte_count -= n;
   }
 
+  pa_threaded_mainloop_unlock (pd->mainloop);
+
   return 1;
 }
 
@@ -169,50 +455,84 @@ pulse_offset (sw_handle * handle)
   return -1;
 }
 
+static sw_framecount_t
+pulse_latency (sw_handle * handle)
+{
+  pulse_data * pd;
+
+  if ((pd = (pulse_data *)handle->custom_data) == NULL)
+    return -1;
+
+  return pd->latency;
+}
+
 static void
 pulse_reset (sw_handle * handle)
 {
 }
 
+/*
+ * pulse_run_operation (pd, o)
+ *
+ * waits for o to complete. Called with the mainloop locked.
+ */
+static void
+pulse_run_operation (pulse_data * pd, pa_operation * o)
+{
+  if (o == NULL) {
+    fprintf(stderr, __FILE__": stream operation failed: %s\n",
+	    pa_strerror(pa_context_errno(pd->context)));
+    return;
+  }
+
+  while (pa_operation_get_state (o) == PA_OPERATION_RUNNING)
+    pa_threaded_mainloop_wait (pd->mainloop);
+
+  pa_operation_unref (o);
+}
+
 static void
 pulse_flush (sw_handle * handle)
 {
-  struct pa_simple * pa ;
-  int error;
+  pulse_data * pd;
 
-  if ((pa = (struct pa_simple *)handle->custom_data) == NULL)
+  if ((pd = (pulse_data *)handle->custom_data) == NULL)
     return;
 
-  if (pa_simple_flush(pa, &error) < 0) {
-    fprintf(stderr, __FILE__": pa_simple_flush() failed: %s\n", pa_strerror(error));
-  }
+  pa_threaded_mainloop_lock (pd->mainloop);
+  pulse_run_operation (pd, pa_stream_flush (pd->stream,
+					    pulse_stream_success_cb, pd));
+  pa_threaded_mainloop_unlock (pd->mainloop);
 }
 
 static void
 pulse_drain (sw_handle * handle)
 {
-  struct pa_simple * pa ;
-  int error;
+  pulse_data * pd;
 
-  if ((pa = (struct pa_simple *)handle->custom_data) == NULL)
+  if ((pd = (pulse_data *)handle->custom_data) == NULL)
     return;
 
-  if (pa_simple_drain(pa, &error) < 0) {
-    fprintf(stderr, __FILE__": pa_simple_drain() failed: %s\n", pa_strerror(error));
-  }
+  if (handle->driver_flags != O_WRONLY)
+    return;
+
+  pa_threaded_mainloop_lock (pd->mainloop);
+  pulse_run_operation (pd, pa_stream_drain (pd->stream,
+					    pulse_stream_success_cb, pd));
+  pa_threaded_mainloop_unlock (pd->mainloop);
 }
 
 static void
 pulse_close (sw_handle * handle)
 {
-  struct pa_simple * pa ;
+  pulse_data * pd;
 
   pulse_drain(handle);
 
-  if ((pa = (struct pa_simple *)handle->custom_data) == NULL)
+  if ((pd = (pulse_data *)handle->custom_data) == NULL)
     return;
 
-  pa_simple_free(pa);
+  pulse_data_free (pd);
   handle->custom_data = NULL;
 }
 
@@ -231,7 +551,8 @@ static sw_driver _driver_pulseaudio = {
   pulse_close,
   "pulseaudio_primary_sink",
   "pulseaudio_monitor_sink",
-  "pulseaudio_log_frags"
+  "pulseaudio_log_frags",
+  pulse_latency
 };
 
 #else
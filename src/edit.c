@@ -36,6 +36,7 @@
 #include <sweep/sweep_typeconvert.h>
 #include <sweep/sweep_undo.h>
 #include <sweep/sweep_sounddata.h>
+#include <sweep/sweep_analysis.h>
 #include <sweep/sweep_sample.h>
 #include <sweep/sweep_selection.h>
 
@@ -313,15 +314,26 @@ edit_buffer_from_sounddata_sels (sw_sounddata * sounddata, GList * sels)
   GList * gl;
   sw_sel * sel;
   sw_edit_region * er;
+  gfloat * fbuf;
 
   eb = edit_buffer_new (sounddata->format);
 
   for (gl = sels; gl; gl = gl->next) {
     sel = (sw_sel *)gl->data;
 
-    er = edit_region_new0 (eb->format,
-			   sel->sel_start, sel->sel_end,
-			   sounddata->data);
+    if (sounddata->storage == SW_STORAGE_FLOAT) {
+      er = edit_region_new0 (eb->format,
+			     sel->sel_start, sel->sel_end,
+			     sounddata->data);
+    } else {
+      /* Copying out of compact data does not require promoting it */
+      fbuf = g_malloc (frames_to_bytes (eb->format,
+					sel->sel_end - sel->sel_start));
+      sounddata_copy_frames (sounddata, sel->sel_start,
+			     sel->sel_end - sel->sel_start, fbuf);
+      er = edit_region_new (eb->format, sel->sel_start, sel->sel_end, fbuf);
+      g_free (fbuf);
+    }
 
 #ifdef DEBUG
     printf("adding eb region [%ld - %ld]\n", sel->sel_start, sel->sel_end);
@@ -1094,6 +1106,9 @@ paste_over (sw_sample * sample, sw_edit_buffer * eb)
     offset = frames_to_bytes (f, er->start);
     len = frames_to_bytes (f, MIN(er->end, length) - er->start);
     memcpy ((gpointer)(sample->sounddata->data + offset), er->data, len);
+
+    sounddata_invalidate_analysis (sample->sounddata, er->start,
+				   MIN(er->end, length));
   }
 
   return sample;
@@ -46,6 +46,7 @@
 #include "sample-display.h"
 #include "question_dialogs.h"
 #include "preferences.h"
+#include "journal.h"
 
 #define LAST_LOAD_KEY "Last_Load"
 #define LAST_SAVE_KEY "Last_Save"
@@ -62,6 +63,12 @@ extern sw_sample * speex_sample_load (char * pathname);
 extern int speex_save_options_dialog (sw_sample * sample, char * pathname);
 #endif
 
+#ifdef HAVE_FLAC
+extern sw_sample * flac_sample_reload (sw_sample * sample);
+extern sw_sample * flac_sample_load (char * pathname);
+extern int flac_save_options_dialog (sw_sample * sample, char * pathname);
+#endif
+
 #ifdef HAVE_MAD
 extern sw_sample * mad_sample_reload (sw_sample * sample);
 extern sw_sample * mad_sample_load (char * pathname);
@@ -193,6 +200,11 @@ sample_reload (sw_sample * sample)
   new_sample = vorbis_sample_reload (sample);
 #endif
 
+#ifdef HAVE_FLAC
+  if (new_sample == NULL)
+    new_sample = flac_sample_reload (sample);
+#endif
+
   if (new_sample == NULL)
     new_sample = sndfile_sample_reload (sample, FALSE);
 
@@ -212,7 +224,13 @@ sample_reload (sw_sample * sample)
   return new_sample;
 }
 
-static sw_sample *
+/*
+ * try_sample_load (pathname)
+ *
+ * loads pathname with the first loader to recognise it, without the
+ * checks and questions of sample_load.
+ */
+sw_sample *
 try_sample_load (char * pathname)
 {
   sw_sample * sample = NULL;
@@ -221,6 +239,11 @@ try_sample_load (char * pathname)
   sample = vorbis_sample_load (pathname);
 #endif
 
+#ifdef HAVE_FLAC
+  if (sample == NULL)
+    sample = flac_sample_load (pathname);
+#endif
+
   if (sample == NULL)
     sample = sndfile_sample_load (pathname, FALSE);
 
@@ -237,18 +260,18 @@ try_sample_load (char * pathname)
   if (sample == NULL)
     sample = sndfile_sample_load (pathname, TRUE);
 
-  if (sample != NULL)
-        recent_manager_add_item (pathname);
-
   return sample;
 }
 
 sw_sample *
 sample_load (char * pathname)
 {
+  sw_sample * sample;
+
   if (sweep_dir_exists (pathname)) {
     if (strcmp (pathname, "-") == 0) {
-      try_sample_load (pathname);
+      if (try_sample_load (pathname) != NULL)
+	recent_manager_add_item (pathname);
     } else if (access(pathname, R_OK) == -1) {
       switch (errno) {
       case ENOENT:
@@ -262,7 +285,10 @@ sample_load (char * pathname)
     } else {
       prefs_set_string (LAST_LOAD_KEY, pathname);
 
-      return try_sample_load (pathname);
+      if ((sample = try_sample_load (pathname)) != NULL)
+	recent_manager_add_item (pathname);
+
+      return sample;
     }
   }
 
@@ -377,6 +403,9 @@ sample_store_and_free_pathname (sw_sample * sample, gchar * pathname)
 
   sample_set_pathname (sample, pathname);
 
+  /* The file on disk now holds everything the journal would recover */
+  journal_discard (sample);
+
 #ifdef DEVEL_CODE
   g_free (pathname);
 #endif
@@ -421,6 +450,14 @@ file_guess_method (sw_sample * sample, char * pathname)
     }
 #endif
 
+#ifdef HAVE_FLAC
+    if (!g_ascii_strncasecmp (ext, "flac", SW_DIR_LEN)) {
+      sample->file_method = SWEEP_FILE_METHOD_FLAC;
+      sample->file_format = 0;
+      return;
+    }
+#endif
+
     /* MP3 has dummy annoying dialog support */
     if (!g_ascii_strncasecmp (ext, "mp3", SW_DIR_LEN)) {
       sample->file_method = SWEEP_FILE_METHOD_MP3;
@@ -488,6 +525,33 @@ file_guess_method (sw_sample * sample, char * pathname)
   return;
 }
 
+/*
+ * sample_save_by_extension (sample, pathname)
+ *
+ * saves sample to pathname in the format its extension suggests,
+ * without asking for save options. Only formats written through
+ * libsndfile can be saved this way.
+ */
+int
+sample_save_by_extension (sw_sample * sample, gchar * pathname)
+{
+  /* Only keep an encoding libsndfile itself loaded */
+  if (sample->file_method != SWEEP_FILE_METHOD_LIBSNDFILE)
+    sample->file_info = NULL;
+
+  sample->file_method = SWEEP_FILE_METHOD_BY_EXTENSION;
+  file_guess_method (sample, pathname);
+
+  if (sample->file_method != SWEEP_FILE_METHOD_LIBSNDFILE) {
+    info_dialog_new (_("Unsupported format"), NULL,
+		     _("%s:\nThis format needs its save options chosen "
+		       "interactively"), pathname);
+    return -1;
+  }
+
+  return sndfile_sample_save_format (sample, pathname);
+}
+
 typedef struct {
   sw_sample * sample;
   char * pathname;
@@ -517,6 +581,11 @@ overwrite_ok_cb (GtkWidget * widget, gpointer data)
   case SWEEP_FILE_METHOD_SPEEX:
     speex_save_options_dialog (sample, pathname);
     break;
+#endif
+#ifdef HAVE_FLAC
+  case SWEEP_FILE_METHOD_FLAC:
+    flac_save_options_dialog (sample, pathname);
+    break;
 #endif
   case SWEEP_FILE_METHOD_MP3:
     mp3_unsupported_dialog ();
@@ -661,6 +730,20 @@ create_save_menu (sw_sample * sample)
   gtk_widget_show (menuitem);
 #endif
 
+#ifdef HAVE_FLAC
+  /* FLAC */
+
+  menuitem = gtk_menu_item_new_with_label ("FLAC (Xiph.org)");
+  gtk_menu_append (GTK_MENU(menu), menuitem);
+  gtk_object_set_data (GTK_OBJECT(menuitem), "method",
+		       GINT_TO_POINTER(SWEEP_FILE_METHOD_FLAC));
+  gtk_object_set_data (GTK_OBJECT(menuitem), "format",
+		       GINT_TO_POINTER(0));
+  gtk_signal_connect (GTK_OBJECT(menuitem), "activate",
+		      GTK_SIGNAL_FUNC(file_set_format_cb), sample);
+  gtk_widget_show (menuitem);
+#endif
+
   return menu;
 }
 
@@ -837,6 +920,11 @@ sample_save_ok_cb(GtkWidget * widget, gpointer data)
   case SWEEP_FILE_METHOD_SPEEX:
     speex_save_options_dialog (sample, sample->pathname);
     break;
+#endif
+#ifdef HAVE_FLAC
+  case SWEEP_FILE_METHOD_FLAC:
+    flac_save_options_dialog (sample, sample->pathname);
+    break;
 #endif
   case SWEEP_FILE_METHOD_MP3:
     mp3_unsupported_dialog ();
@@ -32,6 +32,9 @@ guess_file_format (gchar * pathname);
 gboolean
 sample_mtime_changed (sw_sample * sample);
 
+sw_sample *
+try_sample_load (char * pathname);
+
 sw_sample *
 sample_load(const gchar * pathname);
 
@@ -50,6 +53,9 @@ sample_save_as_cb(GtkWidget * wiget, gpointer data);
 void
 sample_save_cb(GtkWidget * wiget, gpointer data);
 
+int
+sample_save_by_extension (sw_sample * sample, gchar * pathname);
+
 void
 sample_store_and_free_pathname (sw_sample * sample, gchar * pathname);
 
@@ -0,0 +1,771 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * FLAC loading and saving through libFLAC.
+ *
+ * Decoding goes a whole FLAC frame at a time straight into compact
+ * sounddata, so a 16 or 24 bit file is never expanded to float until it
+ * is edited. Saved files carry a seek table, and the encoder runs
+ * multi-threaded where libFLAC supports it.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#ifdef HAVE_FLAC
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <math.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <FLAC/metadata.h>
+#include <FLAC/stream_decoder.h>
+#include <FLAC/stream_encoder.h>
+
+#include <glib.h>
+#include <gdk/gdkkeysyms.h>
+#include <gtk/gtk.h>
+
+#include <sweep/sweep_i18n.h>
+#include <sweep/sweep_types.h>
+#include <sweep/sweep_typeconvert.h>
+#include <sweep/sweep_sample.h>
+#include <sweep/sweep_undo.h>
+#include <sweep/sweep_sounddata.h>
+
+#include "sample.h"
+#include "interface.h"
+#include "file_dialogs.h"
+#include "question_dialogs.h"
+#include "preferences.h"
+#include "peakcache.h"
+#include "view.h"
+#include "batch.h"
+
+/*#define DEBUG*/
+
+#define LEVEL_KEY "FLAC_Level"
+#define BITS_KEY "FLAC_Bits"
+
+#define DEFAULT_LEVEL 5
+
+/* Nr. of frames passed to the encoder at a time */
+#define BUFFER_LEN 4096
+
+/* Interval between seek points in saved files (seconds) */
+#define SEEK_INTERVAL 10
+
+/* Maximum nr. of encoder threads */
+#define MAX_THREADS 8
+
+typedef struct {
+  FLAC__StreamDecoder * decoder;
+  sw_sample * sample;
+  sw_framecount_t run_total;
+  gint shift; /* bits to left-justify decoded samples to 32 */
+  gint32 * ibuf;
+  sw_framecount_t ibuf_frames;
+  gfloat * fbuf;
+  sw_peaks * peaks;
+  gboolean error;
+} flac_load_data;
+
+typedef struct {
+  gint level;
+  gint bits;
+} flac_save_options;
+
+static FLAC__StreamDecoderWriteStatus
+flac_write_cb (const FLAC__StreamDecoder * decoder, const FLAC__Frame * frame,
+	       const FLAC__int32 * const buffer[], void * client_data)
+{
+  flac_load_data * fd = (flac_load_data *)client_data;
+  sw_sounddata * sounddata = fd->sample->sounddata;
+  gint channels = sounddata->format->channels;
+  sw_framecount_t n = frame->header.blocksize;
+  gfloat * d;
+  gint i, j;
+
+  /* Ignore anything beyond the length given in the stream info */
+  n = MIN (n, sounddata->nr_frames - fd->run_total);
+  if (n <= 0) return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+
+  if (sounddata->storage == SW_STORAGE_FLOAT) {
+    d = (gfloat *)sounddata->data + fd->run_total * channels;
+    for (i = 0; i < channels; i++) {
+      for (j = 0; j < n; j++) {
+	d[j*channels + i] =
+	  (gint32)((guint32)buffer[i][j] << fd->shift) / 2147483648.0f;
+      }
+    }
+    if (fd->peaks) peaks_add_frames (fd->peaks, d, n);
+  } else {
+    if (n > fd->ibuf_frames) {
+      fd->ibuf = g_realloc (fd->ibuf, n * channels * sizeof (gint32));
+      if (fd->peaks)
+	fd->fbuf = g_realloc (fd->fbuf, n * channels * sizeof (gfloat));
+      fd->ibuf_frames = n;
+    }
+
+    for (i = 0; i < channels; i++) {
+      for (j = 0; j < n; j++) {
+	fd->ibuf[j*channels + i] = (gint32)((guint32)buffer[i][j] << fd->shift);
+      }
+    }
+
+    sounddata_compact_store_int (sounddata, fd->run_total, fd->ibuf, n);
+
+    if (fd->peaks) {
+      sounddata_copy_frames (sounddata, fd->run_total, n, fd->fbuf);
+      peaks_add_frames (fd->peaks, fd->fbuf, n);
+    }
+  }
+
+  fd->run_total += n;
+
+  return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void
+flac_error_cb (const FLAC__StreamDecoder * decoder,
+	       FLAC__StreamDecoderErrorStatus status, void * client_data)
+{
+  flac_load_data * fd = (flac_load_data *)client_data;
+
+  fprintf (stderr, "sweep: FLAC decoding error in %s: %s\n",
+	   fd->sample->pathname, FLAC__StreamDecoderErrorStatusString[status]);
+
+  fd->error = TRUE;
+}
+
+static sw_sample *
+sample_load_flac_data (sw_op_instance * inst)
+{
+  sw_sample * sample = inst->sample;
+  flac_load_data * fd = (flac_load_data *)inst->do_data;
+  FLAC__StreamDecoderState state;
+  sw_framecount_t nr_frames, cframes;
+  gint percent;
+
+  struct stat statbuf;
+
+  gboolean active = TRUE;
+
+  nr_frames = sample->sounddata->nr_frames;
+
+  cframes = nr_frames / 100;
+  if (cframes == 0) cframes = 1;
+
+  while (active && fd->run_total < nr_frames) {
+    g_mutex_lock (&sample->ops_mutex);
+
+    if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
+      active = FALSE;
+    } else {
+      if (!FLAC__stream_decoder_process_single (fd->decoder)) {
+	active = FALSE;
+      } else {
+	state = FLAC__stream_decoder_get_state (fd->decoder);
+	if (state == FLAC__STREAM_DECODER_END_OF_STREAM ||
+	    state == FLAC__STREAM_DECODER_ABORTED) {
+	  active = FALSE;
+	}
+      }
+
+      percent = fd->run_total / cframes;
+      sample_set_progress_percent (sample, percent);
+    }
+
+    g_mutex_unlock (&sample->ops_mutex);
+  }
+
+  FLAC__stream_decoder_finish (fd->decoder);
+  FLAC__stream_decoder_delete (fd->decoder);
+
+  if (fd->run_total >= nr_frames) {
+    stat (sample->pathname, &statbuf);
+    sample->last_mtime = statbuf.st_mtime;
+    sample->edit_ignore_mtime = FALSE;
+    sample->modified = FALSE;
+
+    /* Don't cache an overview of a damaged file */
+    if (!fd->error && peaks_finish (fd->peaks)) {
+      peaks_cache_write (sample->pathname, fd->peaks);
+
+      g_mutex_lock (&sample->ops_mutex);
+      sample->sounddata->peaks = fd->peaks;
+      g_mutex_unlock (&sample->ops_mutex);
+
+      fd->peaks = NULL;
+    }
+  } else if (sample->edit_state != SWEEP_EDIT_STATE_CANCEL) {
+    sample_set_tmp_message (sample, _("Error decoding %s"),
+			    g_path_get_basename (sample->pathname));
+  }
+
+  peaks_free (fd->peaks);
+  g_free (fd->ibuf);
+  g_free (fd->fbuf);
+  g_free (fd);
+
+  sample_set_edit_state (sample, SWEEP_EDIT_STATE_DONE);
+
+  return sample;
+}
+
+static sw_operation flac_load_op = {
+  SWEEP_EDIT_MODE_FILTER,
+  (SweepCallback)sample_load_flac_data,
+  (SweepFunction)NULL,
+  (SweepCallback)NULL, /* undo */
+  (SweepFunction)NULL,
+  (SweepCallback)NULL, /* redo */
+  (SweepFunction)NULL
+};
+
+/*
+ * flac_storage_for_bits (bits)
+ *
+ * choose how to hold data of the given FLAC sample width in memory.
+ */
+static sw_storage_t
+flac_storage_for_bits (guint bits)
+{
+  if (bits <= 16) return SW_STORAGE_INT16;
+  if (bits <= 24) return SW_STORAGE_INT24;
+  return SW_STORAGE_FLOAT;
+}
+
+static sw_sample *
+sample_load_flac_info (sw_sample * sample, char * pathname)
+{
+  FLAC__StreamMetadata streaminfo;
+  FLAC__StreamMetadata_StreamInfo * si;
+  FLAC__StreamDecoder * decoder;
+  flac_load_data * fd;
+  sw_sounddata * sounddata;
+  char buf[128];
+
+  gboolean isnew = (sample == NULL);
+
+  sw_view * v;
+
+  /* Reading just the STREAMINFO block is a cheap test for FLAC */
+  if (!FLAC__metadata_get_streaminfo (pathname, &streaminfo))
+    return NULL;
+
+  si = &streaminfo.data.stream_info;
+
+  /* Streams of unknown length are left to libsndfile */
+  if (si->total_samples == 0) return NULL;
+
+  if ((decoder = FLAC__stream_decoder_new ()) == NULL)
+    return NULL;
+
+  fd = g_malloc0 (sizeof (flac_load_data));
+  fd->decoder = decoder;
+  fd->shift = 32 - si->bits_per_sample;
+
+  if (FLAC__stream_decoder_init_file (decoder, pathname,
+				      flac_write_cb, NULL, flac_error_cb, fd)
+      != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+    FLAC__stream_decoder_delete (decoder);
+    g_free (fd);
+    return NULL;
+  }
+
+  /* Allocate the new data before touching the sample, so that a
+   * reload which fails leaves the sample as it was */
+  sounddata =
+    sounddata_new_compact (si->channels, si->sample_rate,
+			   (sw_framecount_t)si->total_samples,
+			   flac_storage_for_bits (si->bits_per_sample));
+
+  if (sounddata == NULL) {
+    FLAC__stream_decoder_delete (decoder);
+    g_free (fd);
+    return NULL;
+  }
+
+  if (sample == NULL) {
+    sample = sample_new_empty (pathname, si->channels, si->sample_rate, 0);
+  }
+
+  if (!sample) {
+    sounddata_destroy (sounddata);
+    FLAC__stream_decoder_delete (decoder);
+    g_free (fd);
+    return NULL;
+  }
+
+  sounddata_destroy (sample->sounddata);
+  sample->sounddata = sounddata;
+
+  fd->sample = sample;
+
+  /* Pick up a cached overview so the views can be drawn before
+   * the data has been decoded */
+  sample->sounddata->peaks =
+    peaks_cache_read (pathname, si->channels,
+		      (sw_framecount_t)si->total_samples);
+
+  if (sample->sounddata->peaks == NULL)
+    fd->peaks = peaks_new (si->channels, (sw_framecount_t)si->total_samples);
+
+  sample->file_method = SWEEP_FILE_METHOD_FLAC;
+
+  sample_bank_add (sample);
+
+  if (isnew && !batch_mode) {
+    v = view_new_all (sample, 1.0);
+    sample_add_view (sample, v);
+  } else {
+    trim_registered_ops (sample, 0);
+  }
+
+  g_snprintf (buf, sizeof (buf), _("Loading %s"), g_path_get_basename (sample->pathname));
+
+  schedule_operation (sample, buf, &flac_load_op, fd);
+
+  return sample;
+}
+
+sw_sample *
+flac_sample_reload (sw_sample * sample)
+{
+  if (sample == NULL) return NULL;
+
+  return sample_load_flac_info (sample, sample->pathname);
+}
+
+sw_sample *
+flac_sample_load (char * pathname)
+{
+  if (pathname == NULL) return NULL;
+
+  return sample_load_flac_info (NULL, pathname);
+}
+
+#if FLAC_API_VERSION_CURRENT >= 14
+/*
+ * flac_nr_threads ()
+ *
+ * number of threads to give the encoder: one per online CPU.
+ */
+static gint
+flac_nr_threads (void)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  return (gint)CLAMP (n, 1, MAX_THREADS);
+}
+#endif
+
+static int
+flac_sample_save_thread (sw_op_instance * inst)
+{
+  sw_sample * sample = inst->sample;
+  char * pathname = (char *)inst->do_data;
+
+  FLAC__StreamEncoder * encoder;
+  FLAC__StreamMetadata * metadata[2];
+  FLAC__StreamMetadata_VorbisComment_Entry entry;
+  FLAC__StreamEncoderInitStatus init_status;
+  flac_save_options * so;
+  sw_format * format;
+  const gfloat * d;
+  gfloat * rbuf;
+  FLAC__int32 * ibuf;
+  gfloat scale, v, vmax;
+  sw_framecount_t nr_frames, remaining, len, run_total, cframes;
+  gint percent = 0;
+  gint i;
+
+  gboolean active = TRUE;
+
+  struct stat statbuf;
+
+  if (sample == NULL) return -1;
+
+  so = (flac_save_options *)sample->file_info;
+
+  format = sample->sounddata->format;
+
+  nr_frames = sample->sounddata->nr_frames;
+  cframes = nr_frames / 100;
+  if (cframes == 0) cframes = 1;
+
+  remaining = nr_frames;
+  run_total = 0;
+
+  if ((encoder = FLAC__stream_encoder_new ()) == NULL) {
+    sample_set_tmp_message (sample, _("Could not create FLAC encoder"));
+    sample_set_edit_state (sample, SWEEP_EDIT_STATE_DONE);
+    return -1;
+  }
+
+  FLAC__stream_encoder_set_channels (encoder, format->channels);
+  FLAC__stream_encoder_set_sample_rate (encoder, format->rate);
+  FLAC__stream_encoder_set_bits_per_sample (encoder, so->bits);
+  FLAC__stream_encoder_set_compression_level (encoder, so->level);
+  FLAC__stream_encoder_set_total_samples_estimate (encoder, nr_frames);
+
+#if FLAC_API_VERSION_CURRENT >= 14
+  FLAC__stream_encoder_set_num_threads (encoder, flac_nr_threads ());
+#endif
+
+  /* A seek table lets players and later loads jump straight to a
+   * position without scanning the stream */
+  metadata[0] = FLAC__metadata_object_new (FLAC__METADATA_TYPE_SEEKTABLE);
+  FLAC__metadata_object_seektable_template_append_spaced_points_by_samples
+    (metadata[0], format->rate * SEEK_INTERVAL, nr_frames);
+  FLAC__metadata_object_seektable_template_sort (metadata[0], TRUE);
+
+  metadata[1] = FLAC__metadata_object_new (FLAC__METADATA_TYPE_VORBIS_COMMENT);
+  FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair
+    (&entry, "ENCODER", "Sweep " VERSION " (metadecks.org)");
+  FLAC__metadata_object_vorbiscomment_append_comment (metadata[1], entry,
+						      FALSE);
+
+  FLAC__stream_encoder_set_metadata (encoder, metadata, 2);
+
+  init_status = FLAC__stream_encoder_init_file (encoder, pathname, NULL, NULL);
+
+  if (init_status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+    if (init_status == FLAC__STREAM_ENCODER_INIT_STATUS_ENCODER_ERROR &&
+	FLAC__stream_encoder_get_state (encoder) ==
+	FLAC__STREAM_ENCODER_IO_ERROR) {
+      sweep_perror (errno, pathname);
+    } else {
+      sample_set_tmp_message (sample, "FLAC: %s",
+			      FLAC__StreamEncoderInitStatusString[init_status]);
+    }
+    FLAC__stream_encoder_delete (encoder);
+    FLAC__metadata_object_delete (metadata[0]);
+    FLAC__metadata_object_delete (metadata[1]);
+    sample_set_edit_state (sample, SWEEP_EDIT_STATE_DONE);
+    return -1;
+  }
+
+  rbuf = g_malloc (BUFFER_LEN * format->channels * sizeof (gfloat));
+  ibuf = g_malloc (BUFFER_LEN * format->channels * sizeof (FLAC__int32));
+
+  scale = (gfloat)(1 << (so->bits - 1));
+  vmax = scale - 1.0f;
+
+  while (active && remaining > 0) {
+    g_mutex_lock (&sample->ops_mutex);
+
+    if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
+      active = FALSE;
+    } else {
+      len = MIN (remaining, BUFFER_LEN);
+
+      /* Data held compact at this width converts back exactly */
+      d = sounddata_read_frames (sample->sounddata, run_total, len, rbuf);
+      for (i = 0; i < len * format->channels; i++) {
+	v = CLAMP (d[i] * scale, -scale, vmax);
+	ibuf[i] = (FLAC__int32)lrintf (v);
+      }
+
+      if (!FLAC__stream_encoder_process_interleaved (encoder, ibuf, len)) {
+	active = FALSE;
+      }
+
+      remaining -= len;
+
+      run_total += len;
+      percent = run_total / cframes;
+      sample_set_progress_percent (sample, percent);
+    }
+
+    g_mutex_unlock (&sample->ops_mutex);
+  }
+
+  if (!FLAC__stream_encoder_finish (encoder)) active = FALSE;
+
+  if (!active && sample->edit_state != SWEEP_EDIT_STATE_CANCEL) {
+    sample_set_tmp_message (sample, "FLAC: %s",
+			    FLAC__stream_encoder_get_resolved_state_string (encoder));
+  }
+
+  FLAC__stream_encoder_delete (encoder);
+  FLAC__metadata_object_delete (metadata[0]);
+  FLAC__metadata_object_delete (metadata[1]);
+
+  g_free (ibuf);
+  g_free (rbuf);
+
+  if (active && remaining <= 0) {
+    stat (pathname, &statbuf);
+    sample->last_mtime = statbuf.st_mtime;
+    sample->edit_ignore_mtime = FALSE;
+    sample->modified = FALSE;
+
+    sample_store_and_free_pathname (sample, pathname);
+  }
+
+  sample_set_edit_state (sample, SWEEP_EDIT_STATE_DONE);
+
+  return 0;
+}
+
+static sw_operation flac_save_op = {
+  SWEEP_EDIT_MODE_META,
+  (SweepCallback)flac_sample_save_thread,
+  (SweepFunction)NULL,
+  (SweepCallback)NULL, /* undo */
+  (SweepFunction)NULL,
+  (SweepCallback)NULL, /* redo */
+  (SweepFunction)NULL
+};
+
+int
+flac_sample_save (sw_sample * sample, char * pathname)
+{
+  char buf[128];
+
+  g_snprintf (buf, sizeof (buf), _("Saving %s"), g_path_get_basename (pathname));
+
+  schedule_operation (sample, buf, &flac_save_op, pathname);
+
+  return 0;
+}
+
+static void
+flac_save_options_dialog_ok_cb (GtkWidget * widget, gpointer data)
+{
+  sw_sample * sample = (sw_sample *)data;
+  GtkWidget * dialog;
+  GtkWidget * checkbutton;
+  GtkObject * level_adj;
+  flac_save_options * so;
+  gint level, bits;
+  gboolean rem_encode;
+  char * pathname;
+
+  dialog = gtk_widget_get_toplevel (widget);
+
+  level_adj =
+    GTK_OBJECT(g_object_get_data (G_OBJECT(dialog), "level_adj"));
+  level = (gint)GTK_ADJUSTMENT(level_adj)->value;
+
+  checkbutton =
+    GTK_WIDGET(g_object_get_data (G_OBJECT(dialog), "bits24_rb"));
+  bits = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON(checkbutton)) ?
+    24 : 16;
+
+  checkbutton =
+    GTK_WIDGET(g_object_get_data (G_OBJECT(dialog), "rem_encode_chb"));
+  rem_encode =
+    gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON(checkbutton));
+
+  pathname = g_object_get_data (G_OBJECT(dialog), "pathname");
+
+  gtk_widget_destroy (dialog);
+
+  if (rem_encode) {
+    prefs_set_int (LEVEL_KEY, level);
+    prefs_set_int (BITS_KEY, bits);
+  }
+
+  if (sample->file_info) {
+    g_free (sample->file_info);
+  }
+
+  so = g_malloc (sizeof (flac_save_options));
+  so->level = level;
+  so->bits = bits;
+
+  sample->file_info = so;
+
+  flac_sample_save (sample, pathname);
+}
+
+static void
+flac_save_options_dialog_cancel_cb (GtkWidget * widget, gpointer data)
+{
+  GtkWidget * dialog;
+
+  dialog = gtk_widget_get_toplevel (widget);
+  gtk_widget_destroy (dialog);
+
+  /* if the sample bank is empty, quit the program */
+  sample_bank_remove (NULL);
+}
+
+static GtkWidget *
+create_flac_encoding_options_dialog (sw_sample * sample, char * pathname)
+{
+  GtkWidget * dialog;
+  GtkWidget * ok_button, * button;
+  GtkWidget * main_vbox;
+  GtkWidget * vbox;
+  GtkWidget * hbox;
+  GtkWidget * label;
+  GtkWidget * checkbutton;
+  GtkWidget * bits16_rb, * bits24_rb;
+  GtkObject * level_adj;
+  GtkWidget * level_hscale;
+  GtkTooltips * tooltips;
+  gint bits;
+
+  dialog = gtk_dialog_new ();
+  gtk_window_set_title (GTK_WINDOW(dialog), _("Sweep: FLAC save options"));
+  gtk_window_set_position (GTK_WINDOW (dialog), GTK_WIN_POS_CENTER);
+
+  attach_window_close_accel(GTK_WINDOW(dialog));
+
+  g_object_set_data (G_OBJECT(dialog), "pathname", pathname);
+
+  main_vbox = GTK_DIALOG(dialog)->vbox;
+
+  vbox = gtk_vbox_new (FALSE, 0);
+  gtk_box_pack_start (GTK_BOX(main_vbox), vbox, TRUE, TRUE, 0);
+  gtk_container_set_border_width (GTK_CONTAINER(vbox), 8);
+  gtk_widget_show (vbox);
+
+  /* filename */
+
+  label = gtk_label_new (g_path_get_basename (pathname));
+  gtk_box_pack_start (GTK_BOX(vbox), label, FALSE, FALSE, 4);
+  gtk_widget_show (label);
+
+  /* Compression level */
+
+  hbox = gtk_hbox_new (FALSE, 4);
+  gtk_box_pack_start (GTK_BOX(vbox), hbox, FALSE, FALSE, 4);
+  gtk_widget_show (hbox);
+
+  label = gtk_label_new (_("Compression level:"));
+  gtk_box_pack_start (GTK_BOX(hbox), label, FALSE, FALSE, 4);
+  gtk_widget_show (label);
+
+  level_adj = gtk_adjustment_new (prefs_get_int (LEVEL_KEY, DEFAULT_LEVEL),
+				  0.0, /* lower */
+				  8.0, /* upper */
+				  1.0, /* step incr */
+				  1.0, /* page incr */
+				  0.0  /* page size */
+				  );
+
+  level_hscale = gtk_hscale_new (GTK_ADJUSTMENT(level_adj));
+  gtk_box_pack_start (GTK_BOX (hbox), level_hscale, TRUE, TRUE, 0);
+  gtk_scale_set_digits (GTK_SCALE (level_hscale), 0);
+  gtk_scale_set_draw_value (GTK_SCALE (level_hscale), TRUE);
+  gtk_widget_set_size_request (level_hscale, gdk_screen_width() / 8, -1);
+  gtk_widget_show (level_hscale);
+
+  tooltips = gtk_tooltips_new ();
+  gtk_tooltips_set_tip (tooltips, level_hscale,
+			_("Compression level between 0 (fastest, largest "
+			  "file) and 8 (slowest, smallest file). FLAC is "
+			  "lossless at every level."),
+			NULL);
+
+  g_object_set_data (G_OBJECT (dialog), "level_adj", level_adj);
+
+  /* Sample width */
+
+  hbox = gtk_hbox_new (FALSE, 4);
+  gtk_box_pack_start (GTK_BOX(vbox), hbox, FALSE, FALSE, 4);
+  gtk_widget_show (hbox);
+
+  label = gtk_label_new (_("Sample width:"));
+  gtk_box_pack_start (GTK_BOX(hbox), label, FALSE, FALSE, 4);
+  gtk_widget_show (label);
+
+  bits16_rb = gtk_radio_button_new_with_label (NULL, _("16 bit"));
+  gtk_box_pack_start (GTK_BOX(hbox), bits16_rb, FALSE, FALSE, 4);
+  gtk_widget_show (bits16_rb);
+
+  bits24_rb = gtk_radio_button_new_with_label_from_widget
+    (GTK_RADIO_BUTTON(bits16_rb), _("24 bit"));
+  gtk_box_pack_start (GTK_BOX(hbox), bits24_rb, FALSE, FALSE, 4);
+  gtk_widget_show (bits24_rb);
+
+  g_object_set_data (G_OBJECT (dialog), "bits24_rb", bits24_rb);
+
+  /* Default to the width the data was loaded at, if known */
+  switch (sample->sounddata->storage) {
+  case SW_STORAGE_INT16: bits = 16; break;
+  case SW_STORAGE_INT24: bits = 24; break;
+  default: bits = prefs_get_int (BITS_KEY, 16); break;
+  }
+
+  gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(bits == 24 ?
+						  bits24_rb : bits16_rb),
+				TRUE);
+
+  /* Remember */
+
+  checkbutton =
+    gtk_check_button_new_with_label (_("Remember these encoding options"));
+  gtk_box_pack_start (GTK_BOX(vbox), checkbutton, FALSE, FALSE, 4);
+  gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(checkbutton), TRUE);
+  gtk_widget_show (checkbutton);
+
+  g_object_set_data (G_OBJECT (dialog), "rem_encode_chb", checkbutton);
+
+  /* OK */
+
+  ok_button = gtk_button_new_with_label (_("Save"));
+  GTK_WIDGET_SET_FLAGS (GTK_WIDGET (ok_button), GTK_CAN_DEFAULT);
+  gtk_box_pack_start (GTK_BOX (GTK_DIALOG(dialog)->action_area), ok_button,
+		      TRUE, TRUE, 0);
+  gtk_widget_show (ok_button);
+  g_signal_connect (G_OBJECT(ok_button), "clicked",
+		      G_CALLBACK (flac_save_options_dialog_ok_cb),
+		      sample);
+
+  /* Cancel */
+
+  button = gtk_button_new_with_label (_("Don't save"));
+  GTK_WIDGET_SET_FLAGS (GTK_WIDGET (button), GTK_CAN_DEFAULT);
+  gtk_box_pack_start (GTK_BOX (GTK_DIALOG(dialog)->action_area), button,
+		      TRUE, TRUE, 0);
+  gtk_widget_show (button);
+  g_signal_connect (G_OBJECT(button), "clicked",
+		      G_CALLBACK (flac_save_options_dialog_cancel_cb),
+		      sample);
+
+  gtk_widget_grab_default (ok_button);
+
+  return (dialog);
+}
+
+int
+flac_save_options_dialog (sw_sample * sample, char * pathname)
+{
+  GtkWidget * dialog;
+
+  dialog = create_flac_encoding_options_dialog (sample, pathname);
+  gtk_widget_show (dialog);
+
+  return 0;
+}
+
+#endif /* HAVE_FLAC */
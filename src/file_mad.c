@@ -66,10 +66,12 @@
 #include "interface.h"
 #include "file_dialogs.h"
 #include "file_sndfile.h"
+#include "peakcache.h"
 #include "question_dialogs.h"
 #include "preferences.h"
 #include "print.h"
 #include "view.h"
+#include "batch.h"
 
 
 static gboolean
@@ -357,6 +359,27 @@ sample_load_mad_data (sw_op_instance * inst)
   sample->edit_ignore_mtime = FALSE;
   sample->modified = FALSE;
 
+  /* The length is only known once the stream has been decoded, so the
+   * overview is built from the decoded data rather than as we go */
+  if (sample->edit_state != SWEEP_EDIT_STATE_CANCEL &&
+      sample->sounddata->peaks == NULL) {
+    sw_sounddata * sounddata = sample->sounddata;
+    sw_peaks * peaks;
+
+    peaks = peaks_new (sounddata->format->channels, sounddata->nr_frames);
+    if (peaks) peaks_add_frames (peaks, sounddata->data, sounddata->nr_frames);
+
+    if (peaks_finish (peaks)) {
+      g_mutex_lock (&sample->ops_mutex);
+      sounddata->peaks = peaks;
+      g_mutex_unlock (&sample->ops_mutex);
+
+      peaks = NULL;
+    }
+
+    peaks_free (peaks);
+  }
+
   sample_set_edit_state (sample, SWEEP_EDIT_STATE_DONE);
 
   return sample;
@@ -415,7 +438,7 @@ sample_load_mad_info (sw_sample * sample, char * pathname)
 
   sample_bank_add(sample);
 
-  if (isnew) {
+  if (isnew && !batch_mode) {
     v = view_new_all (sample, 1.0);
     sample_add_view (sample, v);
   } else {
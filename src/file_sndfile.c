@@ -48,9 +48,11 @@
 #include "file_dialogs.h"
 #include "file_sndfile.h"
 #include "interface.h"
+#include "peakcache.h"
 #include "question_dialogs.h"
 #include "sw_chooser.h"
 #include "view.h"
+#include "batch.h"
 
 extern GtkStyle * style_wb;
 
@@ -521,6 +523,27 @@ sndfile_load_options_dialog_ok_cb (GtkWidget * widget, gpointer data)
 }
 
 
+/*
+ * sndfile_storage_for_format (format)
+ *
+ * choose how to hold data of the given libsndfile format in memory.
+ * Integer PCM of up to 24 bits is kept compact until it is modified.
+ */
+static sw_storage_t
+sndfile_storage_for_format (int format)
+{
+  switch (format & SF_FORMAT_SUBMASK) {
+  case SF_FORMAT_PCM_S8:
+  case SF_FORMAT_PCM_U8:
+  case SF_FORMAT_PCM_16:
+    return SW_STORAGE_INT16;
+  case SF_FORMAT_PCM_24:
+    return SW_STORAGE_INT24;
+  default:
+    return SW_STORAGE_FLOAT;
+  }
+}
+
 static sw_sample *
 sample_load_sf_data (sw_op_instance * inst)
 {
@@ -528,10 +551,13 @@ sample_load_sf_data (sw_op_instance * inst)
   sf_data * sf = (sf_data *)inst->do_data;
   SNDFILE * sndfile = sf->sndfile;
   SF_INFO * sfinfo = sf->sfinfo;
-  float * d;
+  sw_sounddata * sounddata = sample->sounddata;
+  float * d, * fbuf = NULL;
+  gint32 * ibuf = NULL;
   sw_framecount_t remaining, n, run_total;
   sw_framecount_t cframes;
   gint percent;
+  sw_peaks * peaks = NULL;
 
   struct stat statbuf;
 
@@ -539,10 +565,20 @@ sample_load_sf_data (sw_op_instance * inst)
 
   sf_command (sndfile, SFC_SET_NORM_FLOAT, NULL, SF_TRUE) ;
 
+  /* If no cached peaks were found on open, build them as we go */
+  if (sample->sounddata->peaks == NULL)
+    peaks = peaks_new (sfinfo->channels, sfinfo->frames);
+
   remaining = sfinfo->frames;
   run_total = 0;
 
-  d = sample->sounddata->data;
+  d = sounddata->data;
+
+  if (sounddata->storage != SW_STORAGE_FLOAT) {
+    ibuf = g_malloc (BUFFER_LEN * sfinfo->channels * sizeof (gint32));
+    if (peaks)
+      fbuf = g_malloc (BUFFER_LEN * sfinfo->channels * sizeof (float));
+  }
 
   cframes = sfinfo->frames / 100;
   if (cframes == 0) cframes = 1;
@@ -553,8 +589,20 @@ sample_load_sf_data (sw_op_instance * inst)
     if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
       active = FALSE;
     } else {
-      n = MIN (remaining, 1024);
-      n = sf_readf_float (sndfile, d, n);
+      n = MIN (remaining, BUFFER_LEN);
+
+      if (ibuf) {
+	n = sf_readf_int (sndfile, ibuf, n);
+	sounddata_compact_store_int (sounddata, run_total, ibuf, n);
+	if (peaks) {
+	  sounddata_copy_frames (sounddata, run_total, n, fbuf);
+	  peaks_add_frames (peaks, fbuf, n);
+	}
+      } else {
+	n = sf_readf_float (sndfile, d, n);
+	if (peaks) peaks_add_frames (peaks, d, n);
+	d += (n * sfinfo->channels);
+      }
 
       if (n == 0) {
 	sweep_sndfile_perror (sndfile, sample->pathname);
@@ -563,8 +611,6 @@ sample_load_sf_data (sw_op_instance * inst)
 
       remaining -= n;
 
-      d += (n * sfinfo->channels);
-
       run_total += n;
       percent = run_total / cframes;
       sample_set_progress_percent (sample, percent);
@@ -575,13 +621,28 @@ sample_load_sf_data (sw_op_instance * inst)
 
   sf_close (sndfile) ;
 
+  g_free (ibuf);
+  g_free (fbuf);
+
   if (remaining <= 0) {
     stat (sample->pathname, &statbuf);
     sample->last_mtime = statbuf.st_mtime;
     sample->edit_ignore_mtime = FALSE;
     sample->modified = FALSE;
+
+    if (peaks_finish (peaks)) {
+      peaks_cache_write (sample->pathname, peaks);
+
+      g_mutex_lock (&sample->ops_mutex);
+      sample->sounddata->peaks = peaks;
+      g_mutex_unlock (&sample->ops_mutex);
+
+      peaks = NULL;
+    }
   }
 
+  peaks_free (peaks);
+
   sample_set_edit_state (sample, SWEEP_EDIT_STATE_DONE);
 
   return sample;
@@ -602,6 +663,7 @@ _sndfile_sample_load (sw_sample * sample, gchar * pathname, SF_INFO * sfinfo,
 		      gboolean try_raw)
 {
   SNDFILE * sndfile;
+  sw_sounddata * sounddata;
   const char * errstr;
   char buf[128];
   gchar message [256];
@@ -632,8 +694,10 @@ _sndfile_sample_load (sw_sample * sample, gchar * pathname, SF_INFO * sfinfo,
     }
 
     errstr = sf_strerror (NULL);
-    if (!strcmp (errstr, RAW_ERR_STR_1) ||
-	!strcmp (errstr, RAW_ERR_STR_2)) {
+    /* Raw data can only be loaded by asking what it holds */
+    if (!batch_mode &&
+	(!strcmp (errstr, RAW_ERR_STR_1) ||
+	 !strcmp (errstr, RAW_ERR_STR_2))) {
 
       so = g_malloc0 (sizeof(*so));
       so->saving = FALSE;
@@ -672,27 +736,46 @@ _sndfile_sample_load (sw_sample * sample, gchar * pathname, SF_INFO * sfinfo,
     return NULL;
   }
 
+  /* Allocate the new data before touching the sample, so that a
+   * reload which fails leaves the sample as it was */
+  sounddata =
+    sounddata_new_compact (sfinfo->channels, sfinfo->samplerate,
+			   (sw_framecount_t)sfinfo->frames,
+			   sndfile_storage_for_format (sfinfo->format));
+
+  if (sounddata == NULL) {
+    sf_close (sndfile);
+    g_free (sfinfo);
+    return NULL;
+  }
+
   if (sample == NULL) {
     sample = sample_new_empty(pathname, sfinfo->channels, sfinfo->samplerate,
-			      (sw_framecount_t)sfinfo->frames);
-  } else {
-    sounddata_destroy (sample->sounddata);
-    sample->sounddata =
-      sounddata_new_empty (sfinfo->channels, sfinfo->samplerate,
-			   (sw_framecount_t)sfinfo->frames);
+			      0);
   }
 
   if(!sample) {
+    sounddata_destroy (sounddata);
+    sf_close (sndfile);
     g_free (sfinfo);
     return NULL;
   }
 
+  sounddata_destroy (sample->sounddata);
+  sample->sounddata = sounddata;
+
+  /* Pick up a cached overview so the views can be drawn before
+   * the data has been read in */
+  sample->sounddata->peaks =
+    peaks_cache_read (pathname, sfinfo->channels,
+		      (sw_framecount_t)sfinfo->frames);
+
   sample->file_method = SWEEP_FILE_METHOD_LIBSNDFILE;
   sample->file_info = sfinfo;
 
   sample_bank_add(sample);
 
-  if (isnew) {
+  if (isnew && !batch_mode) {
     v = view_new_all (sample, 1.0);
     sample_add_view (sample, v);
   } else {
@@ -736,7 +819,8 @@ sndfile_sample_save_thread (sw_op_instance * inst)
   SNDFILE *sndfile;
   SF_INFO * sfinfo;
   sw_format * format;
-  float * fbuf, * d;
+  float * fbuf, * rbuf;
+  const float * d;
   sw_framecount_t nwritten = 0, len, n;
   sw_framecount_t cframes;
   int i, j;
@@ -775,21 +859,23 @@ sndfile_sample_save_thread (sw_op_instance * inst)
   cframes = sfinfo->frames / 100;
   if (cframes == 0) cframes = 1;
 
+  /* Frames are fetched through rbuf in case the data is held compact */
+  rbuf = (float *)alloca(1024 * sizeof(float) * format->channels);
+
   if ((int)format->channels == sfinfo->channels) {
-    fbuf = sample->sounddata->data;
     while (active && nwritten < sfinfo->frames) {
       g_mutex_lock (&sample->ops_mutex);
 
       if (sample->edit_mode == SWEEP_EDIT_MODE_META) {
 	len = MIN (sfinfo->frames - nwritten, 1024);
-	n = sf_writef_float (sndfile, fbuf, len);
+	d = sounddata_read_frames (sample->sounddata, nwritten, len, rbuf);
+	n = sf_writef_float (sndfile, d, len);
 
 	if (n == 0) {
 	  sweep_sndfile_perror (sndfile, pathname);
 	  active = FALSE;
 	}
 
-	fbuf += n * sfinfo->channels;
 	nwritten += n;
 	percent = nwritten / cframes;
 	sample_set_progress_percent (sample, percent);
@@ -802,12 +888,12 @@ sndfile_sample_save_thread (sw_op_instance * inst)
   } else if (format->channels == 1 && sfinfo->channels == 2) {
     /* Duplicate mono to stereo */
     fbuf = (float *)alloca(1024 * sizeof(float));
-    d = sample->sounddata->data;
     while (active && nwritten < sfinfo->frames) {
       g_mutex_lock (&sample->ops_mutex);
 
       if (sample->edit_mode == SWEEP_EDIT_MODE_META) {
 	len = MIN (sfinfo->frames - nwritten, 512);
+	d = sounddata_read_frames (sample->sounddata, nwritten, len, rbuf);
 	for (i = 0; i < len; i++) {
 	  fbuf[i*2] = fbuf[i*2+1] = *d++;
 	}
@@ -830,12 +916,12 @@ sndfile_sample_save_thread (sw_op_instance * inst)
   } else if (format->channels == 2 && sfinfo->channels == 1) {
     /* Mix down stereo to mono */
     fbuf = (float *)alloca(1024 * sizeof(float));
-    d = sample->sounddata->data;
     while (active && nwritten < sfinfo->frames) {
       g_mutex_lock (&sample->ops_mutex);
 
       if (sample->edit_mode == SWEEP_EDIT_MODE_META) {
 	len = MIN (sfinfo->frames - nwritten, 1024);
+	d = sounddata_read_frames (sample->sounddata, nwritten, len, rbuf);
 	for (i = 0; i < len; i++) {
 	  fbuf[i] = *d++;
 	  fbuf[i] += *d++;
@@ -864,12 +950,12 @@ sndfile_sample_save_thread (sw_op_instance * inst)
     /* Copy corresponding channels as much as possible */
     fbuf = (float *)alloca(buf_size);
     memset (fbuf, 0, buf_size);
-    d = sample->sounddata->data;
     while (active && nwritten < sfinfo->frames) {
       g_mutex_lock (&sample->ops_mutex);
 
       if (sample->edit_mode == SWEEP_EDIT_MODE_META) {
 	len = MIN (sfinfo->frames - nwritten, 1024);
+	d = sounddata_read_frames (sample->sounddata, nwritten, len, rbuf);
 	for (i = 0; i < len; i++) {
 	  for (j = 0; j < min_channels; j++) {
 	    fbuf[i*sfinfo->channels + j] = d[j];
@@ -932,3 +1018,41 @@ sndfile_sample_save (sw_sample * sample, gchar * pathname)
 
   return 0;
 }
+
+/*
+ * sndfile_sample_save_format (sample, pathname)
+ *
+ * saves sample to pathname in the libsndfile format sample->file_format
+ * without asking for save options. The encoding in sample->file_info is
+ * kept if that format can hold it, else 16 bit PCM is used.
+ */
+int
+sndfile_sample_save_format (sw_sample * sample, gchar * pathname)
+{
+  sw_format * format = sample->sounddata->format;
+  SF_INFO * sfinfo, * old_sfinfo = (SF_INFO *)sample->file_info;
+  int major = sample->file_format & SF_FORMAT_TYPEMASK;
+
+  sfinfo = g_malloc0 (sizeof (SF_INFO));
+  sfinfo->samplerate = (int)format->rate;
+  sfinfo->channels = (int)format->channels;
+
+  if (old_sfinfo != NULL)
+    sfinfo->format = major | (old_sfinfo->format & SF_FORMAT_SUBMASK);
+
+  if (old_sfinfo == NULL || !sf_format_check (sfinfo))
+    sfinfo->format = major | SF_FORMAT_PCM_16;
+
+  if (!sf_format_check (sfinfo)) {
+    info_dialog_new (_("Unsupported format"), NULL,
+		     _("%s:\nCannot write %d channels at %d Hz in this format"),
+		     pathname, sfinfo->channels, sfinfo->samplerate);
+    g_free (sfinfo);
+    return -1;
+  }
+
+  g_free (old_sfinfo);
+  sample->file_info = sfinfo;
+
+  return sndfile_sample_save (sample, pathname);
+}
@@ -32,6 +32,9 @@ sndfile_sample_load (gchar * pathname, gboolean try_raw);
 int
 sndfile_sample_save(sw_sample * s, gchar * pathname);
 
+int
+sndfile_sample_save_format (sw_sample * sample, gchar * pathname);
+
 int
 sndfile_save_options_dialog (sw_sample * sample, gchar * pathname);
 
@@ -97,10 +97,12 @@
 #include "interface.h"
 #include "file_dialogs.h"
 #include "file_sndfile.h"
+#include "peakcache.h"
 #include "question_dialogs.h"
 #include "preferences.h"
 #include "print.h"
 #include "view.h"
+#include "batch.h"
 
 #include "../pixmaps/xifish.xpm"
 #include "../pixmaps/speex_logo.xpm"
@@ -502,6 +504,26 @@ sample_load_speex_data (sw_op_instance * inst)
     sample->last_mtime = statbuf.st_mtime;
     sample->edit_ignore_mtime = FALSE;
     sample->modified = FALSE;
+
+    /* The length is only known once the stream has been decoded, so
+     * the overview is built from the decoded data rather than as we go */
+    if (sample->sounddata->peaks == NULL) {
+      sw_sounddata * sounddata = sample->sounddata;
+      sw_peaks * peaks;
+
+      peaks = peaks_new (channels, frames_decoded);
+      if (peaks) peaks_add_frames (peaks, sounddata->data, frames_decoded);
+
+      if (peaks_finish (peaks)) {
+	g_mutex_lock (&sample->ops_mutex);
+	sounddata->peaks = peaks;
+	g_mutex_unlock (&sample->ops_mutex);
+
+	peaks = NULL;
+      }
+
+      peaks_free (peaks);
+    }
   }
 
   sample_set_edit_state (sample, SWEEP_EDIT_STATE_DONE);
@@ -561,7 +583,7 @@ sample_load_speex_info (sw_sample * sample, char * pathname)
 
   sample_bank_add(sample);
 
-  if (isnew) {
+  if (isnew && !batch_mode) {
     v = view_new_all (sample, 1.0);
     sample_add_view (sample, v);
   } else {
@@ -728,6 +750,9 @@ speex_sample_save_thread (sw_op_instance * inst)
 
   if (sample == NULL) return -1;
 
+  /* The encoder reads the data as float */
+  if (!sample_promote_data (sample)) return -1;
+
   so = (speex_save_options *)sample->file_info;
 
   format = sample->sounddata->format;
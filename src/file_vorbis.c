@@ -94,10 +94,12 @@
 #include "interface.h"
 #include "file_dialogs.h"
 #include "file_sndfile.h"
+#include "peakcache.h"
 #include "question_dialogs.h"
 #include "preferences.h"
 #include "print.h"
 #include "view.h"
+#include "batch.h"
 
 #include "../pixmaps/white-ogg.xpm"
 #include "../pixmaps/vorbisword2.xpm"
@@ -166,6 +168,8 @@ sample_load_vorbis_data (sw_op_instance * inst)
 
   struct stat statbuf;
 
+  sw_peaks * peaks = NULL;
+
   gboolean active = TRUE;
 
   channels = sample->sounddata->format->channels;
@@ -173,6 +177,10 @@ sample_load_vorbis_data (sw_op_instance * inst)
   remaining = sample->sounddata->nr_frames;
   run_total = 0;
 
+  /* If no cached peaks were found on open, build them as we go */
+  if (sample->sounddata->peaks == NULL)
+    peaks = peaks_new (channels, remaining);
+
   d = sample->sounddata->data;
 
   cframes = remaining / 100;
@@ -205,6 +213,8 @@ sample_load_vorbis_data (sw_op_instance * inst)
 	  }
 	}
 
+	if (peaks) peaks_add_frames (peaks, d, n);
+
 	d += (n * channels);
 
 	remaining -= n;
@@ -225,6 +235,18 @@ sample_load_vorbis_data (sw_op_instance * inst)
   sample->edit_ignore_mtime = FALSE;
   sample->modified = FALSE;
 
+  if (peaks_finish (peaks)) {
+    peaks_cache_write (sample->pathname, peaks);
+
+    g_mutex_lock (&sample->ops_mutex);
+    sample->sounddata->peaks = peaks;
+    g_mutex_unlock (&sample->ops_mutex);
+
+    peaks = NULL;
+  }
+
+  peaks_free (peaks);
+
   sample_set_edit_state (sample, SWEEP_EDIT_STATE_DONE);
 
   return sample;
@@ -308,9 +330,13 @@ sample_load_vorbis_info (sw_sample * sample, char * pathname)
   sample->file_method = SWEEP_FILE_METHOD_OGGVORBIS;
   sample->file_info = vf;
 
+  sample->sounddata->peaks =
+    peaks_cache_read (pathname, vi->channels,
+		      (sw_framecount_t) ov_pcm_total (vf, -1));
+
   sample_bank_add(sample);
 
-  if (isnew) {
+  if (isnew && !batch_mode) {
     v = view_new_all (sample, 1.0);
     sample_add_view (sample, v);
   } else {
@@ -427,6 +453,9 @@ vorbis_sample_save_thread (sw_op_instance * inst)
 
   if (sample == NULL) return -1;
 
+  /* The encoder reads the data as float */
+  if (!sample_promote_data (sample)) return -1;
+
   so = (vorbis_save_options *)sample->file_info;
 
   format = sample->sounddata->format;
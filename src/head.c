@@ -72,11 +72,11 @@ head_init_repeater (sw_head * head, GtkFunction function, gpointer data)
   g_mutex_lock (&head->head_mutex);
 
   if (head->repeater_tag > 0) {
-    g_source_remove (head->repeater_tag);
+    sweep_timeout_remove (head->repeater_tag);
   }
 
-  head->repeater_tag = g_timeout_add ((guint32)1000/FRAMERATE,
-					function, data);
+  head->repeater_tag = sweep_timeout_add ((guint32)1000/FRAMERATE,
+					  function, data);
 
   g_mutex_unlock (&head->head_mutex);
 }
@@ -90,7 +90,7 @@ hctl_repeater_released_cb (GtkWidget * widget, gpointer data)
   g_mutex_lock (&head->head_mutex);
 
   if (head->repeater_tag > 0) {
-    g_source_remove (head->repeater_tag);
+    sweep_timeout_remove (head->repeater_tag);
     head->repeater_tag = 0;
   }
 
@@ -317,7 +317,9 @@ hctl_destroy_cb (GtkWidget * widget, gpointer data)
 {
   sw_head_controller * hctl = (sw_head_controller *)data;
 
-  hctl->head->controllers = g_list_remove (hctl->head->controllers, hctl);
+  /* The head may have gone with its sample before the view's widgets */
+  if (hctl->head != NULL)
+    hctl->head->controllers = g_list_remove (hctl->head->controllers, hctl);
 
   g_free (hctl);
 }
@@ -607,12 +609,54 @@ head_new (sw_sample * sample, sw_head_t head_type)
   head->rate = 1.0;
   head->mix = 0.0;
 
+  head->punch_in = 0;
+  head->punch_next = -1;
+  head->punch_reverse = FALSE;
+
   head->repeater_tag = -1;
   head->controllers = NULL;
 
+  g_mutex_init (&head->chain_mutex);
+  head->processors = NULL;
+
+  if (head->type == SWEEP_HEAD_PLAY)
+    head->clock_history = g_new0 (gdouble, PLAY_CLOCK_HISTORY);
+
   return head;
 }
 
+/*
+ * head_destroy (head)
+ *
+ * frees head. No thread may be using it any more; a play head must
+ * first have been given to play_release_head ().
+ */
+void
+head_destroy (sw_head * head)
+{
+  GList * gl;
+  sw_head_controller * hctl;
+
+  if (head == NULL) return;
+
+  if (head->repeater_tag > 0)
+    sweep_timeout_remove (head->repeater_tag);
+
+  for (gl = head->controllers; gl; gl = gl->next) {
+    hctl = (sw_head_controller *)gl->data;
+    hctl->head = NULL;
+  }
+  g_list_free (head->controllers);
+  g_list_free (head->processors);
+
+  g_free (head->clock_history);
+
+  g_mutex_clear (&head->head_mutex);
+  g_mutex_clear (&head->chain_mutex);
+
+  g_free (head);
+}
+
 void
 head_set_scrubbing (sw_head * h, gboolean scrubbing)
 {
@@ -796,45 +840,255 @@ head_set_monitor (sw_head * h, gboolean monitor)
   sample_update_device (h->sample);
 }
 
+/*
+ * head_add_processor (h, processor)
+ *
+ * append processor to the chain applied to audio played by h.
+ */
+void
+head_add_processor (sw_head * h, sw_processor * processor)
+{
+  g_mutex_lock (&h->chain_mutex);
+
+  h->processors = g_list_append (h->processors, processor);
+
+  g_mutex_unlock (&h->chain_mutex);
+}
+
+/*
+ * head_remove_processor (h, processor)
+ *
+ * remove processor from the chain of h. The audio thread holds the
+ * chain while running it, so once this returns processor is no longer
+ * in use and may be destroyed.
+ */
+void
+head_remove_processor (sw_head * h, sw_processor * processor)
+{
+  g_mutex_lock (&h->chain_mutex);
+
+  h->processors = g_list_remove (h->processors, processor);
+
+  g_mutex_unlock (&h->chain_mutex);
+}
+
+/*
+ * head_process (head, buf, count, channels)
+ *
+ * run the chain of head over count frames of buf, which holds
+ * interleaved audio of the given nr. of channels. Processors made for
+ * a different nr. of channels, eg. before the sample was converted,
+ * are passed over.
+ *
+ * Called in the audio thread, which must not wait on the interface: if
+ * the chain is being changed just then, this block goes unprocessed.
+ */
+void
+head_process (sw_head * head, float * buf, sw_framecount_t count,
+	      gint channels)
+{
+  GList * gl;
+  sw_processor * processor;
+
+  if (head->processors == NULL) return;
+
+  if (!g_mutex_trylock (&head->chain_mutex)) return;
+
+  for (gl = head->processors; gl; gl = gl->next) {
+    processor = (sw_processor *)gl->data;
+    if (processor->channels == channels)
+      processor->process (processor, buf, count);
+  }
+
+  g_mutex_unlock (&head->chain_mutex);
+}
+
+/* Length of the crossfades at the punch in and punch out points */
+#define PUNCH_FADE_MS 5
+
+/* Nr. of frames reversed at a time when recording in reverse */
+#define REVERSE_CHUNK 1024
+
+/*
+ * mix_samples (rd, buf, n, mix, gain)
+ *
+ * mixes n samples of buf into rd at constant levels. The common cases
+ * of overwriting and of plain overdubbing get loops of their own. Each
+ * loop handles four samples per iteration, which the compiler turns
+ * into vector instructions.
+ */
+static void
+mix_samples (float * restrict rd, const float * restrict buf, glong n,
+	     gfloat mix, gfloat gain)
+{
+  glong i = 0;
+
+  if (mix == 0.0) {
+    for (; i + 4 <= n; i += 4) {
+      rd[i] = buf[i] * gain;     rd[i+1] = buf[i+1] * gain;
+      rd[i+2] = buf[i+2] * gain; rd[i+3] = buf[i+3] * gain;
+    }
+    for (; i < n; i++) rd[i] = buf[i] * gain;
+  } else if (mix == 1.0 && gain == 1.0) {
+    for (; i + 4 <= n; i += 4) {
+      rd[i] += buf[i];     rd[i+1] += buf[i+1];
+      rd[i+2] += buf[i+2]; rd[i+3] += buf[i+3];
+    }
+    for (; i < n; i++) rd[i] += buf[i];
+  } else {
+    for (; i + 4 <= n; i += 4) {
+      rd[i] = rd[i] * mix + buf[i] * gain;
+      rd[i+1] = rd[i+1] * mix + buf[i+1] * gain;
+      rd[i+2] = rd[i+2] * mix + buf[i+2] * gain;
+      rd[i+3] = rd[i+3] * mix + buf[i+3] * gain;
+    }
+    for (; i < n; i++) rd[i] = rd[i] * mix + buf[i] * gain;
+  }
+}
+
+/*
+ * mix_frames_faded (rd, buf, pos, n, channels, lo, hi, fade, mix, gain)
+ *
+ * mixes n frames of buf into rd, which holds frame pos of the sample,
+ * crossfading from the old sound to the mix over the first fade frames
+ * from lo and back over the last fade frames before hi.
+ */
+static void
+mix_frames_faded (float * rd, const float * buf, sw_framecount_t pos,
+		  sw_framecount_t n, gint channels,
+		  sw_framecount_t lo, sw_framecount_t hi,
+		  sw_framecount_t fade, gfloat mix, gfloat gain)
+{
+  sw_framecount_t i, p;
+  gfloat w, old_level, new_level;
+  gint c;
+
+  for (i = 0; i < n; i++) {
+    p = pos + i;
+    w = (gfloat)MIN (p - lo, hi - 1 - p) / (gfloat)fade;
+    w = CLAMP (w, 0.0, 1.0);
+
+    old_level = 1.0 - w * (1.0 - mix);
+    new_level = w * gain;
+
+    for (c = 0; c < channels; c++) {
+      rd[c] = rd[c] * old_level + buf[c] * new_level;
+    }
+
+    rd += channels;
+    buf += channels;
+  }
+}
+
+/*
+ * head_mix (head, rd, buf, pos, n, lo, hi, fade)
+ *
+ * mixes n frames of buf into rd, which holds frame pos of the sample,
+ * at the mix and gain levels of head. The mix is faded in over the
+ * fade frames from lo and out over those before hi; only the frames
+ * near them are mixed frame by frame.
+ */
+static void
+head_mix (sw_head * head, float * rd, const float * buf,
+	  sw_framecount_t pos, sw_framecount_t n,
+	  sw_framecount_t lo, sw_framecount_t hi, sw_framecount_t fade)
+{
+  gint channels = head->sample->sounddata->format->channels;
+  sw_framecount_t a, b;
+
+  a = CLAMP (lo + fade - pos, 0, n);
+  b = CLAMP (hi - fade - pos, a, n);
+
+  if (a > 0) {
+    mix_frames_faded (rd, buf, pos, a, channels, lo, hi, fade,
+		      head->mix, head->gain);
+  }
+
+  mix_samples (rd + a * channels, buf + a * channels, (b - a) * channels,
+	       head->mix, head->gain);
+
+  if (b < n) {
+    mix_frames_faded (rd + b * channels, buf + b * channels, pos + b,
+		      n - b, channels, lo, hi, fade,
+		      head->mix, head->gain);
+  }
+}
+
+/*
+ * head_write_unrestricted (head, buf, count, start, end)
+ *
+ * writes count frames of buf at the offset of head, moving it on. In
+ * reverse, the frames before the offset are written, last first.
+ *
+ * The mix fades in where the head punched in, which is where recording
+ * started or the head last jumped to. If end > start, the head stops
+ * at the edge of the selection from start to end ahead of it, and the
+ * mix fades out there.
+ */
 static sw_framecount_t
 head_write_unrestricted (sw_head * head, float * buf,
-			 sw_framecount_t count)
+			 sw_framecount_t count,
+			 sw_framecount_t start, sw_framecount_t end)
 {
   sw_sample * sample = head->sample;
   sw_sounddata * sounddata = sample->sounddata;
   sw_format * f = sounddata->format;
-  gpointer d;
-  float * rd;
-  sw_framecount_t i, j, t, b;
+  float * rd, * rbuf;
+  sw_framecount_t pos, i, j, n;
+  sw_framecount_t fade, lo, hi;
+  gint c;
+
+  /* A write that does not carry on from the last one punches in anew */
+  if ((sw_framecount_t)head->offset != head->punch_next ||
+      head->reverse != head->punch_reverse) {
+    head->punch_in = (sw_framecount_t)head->offset;
+    head->punch_reverse = head->reverse;
+  }
 
-  d = sounddata->data +
-    (int)frames_to_bytes (f, head->offset);
-  rd = (float *)d;
+  fade = MAX (1, f->rate * PUNCH_FADE_MS / 1000);
 
   if (head->reverse) {
-    b = 0;
-
-    for (i = 0; i < count; i++) {
-      for (j = 0; j < f->channels; j++) {
-	t = (count-1 - i) * f->channels + j;
-	rd[t] *= head->mix;
-	rd[t] += (buf[b] * head->gain);
-	b++;
+    lo = (end > start) ? start : -fade;
+    hi = head->punch_in;
+  } else {
+    lo = head->punch_in;
+    hi = (end > start) ? end : sounddata->nr_frames + fade;
+  }
+
+  if (head->reverse) {
+    pos = (sw_framecount_t)head->offset - count;
+
+    rbuf = alloca (MIN (count, REVERSE_CHUNK) * f->channels * sizeof (float));
+
+    /* Frame j of buf goes to frame pos + count-1 - j */
+    for (j = 0; j < count; j += n) {
+      n = MIN (count - j, REVERSE_CHUNK);
+
+      for (i = 0; i < n; i++) {
+	for (c = 0; c < f->channels; c++) {
+	  rbuf[i * f->channels + c] = buf[(j + n-1 - i) * f->channels + c];
+	}
       }
+
+      rd = (float *)(sounddata->data +
+		     (int)frames_to_bytes (f, pos + count - j - n));
+      head_mix (head, rd, rbuf, pos + count - j - n, n, lo, hi, fade);
     }
 
     head->offset -= count;
 
   } else {
-    for (i = 0; i < count * f->channels; i++) {
-      rd[i] *= head->mix;
-      rd[i] += (buf[i] * head->gain);
-    }
+    pos = (sw_framecount_t)head->offset;
+
+    rd = (float *)(sounddata->data + (int)frames_to_bytes (f, pos));
+    head_mix (head, rd, buf, pos, count, lo, hi, fade);
 
     head->offset += count;
 
   }
 
+  head->punch_next = (sw_framecount_t)head->offset;
+
   return count;
 }
 
@@ -888,14 +1142,15 @@ head_write (sw_head * head, float * buf, sw_framecount_t count)
 	return written;
       }
     } else {
-      written += head_write_unrestricted (head, buf, n);
+      written += head_write_unrestricted (head, buf, n, sel->sel_start,
+					  sel->sel_end);
       buf += (int)frames_to_samples (f, n);
       remaining -= n;
     }
   }
 
   if (remaining > 0) {
-    written += head_write_unrestricted (head, buf, remaining);
+    written += head_write_unrestricted (head, buf, remaining, 0, 0);
   }
 
   return written;
@@ -25,6 +25,10 @@
 
 #include "sweep_app.h"
 
+/* Nr. of blocks of history kept for the play marker; enough to cover
+ * the largest device buffer */
+#define PLAY_CLOCK_HISTORY 2048
+
 #define HEAD_LOCK(h,e) \
   g_mutex_lock ((h)->head_mutex);    \
   (e);                               \
@@ -42,6 +46,9 @@ head_controller_create (sw_head * head, GtkWidget * window,
 sw_head *
 head_new (sw_sample * sample, sw_head_t head_type);
 
+void
+head_destroy (sw_head * head);
+
 void
 head_set_scrubbing (sw_head * h, gboolean scrubbing);
 
@@ -78,6 +85,16 @@ head_set_offset (sw_head * h, sw_framecount_t offset);
 void
 head_set_monitor (sw_head * h, gboolean monitor);
 
+void
+head_add_processor (sw_head * h, sw_processor * processor);
+
+void
+head_remove_processor (sw_head * h, sw_processor * processor);
+
+void
+head_process (sw_head * head, float * buf, sw_framecount_t count,
+	      gint channels);
+
 sw_framecount_t
 head_read (sw_head * head, float * buf, sw_framecount_t count,
 	   int driver_rate);
@@ -0,0 +1,1037 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Crash recovery journal.
+ *
+ * Every sample with unsaved edits has a journal under ~/.sweep/journal/,
+ * made of two append-only files:
+ *
+ *   <pid>-<n>.log     a record of each edit, and periodic checkpoints
+ *   <pid>-<n>.chunks  sample data referred to by the checkpoints
+ *
+ * A checkpoint describes the whole sample as a list of chunks. Chunk
+ * boundaries are chosen from the content (with a rolling hash), so that
+ * an edit only changes the chunks it touches even if it shifts all the
+ * data after it, and chunks already in the journal are not written
+ * again. Only the data modified since the last checkpoint is read: the
+ * chunks before it are kept, and the chunks after it are kept from the
+ * first boundary past it which the last checkpoint also had. An
+ * autosave therefore reads and writes roughly as much as was edited.
+ *
+ * Every record carries a checksum; a record torn by a crash is ignored
+ * and recovery uses the last complete checkpoint. The journal is removed
+ * when the sample is saved or closed. The log is locked for as long as
+ * its journal is open, so journals left unlocked by a process that has
+ * gone are offered for recovery at startup.
+ *
+ * The files are in native byte order, as they are only ever read back
+ * on the machine that wrote them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include <sweep/sweep_i18n.h>
+#include <sweep/sweep_types.h>
+#include <sweep/sweep_sample.h>
+#include <sweep/sweep_sounddata.h>
+#include <sweep/sweep_undo.h>
+#include <sweep/sweep_analysis.h>
+
+#include "sweep_app.h"
+#include "journal.h"
+#include "question_dialogs.h"
+#include "sample.h"
+#include "view.h"
+#include "batch.h"
+
+/*#define DEBUG*/
+
+#define JOURNAL_DIR_MODE 0700
+
+#define JOURNAL_MAGIC 0x4c4a5753 /* "SWJL" */
+#define JOURNAL_VERSION 1
+
+#define JOURNAL_RECORD_HEADER 1
+#define JOURNAL_RECORD_EDIT 2
+#define JOURNAL_RECORD_CHECKPOINT 3
+
+/* Limits on chunk length (frames); boundaries fall on average every
+ * (JOURNAL_CHUNK_MASK + 1) frames between these */
+#define JOURNAL_CHUNK_MIN 4096
+#define JOURNAL_CHUNK_MAX 262144
+#define JOURNAL_CHUNK_MASK 0xffff
+
+/* Nr. of frames read from the sample at a time */
+#define JOURNAL_BUFFER_LEN 16384
+
+typedef struct {
+  guint64 hash;
+  guint64 offset; /* byte offset in the chunks file */
+  guint32 nr_frames;
+} sw_journal_chunk;
+
+struct _sw_journal {
+  gchar * log_path;
+  gchar * chunks_path;
+  FILE * log;
+  FILE * chunks; /* read back to compare chunks whose hashes match */
+  guint64 chunks_size;
+  GHashTable * chunk_index; /* hash -> sw_journal_chunk */
+  gfloat * vbuf; /* for reading back chunks */
+
+  guint edits; /* nr. of edits recorded */
+  guint checkpoint_edits; /* value of edits at the last checkpoint */
+
+  GArray * checkpoint; /* sw_journal_chunk of the last checkpoint */
+  sw_sounddata * checkpoint_sounddata; /* the data it was taken of */
+  sw_framecount_t checkpoint_nr_frames;
+};
+
+static guint64 gear[256];
+static gint journal_serial = 0;
+
+static void
+journal_init_gear (void)
+{
+  guint64 x = 0x9e3779b97f4a7c15ULL;
+  guint64 z;
+  gint i;
+
+  if (gear[0] != 0) return;
+
+  /* splitmix64, so that chunking is the same on every run */
+  for (i = 0; i < 256; i++) {
+    z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    gear[i] = z ^ (z >> 31);
+  }
+}
+
+static guint32
+journal_checksum (const guint8 * p, guint32 len)
+{
+  guint32 a = 1, b = 0;
+  guint32 i;
+
+  /* Adler-32 */
+  for (i = 0; i < len; i++) {
+    a = (a + p[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+
+  return (b << 16) | a;
+}
+
+static gchar *
+journal_dirname (void)
+{
+  return g_strconcat (g_get_home_dir (), "/.sweep/journal", NULL);
+}
+
+/* Record I/O */
+
+static gboolean
+journal_write_record (FILE * f, guint32 type, GByteArray * payload)
+{
+  guint32 header[3], sum;
+
+  header[0] = JOURNAL_MAGIC;
+  header[1] = type;
+  header[2] = payload->len;
+
+  sum = journal_checksum (payload->data, payload->len);
+
+  if (fwrite (header, sizeof (header), 1, f) != 1) return FALSE;
+  if (payload->len > 0 &&
+      fwrite (payload->data, payload->len, 1, f) != 1) return FALSE;
+  if (fwrite (&sum, sizeof (sum), 1, f) != 1) return FALSE;
+
+  return (fflush (f) == 0);
+}
+
+static GByteArray *
+journal_read_record (FILE * f, guint32 * type)
+{
+  GByteArray * payload;
+  guint32 header[3], sum;
+  struct stat statbuf;
+  off_t pos;
+
+  if (fread (header, sizeof (header), 1, f) != 1) return NULL;
+  if (header[0] != JOURNAL_MAGIC) return NULL;
+
+  /* Don't trust a length running past the end of the file */
+  if (fstat (fileno (f), &statbuf) == -1 || (pos = ftello (f)) == -1 ||
+      (off_t)header[2] + (off_t)sizeof (sum) > statbuf.st_size - pos)
+    return NULL;
+
+  payload = g_byte_array_sized_new (header[2]);
+  g_byte_array_set_size (payload, header[2]);
+
+  if ((header[2] > 0 && fread (payload->data, header[2], 1, f) != 1) ||
+      fread (&sum, sizeof (sum), 1, f) != 1 ||
+      sum != journal_checksum (payload->data, header[2])) {
+    g_byte_array_free (payload, TRUE);
+    return NULL;
+  }
+
+  *type = header[1];
+
+  return payload;
+}
+
+static void
+put_u32 (GByteArray * b, guint32 v)
+{
+  g_byte_array_append (b, (guint8 *)&v, sizeof (v));
+}
+
+static void
+put_u64 (GByteArray * b, guint64 v)
+{
+  g_byte_array_append (b, (guint8 *)&v, sizeof (v));
+}
+
+static void
+put_string (GByteArray * b, const gchar * s)
+{
+  guint32 len = strlen (s);
+
+  put_u32 (b, len);
+  g_byte_array_append (b, (const guint8 *)s, len);
+}
+
+typedef struct {
+  GByteArray * b;
+  guint pos;
+  gboolean ok;
+} journal_reader;
+
+static gboolean
+get_bytes (journal_reader * r, void * v, guint len)
+{
+  if (!r->ok || r->pos + len > r->b->len) {
+    r->ok = FALSE;
+    memset (v, 0, len);
+    return FALSE;
+  }
+
+  memcpy (v, r->b->data + r->pos, len);
+  r->pos += len;
+
+  return TRUE;
+}
+
+static guint32
+get_u32 (journal_reader * r)
+{
+  guint32 v;
+  get_bytes (r, &v, sizeof (v));
+  return v;
+}
+
+static guint64
+get_u64 (journal_reader * r)
+{
+  guint64 v;
+  get_bytes (r, &v, sizeof (v));
+  return v;
+}
+
+static gchar *
+get_string (journal_reader * r)
+{
+  guint32 len = get_u32 (r);
+  gchar * s;
+
+  if (!r->ok || r->pos + len > r->b->len) {
+    r->ok = FALSE;
+    return g_strdup ("");
+  }
+
+  s = g_strndup ((gchar *)r->b->data + r->pos, len);
+  r->pos += len;
+
+  return s;
+}
+
+/* Journal lifetime */
+
+static sw_journal *
+journal_open (sw_sample * sample)
+{
+  sw_journal * journal;
+  GByteArray * payload;
+  gchar * dirname, * base;
+
+  dirname = journal_dirname ();
+  if (mkdir (dirname, JOURNAL_DIR_MODE) == -1 && errno != EEXIST) {
+    g_free (dirname);
+    return NULL;
+  }
+
+  base = g_strdup_printf ("%s/%d-%d", dirname, (int)getpid (),
+			  journal_serial++);
+  g_free (dirname);
+
+  journal = g_malloc0 (sizeof (sw_journal));
+  journal->log_path = g_strconcat (base, ".log", NULL);
+  journal->chunks_path = g_strconcat (base, ".chunks", NULL);
+  g_free (base);
+
+  journal->log = fopen (journal->log_path, "wb");
+  journal->chunks = fopen (journal->chunks_path, "w+b");
+
+  /* The lock tells journal_scan () that this journal is in use; it is
+   * released by the system however this process ends */
+  if (journal->log == NULL || journal->chunks == NULL ||
+      flock (fileno (journal->log), LOCK_EX | LOCK_NB) == -1) {
+    if (journal->log) fclose (journal->log);
+    if (journal->chunks) fclose (journal->chunks);
+    unlink (journal->log_path);
+    unlink (journal->chunks_path);
+    g_free (journal->log_path);
+    g_free (journal->chunks_path);
+    g_free (journal);
+    return NULL;
+  }
+
+  journal->chunk_index = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+						NULL, g_free);
+
+  payload = g_byte_array_new ();
+  put_u32 (payload, JOURNAL_VERSION);
+  put_u32 (payload, (guint32)getpid ());
+  put_string (payload, sample->pathname);
+  journal_write_record (journal->log, JOURNAL_RECORD_HEADER, payload);
+  g_byte_array_free (payload, TRUE);
+
+  return journal;
+}
+
+/*
+ * journal_discard (sample)
+ *
+ * remove the journal of a sample, once its edits are saved or no
+ * longer wanted. Waits for an autosave in progress to finish.
+ */
+void
+journal_discard (sw_sample * sample)
+{
+  sw_journal * journal;
+
+  g_mutex_lock (&sample->journal_mutex);
+  journal = sample->journal;
+  sample->journal = NULL;
+  g_mutex_unlock (&sample->journal_mutex);
+
+  if (journal == NULL) return;
+
+  /* Unlink before closing, so the files go while still locked */
+  unlink (journal->log_path);
+  unlink (journal->chunks_path);
+  fclose (journal->log);
+  fclose (journal->chunks);
+
+  g_hash_table_destroy (journal->chunk_index);
+  if (journal->checkpoint) g_array_free (journal->checkpoint, TRUE);
+  g_free (journal->vbuf);
+  g_free (journal->log_path);
+  g_free (journal->chunks_path);
+  g_free (journal);
+}
+
+/*
+ * journal_record (sample, description)
+ *
+ * note that an edit has been made to sample, opening a journal for it
+ * if it has none. Called from the ops thread as each edit completes.
+ */
+void
+journal_record (sw_sample * sample, const gchar * description)
+{
+  GByteArray * payload;
+
+  /* Batch edits are never recovered: the input files are left as they were */
+  if (batch_mode) return;
+
+  g_mutex_lock (&sample->journal_mutex);
+
+  if (sample->journal == NULL &&
+      (sample->journal = journal_open (sample)) == NULL) {
+    g_mutex_unlock (&sample->journal_mutex);
+    return;
+  }
+
+  payload = g_byte_array_new ();
+  put_u64 (payload, (guint64)time (NULL));
+  put_u64 (payload, (guint64)sample->sounddata->nr_frames);
+  put_string (payload, description);
+  journal_write_record (sample->journal->log, JOURNAL_RECORD_EDIT, payload);
+  g_byte_array_free (payload, TRUE);
+
+  sample->journal->edits++;
+
+  g_mutex_unlock (&sample->journal_mutex);
+}
+
+/*
+ * journal_needs_checkpoint (sample)
+ *
+ * returns TRUE if sample has edits not yet autosaved. Never waits: a
+ * journal busy with an autosave does not need another.
+ */
+gboolean
+journal_needs_checkpoint (sw_sample * sample)
+{
+  sw_journal * journal;
+  gboolean needs = FALSE;
+
+  if (!g_mutex_trylock (&sample->journal_mutex)) return FALSE;
+
+  journal = sample->journal;
+  needs = (journal != NULL && journal->edits != journal->checkpoint_edits);
+
+  g_mutex_unlock (&sample->journal_mutex);
+
+  return needs;
+}
+
+/* Checkpoints */
+
+static guint64
+journal_chunk_hash (const gfloat * d, guint32 nr_frames, gint channels)
+{
+  const guint32 * w = (const guint32 *)d;
+  guint64 h = 0xcbf29ce484222325ULL ^ ((guint64)channels << 32) ^ nr_frames;
+  gsize i, n = (gsize)nr_frames * channels;
+
+  for (i = 0; i < n; i++) {
+    h = (h ^ w[i]) * 0x100000001b3ULL;
+  }
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+
+  return h;
+}
+
+/*
+ * journal_chunk_matches (journal, chunk, d, nr_frames, channels)
+ *
+ * returns TRUE if the journalled chunk holds the same data as d: equal
+ * hashes are only a hint.
+ */
+static gboolean
+journal_chunk_matches (sw_journal * journal, sw_journal_chunk * chunk,
+		       const gfloat * d, guint32 nr_frames, gint channels)
+{
+  gsize n = (gsize)nr_frames * channels;
+
+  if (chunk->nr_frames != nr_frames) return FALSE;
+
+  if (journal->vbuf == NULL)
+    journal->vbuf = g_malloc (JOURNAL_CHUNK_MAX * channels * sizeof (gfloat));
+
+  return (fseeko (journal->chunks, (off_t)chunk->offset, SEEK_SET) == 0 &&
+	  fread (journal->vbuf, sizeof (gfloat), n, journal->chunks) == n &&
+	  memcmp (journal->vbuf, d, n * sizeof (gfloat)) == 0);
+}
+
+/*
+ * journal_add_chunk (journal, d, nr_frames, channels, chunks)
+ *
+ * append a reference to a chunk of data to the chunk list of a
+ * checkpoint, writing the data out unless it is already journalled.
+ */
+static gboolean
+journal_add_chunk (sw_journal * journal, const gfloat * d, guint32 nr_frames,
+		   gint channels, GArray * chunks)
+{
+  sw_journal_chunk * chunk, new_chunk;
+  guint64 hash;
+  gsize n;
+
+  hash = journal_chunk_hash (d, nr_frames, channels);
+
+  chunk = g_hash_table_lookup (journal->chunk_index, &hash);
+
+  if (chunk != NULL &&
+      journal_chunk_matches (journal, chunk, d, nr_frames, channels)) {
+    g_array_append_val (chunks, *chunk);
+    return TRUE;
+  }
+
+  n = (gsize)nr_frames * channels;
+  if (fseeko (journal->chunks, (off_t)journal->chunks_size, SEEK_SET) != 0 ||
+      fwrite (d, sizeof (gfloat), n, journal->chunks) != n)
+    return FALSE;
+
+  new_chunk.hash = hash;
+  new_chunk.offset = journal->chunks_size;
+  new_chunk.nr_frames = nr_frames;
+
+  /* On a collision the chunk first journalled keeps the index entry */
+  if (chunk == NULL) {
+    chunk = g_malloc (sizeof (sw_journal_chunk));
+    *chunk = new_chunk;
+    g_hash_table_insert (journal->chunk_index, &chunk->hash, chunk);
+  }
+
+  journal->chunks_size += n * sizeof (gfloat);
+
+  g_array_append_val (chunks, new_chunk);
+
+  return TRUE;
+}
+
+/*
+ * journal_keep_head (journal, start, chunks)
+ *
+ * copies into chunks the chunks of the last checkpoint which end at or
+ * before frame start, and returns the frame they end at.
+ */
+static sw_framecount_t
+journal_keep_head (sw_journal * journal, sw_framecount_t start,
+		   GArray * chunks)
+{
+  sw_journal_chunk * chunk;
+  sw_framecount_t pos = 0;
+  guint i;
+
+  for (i = 0; i < journal->checkpoint->len; i++) {
+    chunk = &g_array_index (journal->checkpoint, sw_journal_chunk, i);
+    if (pos + chunk->nr_frames > start) break;
+    g_array_append_val (chunks, *chunk);
+    pos += chunk->nr_frames;
+  }
+
+  return pos;
+}
+
+static void
+do_autosave_thread (sw_op_instance * inst)
+{
+  sw_sample * sample = inst->sample;
+  sw_sounddata * sounddata = sample->sounddata;
+  sw_journal * journal;
+  sw_journal_chunk * chunk;
+  gint channels = sounddata->format->channels;
+  sw_framecount_t nr_frames = sounddata->nr_frames;
+  sw_framecount_t changed_start, changed_tail, tail_start = 0;
+  sw_framecount_t first, offset = 0, n, i, old_pos = 0;
+  const gfloat * d;
+  gfloat * rbuf, * cbuf;
+  guint32 clen = 0;
+  guint64 g = 0;
+  guint32 v;
+  gint c, percent;
+  guint k = 0;
+  GArray * chunks;
+  GByteArray * payload;
+  GList * gl;
+  sw_sel * sel;
+  guint edits;
+  gboolean active = TRUE, incremental, resynced = FALSE, saved = FALSE;
+
+  g_mutex_lock (&sample->journal_mutex);
+
+  if ((journal = sample->journal) == NULL) goto out;
+
+  journal_init_gear ();
+
+  edits = journal->edits;
+
+  sounddata_take_changes (sounddata, &changed_start, &changed_tail);
+
+  rbuf = g_malloc (JOURNAL_BUFFER_LEN * channels * sizeof (gfloat));
+  cbuf = g_malloc (JOURNAL_CHUNK_MAX * channels * sizeof (gfloat));
+  chunks = g_array_new (FALSE, FALSE, sizeof (sw_journal_chunk));
+
+  /* The changes are counted from the last checkpoint only if it was
+   * taken of this same sounddata */
+  incremental = (journal->checkpoint != NULL &&
+		 journal->checkpoint_sounddata == sounddata);
+
+  if (incremental) {
+    /* Chunking can start afresh at any boundary, as the rolling hash
+     * only looks back 64 frames and no boundary falls in the first
+     * JOURNAL_CHUNK_MIN frames of a chunk */
+    offset = journal_keep_head (journal, MIN (changed_start, nr_frames),
+				chunks);
+    k = chunks->len;
+    old_pos = offset;
+    tail_start = nr_frames - changed_tail;
+  }
+
+  first = offset;
+
+  while (active && !resynced && offset < nr_frames) {
+    g_mutex_lock (&sample->ops_mutex);
+
+    /* Give way to anything the user has asked for */
+    if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL ||
+	sample->pending_ops != NULL) {
+      active = FALSE;
+    } else {
+      n = MIN (nr_frames - offset, JOURNAL_BUFFER_LEN);
+      d = sounddata_read_frames (sounddata, offset, n, rbuf);
+
+      for (i = 0; active && !resynced && i < n; i++) {
+	v = 0;
+	for (c = 0; c < channels; c++) {
+	  cbuf[clen * channels + c] = d[i * channels + c];
+	  v ^= ((const guint32 *)d)[i * channels + c];
+	}
+	clen++;
+
+	v ^= v >> 16;
+	v ^= v >> 8;
+	g = (g << 1) + gear[v & 0xff];
+
+	if ((clen >= JOURNAL_CHUNK_MIN && (g & JOURNAL_CHUNK_MASK) == 0) ||
+	    clen == JOURNAL_CHUNK_MAX) {
+	  active = journal_add_chunk (journal, cbuf, clen, channels, chunks);
+	  clen = 0;
+
+	  /* Past the last change, a boundary the last checkpoint also
+	   * had at the same distance from the end is followed by the
+	   * same chunks */
+	  if (active && incremental && offset + i + 1 >= tail_start) {
+	    while (k < journal->checkpoint->len &&
+		   old_pos - journal->checkpoint_nr_frames <
+		   offset + i + 1 - nr_frames) {
+	      chunk = &g_array_index (journal->checkpoint, sw_journal_chunk, k);
+	      old_pos += chunk->nr_frames;
+	      k++;
+	    }
+
+	    if (old_pos - journal->checkpoint_nr_frames ==
+		offset + i + 1 - nr_frames) {
+	      g_array_append_vals (chunks,
+				   &g_array_index (journal->checkpoint,
+						   sw_journal_chunk, k),
+				   journal->checkpoint->len - k);
+	      resynced = TRUE;
+	    }
+	  }
+	}
+      }
+
+      offset += n;
+
+      percent = (offset - first) * 100 / (nr_frames - first);
+      sample_set_progress_percent (sample, percent);
+    }
+
+    g_mutex_unlock (&sample->ops_mutex);
+  }
+
+  if (active && !resynced && clen > 0)
+    active = journal_add_chunk (journal, cbuf, clen, channels, chunks);
+
+  /* The data must be on disk before the checkpoint that refers to it */
+  if (active) {
+    active = (fflush (journal->chunks) == 0 &&
+	      fsync (fileno (journal->chunks)) == 0);
+  }
+
+  if (active) {
+    payload = g_byte_array_new ();
+
+    put_u32 (payload, (guint32)sounddata->format->rate);
+    put_u32 (payload, (guint32)channels);
+    put_u64 (payload, (guint64)nr_frames);
+
+    put_u32 (payload, g_list_length (sounddata->sels));
+    for (gl = sounddata->sels; gl; gl = gl->next) {
+      sel = (sw_sel *)gl->data;
+      put_u64 (payload, (guint64)sel->sel_start);
+      put_u64 (payload, (guint64)sel->sel_end);
+    }
+
+    put_u32 (payload, chunks->len);
+    for (i = 0; i < chunks->len; i++) {
+      chunk = &g_array_index (chunks, sw_journal_chunk, i);
+      put_u64 (payload, chunk->offset);
+      put_u32 (payload, chunk->nr_frames);
+    }
+
+    if (journal_write_record (journal->log, JOURNAL_RECORD_CHECKPOINT,
+			      payload) &&
+	fsync (fileno (journal->log)) == 0) {
+      journal->checkpoint_edits = edits;
+      saved = TRUE;
+    }
+
+    g_byte_array_free (payload, TRUE);
+
+#ifdef DEBUG
+    g_print ("journal %s: checkpoint of %d chunks, read %ld frames, "
+	     "%lu bytes of data\n", journal->log_path, chunks->len,
+	     (long)(offset - first), (unsigned long)journal->chunks_size);
+#endif
+  }
+
+  if (saved) {
+    if (journal->checkpoint) g_array_free (journal->checkpoint, TRUE);
+    journal->checkpoint = chunks;
+    journal->checkpoint_sounddata = sounddata;
+    journal->checkpoint_nr_frames = nr_frames;
+  } else {
+    g_array_free (chunks, TRUE);
+    sounddata_restore_changes (sounddata, changed_start, changed_tail);
+  }
+
+  g_free (cbuf);
+  g_free (rbuf);
+
+ out:
+  g_mutex_unlock (&sample->journal_mutex);
+
+  sample_set_edit_state (sample, SWEEP_EDIT_STATE_DONE);
+}
+
+static sw_operation autosave_op = {
+  SWEEP_EDIT_MODE_META,
+  (SweepCallback)do_autosave_thread,
+  (SweepFunction)NULL,
+  (SweepCallback)NULL, /* undo */
+  (SweepFunction)NULL,
+  (SweepCallback)NULL, /* redo */
+  (SweepFunction)NULL
+};
+
+/*
+ * journal_autosave (sample)
+ *
+ * schedule a checkpoint of the current state of sample into its journal.
+ */
+void
+journal_autosave (sw_sample * sample)
+{
+  char buf[128];
+
+  if (!journal_needs_checkpoint (sample)) return;
+
+  g_snprintf (buf, sizeof (buf), _("Autosaving %s"),
+	      g_path_get_basename (sample->pathname));
+
+  schedule_operation (sample, buf, &autosave_op, NULL);
+}
+
+/* Recovery */
+
+typedef struct {
+  FILE * log; /* kept open and locked until recovered or discarded */
+  gchar * log_path;
+  gchar * chunks_path;
+  gchar * pathname;
+  gint rate;
+  gint channels;
+  sw_framecount_t nr_frames;
+  GArray * sels; /* sw_sel */
+  GArray * chunks; /* sw_journal_chunk */
+  guint lost_edits; /* edits made after the last checkpoint */
+} sw_journal_recovery;
+
+static void
+journal_recovery_free (sw_journal_recovery * jr)
+{
+  if (jr->log) fclose (jr->log);
+  g_free (jr->log_path);
+  g_free (jr->chunks_path);
+  g_free (jr->pathname);
+  if (jr->sels) g_array_free (jr->sels, TRUE);
+  if (jr->chunks) g_array_free (jr->chunks, TRUE);
+  g_free (jr);
+}
+
+static void
+journal_recovery_remove (sw_journal_recovery * jr)
+{
+  unlink (jr->log_path);
+  unlink (jr->chunks_path);
+}
+
+/*
+ * journal_scan (log_path)
+ *
+ * read the journal log at log_path. Returns NULL if it is locked, as
+ * it is in use by a running process or being recovered by another, or
+ * has no complete checkpoint (in which case it is removed, as there is
+ * nothing to recover). The log is left locked until the result is
+ * freed.
+ */
+static sw_journal_recovery *
+journal_scan (gchar * log_path)
+{
+  sw_journal_recovery * jr;
+  journal_reader r;
+  FILE * f;
+  GByteArray * payload;
+  guint32 type, nr, i;
+  sw_sel sel;
+  sw_journal_chunk chunk;
+  gboolean have_checkpoint = FALSE;
+
+  if ((f = fopen (log_path, "rb")) == NULL) return NULL;
+
+  /* Leave alone journals of running instances */
+  if (flock (fileno (f), LOCK_EX | LOCK_NB) == -1) {
+    fclose (f);
+    return NULL;
+  }
+
+  if ((payload = journal_read_record (f, &type)) == NULL ||
+      type != JOURNAL_RECORD_HEADER) {
+    if (payload) g_byte_array_free (payload, TRUE);
+    fclose (f);
+    return NULL;
+  }
+
+  r.b = payload; r.pos = 0; r.ok = TRUE;
+
+  if (get_u32 (&r) != JOURNAL_VERSION) {
+    g_byte_array_free (payload, TRUE);
+    fclose (f);
+    return NULL;
+  }
+
+  get_u32 (&r); /* pid of the writer */
+
+  jr = g_malloc0 (sizeof (sw_journal_recovery));
+  jr->log = f;
+  jr->log_path = g_strdup (log_path);
+  jr->chunks_path = g_strdup_printf ("%.*s.chunks",
+				     (int)(strlen (log_path) - strlen (".log")),
+				     log_path);
+  jr->pathname = get_string (&r);
+  g_byte_array_free (payload, TRUE);
+
+  while ((payload = journal_read_record (f, &type)) != NULL) {
+    r.b = payload; r.pos = 0; r.ok = TRUE;
+
+    switch (type) {
+    case JOURNAL_RECORD_EDIT:
+      jr->lost_edits++;
+      break;
+    case JOURNAL_RECORD_CHECKPOINT:
+      if (jr->sels) g_array_free (jr->sels, TRUE);
+      if (jr->chunks) g_array_free (jr->chunks, TRUE);
+
+      jr->rate = get_u32 (&r);
+      jr->channels = get_u32 (&r);
+      jr->nr_frames = get_u64 (&r);
+
+      jr->sels = g_array_new (FALSE, FALSE, sizeof (sw_sel));
+      nr = get_u32 (&r);
+      for (i = 0; r.ok && i < nr; i++) {
+	sel.sel_start = get_u64 (&r);
+	sel.sel_end = get_u64 (&r);
+	g_array_append_val (jr->sels, sel);
+      }
+
+      jr->chunks = g_array_new (FALSE, FALSE, sizeof (sw_journal_chunk));
+      nr = get_u32 (&r);
+      for (i = 0; r.ok && i < nr; i++) {
+	chunk.hash = 0;
+	chunk.offset = get_u64 (&r);
+	chunk.nr_frames = get_u32 (&r);
+	g_array_append_val (jr->chunks, chunk);
+      }
+
+      have_checkpoint = r.ok;
+      jr->lost_edits = 0;
+      break;
+    default:
+      break;
+    }
+
+    g_byte_array_free (payload, TRUE);
+  }
+
+  if (!have_checkpoint) {
+    journal_recovery_remove (jr);
+    journal_recovery_free (jr);
+    return NULL;
+  }
+
+  return jr;
+}
+
+static void
+journal_recover_ok_cb (GtkWidget * widget, gpointer data)
+{
+  sw_journal_recovery * jr = (sw_journal_recovery *)data;
+  sw_sample * sample;
+  sw_view * view;
+  sw_journal_chunk * chunk;
+  gfloat * d;
+  FILE * f;
+  sw_framecount_t pos = 0;
+  gsize n;
+  guint i;
+  gboolean ok = TRUE;
+  struct stat statbuf;
+
+  if ((f = fopen (jr->chunks_path, "rb")) == NULL) {
+    sweep_perror (errno, jr->chunks_path);
+    goto out;
+  }
+
+  sample = sample_new_empty (jr->pathname, jr->channels, jr->rate,
+			     jr->nr_frames);
+
+  if (sample == NULL) {
+    fclose (f);
+    goto out;
+  }
+
+  d = sample->sounddata->data;
+
+  for (i = 0; ok && i < jr->chunks->len; i++) {
+    chunk = &g_array_index (jr->chunks, sw_journal_chunk, i);
+    n = (gsize)chunk->nr_frames * jr->channels;
+
+    ok = (pos + chunk->nr_frames <= jr->nr_frames &&
+	  fseeko (f, (off_t)chunk->offset, SEEK_SET) == 0 &&
+	  fread (d + pos * jr->channels, sizeof (gfloat), n, f) == n);
+
+    pos += chunk->nr_frames;
+  }
+
+  fclose (f);
+
+  if (!ok || pos != jr->nr_frames) {
+    sample_destroy (sample);
+    info_dialog_new (_("Recovery failed"), NULL,
+		     _("The journal of unsaved changes to %s is damaged "
+		       "and could not be recovered."), jr->pathname);
+    goto out;
+  }
+
+  for (i = 0; i < jr->sels->len; i++) {
+    sw_sel * sel = &g_array_index (jr->sels, sw_sel, i);
+    sounddata_add_selection_1 (sample->sounddata, sel->sel_start,
+			       sel->sel_end);
+  }
+
+  if (stat (sample->pathname, &statbuf) == 0)
+    sample->last_mtime = statbuf.st_mtime;
+
+  sample->modified = TRUE;
+
+  sample_bank_add (sample);
+
+  view = view_new_all (sample, 1.0);
+  sample_add_view (sample, view);
+
+  /* Start a new journal, so the recovered data is itself protected
+   * once the next autosave has run */
+  journal_record (sample, _("Recover unsaved changes"));
+  journal_autosave (sample);
+
+ out:
+  journal_recovery_remove (jr);
+  journal_recovery_free (jr);
+}
+
+static void
+journal_recover_discard_cb (GtkWidget * widget, gpointer data)
+{
+  sw_journal_recovery * jr = (sw_journal_recovery *)data;
+
+  journal_recovery_remove (jr);
+  journal_recovery_free (jr);
+}
+
+/*
+ * journal_recover ()
+ *
+ * offer to recover the unsaved edits of any journals left behind by
+ * instances of sweep that did not exit cleanly.
+ */
+void
+journal_recover (void)
+{
+  sw_journal_recovery * jr;
+  gchar * dirname, * log_path;
+  const gchar * name;
+  GDir * dir;
+  gchar buf[1024];
+  gint n;
+
+  dirname = journal_dirname ();
+
+  if ((dir = g_dir_open (dirname, 0, NULL)) == NULL) {
+    g_free (dirname);
+    return;
+  }
+
+  while ((name = g_dir_read_name (dir)) != NULL) {
+    if (!g_str_has_suffix (name, ".log")) continue;
+
+    log_path = g_strconcat (dirname, "/", name, NULL);
+    jr = journal_scan (log_path);
+    g_free (log_path);
+
+    if (jr == NULL) continue;
+
+    n = snprintf (buf, sizeof (buf),
+		  _("Sweep did not exit cleanly while editing\n%s\n\n"
+		    "The changes made up to the last autosave can be "
+		    "recovered."),
+		  jr->pathname);
+
+    if (jr->lost_edits > 0 && n < sizeof (buf)) {
+      snprintf (buf + n, sizeof (buf) - n,
+		_(" %d later edits were not autosaved and are lost."),
+		jr->lost_edits);
+    }
+
+    question_dialog_new (NULL, _("Recover unsaved changes"), buf,
+			 _("Recover"), _("Discard changes"),
+			 G_CALLBACK (journal_recover_ok_cb), jr,
+			 G_CALLBACK (journal_recover_discard_cb), jr,
+			 SWEEP_EDIT_MODE_READY);
+  }
+
+  g_dir_close (dir);
+  g_free (dirname);
+}
@@ -23,10 +23,15 @@
 #endif
 
 #include <stdio.h>
+#include <math.h>
 #include <gtk/gtkmain.h>
 #include <gtk/gtksignal.h>
 #include <gtk/gtk.h>
 
+#include <sweep/sweep_i18n.h>
+#include <sweep/sweep_types.h>
+
+#include "sweep_app.h"
 #include "levelmeter.h"
 
 #define LEVELMETER_DEFAULT_WIDTH 4
@@ -38,6 +43,21 @@
 /* Start of 'high' [red] divisions */
 #define LEVELMETER_DEFAULT_HIGH 7
 
+/* Level shown by each division, in dB; the top one is full scale */
+#define LEVELMETER_DB_PER_DIVISION 6.0
+
+/* Interval between polls of a box's sw_meter, in ms */
+#define LEVELMETER_POLL_INTERVAL 40
+
+/* Divisions the peak hold falls by on each poll */
+#define LEVELMETER_PEAK_FALL 0.25
+
+/* Polls without a fresh reading before polling stops: long enough for
+ * a peak hold to fall all the way, and for a meter just started to
+ * publish its first reading */
+#define LEVELMETER_IDLE_POLLS \
+  (LEVELMETER_DEFAULT_DIVISIONS / LEVELMETER_PEAK_FALL)
+
 /* Local data */
 
 static GtkWidgetClass *parent_class = NULL;
@@ -61,13 +81,22 @@ levelmeter_set_level(LevelMeter * levelmeter, guint level)
   g_return_if_fail(levelmeter != NULL);
   g_return_if_fail(IS_LEVELMETER(levelmeter));
 
-  levelmeter->level = level;
-/*
-  gtk_widget_queue_draw_area(GTK_WIDGET(levelmeter),
-									        gint x,
-                                             gint y,
-                                             gint width,
-                                             gint height) */
+  if (levelmeter->level != level) {
+    levelmeter->level = level;
+    gtk_widget_queue_draw(GTK_WIDGET(levelmeter));
+  }
+}
+
+void
+levelmeter_set_peak(LevelMeter * levelmeter, guint peak)
+{
+  g_return_if_fail(levelmeter != NULL);
+  g_return_if_fail(IS_LEVELMETER(levelmeter));
+
+  if (levelmeter->peak != peak) {
+    levelmeter->peak = peak;
+    gtk_widget_queue_draw(GTK_WIDGET(levelmeter));
+  }
 }
 
 static void
@@ -140,17 +169,13 @@ levelmeter_draw (GtkWidget * widget, GdkRectangle * area)
     levelmeter_style->fg_gc[GTK_STATE_NORMAL] =
       gdk_gc_new(widget->window);
   }
-  gdk_gc_set_foreground(levelmeter_style->fg_gc[GTK_STATE_NORMAL], &col_green);
+  for (i = 1; i <= LEVELMETER_DEFAULT_DIVISIONS; i++) {
+    if (i > LEVELMETER(widget)->level && i != LEVELMETER(widget)->peak)
+      continue;
 
-  for (i = 0; i < LEVELMETER_DEFAULT_HIGH && i <= LEVELMETER(widget)->level; i++) {
-    gdk_draw_rectangle(widget->window, levelmeter_style->fg_gc[widget->state],
-		       TRUE, 0, (LEVELMETER_DEFAULT_DIVISIONS - i) * levelmeter_height, widget->allocation.width, levelmeter_height - 1);
-  }
+    gdk_gc_set_foreground(levelmeter_style->fg_gc[GTK_STATE_NORMAL],
+			  i < LEVELMETER_DEFAULT_HIGH ? &col_green : &col_red);
 
-  gdk_gc_set_foreground(levelmeter_style->fg_gc[GTK_STATE_NORMAL], &col_red);
-
-  for (; i <= LEVELMETER_DEFAULT_DIVISIONS && i <= LEVELMETER(widget)->level;
-       i++) {
     gdk_draw_rectangle(widget->window, levelmeter_style->fg_gc[widget->state],
 		       TRUE, 0, (LEVELMETER_DEFAULT_DIVISIONS - i) * levelmeter_height, widget->allocation.width, levelmeter_height - 1);
   }
@@ -220,6 +245,7 @@ static void
 levelmeter_init(LevelMeter * levelmeter)
 {
   levelmeter->level = 0;
+  levelmeter->peak = 0;
 }
 
 GType
@@ -259,3 +285,228 @@ levelmeter_new(guint level)
 
   return GTK_WIDGET(levelmeter);
 }
+
+/*
+ * Level meter boxes.
+ *
+ * All boxes are polled from one timeout, which runs only while
+ * playback or capture is feeding their meters: it is started by
+ * levelmeter_poll_start () and stops itself once the readings have
+ * gone stale and the displays have fallen to rest. Boxes showing the
+ * same sw_meter share each reading of it, as each reading of a
+ * sw_meter starts a new measurement.
+ */
+
+typedef struct _levelmeter_box levelmeter_box;
+
+struct _levelmeter_box {
+  sw_meter * meter;
+  GtkWidget * levelmeters[2];
+  GtkWidget * clip_label;
+  gfloat peak[2]; /* in divisions, falling between peaks */
+  guint clips;
+};
+
+static GList * levelmeter_boxes = NULL;
+static gint levelmeter_poll_tag = 0;
+static gint levelmeter_idle_polls = 0;
+
+static gfloat
+levelmeter_divisions (gfloat level)
+{
+  gfloat d;
+
+  if (level <= 0.0) return 0.0;
+
+  d = LEVELMETER_DEFAULT_DIVISIONS +
+    20.0 * log10 (level) / LEVELMETER_DB_PER_DIVISION;
+
+  return CLAMP (d, 0.0, LEVELMETER_DEFAULT_DIVISIONS);
+}
+
+static void
+levelmeter_box_update (levelmeter_box * box, sw_meter_levels * levels)
+{
+  gint i, c;
+  gfloat peak, rms;
+  guint clips = 0;
+  gchar * text;
+
+  for (i = 0; i < 2; i++) {
+    peak = rms = 0.0;
+
+    if (levels != NULL && levels->channels > 0) {
+      c = MIN (i, levels->channels - 1);
+      peak = levelmeter_divisions (levels->peak[c]);
+      rms = levelmeter_divisions (levels->rms[c]);
+    }
+
+    box->peak[i] = MAX (peak, box->peak[i] - LEVELMETER_PEAK_FALL);
+
+    levelmeter_set_level (LEVELMETER(box->levelmeters[i]), (guint)rms);
+    levelmeter_set_peak (LEVELMETER(box->levelmeters[i]),
+			 (guint)ceil (box->peak[i]));
+  }
+
+  if (levels == NULL) return;
+
+  for (c = 0; c < levels->channels; c++)
+    clips += levels->clips[c];
+
+  if (clips != box->clips) {
+    box->clips = clips;
+
+    if (clips == 0) {
+      gtk_label_set_text (GTK_LABEL(box->clip_label), "");
+    } else {
+      text = g_strdup_printf (_("%u clipped"), clips);
+      gtk_label_set_text (GTK_LABEL(box->clip_label), text);
+      g_free (text);
+    }
+  }
+}
+
+static gint
+levelmeter_poll (gpointer data)
+{
+  GList * gl, * gl2;
+  levelmeter_box * box, * box2;
+  sw_meter_levels levels;
+  gboolean fresh, any_fresh = FALSE;
+
+  for (gl = levelmeter_boxes; gl; gl = gl->next) {
+    box = (levelmeter_box *)gl->data;
+
+    /* Boxes before this one with the same meter have been done already */
+    for (gl2 = levelmeter_boxes; gl2 != gl; gl2 = gl2->next) {
+      box2 = (levelmeter_box *)gl2->data;
+      if (box2->meter == box->meter) break;
+    }
+    if (gl2 != gl) continue;
+
+    fresh = meter_read (box->meter, &levels);
+    if (fresh) any_fresh = TRUE;
+
+    for (gl2 = gl; gl2; gl2 = gl2->next) {
+      box2 = (levelmeter_box *)gl2->data;
+      if (box2->meter == box->meter)
+	levelmeter_box_update (box2, fresh ? &levels : NULL);
+    }
+  }
+
+  if (any_fresh) {
+    levelmeter_idle_polls = 0;
+  } else if (++levelmeter_idle_polls >= LEVELMETER_IDLE_POLLS) {
+    levelmeter_poll_tag = 0;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gint
+levelmeter_poll_start_cb (gpointer data)
+{
+  levelmeter_idle_polls = 0;
+
+  if (levelmeter_boxes != NULL && levelmeter_poll_tag == 0) {
+    levelmeter_poll_tag =
+      sweep_timeout_add ((guint32)LEVELMETER_POLL_INTERVAL,
+			 (GtkFunction)levelmeter_poll, NULL);
+  }
+
+  return FALSE;
+}
+
+/*
+ * levelmeter_poll_start ()
+ *
+ * starts polling the meters shown, if it is not running already. Call
+ * this when playback or capture starts to feed a sw_meter; it may be
+ * called from any thread.
+ */
+void
+levelmeter_poll_start (void)
+{
+  sweep_timeout_add ((guint32)0, (GtkFunction)levelmeter_poll_start_cb, NULL);
+}
+
+static void
+levelmeter_box_destroy_cb (GtkWidget * widget, gpointer data)
+{
+  levelmeter_box * box = (levelmeter_box *)data;
+
+  levelmeter_boxes = g_list_remove (levelmeter_boxes, box);
+  g_free (box);
+
+  if (levelmeter_boxes == NULL && levelmeter_poll_tag > 0) {
+    sweep_timeout_remove (levelmeter_poll_tag);
+    levelmeter_poll_tag = 0;
+  }
+}
+
+static gboolean
+levelmeter_box_press_cb (GtkWidget * widget, GdkEventButton * event,
+			 gpointer data)
+{
+  levelmeter_box * box = (levelmeter_box *)data;
+
+  meter_reset (box->meter);
+
+  box->clips = 0;
+  gtk_label_set_text (GTK_LABEL(box->clip_label), "");
+
+  return TRUE;
+}
+
+GtkWidget *
+levelmeter_box_new (sw_meter * meter)
+{
+  levelmeter_box * box;
+  GtkWidget * ebox;
+  GtkWidget * hbox;
+  GtkWidget * label;
+  GtkTooltips * tooltips;
+  gint i;
+
+  g_return_val_if_fail (meter != NULL, NULL);
+
+  box = g_malloc0 (sizeof (levelmeter_box));
+  box->meter = meter;
+
+  ebox = gtk_event_box_new ();
+  gtk_widget_add_events (ebox, GDK_BUTTON_PRESS_MASK);
+
+  g_signal_connect (G_OBJECT(ebox), "destroy",
+		    G_CALLBACK(levelmeter_box_destroy_cb), box);
+  g_signal_connect (G_OBJECT(ebox), "button_press_event",
+		    G_CALLBACK(levelmeter_box_press_cb), box);
+
+  tooltips = gtk_tooltips_new ();
+  gtk_tooltips_set_tip (tooltips, ebox,
+			_("Levels of the first two channels: the bar "
+			  "shows the RMS level and the single division "
+			  "above it the recent peak, in steps of 6dB. "
+			  "Click to clear the count of clipped samples."),
+			NULL);
+
+  hbox = gtk_hbox_new (FALSE, 2);
+  gtk_container_add (GTK_CONTAINER(ebox), hbox);
+  gtk_widget_show (hbox);
+
+  for (i = 0; i < 2; i++) {
+    box->levelmeters[i] = levelmeter_new (0);
+    gtk_box_pack_start (GTK_BOX(hbox), box->levelmeters[i], FALSE, TRUE, 1);
+    gtk_widget_show (box->levelmeters[i]);
+  }
+
+  label = gtk_label_new ("");
+  gtk_box_pack_start (GTK_BOX(hbox), label, FALSE, FALSE, 2);
+  gtk_widget_show (label);
+
+  box->clip_label = label;
+
+  levelmeter_boxes = g_list_append (levelmeter_boxes, box);
+
+  return ebox;
+}
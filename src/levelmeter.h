@@ -24,6 +24,8 @@
 #include <gdk/gdk.h>
 #include <gtk/gtkwidget.h>
 
+#include "meter.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -39,6 +41,7 @@ struct _LevelMeter {
   GtkWidget widget;
 
   guint level;
+  guint peak; /* a single division held above level */
 };
 
 struct _LevelMeterClass {
@@ -49,6 +52,13 @@ GtkWidget *levelmeter_new(guint state);
 GType levelmeter_get_type(void);
 guint levelmeter_get_level(LevelMeter * levelmeter);
 void levelmeter_set_level(LevelMeter * levelmeter, guint level);
+void levelmeter_set_peak(LevelMeter * levelmeter, guint peak);
+
+/* A pair of meters showing the RMS and peak levels of a sw_meter */
+GtkWidget *levelmeter_box_new(sw_meter * meter);
+
+/* Start polling the boxes' meters, from any thread, as they are fed */
+void levelmeter_poll_start(void);
 
 #ifdef __cplusplus
 }
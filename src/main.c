@@ -45,6 +45,9 @@
 #include "callbacks.h"
 #include "question_dialogs.h"
 #include "play.h"
+#include "journal.h"
+#include "startup.h"
+#include "batch.h"
 
 extern void sweep_timeouts_init (void);
 extern gboolean ignore_failed_tdb_lock;
@@ -86,6 +89,8 @@ initial_sample_ask (gpointer data)
 		       _("Create new file"), _("Load existing file"),
 		       G_CALLBACK (sample_new_empty_cb), NULL, G_CALLBACK (sample_load_cb), NULL, 0);
 
+  startup_trace_first_window ();
+
   return FALSE;
 }
 
@@ -107,11 +112,18 @@ main (int argc, char *argv[])
   gchar *display_env;
 #endif
 
+  startup_trace_init ();
+
 #ifdef ENABLE_NLS
   bindtextdomain (PACKAGE, PACKAGE_LOCALE_DIR);
   textdomain (PACKAGE);
 #endif
 
+  /* Batch mode runs without a display */
+  if (batch_requested (argc, argv)) {
+    exit (batch_main (argc, argv));
+  }
+
   gtk_set_locale ();
 
 #ifdef DEVEL_CODE
@@ -122,6 +134,8 @@ main (int argc, char *argv[])
 
   gtk_init (&argc, &argv);
 
+  startup_trace ("gtk initialised");
+
 #ifdef HAVE_PUTENV
   display_env = g_strconcat ("DISPLAY=", gdk_get_display (), NULL);
   putenv (display_env);
@@ -174,6 +188,10 @@ main (int argc, char *argv[])
                       "                           preferences file fails.  For use when\n"
                       "                           the users home directory is on an NFS\n"
 	                  "                           file system. (possibly unsafe) \n" ));
+    g_print (_("  --batch <script>         Process the files with the steps in\n"
+	       "                           script, without a display.\n"));
+    g_print (_("  -j --jobs <n>            With --batch, the nr. of files to\n"
+	       "                           process at once.\n"));
 
   }
 
@@ -190,21 +208,29 @@ main (int argc, char *argv[])
 
   /* initialise preferences */
   prefs_init ();
+  startup_trace ("preferences");
 
   /* initialise plugins */
   init_plugins ();
+  startup_trace ("plugins from manifest");
 
   /* initialise cursors */
   init_cursors ();
 
   /* initialise interface components */
   init_ui ();
+  startup_trace ("interface");
 
   /* initialise devices */
   init_devices ();
+  startup_trace ("devices");
 
   /* init playback subsystem */
   init_playback ();
+  startup_trace ("playback");
+
+  /* offer to recover edits lost in a crash */
+  journal_recover ();
 
 
   gtk_main ();
@@ -0,0 +1,249 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Level metering for the audio threads.
+ *
+ * The audio thread accumulates peak, sum of squares and clips over each
+ * buffer it handles, and publishes the totals so far under a sequence
+ * count: the count is odd while the levels are being written and is
+ * bumped again once they are complete. A reader copies the levels and
+ * keeps the copy only if the count was even and unchanged throughout.
+ * Neither side ever blocks; a reader which keeps losing the race just
+ * gives up until its next poll.
+ *
+ * Once a reader has taken a copy it says so, and the audio thread then
+ * starts measuring afresh, so each reading covers everything played or
+ * captured since the one before however often the display polls.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+#include <math.h>
+
+#include <glib.h>
+
+#include "meter.h"
+
+/*#define DEBUG*/
+
+/* Samples at or beyond full scale count as clipped */
+#define METER_CLIP_LEVEL 1.0f
+
+/* Nr. of attempts meter_read () makes before giving up */
+#define METER_READ_TRIES 4
+
+struct _sw_meter {
+  gint seq;      /* odd while levels is being written */
+  gint consumed; /* set by readers: start a new measurement */
+  gint read_seq; /* seq of the last levels read */
+  gint reset;    /* set by meter_reset (): also clear the clip counts */
+
+  sw_meter_levels levels; /* published */
+
+  /* Private to the audio thread */
+  gint channels;
+  gfloat peak[METER_MAX_CHANNELS];
+  gdouble sum_sq[METER_MAX_CHANNELS];
+  guint clips[METER_MAX_CHANNELS];
+  glong nr_frames;
+};
+
+sw_meter *
+meter_new (void)
+{
+  return g_malloc0 (sizeof (sw_meter));
+}
+
+void
+meter_free (sw_meter * meter)
+{
+  g_free (meter);
+}
+
+/*
+ * meter_reset (meter)
+ *
+ * clears the clip counts. This may be called from any thread; the audio
+ * thread picks it up on its next meter_update ().
+ */
+void
+meter_reset (sw_meter * meter)
+{
+  g_atomic_int_set (&meter->reset, TRUE);
+}
+
+/*
+ * measure_lanes (d, n, channels, peak, sum_sq, clips)
+ *
+ * measures n interleaved samples of a buffer whose nr. of channels
+ * divides four, so that each of the four lanes below always sees the
+ * same channel and the lanes can be kept in vector registers.
+ */
+static void
+measure_lanes (const gfloat * restrict d, glong n, gint channels,
+	       gfloat * peak, gdouble * sum_sq, guint * clips)
+{
+  gfloat p[4] = {0.0, 0.0, 0.0, 0.0}, q[4] = {0.0, 0.0, 0.0, 0.0}, x;
+  gint c[4] = {0, 0, 0, 0};
+  glong i;
+  gint k;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    for (k = 0; k < 4; k++) {
+      x = fabsf (d[i+k]);
+      p[k] = MAX (p[k], x);
+      q[k] += x * x;
+      c[k] += (x >= METER_CLIP_LEVEL);
+    }
+  }
+
+  for (k = 0; i < n; i++, k++) {
+    x = fabsf (d[i]);
+    p[k] = MAX (p[k], x);
+    q[k] += x * x;
+    c[k] += (x >= METER_CLIP_LEVEL);
+  }
+
+  for (k = 0; k < 4; k++) {
+    peak[k % channels] = MAX (peak[k % channels], p[k]);
+    sum_sq[k % channels] += q[k];
+    clips[k % channels] += c[k];
+  }
+}
+
+static void
+measure_strided (const gfloat * d, glong n, gint channels,
+		 gfloat * peak, gdouble * sum_sq, guint * clips)
+{
+  gfloat x;
+  glong i;
+  gint k;
+
+  for (i = 0, k = 0; i < n; i++) {
+    x = fabsf (d[i]);
+
+    if (k < METER_MAX_CHANNELS) {
+      peak[k] = MAX (peak[k], x);
+      sum_sq[k] += x * x;
+      clips[k] += (x >= METER_CLIP_LEVEL);
+    }
+
+    if (++k == channels) k = 0;
+  }
+}
+
+/*
+ * meter_update (meter, buf, nr_frames, channels)
+ *
+ * measures nr_frames interleaved frames of buf and publishes the levels
+ * since the last reading. This must only ever be called from one thread
+ * at a time, and never waits.
+ */
+void
+meter_update (sw_meter * meter, const gfloat * buf, glong nr_frames,
+	      gint channels)
+{
+  sw_meter_levels * levels = &meter->levels;
+  gint i, nr_channels;
+
+  if (channels <= 0 || nr_frames <= 0) return;
+
+  if (g_atomic_int_get (&meter->reset)) {
+    g_atomic_int_set (&meter->reset, FALSE);
+    memset (meter->clips, 0, sizeof (meter->clips));
+  }
+
+  if (channels != meter->channels ||
+      g_atomic_int_get (&meter->consumed)) {
+    g_atomic_int_set (&meter->consumed, FALSE);
+    memset (meter->peak, 0, sizeof (meter->peak));
+    memset (meter->sum_sq, 0, sizeof (meter->sum_sq));
+    meter->nr_frames = 0;
+
+    if (channels != meter->channels) {
+      memset (meter->clips, 0, sizeof (meter->clips));
+      meter->channels = channels;
+    }
+  }
+
+  if (channels == 1 || channels == 2 || channels == 4) {
+    measure_lanes (buf, nr_frames * channels, channels,
+		   meter->peak, meter->sum_sq, meter->clips);
+  } else {
+    measure_strided (buf, nr_frames * channels, channels,
+		     meter->peak, meter->sum_sq, meter->clips);
+  }
+
+  meter->nr_frames += nr_frames;
+
+  nr_channels = MIN (channels, METER_MAX_CHANNELS);
+
+  /* Publish. The increments are full barriers, so the levels are
+   * written strictly between them */
+  g_atomic_int_inc (&meter->seq);
+
+  levels->channels = nr_channels;
+  for (i = 0; i < nr_channels; i++) {
+    levels->peak[i] = meter->peak[i];
+    levels->rms[i] = (gfloat)sqrt (meter->sum_sq[i] / meter->nr_frames);
+    levels->clips[i] = meter->clips[i];
+  }
+
+  g_atomic_int_inc (&meter->seq);
+}
+
+/*
+ * meter_read (meter, levels)
+ *
+ * copies the levels measured since the last reading into levels, and
+ * returns TRUE; or returns FALSE without waiting if nothing has been
+ * measured since, or the audio thread kept publishing meanwhile.
+ */
+gboolean
+meter_read (sw_meter * meter, sw_meter_levels * levels)
+{
+  gint seq, tries;
+
+  for (tries = 0; tries < METER_READ_TRIES; tries++) {
+    seq = g_atomic_int_get (&meter->seq);
+    if (seq == g_atomic_int_get (&meter->read_seq)) return FALSE;
+    if (seq & 1) continue;
+
+    memcpy (levels, &meter->levels, sizeof (sw_meter_levels));
+
+    /* Adding nothing is a full barrier, which keeps the copy above
+     * before this second look at the count */
+    if (g_atomic_int_add (&meter->seq, 0) == seq) {
+      g_atomic_int_set (&meter->read_seq, seq);
+      g_atomic_int_set (&meter->consumed, TRUE);
+      return TRUE;
+    }
+  }
+
+#ifdef DEBUG
+  g_print ("meter: gave up reading after %d tries\n", tries);
+#endif
+
+  return FALSE;
+}
@@ -0,0 +1,61 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __METER_H__
+#define __METER_H__
+
+#include <glib.h>
+
+/* Channels beyond this are not metered */
+#define METER_MAX_CHANNELS 8
+
+typedef struct _sw_meter_levels sw_meter_levels;
+
+struct _sw_meter_levels {
+  gint channels;
+  gfloat peak[METER_MAX_CHANNELS]; /* since the last meter_read () */
+  gfloat rms[METER_MAX_CHANNELS];  /* since the last meter_read () */
+  guint clips[METER_MAX_CHANNELS]; /* since the last meter_reset () */
+};
+
+/*
+ * sw_meter: signal levels measured by one audio thread and polled by the
+ * display. Each reading starts a new measurement, so there should only
+ * be one poller per meter. The audio thread never waits on it.
+ */
+typedef struct _sw_meter sw_meter;
+
+sw_meter *
+meter_new (void);
+
+void
+meter_free (sw_meter * meter);
+
+void
+meter_reset (sw_meter * meter);
+
+void
+meter_update (sw_meter * meter, const gfloat * buf, glong nr_frames,
+	      gint channels);
+
+gboolean
+meter_read (sw_meter * meter, sw_meter_levels * levels);
+
+#endif /* __METER_H__ */
@@ -0,0 +1,383 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * The playback mixer.
+ *
+ * Each input pulls frames at its own rate and channel count, and is
+ * converted to the device rate before being added into the device
+ * buffer. Inputs already at the device rate are copied straight
+ * through. Otherwise they are interpolated, linearly or with a cubic
+ * spline, or with one of libsamplerate's sinc converters where that is
+ * available. The gain of an input is ramped across each block, so that
+ * moving its slider does not click. Its channels are mapped onto the
+ * device's: mono goes to every channel, and surplus channels are folded
+ * onto the ones the device has rather than dropped.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#ifdef HAVE_LIBSAMPLERATE
+#include <samplerate.h>
+#endif
+
+#include <sweep/sweep_i18n.h>
+#include <sweep/sweep_types.h>
+
+#include "mixer.h"
+
+/*#define DEBUG*/
+
+/* Nr. of input frames pulled at a time */
+#define MIXER_CHUNK 256
+
+/* Frames of input kept around the position, for cubic interpolation */
+#define MIXER_SPAN 3
+
+struct _sw_mixer_input {
+  gint channels;
+  gint rate;
+  gint out_rate;
+  sw_mixer_quality quality;
+
+  sw_mixer_pull pull;
+  gpointer data;
+
+  gdouble step; /* input frames per output frame */
+  gdouble pos;  /* position of the next output frame in buf */
+  gfloat * buf; /* input frames */
+  glong nr_buffered; /* nr. of frames in buf */
+
+  gfloat * out; /* converted frames, before gain and channel mapping */
+  sw_framecount_t out_size; /* most frames added at once */
+
+  gfloat gain; /* reached at the end of the last block */
+  gboolean started;
+
+#ifdef HAVE_LIBSAMPLERATE
+  SRC_STATE * src;
+#endif
+};
+
+const gchar *
+mixer_quality_name (sw_mixer_quality quality)
+{
+  switch (quality) {
+  case MIXER_QUALITY_LINEAR: return _("Linear (fastest)");
+  case MIXER_QUALITY_CUBIC: return _("Cubic");
+  case MIXER_QUALITY_SINC_FAST: return _("Band limited");
+  case MIXER_QUALITY_SINC_MEDIUM: return _("Band limited (best)");
+  default: break;
+  }
+
+  return NULL;
+}
+
+gboolean
+mixer_quality_available (sw_mixer_quality quality)
+{
+  switch (quality) {
+  case MIXER_QUALITY_LINEAR:
+  case MIXER_QUALITY_CUBIC:
+    return TRUE;
+#ifdef HAVE_LIBSAMPLERATE
+  case MIXER_QUALITY_SINC_FAST:
+  case MIXER_QUALITY_SINC_MEDIUM:
+    return TRUE;
+#endif
+  default:
+    break;
+  }
+
+  return FALSE;
+}
+
+#ifdef HAVE_LIBSAMPLERATE
+static long
+mixer_src_pull (void * cb_data, float ** data)
+{
+  sw_mixer_input * input = (sw_mixer_input *)cb_data;
+
+  input->pull (input->data, input->buf, MIXER_CHUNK);
+  *data = input->buf;
+
+  return MIXER_CHUNK;
+}
+#endif
+
+/*
+ * mixer_input_new (channels, rate, out_rate, quality, pull, data, max_count)
+ *
+ * creates an input pulling from data, for mixer_input_add to add at
+ * most max_count frames of at a time. Everything it needs is allocated
+ * here, so that adding never allocates.
+ */
+sw_mixer_input *
+mixer_input_new (gint channels, gint rate, gint out_rate,
+		 sw_mixer_quality quality, sw_mixer_pull pull, gpointer data,
+		 sw_framecount_t max_count)
+{
+  sw_mixer_input * input;
+#ifdef HAVE_LIBSAMPLERATE
+  int converter, error;
+#endif
+
+  input = g_malloc0 (sizeof (sw_mixer_input));
+
+  input->channels = channels;
+  input->rate = rate;
+  input->out_rate = out_rate;
+  input->quality = quality;
+  input->pull = pull;
+  input->data = data;
+  input->step = (gdouble)rate / (gdouble)out_rate;
+
+  input->buf = g_malloc0 ((MIXER_CHUNK + MIXER_SPAN) * channels *
+			  sizeof (gfloat));
+
+  input->out = g_malloc0 (max_count * channels * sizeof (gfloat));
+  input->out_size = max_count;
+
+#ifdef HAVE_LIBSAMPLERATE
+  if (rate != out_rate && quality >= MIXER_QUALITY_SINC_FAST) {
+    converter = (quality == MIXER_QUALITY_SINC_FAST) ?
+      SRC_SINC_FASTEST : SRC_SINC_MEDIUM_QUALITY;
+
+    input->src = src_callback_new (mixer_src_pull, converter, channels,
+				   &error, input);
+    if (input->src == NULL) {
+      g_warning ("mixer: %s, interpolating instead", src_strerror (error));
+    }
+  }
+#endif
+
+  mixer_input_reset (input);
+
+  return input;
+}
+
+gboolean
+mixer_input_matches (sw_mixer_input * input, gint channels, gint rate,
+		     gint out_rate, sw_mixer_quality quality)
+{
+  return (input->channels == channels && input->rate == rate &&
+	  input->out_rate == out_rate && input->quality == quality);
+}
+
+gpointer
+mixer_input_get_data (sw_mixer_input * input)
+{
+  return input->data;
+}
+
+/*
+ * mixer_input_reset (input)
+ *
+ * forgets the input buffered so far, for when the input jumps.
+ */
+void
+mixer_input_reset (sw_mixer_input * input)
+{
+  /* One frame of silence before the start, for interpolating from */
+  memset (input->buf, 0, input->channels * sizeof (gfloat));
+  input->nr_buffered = 1;
+  input->pos = 1.0;
+
+  input->started = FALSE;
+
+#ifdef HAVE_LIBSAMPLERATE
+  if (input->src) src_reset (input->src);
+#endif
+}
+
+void
+mixer_input_free (sw_mixer_input * input)
+{
+  if (input == NULL) return;
+
+#ifdef HAVE_LIBSAMPLERATE
+  if (input->src) src_delete (input->src);
+#endif
+
+  g_free (input->buf);
+  g_free (input->out);
+  g_free (input);
+}
+
+/*
+ * mixer_input_refill (input)
+ *
+ * pulls more input until there is enough around pos to interpolate,
+ * dropping the frames which are no longer needed.
+ */
+static void
+mixer_input_refill (sw_mixer_input * input)
+{
+  gint c = input->channels;
+  glong first, keep;
+
+  while ((glong)input->pos + 2 >= input->nr_buffered) {
+    first = MIN ((glong)input->pos - 1, input->nr_buffered);
+    keep = input->nr_buffered - first;
+
+    memmove (input->buf, input->buf + first * c, keep * c * sizeof (gfloat));
+    input->nr_buffered = keep;
+    input->pos -= first;
+
+    input->pull (input->data, input->buf + keep * c, MIXER_CHUNK);
+    input->nr_buffered += MIXER_CHUNK;
+  }
+}
+
+static void
+mixer_input_interpolate (sw_mixer_input * input, gfloat * out,
+			 sw_framecount_t count)
+{
+  gint c = input->channels, k;
+  sw_framecount_t i;
+  const gfloat * x;
+  gfloat t, a, b, d;
+  glong n;
+
+  for (i = 0; i < count; i++) {
+    n = (glong)input->pos;
+
+    if (n + 2 >= input->nr_buffered) {
+      mixer_input_refill (input);
+      n = (glong)input->pos;
+    }
+
+    t = (gfloat)(input->pos - n);
+    x = input->buf + n * c;
+
+    if (input->quality == MIXER_QUALITY_LINEAR) {
+      for (k = 0; k < c; k++)
+	out[k] = x[k] + t * (x[c+k] - x[k]);
+    } else {
+      /* Catmull-Rom spline through x[-1], x[0], x[1] and x[2] */
+      for (k = 0; k < c; k++) {
+	a = x[-c+k];
+	b = x[c+k];
+	d = x[2*c+k];
+	out[k] = x[k] + 0.5 * t *
+	  ((b - a) + t * ((2.0 * a - 5.0 * x[k] + 4.0 * b - d) +
+			  t * (3.0 * (x[k] - b) + d - a)));
+      }
+    }
+
+    out += c;
+    input->pos += input->step;
+  }
+}
+
+/*
+ * mixer_add_mapped (src, sc, dest, dc, n, g0, g1)
+ *
+ * adds n frames of src, with sc channels, into dest, with dc channels,
+ * ramping the gain from g0 to g1.
+ */
+static void
+mixer_add_mapped (const gfloat * restrict src, gint sc,
+		  gfloat * restrict dest, gint dc, sw_framecount_t n,
+		  gfloat g0, gfloat g1)
+{
+  gfloat dg = (g1 - g0) / (gfloat)n, g, s;
+  sw_framecount_t i;
+  gint j, k;
+
+  if (sc == dc && g0 == g1) {
+    for (i = 0; i < n * sc; i++)
+      dest[i] += src[i] * g0;
+  } else if (sc == dc) {
+    for (i = 0; i < n; i++) {
+      g = g0 + dg * i;
+      for (k = 0; k < sc; k++)
+	dest[i*dc + k] += src[i*sc + k] * g;
+    }
+  } else if (sc == 1) { /* mono to every channel */
+    for (i = 0; i < n; i++) {
+      s = src[i] * (g0 + dg * i);
+      for (k = 0; k < dc; k++)
+	dest[i*dc + k] += s;
+    }
+  } else if (sc < dc) { /* to the first channels */
+    for (i = 0; i < n; i++) {
+      g = g0 + dg * i;
+      for (j = 0; j < sc; j++)
+	dest[i*dc + j] += src[i*sc + j] * g;
+    }
+  } else { /* fold extra channels round, averaging */
+    for (j = 0; j < sc; j++) {
+      k = j % dc;
+      s = 1.0 / (gfloat)((sc - 1 - k) / dc + 1);
+      for (i = 0; i < n; i++)
+	dest[i*dc + k] += src[i*sc + j] * (g0 + dg * i) * s;
+    }
+  }
+}
+
+/*
+ * mixer_input_add (input, dest, dest_channels, count, gain)
+ *
+ * pulls enough of input for count frames at the device rate, and adds
+ * them into dest at the given gain. count must be no more than the
+ * max_count the input was created with.
+ */
+void
+mixer_input_add (sw_mixer_input * input, gfloat * dest, gint dest_channels,
+		 sw_framecount_t count, gfloat gain)
+{
+  gfloat g0;
+#ifdef HAVE_LIBSAMPLERATE
+  long n;
+#endif
+
+  g_return_if_fail (count <= input->out_size);
+
+  if (input->rate == input->out_rate) {
+    input->pull (input->data, input->out, count);
+#ifdef HAVE_LIBSAMPLERATE
+  } else if (input->src) {
+    n = src_callback_read (input->src,
+			   (double)input->out_rate / (double)input->rate,
+			   count, input->out);
+    if (n < count) {
+      memset (input->out + n * input->channels, 0,
+	      (count - n) * input->channels * sizeof (gfloat));
+    }
+#endif
+  } else {
+    mixer_input_interpolate (input, input->out, count);
+  }
+
+  g0 = input->started ? input->gain : gain;
+
+  mixer_add_mapped (input->out, input->channels, dest, dest_channels,
+		    count, g0, gain);
+
+  input->gain = gain;
+  input->started = TRUE;
+}
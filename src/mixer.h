@@ -0,0 +1,81 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __MIXER_H__
+#define __MIXER_H__
+
+#include <glib.h>
+
+#include <sweep/sweep_types.h>
+
+/* Converters for bringing an input to the device rate */
+typedef enum {
+  MIXER_QUALITY_LINEAR = 0,
+  MIXER_QUALITY_CUBIC,
+  MIXER_QUALITY_SINC_FAST,   /* needs libsamplerate */
+  MIXER_QUALITY_SINC_MEDIUM, /* needs libsamplerate */
+  MIXER_NR_QUALITIES
+} sw_mixer_quality;
+
+#define MIXER_DEFAULT_QUALITY MIXER_QUALITY_CUBIC
+
+/*
+ * sw_mixer_pull: fills buf with count frames of an input at its own
+ * rate and returns count.
+ */
+typedef sw_framecount_t (*sw_mixer_pull) (gpointer data, gfloat * buf,
+					  sw_framecount_t count);
+
+/*
+ * sw_mixer_input: one input to a mix, such as a play head, converted to
+ * the rate and channels of the device it is mixed into. Not thread safe;
+ * it belongs to whichever thread does the mixing.
+ */
+typedef struct _sw_mixer_input sw_mixer_input;
+
+const gchar *
+mixer_quality_name (sw_mixer_quality quality);
+
+gboolean
+mixer_quality_available (sw_mixer_quality quality);
+
+sw_mixer_input *
+mixer_input_new (gint channels, gint rate, gint out_rate,
+		 sw_mixer_quality quality, sw_mixer_pull pull, gpointer data,
+		 sw_framecount_t max_count);
+
+gboolean
+mixer_input_matches (sw_mixer_input * input, gint channels, gint rate,
+		     gint out_rate, sw_mixer_quality quality);
+
+gpointer
+mixer_input_get_data (sw_mixer_input * input);
+
+void
+mixer_input_reset (sw_mixer_input * input);
+
+void
+mixer_input_free (sw_mixer_input * input);
+
+void
+mixer_input_add (sw_mixer_input * input, gfloat * dest, gint dest_channels,
+		 sw_framecount_t count, gfloat gain);
+
+#endif /* __MIXER_H__ */
@@ -0,0 +1,636 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Lossless in-memory compression of idle sample data.
+ *
+ * The data is split into blocks of PACKED_BLOCK_FRAMES frames, and each
+ * channel of each block is coded independently. Channels whose values
+ * are all exact 16 or 24 bit quantities (which includes anything loaded
+ * from an integer PCM file and not since processed) are coded with a
+ * fixed polynomial predictor and Rice coded residuals, in the manner of
+ * FLAC. Anything else is stored verbatim.
+ *
+ * Blocks are decoded on demand into a small cache, so that drawing or
+ * playing a packed sample only decodes the region being used.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <sweep/sweep_i18n.h>
+#include <sweep/sweep_types.h>
+#include <sweep/sweep_typeconvert.h>
+#include <sweep/sweep_sample.h>
+#include <sweep/sweep_sounddata.h>
+#include <sweep/sweep_undo.h>
+
+#include "sweep_app.h"
+#include "packed.h"
+#include "peakcache.h"
+
+/*#define DEBUG*/
+
+/* Nr. of decoded blocks kept per packed sounddata */
+#define PACKED_CACHE_SIZE 4
+
+/* Nr. of residuals sharing one Rice parameter */
+#define PACKED_PARTITION 1024
+
+/* Unary prefixes this long escape to a raw 32 bit value */
+#define PACKED_ESCAPE 32
+
+#define PACKED_METHOD_VERBATIM 0
+#define PACKED_METHOD_RICE 1
+
+typedef struct {
+  guint8 * bytes;
+  gsize nr_bytes;
+} sw_packed_block;
+
+typedef struct {
+  gint block;
+  guint32 last_used;
+  gfloat * frames;
+} sw_packed_cache;
+
+struct _sw_packed {
+  gint channels;
+  sw_framecount_t nr_frames;
+
+  gint nr_blocks;
+  sw_packed_block * blocks;
+
+  GMutex cache_mutex;
+  guint32 cache_clock;
+  sw_packed_cache cache[PACKED_CACHE_SIZE];
+};
+
+/* Bit I/O, MSB first */
+
+typedef struct {
+  guint8 * p;
+  guint64 acc;
+  gint nacc;
+} packed_writer;
+
+typedef struct {
+  const guint8 * p;
+  guint64 acc;
+  gint nacc;
+} packed_reader;
+
+static void
+put_bits (packed_writer * w, guint32 value, gint nbits)
+{
+  w->acc = (w->acc << nbits) | (value & (((guint64)1 << nbits) - 1));
+  w->nacc += nbits;
+
+  while (w->nacc >= 8) {
+    w->nacc -= 8;
+    *w->p++ = (guint8)(w->acc >> w->nacc);
+  }
+}
+
+static void
+put_flush (packed_writer * w)
+{
+  if (w->nacc > 0) {
+    *w->p++ = (guint8)(w->acc << (8 - w->nacc));
+    w->nacc = 0;
+  }
+}
+
+static guint32
+get_bits (packed_reader * r, gint nbits)
+{
+  while (r->nacc < nbits) {
+    r->acc = (r->acc << 8) | *r->p++;
+    r->nacc += 8;
+  }
+
+  r->nacc -= nbits;
+
+  return (guint32)((r->acc >> r->nacc) & (((guint64)1 << nbits) - 1));
+}
+
+static void
+put_rice (packed_writer * w, gint32 residual, gint k)
+{
+  guint32 u = ((guint32)residual << 1) ^ (guint32)(residual >> 31);
+  guint32 q = u >> k;
+
+  if (q < PACKED_ESCAPE) {
+    put_bits (w, (guint32)(((guint64)1 << (q + 1)) - 2), q + 1);
+    if (k > 0) put_bits (w, u, k);
+  } else {
+    put_bits (w, 0xffffffff, PACKED_ESCAPE);
+    put_bits (w, u, 32);
+  }
+}
+
+static gint32
+get_rice (packed_reader * r, gint k)
+{
+  guint32 q = 0, u;
+
+  while (q < PACKED_ESCAPE && get_bits (r, 1)) q++;
+
+  if (q == PACKED_ESCAPE) {
+    u = get_bits (r, 32);
+  } else {
+    u = (q << k) | (k > 0 ? get_bits (r, k) : 0);
+  }
+
+  return (gint32)(u >> 1) ^ -(gint32)(u & 1);
+}
+
+/*
+ * packed_quantise (d, n, stride, x)
+ *
+ * find the smallest integer width (16 or 24 bits) at which the n
+ * samples of d are exact, and store them in x. Returns 0 if they
+ * are not all exact at either width.
+ */
+static gint
+packed_quantise (const gfloat * d, gint n, gint stride, gint32 * x)
+{
+  static const gint widths[] = {16, 24};
+  gfloat scale, v;
+  gint w, i;
+
+  for (w = 0; w < 2; w++) {
+    scale = (gfloat)(1 << (widths[w] - 1));
+
+    for (i = 0; i < n; i++) {
+      v = d[i * stride] * scale;
+      if (v < -scale || v >= scale || v != (gfloat)(gint32)v) break;
+      x[i] = (gint32)v;
+    }
+
+    if (i == n) return widths[w];
+  }
+
+  return 0;
+}
+
+static void
+packed_encode_channel (packed_writer * w, const gfloat * d, gint n,
+		       gint stride, gint32 * x)
+{
+  gint width, order, i, j, k, len;
+  guint64 sum[3] = {0, 0, 0}, usum;
+  gint32 r;
+  guint32 bits;
+
+  if ((width = packed_quantise (d, n, stride, x)) == 0) {
+    put_bits (w, PACKED_METHOD_VERBATIM, 8);
+    for (i = 0; i < n; i++) {
+      memcpy (&bits, &d[i * stride], sizeof (bits));
+      put_bits (w, bits, 32);
+    }
+    return;
+  }
+
+  /* Choose the fixed predictor order with the smallest residuals */
+  for (i = 2; i < n; i++) {
+    sum[0] += ABS (x[i]);
+    sum[1] += ABS (x[i] - x[i-1]);
+    sum[2] += ABS (x[i] - 2*x[i-1] + x[i-2]);
+  }
+
+  order = 0;
+  if (sum[1] < sum[order]) order = 1;
+  if (sum[2] < sum[order]) order = 2;
+  order = MIN (order, n);
+
+  put_bits (w, PACKED_METHOD_RICE, 8);
+  put_bits (w, width, 8);
+  put_bits (w, order, 8);
+
+  for (i = 0; i < order; i++) {
+    put_bits (w, (guint32)x[i], 32);
+  }
+
+  /* Residuals overwrite x from the end, as each needs earlier values */
+  for (i = n - 1; i >= order; i--) {
+    switch (order) {
+    case 2: x[i] = x[i] - 2*x[i-1] + x[i-2]; break;
+    case 1: x[i] = x[i] - x[i-1]; break;
+    default: break;
+    }
+  }
+
+  for (i = order; i < n; i += PACKED_PARTITION) {
+    len = MIN (PACKED_PARTITION, n - i);
+
+    usum = 0;
+    for (j = 0; j < len; j++) {
+      r = x[i+j];
+      usum += ((guint32)r << 1) ^ (guint32)(r >> 31);
+    }
+
+    for (k = 0; k < 30 && ((guint64)len << k) < usum; k++);
+
+    put_bits (w, k, 5);
+    for (j = 0; j < len; j++) {
+      put_rice (w, x[i+j], k);
+    }
+  }
+}
+
+static void
+packed_decode_channel (packed_reader * r, gfloat * d, gint n, gint stride)
+{
+  gint method, width, order, i, j, k, len;
+  gint32 x0 = 0, x1 = 0, x;
+  guint32 bits;
+  gfloat scale;
+
+  method = get_bits (r, 8);
+
+  if (method == PACKED_METHOD_VERBATIM) {
+    for (i = 0; i < n; i++) {
+      bits = get_bits (r, 32);
+      memcpy (&d[i * stride], &bits, sizeof (bits));
+    }
+    return;
+  }
+
+  width = get_bits (r, 8);
+  order = get_bits (r, 8);
+  scale = 1.0f / (gfloat)(1 << (width - 1));
+
+  for (i = 0; i < order; i++) {
+    x = (gint32)get_bits (r, 32);
+    d[i * stride] = x * scale;
+    x1 = x0; x0 = x;
+  }
+
+  for (i = order; i < n; i += PACKED_PARTITION) {
+    len = MIN (PACKED_PARTITION, n - i);
+    k = get_bits (r, 5);
+
+    for (j = i; j < i + len; j++) {
+      x = get_rice (r, k);
+      switch (order) {
+      case 2: x += 2*x0 - x1; break;
+      case 1: x += x0; break;
+      default: break;
+      }
+      d[j * stride] = x * scale;
+      x1 = x0; x0 = x;
+    }
+  }
+}
+
+sw_packed *
+packed_new (sw_format * format, sw_framecount_t nr_frames)
+{
+  sw_packed * packed;
+  gint i;
+
+  packed = g_malloc0 (sizeof (sw_packed));
+
+  packed->channels = format->channels;
+  packed->nr_frames = nr_frames;
+  packed->nr_blocks =
+    (gint)((nr_frames + PACKED_BLOCK_FRAMES - 1) / PACKED_BLOCK_FRAMES);
+  packed->blocks = g_malloc0 (packed->nr_blocks * sizeof (sw_packed_block));
+
+  g_mutex_init (&packed->cache_mutex);
+  for (i = 0; i < PACKED_CACHE_SIZE; i++) {
+    packed->cache[i].block = -1;
+  }
+
+  return packed;
+}
+
+void
+packed_free (sw_packed * packed)
+{
+  gint i;
+
+  if (packed == NULL) return;
+
+  for (i = 0; i < packed->nr_blocks; i++) {
+    g_free (packed->blocks[i].bytes);
+  }
+  g_free (packed->blocks);
+
+  for (i = 0; i < PACKED_CACHE_SIZE; i++) {
+    g_free (packed->cache[i].frames);
+  }
+  g_mutex_clear (&packed->cache_mutex);
+
+  g_free (packed);
+}
+
+gint
+packed_nr_blocks (sw_packed * packed)
+{
+  return packed->nr_blocks;
+}
+
+gsize
+packed_nr_bytes (sw_packed * packed)
+{
+  gsize total = sizeof (sw_packed) + packed->nr_blocks * sizeof (sw_packed_block);
+  gint i;
+
+  for (i = 0; i < packed->nr_blocks; i++) {
+    total += packed->blocks[i].nr_bytes;
+  }
+
+  return total;
+}
+
+static gint
+packed_block_nr_frames (sw_packed * packed, gint block)
+{
+  return (gint)MIN (PACKED_BLOCK_FRAMES,
+		    packed->nr_frames - (sw_framecount_t)block * PACKED_BLOCK_FRAMES);
+}
+
+/*
+ * packed_encode_block (packed, sounddata, block)
+ *
+ * compress one block of sounddata, which must have the same format and
+ * length as packed, into packed.
+ */
+void
+packed_encode_block (sw_packed * packed, sw_sounddata * sounddata, gint block)
+{
+  const gint channels = packed->channels;
+  gint n = packed_block_nr_frames (packed, block);
+  packed_writer w;
+  gfloat * d;
+  gint32 * x;
+  guint8 * bytes;
+  gint c;
+
+  d = g_malloc (n * channels * sizeof (gfloat));
+  x = g_malloc (n * sizeof (gint32));
+
+  /* Worst case is an escaped residual of 64 bits for every sample */
+  bytes = g_malloc ((gsize)n * channels * 8 + channels * 16);
+
+  sounddata_peek_frames (sounddata,
+			 (sw_framecount_t)block * PACKED_BLOCK_FRAMES, n, d);
+
+  w.p = bytes;
+  w.acc = 0;
+  w.nacc = 0;
+
+  for (c = 0; c < channels; c++) {
+    packed_encode_channel (&w, d + c, n, channels, x);
+  }
+  put_flush (&w);
+
+  packed->blocks[block].nr_bytes = w.p - bytes;
+  packed->blocks[block].bytes =
+    g_realloc (bytes, packed->blocks[block].nr_bytes);
+
+  g_free (x);
+  g_free (d);
+}
+
+/*
+ * packed_get_block (packed, block)
+ *
+ * return the decoded frames of a block, decoding it into the least
+ * recently used cache entry if necessary. Call with cache_mutex held.
+ */
+static const gfloat *
+packed_get_block (sw_packed * packed, gint block)
+{
+  sw_packed_cache * pc, * lru = NULL;
+  packed_reader r;
+  gint i, c, n;
+
+  packed->cache_clock++;
+
+  for (i = 0; i < PACKED_CACHE_SIZE; i++) {
+    pc = &packed->cache[i];
+    if (pc->block == block) {
+      pc->last_used = packed->cache_clock;
+      return pc->frames;
+    }
+    if (lru == NULL || pc->last_used < lru->last_used) lru = pc;
+  }
+
+  if (lru->frames == NULL)
+    lru->frames = g_malloc (PACKED_BLOCK_FRAMES * packed->channels *
+			    sizeof (gfloat));
+
+  n = packed_block_nr_frames (packed, block);
+
+  r.p = packed->blocks[block].bytes;
+  r.acc = 0;
+  r.nacc = 0;
+
+  for (c = 0; c < packed->channels; c++) {
+    packed_decode_channel (&r, lru->frames + c, n, packed->channels);
+  }
+
+  lru->block = block;
+  lru->last_used = packed->cache_clock;
+
+  return lru->frames;
+}
+
+gfloat
+packed_get_sample (sw_packed * packed, sw_framecount_t frame, gint channel)
+{
+  const gfloat * d;
+  gfloat v;
+
+  g_mutex_lock (&packed->cache_mutex);
+  d = packed_get_block (packed, (gint)(frame / PACKED_BLOCK_FRAMES));
+  v = d[(frame % PACKED_BLOCK_FRAMES) * packed->channels + channel];
+  g_mutex_unlock (&packed->cache_mutex);
+
+  return v;
+}
+
+void
+packed_copy_frames (sw_packed * packed, sw_framecount_t offset,
+		    sw_framecount_t n, gfloat * buf)
+{
+  const gint channels = packed->channels;
+  const gfloat * d;
+  sw_framecount_t pos, len;
+  gint block;
+
+  while (n > 0) {
+    block = (gint)(offset / PACKED_BLOCK_FRAMES);
+    pos = offset % PACKED_BLOCK_FRAMES;
+    len = MIN (n, PACKED_BLOCK_FRAMES - pos);
+
+    g_mutex_lock (&packed->cache_mutex);
+    d = packed_get_block (packed, block);
+    memcpy (buf, d + pos * channels, len * channels * sizeof (gfloat));
+    g_mutex_unlock (&packed->cache_mutex);
+
+    buf += len * channels;
+    offset += len;
+    n -= len;
+  }
+}
+
+static gsize
+sounddata_nr_bytes (sw_sounddata * sounddata)
+{
+  gsize samples = sounddata->nr_frames * sounddata->format->channels;
+
+  switch (sounddata->storage) {
+  case SW_STORAGE_INT16:
+    return samples * 2;
+  case SW_STORAGE_INT24:
+    return samples * 3;
+  case SW_STORAGE_PACKED:
+    return packed_nr_bytes ((sw_packed *)sounddata->compact);
+  default:
+    return samples * sizeof (gfloat);
+  }
+}
+
+static void
+do_pack_thread (sw_op_instance * inst)
+{
+  sw_sample * sample = inst->sample;
+  sw_sounddata * sounddata = sample->sounddata;
+  sw_packed * packed;
+  sw_peaks * peaks = NULL;
+  gfloat * fbuf = NULL;
+  gpointer old_data, old_compact;
+  gint block, nr_blocks;
+  gboolean active = TRUE;
+
+  packed = packed_new (sounddata->format, sounddata->nr_frames);
+  nr_blocks = packed_nr_blocks (packed);
+
+  /* Make sure zoomed out views never need to touch the packed data */
+  if (sounddata->peaks == NULL) {
+    peaks = peaks_new (sounddata->format->channels, sounddata->nr_frames);
+    fbuf = g_malloc (frames_to_bytes (sounddata->format, PACKED_BLOCK_FRAMES));
+  }
+
+  for (block = 0; active && block < nr_blocks; block++) {
+    g_mutex_lock (&sample->ops_mutex);
+
+    /* Give way to anything the user has asked for */
+    if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL ||
+	sample->pending_ops != NULL) {
+      active = FALSE;
+    } else {
+      packed_encode_block (packed, sounddata, block);
+
+      if (peaks) {
+	sounddata_peek_frames (sounddata,
+			       (sw_framecount_t)block * PACKED_BLOCK_FRAMES,
+			       packed_block_nr_frames (packed, block), fbuf);
+	peaks_add_frames (peaks, fbuf, packed_block_nr_frames (packed, block));
+      }
+
+      sample_set_progress_percent (sample, (block + 1) * 100 / nr_blocks);
+    }
+
+    g_mutex_unlock (&sample->ops_mutex);
+  }
+
+  g_free (fbuf);
+
+#ifdef DEBUG
+  g_print ("packed %s: %lu -> %lu bytes\n", sample->pathname,
+	   (unsigned long)sounddata_nr_bytes (sounddata),
+	   (unsigned long)packed_nr_bytes (packed));
+#endif
+
+  /* Only keep the packed form if it is a worthwhile saving */
+  if (active && packed_nr_bytes (packed) < sounddata_nr_bytes (sounddata) / 4 * 3) {
+    g_mutex_lock (&sample->ops_mutex);
+    g_mutex_lock (&sounddata->data_mutex);
+
+    old_data = sounddata->data;
+    old_compact = sounddata->compact;
+
+    sounddata->data = NULL;
+    sounddata->compact = packed;
+    sounddata->storage = SW_STORAGE_PACKED;
+
+    if (peaks != NULL && peaks_finish (peaks)) {
+      sounddata->peaks = peaks;
+      peaks = NULL;
+    }
+
+    g_mutex_unlock (&sounddata->data_mutex);
+    g_mutex_unlock (&sample->ops_mutex);
+
+    g_free (old_data);
+    g_free (old_compact);
+  } else {
+    /* Don't try again until the data is modified */
+    if (active) sample->pack_refused = TRUE;
+
+    packed_free (packed);
+  }
+
+  peaks_free (peaks);
+
+  sample_set_edit_state (sample, SWEEP_EDIT_STATE_DONE);
+}
+
+static sw_operation pack_op = {
+  SWEEP_EDIT_MODE_META,
+  (SweepCallback)do_pack_thread,
+  (SweepFunction)NULL,
+  (SweepCallback)NULL, /* undo */
+  (SweepFunction)NULL,
+  (SweepCallback)NULL, /* redo */
+  (SweepFunction)NULL
+};
+
+/*
+ * sample_pack (sample)
+ *
+ * schedule the data of an idle sample to be compressed in memory.
+ */
+void
+sample_pack (sw_sample * sample)
+{
+  char buf[128];
+
+  if (sample->sounddata->storage == SW_STORAGE_PACKED) return;
+  if (sample->pack_refused) return;
+  if (sample->sounddata->nr_frames == 0) return;
+
+  g_snprintf (buf, sizeof (buf), _("Compressing %s"),
+	      g_path_get_basename (sample->pathname));
+
+  schedule_operation (sample, buf, &pack_op, NULL);
+}
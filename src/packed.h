@@ -0,0 +1,59 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __PACKED_H__
+#define __PACKED_H__
+
+#include <sweep/sweep_types.h>
+
+#include "sweep_app.h"
+
+/* Nr. of frames in each independently compressed block */
+#define PACKED_BLOCK_FRAMES 16384
+
+typedef struct _sw_packed sw_packed;
+
+sw_packed *
+packed_new (sw_format * format, sw_framecount_t nr_frames);
+
+void
+packed_free (sw_packed * packed);
+
+gint
+packed_nr_blocks (sw_packed * packed);
+
+gsize
+packed_nr_bytes (sw_packed * packed);
+
+void
+packed_encode_block (sw_packed * packed, sw_sounddata * sounddata,
+		     gint block);
+
+gfloat
+packed_get_sample (sw_packed * packed, sw_framecount_t frame, gint channel);
+
+void
+packed_copy_frames (sw_packed * packed, sw_framecount_t offset,
+		    sw_framecount_t n, gfloat * buf);
+
+void
+sample_pack (sw_sample * sample);
+
+#endif /* __PACKED_H__ */
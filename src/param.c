@@ -28,8 +28,10 @@
 
 #include <sweep/sweep_i18n.h>
 #include <sweep/sweep_types.h>
+#include <sweep/sweep_sample.h>
 #include "sweep_app.h"
 #include "interface.h"
+#include "head.h"
 
 #include "../pixmaps/ladlogo.xpm"
 
@@ -218,6 +220,7 @@ struct _sw_ps_adjuster {
   GtkWidget * table;
   sw_ps_widget * widgets;
   GList * plsk_list;
+  sw_processor * preview; /* in the play head's chain, or NULL */
 };
 
 static sw_ps_adjuster *
@@ -238,13 +241,32 @@ ps_adjuster_new (sw_procedure * proc, sw_view * view, sw_param_set pset,
 
   ps->widgets = g_malloc (sizeof (sw_ps_widget) * proc->nr_params);
   ps->plsk_list = NULL;
+  ps->preview = NULL;
 
   return ps;
 }
 
+/*
+ * Stop auditioning the procedure, if it is being previewed
+ */
+static void
+param_set_preview_stop (sw_ps_adjuster * ps)
+{
+  sw_sample * sample = ps->view->sample;
+
+  if (ps->preview == NULL) return;
+
+  if (sample_bank_contains (sample))
+    head_remove_processor (sample->play_head, ps->preview);
+
+  ps->preview->destroy (ps->preview);
+  ps->preview = NULL;
+}
+
 static void
 ps_adjuster_destroy (sw_ps_adjuster * ps)
 {
+  param_set_preview_stop (ps);
 }
 
 static void
@@ -306,6 +328,9 @@ param_set_apply_cb (GtkWidget * widget, gpointer data)
   print_param_set (ps->proc, ps->pset);
 #endif
 
+  /* Don't play the effect over its own result */
+  param_set_preview_stop (ps);
+
   if (ps->proc->apply) {
     ps->proc->apply (ps->view->sample,
 		     ps->pset, ps->proc->custom_data);
@@ -329,6 +354,48 @@ param_set_cancel_cb (GtkWidget * widget, gpointer data)
   ps_adjuster_destroy (ps);
 }
 
+/*
+ * Callback for Preview toggle of param_set_adjuster
+ */
+static void
+param_set_preview_cb (GtkWidget * widget, gpointer data)
+{
+  sw_ps_adjuster * ps = (sw_ps_adjuster *)data;
+  sw_sample * sample = ps->view->sample;
+
+  if (!gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (widget))) {
+    param_set_preview_stop (ps);
+    return;
+  }
+
+  if (ps->preview != NULL) return;
+
+  get_param_values (ps->proc, ps->pset, ps->widgets);
+
+  ps->preview = ps->proc->realtime (sample->sounddata->format, ps->pset,
+				    ps->proc->custom_data);
+
+  if (ps->preview != NULL) {
+    head_add_processor (sample->play_head, ps->preview);
+  } else {
+    gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget), FALSE);
+  }
+}
+
+/*
+ * Callback for changes to any parameter, to update the preview
+ */
+static void
+param_set_changed_cb (GtkWidget * widget, gpointer data)
+{
+  sw_ps_adjuster * ps = (sw_ps_adjuster *)data;
+
+  if (ps->preview == NULL) return;
+
+  get_param_values (ps->proc, ps->pset, ps->widgets);
+  ps->preview->set_params (ps->preview, ps->pset);
+}
+
 typedef struct _sw_pl_set_known sw_pl_set_known;
 
 struct _sw_pl_set_known {
@@ -391,6 +458,9 @@ create_param_set_table (sw_ps_adjuster * ps)
 
       gtk_widget_show (checkbutton);
 
+      g_signal_connect (G_OBJECT(checkbutton), "toggled",
+			G_CALLBACK(param_set_changed_cb), ps);
+
       ps->widgets[i].type = SW_PS_TOGGLE_BUTTON;
       ps->widgets[i].w.toggle_button = checkbutton;
 
@@ -438,6 +508,8 @@ create_param_set_table (sw_ps_adjuster * ps)
 
           g_signal_connect (G_OBJECT(menuitem), "activate",
             G_CALLBACK(param_list_set_known_cb), &plsk[j]);
+          g_signal_connect (G_OBJECT(menuitem), "activate",
+            G_CALLBACK(param_set_changed_cb), ps);
 
 	  if (!param_cmp (pspec->type, pspec->constraint.list[j+1], pset[i])) {
 	    gtk_option_menu_set_history (GTK_OPTION_MENU(optionmenu), j);
@@ -488,6 +560,8 @@ create_param_set_table (sw_ps_adjuster * ps)
                                                                            \
 	adj = gtk_adjustment_new (value, lower, upper, step_inc,           \
 				  page_inc, page_size);                    \
+	g_signal_connect (G_OBJECT(adj), "value_changed",                  \
+			  G_CALLBACK(param_set_changed_cb), ps);           \
                                                                            \
 	if ( (valid & SW_RANGE_LOWER_BOUND_VALID) &&                       \
 	     (valid & SW_RANGE_UPPER_BOUND_VALID)) {                       \
@@ -548,6 +622,8 @@ param_set_suggest_cb (GtkWidget * widget, gpointer data)
   gtk_widget_show (table);
 
   ps->table = table;
+
+  param_set_changed_cb (widget, ps);
 }
 
 gint
@@ -735,6 +811,14 @@ create_param_set_adjuster (sw_procedure * proc, sw_view * view,
   g_signal_connect (G_OBJECT(button), "clicked",
 		      G_CALLBACK (param_set_suggest_cb), ps);
 
+  if (proc->realtime != NULL) {
+    button = gtk_toggle_button_new_with_label (_("Preview"));
+    gtk_box_pack_start (GTK_BOX(vbox), button, FALSE, FALSE, 0);
+    gtk_widget_show (button);
+    g_signal_connect (G_OBJECT(button), "toggled",
+		      G_CALLBACK (param_set_preview_cb), ps);
+  }
+
   scrolled = gtk_scrolled_window_new (NULL, NULL);
   gtk_widget_set_size_request (scrolled, -1, 240);
   gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrolled),
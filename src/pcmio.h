@@ -24,6 +24,7 @@
 #include <glib.h>
 
 #define USE_MONITOR_KEY "UseMonitor"
+#define RESAMPLE_QUALITY_KEY "PlaybackResampleQuality"
 
 #define DEFAULT_LOG_FRAGS 6
 #define LOG_FRAGS_MIN 1
@@ -45,5 +46,8 @@ pcmio_get_use_monitor (void);
 int
 pcmio_get_log_frags (void);
 
+int
+pcmio_get_resample_quality (void);
+
 
 #endif /* __PCMIO_H__ */
@@ -0,0 +1,502 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Persistent peak cache.
+ *
+ * When a file is loaded, a min/max/RMS summary of its contents is built
+ * and stored under ~/.sweep/peaks/. The next time the same file is
+ * opened the summary is read back before any sample data is decoded,
+ * so that the overview can be drawn immediately.
+ *
+ * A cache file is only trusted if the size, modification time and a
+ * digest of the head and tail of the audio file all match.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include <sweep/sweep_types.h>
+
+#include "sweep_app.h"
+#include "peakcache.h"
+#include "batch.h"
+
+/*#define DEBUG*/
+
+#define PEAKS_MAGIC 0x5357504b /* "SWPK" */
+#define PEAKS_VERSION 1
+
+#define PEAKS_DIR_MODE (S_IRWXU)
+
+/* Nr. of bytes at each end of the audio file to include in its digest */
+#define PEAKS_DIGEST_BYTES 65536
+
+#define PEAKS_DIGEST_LEN 20
+
+typedef struct {
+  guint32 magic;
+  guint32 version;
+  guint32 channels;
+  guint32 bin_frames;
+  gint64 nr_frames;
+  gint64 file_size;
+  gint64 file_mtime;
+  guint8 digest[PEAKS_DIGEST_LEN];
+} peaks_cache_header;
+
+sw_peaks *
+peaks_new (gint channels, sw_framecount_t nr_frames)
+{
+  sw_peaks * peaks;
+
+  /* Nothing is drawn in batch mode */
+  if (batch_mode) return NULL;
+
+  if (channels <= 0 || nr_frames <= 0) return NULL;
+
+  peaks = g_malloc0 (sizeof (sw_peaks));
+
+  peaks->channels = channels;
+  peaks->nr_frames = nr_frames;
+  peaks->nr_levels = 1;
+  peaks->nr_bins[0] = (nr_frames + PEAKS_BIN_FRAMES - 1) / PEAKS_BIN_FRAMES;
+  peaks->levels[0] =
+    g_malloc0 (peaks->nr_bins[0] * channels * sizeof (sw_peak));
+
+  peaks->cursor = 0;
+  peaks->sumsq = g_malloc0 (channels * sizeof (gdouble));
+
+  return peaks;
+}
+
+void
+peaks_free (sw_peaks * peaks)
+{
+  gint i;
+
+  if (peaks == NULL) return;
+
+  for (i = 0; i < peaks->nr_levels; i++) {
+    g_free (peaks->levels[i]);
+  }
+
+  g_free (peaks->sumsq);
+  g_free (peaks);
+}
+
+/*
+ * peaks_add_frames (peaks, buf, n)
+ *
+ * accumulate n interleaved frames from buf into the finest level of
+ * peaks. Frames must be added in order from the start of the data.
+ */
+void
+peaks_add_frames (sw_peaks * peaks, const gfloat * buf, sw_framecount_t n)
+{
+  const gint channels = peaks->channels;
+  sw_framecount_t bin, pos, len, i;
+  sw_peak * p;
+  gfloat d;
+  gint c;
+
+  while (n > 0 && peaks->cursor < peaks->nr_frames) {
+    bin = peaks->cursor / PEAKS_BIN_FRAMES;
+    pos = peaks->cursor % PEAKS_BIN_FRAMES;
+
+    len = MIN (n, PEAKS_BIN_FRAMES - pos);
+    len = MIN (len, peaks->nr_frames - peaks->cursor);
+
+    for (c = 0; c < channels; c++) {
+      p = &peaks->levels[0][bin * channels + c];
+
+      if (pos == 0) {
+	p->min = p->max = buf[c];
+	peaks->sumsq[c] = 0.0;
+      }
+
+      for (i = 0; i < len; i++) {
+	d = buf[i * channels + c];
+	if (d < p->min) p->min = d;
+	if (d > p->max) p->max = d;
+	peaks->sumsq[c] += d * d;
+      }
+
+      p->rms = (gfloat) sqrt (peaks->sumsq[c] / (pos + len));
+    }
+
+    buf += len * channels;
+    n -= len;
+    peaks->cursor += len;
+  }
+}
+
+static sw_framecount_t
+peaks_bin_nr_frames (sw_peaks * peaks, gint level, sw_framecount_t bin)
+{
+  sw_framecount_t bin_frames = (sw_framecount_t)PEAKS_BIN_FRAMES << level;
+
+  return MIN (bin_frames, peaks->nr_frames - bin * bin_frames);
+}
+
+/*
+ * peaks_build_levels (peaks)
+ *
+ * build the coarser levels of the pyramid from level 0.
+ */
+static void
+peaks_build_levels (sw_peaks * peaks)
+{
+  const gint channels = peaks->channels;
+  sw_peak * lo, * hi, * a, * b, * p;
+  sw_framecount_t i, nlo, na, nb;
+  gint l, c;
+
+  for (l = 1; l < PEAKS_MAX_LEVELS && peaks->nr_bins[l-1] > 1; l++) {
+    nlo = peaks->nr_bins[l-1];
+    lo = peaks->levels[l-1];
+
+    peaks->nr_bins[l] = (nlo + 1) / 2;
+    hi = g_malloc (peaks->nr_bins[l] * channels * sizeof (sw_peak));
+
+    for (i = 0; i < peaks->nr_bins[l]; i++) {
+      for (c = 0; c < channels; c++) {
+	a = &lo[(2*i) * channels + c];
+	p = &hi[i * channels + c];
+
+	if (2*i + 1 < nlo) {
+	  b = &lo[(2*i + 1) * channels + c];
+	  na = peaks_bin_nr_frames (peaks, l-1, 2*i);
+	  nb = peaks_bin_nr_frames (peaks, l-1, 2*i + 1);
+
+	  p->min = MIN (a->min, b->min);
+	  p->max = MAX (a->max, b->max);
+	  p->rms = (gfloat)
+	    sqrt (((gdouble)a->rms * a->rms * na +
+		   (gdouble)b->rms * b->rms * nb) / (na + nb));
+	} else {
+	  *p = *a;
+	}
+      }
+    }
+
+    peaks->levels[l] = hi;
+  }
+
+  peaks->nr_levels = l;
+}
+
+/*
+ * peaks_finish (peaks)
+ *
+ * complete a pyramid once all frames have been added. Returns FALSE if
+ * not all frames were seen, in which case peaks must not be used.
+ */
+gboolean
+peaks_finish (sw_peaks * peaks)
+{
+  if (peaks == NULL) return FALSE;
+
+  if (peaks->cursor < peaks->nr_frames) return FALSE;
+
+  g_free (peaks->sumsq);
+  peaks->sumsq = NULL;
+
+  peaks_build_levels (peaks);
+
+  return TRUE;
+}
+
+/*
+ * peaks_get_range (peaks, channel, start, end, peak)
+ *
+ * summarise frames [start, end) of the given channel into peak, using
+ * the coarsest level that still gives at least two bins over the range.
+ * The range is widened to bin boundaries, which is invisible at the
+ * zoom levels where a peak summary is useful.
+ */
+gboolean
+peaks_get_range (sw_peaks * peaks, gint channel,
+		 sw_framecount_t start, sw_framecount_t end, sw_peak * peak)
+{
+  const gint channels = peaks->channels;
+  sw_framecount_t bin_frames, b, b0, b1, nb, ntot = 0;
+  gdouble sumsq = 0.0;
+  sw_peak * p;
+  gint l;
+
+  start = CLAMP (start, 0, peaks->nr_frames);
+  end = CLAMP (end, 0, peaks->nr_frames);
+
+  if (end <= start) return FALSE;
+
+  for (l = 0; l + 1 < peaks->nr_levels; l++) {
+    if (((sw_framecount_t)PEAKS_BIN_FRAMES << (l+1)) * 2 > end - start)
+      break;
+  }
+
+  bin_frames = (sw_framecount_t)PEAKS_BIN_FRAMES << l;
+  b0 = start / bin_frames;
+  b1 = (end - 1) / bin_frames;
+
+  p = &peaks->levels[l][b0 * channels + channel];
+  peak->min = p->min;
+  peak->max = p->max;
+
+  for (b = b0; b <= b1; b++) {
+    p = &peaks->levels[l][b * channels + channel];
+    if (p->min < peak->min) peak->min = p->min;
+    if (p->max > peak->max) peak->max = p->max;
+
+    nb = peaks_bin_nr_frames (peaks, l, b);
+    sumsq += (gdouble)p->rms * p->rms * nb;
+    ntot += nb;
+  }
+
+  peak->rms = (gfloat) sqrt (sumsq / ntot);
+
+  return TRUE;
+}
+
+static gchar *
+peaks_cache_filename (const gchar * pathname)
+{
+  gchar * abspath, * digest, * filename;
+
+  abspath = realpath (pathname, NULL);
+
+  digest = g_compute_checksum_for_string (G_CHECKSUM_MD5,
+					  abspath ? abspath : pathname, -1);
+
+  filename = g_strconcat (g_get_home_dir (), "/.sweep/peaks/", digest,
+			  ".peaks", NULL);
+
+  free (abspath);
+  g_free (digest);
+
+  return filename;
+}
+
+/*
+ * peaks_file_digest (pathname, file_size, digest)
+ *
+ * compute a digest of the first and last PEAKS_DIGEST_BYTES of a file.
+ * This is cheap regardless of the file's length, and together with the
+ * size and mtime is enough to catch a file rewritten in place.
+ */
+static gboolean
+peaks_file_digest (const gchar * pathname, off_t file_size, guint8 * digest)
+{
+  FILE * f;
+  GChecksum * checksum;
+  guchar * buf;
+  size_t n;
+  gsize len = PEAKS_DIGEST_LEN;
+  gboolean ret = TRUE;
+
+  if ((f = fopen (pathname, "rb")) == NULL) return FALSE;
+
+  buf = g_malloc (PEAKS_DIGEST_BYTES);
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+
+  n = fread (buf, 1, PEAKS_DIGEST_BYTES, f);
+  g_checksum_update (checksum, buf, n);
+
+  if (file_size > PEAKS_DIGEST_BYTES) {
+    if (fseeko (f, MAX (file_size - PEAKS_DIGEST_BYTES, PEAKS_DIGEST_BYTES),
+		SEEK_SET) == 0) {
+      n = fread (buf, 1, PEAKS_DIGEST_BYTES, f);
+      g_checksum_update (checksum, buf, n);
+    } else {
+      ret = FALSE;
+    }
+  }
+
+  g_checksum_get_digest (checksum, digest, &len);
+
+  g_checksum_free (checksum);
+  g_free (buf);
+  fclose (f);
+
+  return ret;
+}
+
+static gboolean
+peaks_cache_header_fill (peaks_cache_header * header, const gchar * pathname,
+			 gint channels, sw_framecount_t nr_frames)
+{
+  struct stat statbuf;
+
+  memset (header, 0, sizeof (*header));
+
+  if (stat (pathname, &statbuf) == -1) return FALSE;
+
+  header->magic = PEAKS_MAGIC;
+  header->version = PEAKS_VERSION;
+  header->channels = channels;
+  header->bin_frames = PEAKS_BIN_FRAMES;
+  header->nr_frames = nr_frames;
+  header->file_size = statbuf.st_size;
+  header->file_mtime = statbuf.st_mtime;
+
+  return peaks_file_digest (pathname, statbuf.st_size, header->digest);
+}
+
+/*
+ * peaks_cache_read (pathname, channels, nr_frames)
+ *
+ * look up the cached peaks for the audio file at pathname. Returns NULL
+ * if there is no cache entry, or if it does not match the file.
+ */
+sw_peaks *
+peaks_cache_read (const gchar * pathname, gint channels,
+		  sw_framecount_t nr_frames)
+{
+  peaks_cache_header expected, header;
+  sw_peaks * peaks;
+  gchar * filename;
+  FILE * f;
+  size_t n;
+
+  if (batch_mode) return NULL;
+
+  if (!peaks_cache_header_fill (&expected, pathname, channels, nr_frames))
+    return NULL;
+
+  filename = peaks_cache_filename (pathname);
+  f = fopen (filename, "rb");
+  g_free (filename);
+
+  if (f == NULL) return NULL;
+
+  if (fread (&header, sizeof (header), 1, f) != 1 ||
+      memcmp (&header, &expected, sizeof (header)) != 0) {
+#ifdef DEBUG
+    g_print ("peaks: stale cache for %s\n", pathname);
+#endif
+    fclose (f);
+    return NULL;
+  }
+
+  if ((peaks = peaks_new (channels, nr_frames)) == NULL) {
+    fclose (f);
+    return NULL;
+  }
+
+  n = peaks->nr_bins[0] * channels;
+  if (fread (peaks->levels[0], sizeof (sw_peak), n, f) != n) {
+    peaks_free (peaks);
+    fclose (f);
+    return NULL;
+  }
+
+  fclose (f);
+
+  peaks->cursor = nr_frames;
+  peaks_finish (peaks);
+
+#ifdef DEBUG
+  g_print ("peaks: read %d levels for %s\n", peaks->nr_levels, pathname);
+#endif
+
+  return peaks;
+}
+
+/*
+ * peaks_cache_write (pathname, peaks)
+ *
+ * store peaks as the cache entry for the audio file at pathname. The
+ * entry is written to a temporary file and renamed into place so that
+ * a concurrent reader never sees a partial entry.
+ */
+gboolean
+peaks_cache_write (const gchar * pathname, sw_peaks * peaks)
+{
+  peaks_cache_header header;
+  gchar * dirname, * filename, * tmpname;
+  FILE * f;
+  size_t n;
+  gboolean ret = FALSE;
+
+  if (peaks == NULL || peaks->sumsq != NULL) return FALSE;
+
+  if (!peaks_cache_header_fill (&header, pathname, peaks->channels,
+				peaks->nr_frames))
+    return FALSE;
+
+  dirname = g_strconcat (g_get_home_dir (), "/.sweep/peaks", NULL);
+  if (mkdir (dirname, PEAKS_DIR_MODE) == -1 && errno != EEXIST) {
+    g_free (dirname);
+    return FALSE;
+  }
+  g_free (dirname);
+
+  filename = peaks_cache_filename (pathname);
+  tmpname = g_strdup_printf ("%s.%d", filename, (int)getpid ());
+
+  if ((f = fopen (tmpname, "wb")) != NULL) {
+    n = peaks->nr_bins[0] * peaks->channels;
+
+    if (fwrite (&header, sizeof (header), 1, f) == 1 &&
+	fwrite (peaks->levels[0], sizeof (sw_peak), n, f) == n) {
+      ret = (fclose (f) == 0);
+    } else {
+      fclose (f);
+    }
+
+    if (ret) ret = (rename (tmpname, filename) == 0);
+    if (!ret) unlink (tmpname);
+  }
+
+  g_free (tmpname);
+  g_free (filename);
+
+  return ret;
+}
+
+/*
+ * sample_drop_peaks (sample)
+ *
+ * discard the peak summary of a sample whose data is about to change.
+ */
+void
+sample_drop_peaks (sw_sample * sample)
+{
+  sw_peaks * peaks;
+
+  g_mutex_lock (&sample->ops_mutex);
+  peaks = sample->sounddata->peaks;
+  sample->sounddata->peaks = NULL;
+  g_mutex_unlock (&sample->ops_mutex);
+
+  peaks_free (peaks);
+}
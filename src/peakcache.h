@@ -0,0 +1,90 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __PEAKCACHE_H__
+#define __PEAKCACHE_H__
+
+#include <sweep/sweep_types.h>
+
+/* Nr. of frames summarised by each bin of the finest level */
+#define PEAKS_BIN_FRAMES 256
+
+/* Maximum number of levels in the pyramid; each level halves the
+ * number of bins of the one below it */
+#define PEAKS_MAX_LEVELS 24
+
+typedef struct _sw_peak sw_peak;
+
+struct _sw_peak {
+  gfloat min;
+  gfloat max;
+  gfloat rms;
+};
+
+/*
+ * sw_peaks: a min/max/RMS pyramid summarising a sounddata.
+ *
+ * Level 0 holds one sw_peak per channel for every PEAKS_BIN_FRAMES
+ * frames; level n holds one per (PEAKS_BIN_FRAMES << n) frames.
+ * Bins are interleaved by channel, like the sample data itself.
+ *
+ * Once complete (peaks_finish()) a sw_peaks is never modified, so it
+ * can be read from the GUI thread while holding sample->ops_mutex.
+ */
+struct _sw_peaks {
+  gint channels;
+  sw_framecount_t nr_frames;
+
+  gint nr_levels;
+  sw_framecount_t nr_bins[PEAKS_MAX_LEVELS];
+  sw_peak * levels[PEAKS_MAX_LEVELS];
+
+  /* Accumulation state, used only while building level 0 */
+  sw_framecount_t cursor;
+  gdouble * sumsq;
+};
+
+sw_peaks *
+peaks_new (gint channels, sw_framecount_t nr_frames);
+
+void
+peaks_free (sw_peaks * peaks);
+
+void
+peaks_add_frames (sw_peaks * peaks, const gfloat * buf, sw_framecount_t n);
+
+gboolean
+peaks_finish (sw_peaks * peaks);
+
+gboolean
+peaks_get_range (sw_peaks * peaks, gint channel,
+		 sw_framecount_t start, sw_framecount_t end, sw_peak * peak);
+
+sw_peaks *
+peaks_cache_read (const gchar * pathname, gint channels,
+		  sw_framecount_t nr_frames);
+
+gboolean
+peaks_cache_write (const gchar * pathname, sw_peaks * peaks);
+
+void
+sample_drop_peaks (sw_sample * sample);
+
+#endif /* __PEAKCACHE_H__ */
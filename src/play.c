@@ -48,11 +48,16 @@
 
 #include <sweep/sweep_types.h>
 #include <sweep/sweep_sample.h>
+#include <sweep/sweep_sounddata.h>
 #include <sweep/sweep_typeconvert.h>
 
 #include "play.h"
 #include "head.h"
 #include "driver.h"
+#include "meter.h"
+#include "levelmeter.h"
+#include "mixer.h"
+#include "pcmio.h"
 #include "preferences.h"
 #include "sample-display.h"
 
@@ -62,6 +67,13 @@
 
 #define USE_MONITOR_KEY "UseMonitor"
 
+/* Interval between updates of the play marker, in ms */
+#define PLAYMARKER_INTERVAL 16
+
+/* Longest the play marker is carried on from the last position the
+ * player published, in us */
+#define PLAY_CLOCK_MAX_EXTRAPOLATE 100000
+
 static GMutex play_mutex;
 
 static sw_handle * main_handle = NULL;
@@ -76,8 +88,77 @@ static pthread_t player_thread = (pthread_t)-1;
 
 static gboolean stop_all = FALSE;
 
-static float * pbuf = NULL, * devbuf = NULL;
-static int pbuf_chans = 0, devbuf_chans = 0;
+static float * devbuf = NULL;
+static int devbuf_chans = 0;
+
+/* Nr. of frames head_read_unrestricted () reads from a sample at a time */
+#define HEAD_READ_WINDOW 1024
+
+/* Player thread only: frames read by head_read_unrestricted () */
+static float * readbuf = NULL;
+static int readbuf_chans = 0;
+
+/* Converter chosen in the device preferences, for the next playback */
+static sw_mixer_quality play_quality = MIXER_DEFAULT_QUALITY;
+
+/* Player thread only: the sw_mixer_input of each head being played */
+static GList * play_inputs = NULL;
+
+/* The head play_heads () is playing, and heads released since the last
+ * block whose inputs are still to be freed; under play_mutex */
+static sw_head * playing_head = NULL;
+static GList * released_heads = NULL;
+static GCond play_cond;
+
+/* Levels of everything written to the main device */
+static sw_meter * play_meter = NULL;
+
+/*
+ * play_clock_read (head, offset)
+ *
+ * works out the offset being heard now, carrying on from the position
+ * and rate last published by the player thread. Returns FALSE without
+ * waiting if nothing usable has been published.
+ */
+static gboolean
+play_clock_read (sw_head * head, sw_framecount_t * offset)
+{
+  gdouble nr_frames = (gdouble)head->sample->sounddata->nr_frames;
+  gint seq, tries;
+  gint64 t, elapsed;
+  gdouble o, rate;
+
+  if (g_atomic_int_get (&head->clock_restart)) return FALSE;
+
+  for (tries = 0; tries < 4; tries++) {
+    seq = g_atomic_int_get (&head->clock_seq);
+    if (seq == 0) return FALSE;
+    if (seq & 1) continue;
+
+    t = head->clock_time;
+    o = head->clock_offset;
+    rate = head->clock_rate;
+
+    /* Adding nothing is a full barrier, keeping the reads above before
+     * this second look at the count */
+    if (g_atomic_int_add (&head->clock_seq, 0) != seq) continue;
+
+    elapsed = CLAMP (g_get_monotonic_time () - t, 0,
+		     PLAY_CLOCK_MAX_EXTRAPOLATE);
+    o += rate * (gdouble)elapsed / G_USEC_PER_SEC;
+
+    if (head->looping && nr_frames > 0.0) {
+      while (o < 0.0) o += nr_frames;
+      while (o > nr_frames) o -= nr_frames;
+    }
+
+    *offset = (sw_framecount_t)CLAMP (o, 0.0, nr_frames);
+
+    return TRUE;
+  }
+
+  return FALSE;
+}
 
 
 /*
@@ -120,6 +201,12 @@ update_playmarker (gpointer data)
 
     return FALSE;
   } else {
+    play_clock_read (head, &head->realoffset);
+
+    g_mutex_lock (&s->play_mutex);
+    if (!s->by_user && !head->scrubbing) s->user_offset = head->realoffset;
+    g_mutex_unlock (&s->play_mutex);
+
     sample_set_playmarker (s, head->realoffset, FALSE);
 
     return TRUE;
@@ -130,13 +217,13 @@ static void
 start_playmarker (sw_sample * s)
 {
   if (s->playmarker_tag > 0) {
-    g_source_remove (s->playmarker_tag);
+    sweep_timeout_remove (s->playmarker_tag);
   }
 
   s->playmarker_tag =
-    g_timeout_add ((guint32)30,
-		     (GSourceFunc) update_playmarker,
-		     (gpointer)s);
+    sweep_timeout_add ((guint32)PLAYMARKER_INTERVAL,
+		       (GtkFunction) update_playmarker,
+		       (gpointer)s);
 }
 
 static sw_framecount_t
@@ -149,7 +236,8 @@ head_read_unrestricted (sw_head * head, float * buf,
   gdouble po = 0.0, p;
   gfloat relpitch;
   sw_framecount_t i, j, b;
-  gint si=0, si_next = 0;
+  sw_framecount_t si = 0, win_start = 0, win_end = 0, n;
+  const gfloat * d = NULL, * x, * x_next;
   gboolean interpolate = FALSE;
   gboolean do_smoothing = FALSE;
   sw_framecount_t last_user_offset = -1;
@@ -163,6 +251,14 @@ head_read_unrestricted (sw_head * head, float * buf,
   /* compensate for sampling rate of driver */
   relpitch = (gfloat)((gdouble)f->rate / (gdouble)driver_rate);
 
+  if (f->channels > readbuf_chans) {
+    readbuf = g_realloc (readbuf,
+			 HEAD_READ_WINDOW * f->channels * sizeof (float));
+    readbuf_chans = f->channels;
+  }
+
+  g_mutex_lock (&sounddata->data_mutex);
+
   for (i = 0; i < count; i++) {
     if (head->mute || sample->user_offset == last_user_offset) {
       for (j = 0; j < f->channels; j++) {
@@ -170,43 +266,43 @@ head_read_unrestricted (sw_head * head, float * buf,
 	b++;
       }
     } else {
-      si = (int)floor(po);
+      si = (sw_framecount_t)floor(po);
+
+      /* Read in a window around si and si+1, in the direction of play */
+      if (si >= 0 && si < sounddata->nr_frames &&
+	  (si < win_start || si >= win_end ||
+	   (si + 1 == win_end && win_end < sounddata->nr_frames))) {
+	win_start = head->reverse ? MAX (0, si + 2 - HEAD_READ_WINDOW) : si;
+	n = MIN (HEAD_READ_WINDOW, sounddata->nr_frames - win_start);
+	d = sounddata_read_frames (sounddata, win_start, n, readbuf);
+	win_end = win_start + n;
+      }
+
+      x = (si >= win_start && si < win_end) ?
+	d + (si - win_start) * f->channels : NULL;
+      x_next = (si + 1 >= win_start && si + 1 < win_end) ?
+	d + (si + 1 - win_start) * f->channels : NULL;
 
-      interpolate = (si < sounddata->nr_frames);
+      interpolate = (x != NULL);
 
       p = po - (gdouble)si;
-      si *= f->channels;
-      g_mutex_lock(&head->sample->sounddata->data_mutex);
-
-      if (interpolate) {
-	si_next = si+f->channels;
-	for (j = 0; j < f->channels; j++) {
-         buf[b] = head->gain * (((float *)head->sample->sounddata->data)[si] * p + ((float *)head->sample->sounddata->data)[si_next] * (1 - p));
-	  if (do_smoothing) {
-	    sw_framecount_t b1, b2;
-	    b1 = (b - f->channels + pbuf_size) % pbuf_size;
-	    b2 = (b1 - f->channels + pbuf_size) % pbuf_size;
-	    buf[b] += buf[b] * 2.0;
-	    buf[b] += buf[b1] * 3.0 + buf[b2] * 4.0;
-	    buf[b] /= 10.0;
-	  }
-	  b++; si++; si_next++;
+
+      for (j = 0; j < f->channels; j++) {
+	if (interpolate) {
+	  buf[b] = x[j] * (1 - p) + (x_next ? x_next[j] * p : 0.0);
+	} else {
+	  buf[b] = 0.0;
 	}
-      } else {
-	for (j = 0; j < f->channels; j++) {
-	 buf[b] = head->gain * ((float *)head->sample->sounddata->data)[si];
-	  if (do_smoothing) {
-	    sw_framecount_t b1, b2;
-	    b1 = (b - f->channels + pbuf_size) % pbuf_size;
-	    b2 = (b1 - f->channels + pbuf_size) % pbuf_size;
-	    buf[b] += buf[b] * 2.0;
-	    buf[b] += buf[b1] * 3.0 + buf[b2] * 4.0;
-	    buf[b] /= 10.0;
-	  }
-	  b++; si++;
+	if (do_smoothing) {
+	  sw_framecount_t b1, b2;
+	  b1 = (b - f->channels + pbuf_size) % pbuf_size;
+	  b2 = (b1 - f->channels + pbuf_size) % pbuf_size;
+	  buf[b] += buf[b] * 2.0;
+	  buf[b] += buf[b1] * 3.0 + buf[b2] * 4.0;
+	  buf[b] /= 10.0;
 	}
+	b++;
       }
-     g_mutex_unlock (&head->sample->sounddata->data_mutex);
     }
 
     if (head->scrubbing) {
@@ -283,6 +379,8 @@ head_read_unrestricted (sw_head * head, float * buf,
 
   }
 
+  g_mutex_unlock (&sounddata->data_mutex);
+
   return count;
 }
 
@@ -498,6 +596,7 @@ head_init_playback (sw_sample * s)
   sw_sel * sel;
   sw_framecount_t sels_start, sels_end;
   sw_framecount_t delta;
+  gboolean restart = !head->going;
 
   /*  g_mutex_lock (&s->play_mutex);*/
 
@@ -570,54 +669,13 @@ head_init_playback (sw_sample * s)
     }
   }
 
-  /*  g_mutex_unlock (&s->play_mutex);*/
-}
-
-static void
-channel_convert_adding (float * src, int src_channels,
-			float * dest, int dest_channels,
-			sw_framecount_t n)
-{
-  int j;
-  sw_framecount_t i, b = 0;
-  double a;
-
-  if (src_channels == 1) { /* mix mono data up */
-    for (i = 0; i < n; i++) {
-      for (j = 0; j < dest_channels; j++) {
-	dest[b] += src[i];
-	b++;
-      }
-    }
-  } else if (dest_channels == 1) { /* mix down to mono */
-    for (i = 0; i < n; i++) {
-      a = 0.0;
-      for (j = 0; j < src_channels; j++) {
-	a += src[b];
-	b++;
-      }
-      a /= (double)src_channels;
-      dest[i] += (float)a;
-    }
-  } else if (src_channels < dest_channels) { /* copy to first channels */
-    for (i = 0; i < n; i++) {
-      for (j = 0; j < src_channels; j++) {
-	dest[i * dest_channels + j] += src[b];
-	b++;
-      }
-    }
-  } else if (dest_channels < src_channels) { /* copy first channels only */
-    for (i = 0; i < n; i++) {
-      for (j = 0; j < dest_channels; j++) {
-	dest[b] += src[i * src_channels + j];
-	b++;
-      }
-    }
-  } else if (src_channels == dest_channels) { /* just add */
-    for (i = 0; i < n * src_channels; i ++) {
-      dest[i] += src[i];
-    }
+  /* Show the starting point until the player publishes what is heard */
+  if (restart) {
+    head->realoffset = (sw_framecount_t)head->offset;
+    g_atomic_int_set (&head->clock_restart, TRUE);
   }
+
+  /*  g_mutex_unlock (&s->play_mutex);*/
 }
 
 static void
@@ -655,93 +713,206 @@ generate_demo_filename (void)
 static void
 prepare_to_play_heads (GList * heads, sw_handle * handle)
 {
-  sw_head * head;
-  sw_format * f;
+  device_wait (handle);
 
-  GList * gl;
+  return;
+}
 
-  if ((gl = heads) != NULL) {
-    head = (sw_head *)gl->data;
+/*
+ * play_clock_publish (head, block_offset, latency)
+ *
+ * notes that a block starting at block_offset is being written, and
+ * publishes the offset being heard: that of the block written latency
+ * blocks before it, which the device should be playing by now.
+ */
+static void
+play_clock_publish (sw_head * head, gdouble block_offset, glong latency)
+{
+  sw_format * f = head->sample->sounddata->format;
+  glong heard;
 
-    f = head->sample->sounddata->format;
+  if (g_atomic_int_compare_and_exchange (&head->clock_restart, TRUE, FALSE)) {
+    head->clock_blocks = 0;
+  }
 
-    if (f->channels > pbuf_chans) {
-      pbuf = g_realloc (pbuf, PSIZ * f->channels * sizeof (float));
-      pbuf_chans = f->channels;
-    }
+  head->clock_history[head->clock_blocks % PLAY_CLOCK_HISTORY] = block_offset;
+  head->clock_blocks++;
+
+  heard = head->clock_blocks - 1 - MIN (latency, PLAY_CLOCK_HISTORY - 1);
+
+  g_atomic_int_inc (&head->clock_seq);
+
+  head->clock_time = g_get_monotonic_time ();
+  if (heard < 0) {
+    /* Nothing of this head has reached the speakers yet */
+    head->clock_offset = head->clock_history[0];
+    head->clock_rate = 0.0;
+  } else {
+    head->clock_offset = head->clock_history[heard % PLAY_CLOCK_HISTORY];
+    head->clock_rate = head->delta * f->rate;
   }
 
-  device_wait (handle);
+  g_atomic_int_inc (&head->clock_seq);
+}
 
-  return;
+/*
+ * play_head_pull (head, buf, count)
+ *
+ * reads count frames of head at the sample's own rate, for the mixer
+ * to bring to the device rate.
+ */
+static sw_framecount_t
+play_head_pull (sw_head * head, float * buf, sw_framecount_t count)
+{
+  sw_format * f = head->sample->sounddata->format;
+
+  head_read (head, buf, count, f->rate);
+  head_process (head, buf, count, f->channels);
+
+  return count;
+}
+
+static sw_mixer_input *
+play_find_input (sw_head * head)
+{
+  GList * gl;
+  sw_mixer_input * input;
+
+  for (gl = play_inputs; gl; gl = gl->next) {
+    input = (sw_mixer_input *)gl->data;
+    if (mixer_input_get_data (input) == head) return input;
+  }
+
+  return NULL;
+}
+
+/*
+ * play_free_input (head)
+ *
+ * frees the mixer input of head. The head itself is not looked at, as
+ * it may already be gone with its sample.
+ */
+static void
+play_free_input (sw_head * head)
+{
+  sw_mixer_input * input;
+
+  if ((input = play_find_input (head)) != NULL) {
+    play_inputs = g_list_remove (play_inputs, input);
+    mixer_input_free (input);
+  }
 }
 
 static void
-play_heads (GList ** heads, sw_handle * handle)
+play_heads (GList ** heads, sw_handle * handle, glong latency)
 {
   sw_sample * s;
   sw_head * head;
   sw_format * f;
   sw_framecount_t n;
+  sw_mixer_input * input;
+  gdouble block_offset;
+  gboolean drop;
 
-  GList * gl, * gl_next;
+  GList * gl;
 
   if (*heads == NULL) return;
 
   n = PSIZ;
 
-  for (gl = *heads; gl; gl = gl_next) {
+  g_mutex_lock (&play_mutex);
+  gl = *heads;
 
-    g_mutex_lock (&play_mutex);
+  while (gl != NULL) {
     head = (sw_head *)gl->data;
-    gl_next = gl->next;
+    playing_head = head;
     g_mutex_unlock (&play_mutex);
 
-    if (!head) {
-      /* XXX: wtf??? */
-      return;
-    } else if (!head->going || !sample_bank_contains (head->sample)) {
-      g_mutex_lock (&play_mutex);
-      *heads = g_list_remove (*heads, head);
-      g_mutex_unlock (&play_mutex);
+    drop = (!head->going || !sample_bank_contains (head->sample));
+
+    if (drop) {
+      play_free_input (head);
     } else {
       s = head->sample;
       f = s->sounddata->format;
 
-      if (f->channels > pbuf_chans) {
-	pbuf = g_realloc (pbuf, n * f->channels * sizeof (float));
-	pbuf_chans = f->channels;
+      input = play_find_input (head);
+
+      if (input == NULL ||
+	  !mixer_input_matches (input, f->channels, f->rate,
+				handle->driver_rate, play_quality)) {
+	play_free_input (head);
+	input = mixer_input_new (f->channels, f->rate, handle->driver_rate,
+				 play_quality, (sw_mixer_pull)play_head_pull,
+				 head, PSIZ);
+	play_inputs = g_list_prepend (play_inputs, input);
+      } else if (g_atomic_int_get (&head->clock_restart)) {
+	/* Don't carry on from where the head was before */
+	mixer_input_reset (input);
       }
 
-      head_read (head, pbuf, n, handle->driver_rate);
+      block_offset = head->offset;
 
-      channel_convert_adding (pbuf, f->channels, devbuf,
-			      handle->driver_channels, n);
+      mixer_input_add (input, devbuf, handle->driver_channels, n, head->gain);
 
-      /* XXX: store the head->offset NOW for device_offset referencing */
+      play_clock_publish (head, block_offset, latency);
+    }
 
-      g_mutex_lock (&s->play_mutex);
+    /* The list may have changed while the head was played, so carry on
+     * from wherever it is now */
+    g_mutex_lock (&play_mutex);
+    gl = g_list_find (*heads, head);
+    if (gl != NULL) gl = gl->next;
+    if (drop) *heads = g_list_remove (*heads, head);
 
-      head->realoffset = device_offset (handle);
-      if (head->realoffset == -1) {
-	head->realoffset = head->offset;
-      }
+    playing_head = NULL;
+    g_cond_broadcast (&play_cond);
+  }
 
-      head->offset = head->realoffset;
+  g_mutex_unlock (&play_mutex);
 
-      if (s->by_user /* && s->play_scrubbing */) {
-	/*head->offset = s->user_offset;*/
-      } else {
-	if (!head->scrubbing) s->user_offset = head->realoffset;
-      }
+  return;
+}
 
-      /*	if (!head->going) active = FALSE;*/
+/*
+ * play_free_released_inputs ()
+ *
+ * frees the mixer inputs of the heads given to play_release_head ().
+ * Called by the player thread with play_mutex held.
+ */
+static void
+play_free_released_inputs (void)
+{
+  GList * gl;
 
-      g_mutex_unlock (&s->play_mutex);
-    }
+  for (gl = released_heads; gl; gl = gl->next) {
+    play_free_input ((sw_head *)gl->data);
   }
 
-  return;
+  g_list_free (released_heads);
+  released_heads = NULL;
+}
+
+/*
+ * play_release_head (head)
+ *
+ * takes head off the lists of heads being played and waits for the
+ * player thread to be done with it, so that it can be destroyed.
+ */
+void
+play_release_head (sw_head * head)
+{
+  g_mutex_lock (&play_mutex);
+
+  active_main_heads = g_list_remove (active_main_heads, head);
+  active_monitor_heads = g_list_remove (active_monitor_heads, head);
+
+  while (playing_head == head)
+    g_cond_wait (&play_cond, &play_mutex);
+
+  released_heads = g_list_prepend (released_heads, head);
+
+  g_mutex_unlock (&play_mutex);
 }
 
 /* how many inactive writes to do before closing */
@@ -760,6 +931,7 @@ play_active_heads (void)
 {
   sw_framecount_t count;
   int inactive_writes = 0;
+  glong main_latency, monitor_latency = 0;
   GList * gl;
   sw_head * head;
   sw_format * f;
@@ -815,6 +987,11 @@ play_active_heads (void)
     return;
   }
 
+  /* Device buffering, in blocks, for the play marker */
+  main_latency = device_latency (main_handle) / PSIZ;
+  if (use_monitor)
+    monitor_latency = device_latency (monitor_handle) / PSIZ;
+
   if (use_monitor) {
     max_driver_chans = MAX (main_handle->driver_channels,
 			    monitor_handle->driver_channels);
@@ -837,6 +1014,7 @@ play_active_heads (void)
     }
 
     g_mutex_lock (&play_mutex);
+    play_free_released_inputs ();
     if (use_monitor) {
       prepare_to_play_heads (active_monitor_heads, monitor_handle);
       prepare_to_play_heads (active_main_heads, main_handle);
@@ -849,18 +1027,20 @@ play_active_heads (void)
     if (use_monitor) {
       count = PSIZ * monitor_handle->driver_channels;
       memset (devbuf, 0, count * sizeof (float));
-      play_heads (&active_monitor_heads, monitor_handle);
+      play_heads (&active_monitor_heads, monitor_handle, monitor_latency);
       device_write (monitor_handle, devbuf, count);
 
       count = PSIZ * main_handle->driver_channels;
       memset (devbuf, 0, count * sizeof (float));
-      play_heads (&active_main_heads, main_handle);
+      play_heads (&active_main_heads, main_handle, main_latency);
+      meter_update (play_meter, devbuf, PSIZ, main_handle->driver_channels);
       device_write (main_handle, devbuf, count);
     } else {
       count = PSIZ * main_handle->driver_channels;
       memset (devbuf, 0, count * sizeof (float));
-      play_heads (&active_monitor_heads, main_handle);
-      play_heads (&active_main_heads, main_handle);
+      play_heads (&active_monitor_heads, main_handle, main_latency);
+      play_heads (&active_main_heads, main_handle, main_latency);
+      meter_update (play_meter, devbuf, PSIZ, main_handle->driver_channels);
       device_write (main_handle, devbuf, count);
     }
 
@@ -878,6 +1058,10 @@ play_active_heads (void)
   device_reset (main_handle);
   device_close (main_handle);
 
+  g_list_foreach (play_inputs, (GFunc)mixer_input_free, NULL);
+  g_list_free (play_inputs);
+  play_inputs = NULL;
+
 #ifdef RECORD_DEMO_FILES
   if (sndfile) {
     printf ("Closing %s\n", filename);
@@ -894,6 +1078,10 @@ ensure_playing (void)
   sw_handle * h;
 
   if (player_thread == (pthread_t) -1) {
+    play_quality = pcmio_get_resample_quality ();
+    if (!mixer_quality_available (play_quality))
+      play_quality = MIXER_DEFAULT_QUALITY;
+
     if ((h = device_open (0, O_WRONLY)) != NULL) {
       main_handle = h;
       if (monitor_active()) {
@@ -904,6 +1092,7 @@ ensure_playing (void)
 
       pthread_create (&player_thread, NULL, (void *) (*play_active_heads),
 		      NULL);
+      levelmeter_poll_start ();
       return TRUE;
     } else {
       return FALSE;
@@ -1096,4 +1285,13 @@ void
 init_playback (void)
 {
   g_mutex_init (&play_mutex);
+  g_cond_init (&play_cond);
+
+  play_meter = meter_new ();
+}
+
+sw_meter *
+play_get_meter (void)
+{
+  return play_meter;
 }
@@ -22,10 +22,14 @@
 #define __PLAY_H__
 
 #include "sweep_app.h"
+#include "meter.h"
 
 void
 init_playback (void);
 
+sw_meter *
+play_get_meter (void);
+
 void
 play_view_all (sw_view * view);
 
@@ -56,6 +60,9 @@ pause_playback (sw_sample * s);
 void
 stop_playback (sw_sample * sample);
 
+void
+play_release_head (sw_head * head);
+
 gboolean
 any_playing (void);
 
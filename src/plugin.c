@@ -23,11 +23,22 @@
 #  include <config.h>
 #endif
 
+/*
+ * Native plugins are loaded on a background thread, so that opening
+ * every module in PACKAGE_PLUGIN_DIR is off the path to the first
+ * window. Menus are first built from a manifest of the procedures each
+ * module provided last time (~/.sweep/plugins.cache); the manifest's
+ * entries stand in for the real procedures until their module has
+ * been loaded, and menus are refreshed as modules come in.
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
 #include <glib.h>
@@ -37,43 +48,394 @@
 #include <sweep/sweep_version.h>
 #include <sweep/sweep_types.h>
 
+#include <sweep/sweep_sample.h>
+
+#include "sweep_app.h"
 #include "sweep_compat.h"
+#include "plugin.h"
+#include "startup.h"
+#include "batch.h"
+
+/*#define DEBUG*/
+
+#define PLUGINS_CACHE_HEADER "SWEEP-PLUGIN-CACHE 1"
 
+/* All procedures, sorted by name, for building menus. Only touched in
+ * the main thread. */
 GList * plugins = NULL;
 
+typedef struct _sw_plugin_module sw_plugin_module;
+
+struct _sw_plugin_module {
+  gchar * path;
+  glong mtime;
+  glong size;
+  GList * names; /* names of its procedures */
+
+  /* Once loaded */
+  GModule * module;
+  sw_plugin * plugin;
+  GList * procs;
+};
+
+/* Modules merged into plugins, in the order loaded */
 static GList * module_list = NULL;
 
+/* The manifest read at startup */
+static GList * cached_modules = NULL;
+
+/* Procedures from the manifest standing in for those not yet loaded;
+ * stand_ins holds all of them until release_plugins () */
+static GList * placeholders = NULL;
+static GList * stand_ins = NULL;
+
+/* Handed over from the loader thread */
+static GMutex loader_mutex;
+static GCond loader_cond;
+static GList * loaded_modules = NULL;
+static gboolean loader_done = FALSE;
+static GThread * loader_thread = NULL;
+
+static gboolean merged_all = FALSE;
+
 static gint
 cmp_proc_names (sw_procedure * a, sw_procedure * b)
 {
   return strcmp (_(a->name), _(b->name));
 }
 
+static sw_plugin_module *
+plugin_module_new (const gchar * path, glong mtime, glong size)
+{
+  sw_plugin_module * m;
+
+  m = g_malloc0 (sizeof (*m));
+  m->path = g_strdup (path);
+  m->mtime = mtime;
+  m->size = size;
+
+  return m;
+}
+
+static void
+plugin_module_free (sw_plugin_module * m)
+{
+  GList * gl;
+
+  for (gl = m->names; gl; gl = gl->next) {
+    g_free (gl->data);
+  }
+  g_list_free (m->names);
+  g_list_free (m->procs);
+
+  g_free (m->path);
+  g_free (m);
+}
+
+static gchar *
+plugins_cache_filename (void)
+{
+  return g_strconcat (g_get_home_dir (), "/.sweep/plugins.cache", NULL);
+}
+
+/*
+ * plugins_cache_read ()
+ *
+ * read the manifest: a line "M mtime size path" for each module,
+ * followed by a line "P name" for each of its procedures, with fields
+ * separated by tabs and strings escaped.
+ */
+static GList *
+plugins_cache_read (void)
+{
+  GList * modules = NULL;
+  sw_plugin_module * m = NULL;
+  gchar * filename;
+  gchar ** fields;
+  gchar line[1024];
+  FILE * f;
+  gint n;
+  gboolean ok = TRUE;
+
+  filename = plugins_cache_filename ();
+  f = fopen (filename, "r");
+  g_free (filename);
+
+  if (f == NULL) return NULL;
+
+  if (fgets (line, sizeof (line), f) == NULL ||
+      strcmp (g_strchomp (line), PLUGINS_CACHE_HEADER))
+    ok = FALSE;
+
+  while (ok && fgets (line, sizeof (line), f) != NULL) {
+    n = strlen (line);
+    if (n == 0 || line[n-1] != '\n') {
+      ok = FALSE;
+      break;
+    }
+    line[n-1] = '\0';
+
+    fields = g_strsplit (line, "\t", -1);
+    n = g_strv_length (fields);
+
+    if (!strcmp (fields[0], "M") && n == 4) {
+      gchar * path = g_strcompress (fields[3]);
+      m = plugin_module_new (path, strtol (fields[1], NULL, 10),
+			     strtol (fields[2], NULL, 10));
+      g_free (path);
+      modules = g_list_append (modules, m);
+    } else if (!strcmp (fields[0], "P") && n == 2 && m != NULL) {
+      m->names = g_list_append (m->names, g_strcompress (fields[1]));
+    } else {
+      ok = FALSE;
+    }
+
+    g_strfreev (fields);
+  }
+
+  fclose (f);
+
+  if (!ok) {
+    g_list_foreach (modules, (GFunc)plugin_module_free, NULL);
+    g_list_free (modules);
+    modules = NULL;
+  }
+
+  return modules;
+}
+
+static void
+plugins_cache_write (void)
+{
+  gchar * filename, * tmpname, * escaped;
+  GList * gl, * pl;
+  sw_plugin_module * m;
+  sw_procedure * proc;
+  FILE * f;
+  gboolean ok;
+
+  filename = plugins_cache_filename ();
+  tmpname = g_strconcat (filename, ".tmp", NULL);
+
+  if ((f = fopen (tmpname, "w")) != NULL) {
+    fprintf (f, "%s\n", PLUGINS_CACHE_HEADER);
+
+    for (gl = module_list; gl; gl = gl->next) {
+      m = (sw_plugin_module *)gl->data;
+
+      escaped = g_strescape (m->path, NULL);
+      fprintf (f, "M\t%ld\t%ld\t%s\n", m->mtime, m->size, escaped);
+      g_free (escaped);
+
+      for (pl = m->procs; pl; pl = pl->next) {
+	proc = (sw_procedure *)pl->data;
+	escaped = g_strescape (proc->name, NULL);
+	fprintf (f, "P\t%s\n", escaped);
+	g_free (escaped);
+      }
+    }
+
+    ok = !ferror (f);
+    if (fclose (f) != 0) ok = FALSE;
+
+    if (!ok || rename (tmpname, filename) != 0) unlink (tmpname);
+  }
+
+  g_free (tmpname);
+  g_free (filename);
+}
+
+/*
+ * plugins_cache_stale ()
+ *
+ * whether the modules loaded differ from the manifest read at startup.
+ */
+static gboolean
+plugins_cache_stale (void)
+{
+  GList * gl, * cl, * pl, * nl;
+  sw_plugin_module * m, * c;
+
+  if (g_list_length (module_list) != g_list_length (cached_modules))
+    return TRUE;
+
+  for (gl = module_list; gl; gl = gl->next) {
+    m = (sw_plugin_module *)gl->data;
+
+    for (cl = cached_modules; cl; cl = cl->next) {
+      c = (sw_plugin_module *)cl->data;
+      if (!strcmp (c->path, m->path)) break;
+    }
+    if (cl == NULL) return TRUE;
+
+    if (c->mtime != m->mtime || c->size != m->size) return TRUE;
+
+    for (pl = m->procs, nl = c->names; pl && nl; pl = pl->next, nl = nl->next) {
+      if (strcmp (((sw_procedure *)pl->data)->name, (gchar *)nl->data))
+	return TRUE;
+    }
+    if (pl != NULL || nl != NULL) return TRUE;
+  }
+
+  return FALSE;
+}
+
+/*
+ * init_cached_plugins ()
+ *
+ * add a stand-in for each procedure of each module in the manifest
+ * which is unchanged on disk.
+ */
+static void
+init_cached_plugins (void)
+{
+  GList * gl, * nl;
+  sw_plugin_module * m;
+  sw_procedure * proc;
+  struct stat statbuf;
+
+  cached_modules = plugins_cache_read ();
+
+  for (gl = cached_modules; gl; gl = gl->next) {
+    m = (sw_plugin_module *)gl->data;
+
+    if (stat (m->path, &statbuf) == -1 ||
+	(glong)statbuf.st_mtime != m->mtime ||
+	(glong)statbuf.st_size != m->size)
+      continue;
+
+    for (nl = m->names; nl; nl = nl->next) {
+      proc = g_malloc0 (sizeof (*proc));
+      proc->name = g_strdup ((gchar *)nl->data);
+
+      placeholders = g_list_append (placeholders, proc);
+      stand_ins = g_list_append (stand_ins, proc);
+      plugins = g_list_insert_sorted (plugins, proc,
+				      (GCompareFunc)cmp_proc_names);
+    }
+  }
+}
+
+/*
+ * plugins_merge ()
+ *
+ * add the procedures of modules loaded since the last merge, replacing
+ * their stand-ins. Once all modules are loaded, stand-ins left over are
+ * removed and the manifest is brought up to date. Returns whether the
+ * list of plugins changed, ie. menus need refreshing.
+ *
+ * Called in the main thread.
+ */
+static gboolean
+plugins_merge (void)
+{
+  GList * pending, * gl, * pl, * ph;
+  sw_plugin_module * m;
+  sw_procedure * proc, * stand_in;
+  gboolean done, changed = FALSE;
+
+  g_mutex_lock (&loader_mutex);
+  pending = loaded_modules;
+  loaded_modules = NULL;
+  done = loader_done;
+  g_mutex_unlock (&loader_mutex);
+
+  for (gl = pending; gl; gl = gl->next) {
+    m = (sw_plugin_module *)gl->data;
+    module_list = g_list_append (module_list, m);
+
+    for (pl = m->procs; pl; pl = pl->next) {
+      proc = (sw_procedure *)pl->data;
+
+      for (ph = placeholders; ph; ph = ph->next) {
+	stand_in = (sw_procedure *)ph->data;
+	if (!strcmp (stand_in->name, proc->name)) break;
+      }
+
+      if (ph != NULL) {
+	g_list_find (plugins, stand_in)->data = proc;
+	placeholders = g_list_delete_link (placeholders, ph);
+      } else {
+	plugins = g_list_insert_sorted (plugins, proc,
+					(GCompareFunc)cmp_proc_names);
+      }
+    }
+
+    changed = TRUE;
+  }
+
+  g_list_free (pending);
+
+  if (done && !merged_all) {
+    merged_all = TRUE;
+
+    /* Procedures no longer provided by any module */
+    for (ph = placeholders; ph; ph = ph->next) {
+      plugins = g_list_remove (plugins, ph->data);
+      changed = TRUE;
+    }
+    g_list_free (placeholders);
+    placeholders = NULL;
+
+    if (plugins_cache_stale ()) plugins_cache_write ();
+  }
+
+  return changed;
+}
+
+static gint
+plugins_refresh_menus_cb (gpointer data)
+{
+  sample_bank_refresh_proc_menus ();
+  return FALSE;
+}
+
+static gint
+plugins_merge_cb (gpointer data)
+{
+  if (plugins_merge ()) sample_bank_refresh_proc_menus ();
+  return FALSE;
+}
+
+/*
+ * sweep_plugin_load (path, statbuf)
+ *
+ * open the module at path and initialise it. Called in the loader
+ * thread; the module is handed over to the main thread to be merged.
+ */
 static void
-sweep_plugin_init (const gchar * path)
+sweep_plugin_load (const gchar * path, struct stat * statbuf)
 {
   GModule * module;
   sw_plugin * m_plugin;
   gpointer  m_plugin_ptr;
-  GList * gl;
+  sw_plugin_module * m;
 
   module = g_module_open (path, G_MODULE_BIND_LAZY);
 
   if (!module) {
 #ifdef DEBUG
-    fprintf (stderr, "sweep_plugin_init: Error opening %s: %s\n",
+    fprintf (stderr, "sweep_plugin_load: Error opening %s: %s\n",
 	     path, g_module_error());
 #endif
     return;
   }
 
   if (g_module_symbol (module, "plugin", &m_plugin_ptr)) {
-	m_plugin = (sw_plugin *)m_plugin_ptr;
-	module_list = g_list_append (module_list, m_plugin);
-    for (gl = m_plugin->plugin_init (); gl; gl = gl->next) {
-      plugins = g_list_insert_sorted (plugins, (sw_procedure *)gl->data,
-				      (GCompareFunc)cmp_proc_names);
-    }
+    m_plugin = (sw_plugin *)m_plugin_ptr;
+
+    m = plugin_module_new (path, (glong)statbuf->st_mtime,
+			   (glong)statbuf->st_size);
+    m->module = module;
+    m->plugin = m_plugin;
+    m->procs = g_list_copy (m_plugin->plugin_init ());
+
+    g_mutex_lock (&loader_mutex);
+    loaded_modules = g_list_append (loaded_modules, m);
+    g_mutex_unlock (&loader_mutex);
+
+    if (!batch_mode)
+      sweep_timeout_add ((guint32)0, (GtkFunction)plugins_merge_cb, NULL);
   }
 }
 
@@ -96,41 +458,141 @@ init_dynamic_plugins_dir (gchar * dirname)
     if (stat (path, &statbuf) == -1) {
       /* system error -- non-fatal, ignore for plugin loading */
     } else if (sw_stat_regular (statbuf.st_mode)) {
-      sweep_plugin_init (path);
+      sweep_plugin_load (path, &statbuf);
     }
+    g_free (path);
   }
 
   closedir (dir);
 }
 
+static gpointer
+plugins_loader_thread (gpointer data)
+{
+  init_dynamic_plugins_dir (PACKAGE_PLUGIN_DIR);
+
+  startup_trace ("plugins loaded");
+
+  g_mutex_lock (&loader_mutex);
+  loader_done = TRUE;
+  g_cond_broadcast (&loader_cond);
+  g_mutex_unlock (&loader_mutex);
+
+  if (!batch_mode)
+    sweep_timeout_add ((guint32)0, (GtkFunction)plugins_merge_cb, NULL);
+
+  return NULL;
+}
+
 /* Initialise dynamically linked plugins */
 static void
 init_dynamic_plugins (void)
 {
-  init_dynamic_plugins_dir (PACKAGE_PLUGIN_DIR);
+  init_cached_plugins ();
+
+  loader_thread = g_thread_new ("plugins", plugins_loader_thread, NULL);
 }
 
-static void
-release_one (gpointer data, gpointer user_data)
+static gboolean
+plugins_wait_and_merge (void)
 {
-  sw_plugin *p = (sw_plugin *) data;
-  if (p && p->plugin_cleanup)
-    p->plugin_cleanup ();
+  g_mutex_lock (&loader_mutex);
+  while (!loader_done)
+    g_cond_wait (&loader_cond, &loader_mutex);
+  g_mutex_unlock (&loader_mutex);
+
+  return plugins_merge ();
 }
 
+/*
+ * plugins_wait_loaded ()
+ *
+ * wait for plugins to finish loading and merge them all, for when there
+ * is no main loop to merge them as they arrive.
+ */
+void
+plugins_wait_loaded (void)
+{
+  plugins_wait_and_merge ();
+}
+
+/*
+ * plugin_procedure_resolve (proc)
+ *
+ * return the procedure to apply for the menu entry proc. If proc is a
+ * stand-in from the manifest, wait for plugins to finish loading and
+ * return the real procedure of the same name, or NULL if it has gone.
+ */
+sw_procedure *
+plugin_procedure_resolve (sw_procedure * proc)
+{
+  GList * gl;
+  sw_procedure * p;
+
+  if (g_list_find (stand_ins, proc) == NULL) return proc;
+
+  /* This is called from a menu item, so refresh menus afterwards */
+  if (plugins_wait_and_merge ())
+    sweep_timeout_add ((guint32)0, (GtkFunction)plugins_refresh_menus_cb,
+		       NULL);
+
+  for (gl = plugins; gl; gl = gl->next) {
+    p = (sw_procedure *)gl->data;
+    if (!strcmp (p->name, proc->name)) return p;
+  }
+
+  return NULL;
+}
 
 void
 init_plugins (void)
 {
   if (g_module_supported ()) {
     init_dynamic_plugins ();
+  } else {
+    loader_done = TRUE;
   }
 }
 
 void
 release_plugins (void)
 {
-  g_list_foreach (module_list, release_one, NULL);
+  GList * gl;
+  sw_plugin_module * m;
+  sw_procedure * proc;
+
+  if (loader_thread != NULL) {
+    g_thread_join (loader_thread);
+    loader_thread = NULL;
+  }
+
+  /* Modules loaded too late to be merged */
+  module_list = g_list_concat (module_list, loaded_modules);
+  loaded_modules = NULL;
+
+  for (gl = module_list; gl; gl = gl->next) {
+    m = (sw_plugin_module *)gl->data;
+    if (m->plugin && m->plugin->plugin_cleanup)
+      m->plugin->plugin_cleanup ();
+    plugin_module_free (m);
+  }
+  g_list_free (module_list);
+  module_list = NULL;
+
+  g_list_foreach (cached_modules, (GFunc)plugin_module_free, NULL);
+  g_list_free (cached_modules);
+  cached_modules = NULL;
+
+  for (gl = stand_ins; gl; gl = gl->next) {
+    proc = (sw_procedure *)gl->data;
+    g_free (proc->name);
+    g_free (proc);
+  }
+  g_list_free (stand_ins);
+  stand_ins = NULL;
+  g_list_free (placeholders);
+  placeholders = NULL;
+
   g_list_free (plugins);
   plugins = NULL;
 }
@@ -22,9 +22,17 @@
 #ifndef __PLUGIN_H__
 #define __PLUGIN_H__
 
+#include <sweep/sweep_types.h>
+
 void
 init_plugins (void);
 
+void
+plugins_wait_loaded (void);
+
+sw_procedure *
+plugin_procedure_resolve (sw_procedure * proc);
+
 void
 release_plugins (void);
 
@@ -34,6 +34,7 @@
 #include <sweep/sweep_sample.h>
 
 #include "interface.h"
+#include "batch.h"
 
 #include "../pixmaps/scrubby.xpm"
 #include "../pixmaps/scrubby_system.xpm"
@@ -217,6 +218,11 @@ info_dialog_new (const char * title, gpointer xpm_data, const char * fmt, ...)
   vsnprintf (buf, sizeof (buf), fmt, ap);
   va_end (ap);
 
+  if (batch_mode) {
+    batch_report ("%s: %s", title, buf);
+    return;
+  }
+
   id = g_malloc (sizeof (info_dialog_data));
   snprintf (id->title, sizeof (id->title), "%s", title);
   snprintf (id->message, sizeof (id->message), "%s", buf);
@@ -266,5 +272,11 @@ sweep_perror (int thread_errno, const char * fmt, ...)
   vsnprintf (pd->message, sizeof (pd->message), fmt, ap);
   va_end (ap);
 
+  if (batch_mode) {
+    batch_report ("%s: %s", pd->message, g_strerror (thread_errno));
+    g_free (pd);
+    return;
+  }
+
   sweep_timeout_add ((guint32)0, (GtkFunction)syserror_dialog_new, pd);
 }
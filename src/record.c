@@ -30,11 +30,14 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include <glib.h>
 #include <gdk/gdkkeysyms.h>
 #include <gtk/gtk.h>
 
+#include <sndfile.h>
+
 #include "callbacks.h"
 
 #include <sweep/sweep_i18n.h>
@@ -55,9 +58,39 @@
 #include "driver.h"
 #include "undo_dialog.h"
 #include "db_slider.h"
+#include "file_dialogs.h"
+#include "preferences.h"
+#include "ringbuffer.h"
 
 #define DEBUG
 
+/* Seconds of input the capture ring holds while the writer is held up */
+#define CAPTURE_RING_SECONDS 2
+
+/* Nr. of frames read from the device at a time */
+#define CAPTURE_FRAMES 1024
+
+/* How long the writer sleeps when the capture ring is empty */
+#define CAPTURE_POLL_USEC 5000
+
+/* Seconds between header updates of a file being recorded to, so that
+ * the file is readable up to then if sweep does not finish it */
+#define TAKE_HEADER_SECONDS 2
+
+#define REC_FILE_KEY "Record_File"
+#define REC_FILE_OPEN_KEY "Record_File_Open"
+
+typedef struct {
+  sw_handle * handle;
+  sw_ringbuffer * ring;
+  sw_meter * meter;
+  gint channels;
+  gint running; /* cleared to stop the capture thread */
+  gint failed; /* set if the device could not be read */
+  gint overruns; /* nr. of reads which did not fit in the ring */
+  gint dropped; /* nr. of frames lost to overruns */
+} sw_capture;
+
 extern GtkStyle * style_wb;
 extern GtkStyle * style_LCD;
 extern GtkStyle * style_light_grey;
@@ -75,6 +108,8 @@ static gint update_tag = -1;
 
 static GtkWidget * rec_ind_ebox;
 static GtkWidget * rec_ind_label;
+static GtkWidget * rec_overruns_label;
+static GtkWidget * rec_file_checkbox, * rec_file_entry, * rec_open_checkbox;
 static gboolean rec_ind_state = FALSE;
 
 static GtkWidget * combo;
@@ -83,6 +118,35 @@ static sw_head_controller * head_controller;
 
 static sw_head * rec_head = NULL;
 
+static sw_capture capture;
+
+/* Levels of the input, kept for the life of the dialog's meters */
+static sw_meter * rec_meter = NULL;
+
+/* The file being recorded to, if any, and its length so far */
+static gchar * take_pathname = NULL;
+static gint take_seconds = 0;
+static sw_framecount_t take_frames = 0;
+
+static void
+update_rec_overruns (void)
+{
+  gint overruns, dropped;
+  gchar * text;
+
+  overruns = g_atomic_int_get (&capture.overruns);
+  dropped = g_atomic_int_get (&capture.dropped);
+
+  if (overruns == 0) {
+    gtk_label_set_text (GTK_LABEL(rec_overruns_label), _("No overruns"));
+  } else {
+    text = g_strdup_printf (_("Overruns: %d (%d frames dropped)"),
+			    overruns, dropped);
+    gtk_label_set_text (GTK_LABEL(rec_overruns_label), text);
+    g_free (text);
+  }
+}
+
 static gint
 update_rec_ind (gpointer data)
 {
@@ -90,11 +154,25 @@ update_rec_ind (gpointer data)
 
   if (rec_dialog == NULL) {
     return FALSE;
-  } else if (!h->going) {
+  }
+
+  update_rec_overruns ();
+
+  if (!h->going) {
     gtk_label_set_text (GTK_LABEL(rec_ind_label), _("Ready to record"));
     gtk_widget_set_style (rec_ind_ebox, style_light_grey);
     return FALSE;
   } else {
+    if (take_pathname != NULL) {
+      gint t = g_atomic_int_get (&take_seconds);
+      gchar * text;
+
+      text = g_strdup_printf (_("RECORDING to %s (%d:%02d:%02d)"),
+			      take_pathname, t / 3600, (t / 60) % 60, t % 60);
+      gtk_label_set_text (GTK_LABEL(rec_ind_label), text);
+      g_free (text);
+    }
+
     rec_ind_state = !rec_ind_state;
 
     if (rec_ind_state) {
@@ -130,20 +208,20 @@ static void
 start_recmarker (sw_head * head)
 {
   if (update_tag > 0) {
-    g_source_remove (update_tag);
+    sweep_timeout_remove (update_tag);
   }
 
-  update_tag = g_timeout_add ((guint32)30,
-				(GSourceFunc)update_recmarker,
-				(gpointer)head);
+  update_tag = sweep_timeout_add ((guint32)30,
+				  (GtkFunction)update_recmarker,
+				  (gpointer)head);
 
   gtk_label_set_text (GTK_LABEL(rec_ind_label), "RECORDING");
   gtk_widget_set_style (rec_ind_ebox, style_red);
   rec_ind_state = TRUE;
 
-  g_timeout_add ((guint32)500,
-		   (GSourceFunc)update_rec_ind,
-		   (gpointer)head);
+  sweep_timeout_add ((guint32)500,
+		     (GtkFunction)update_rec_ind,
+		     (gpointer)head);
 }
 
 static void
@@ -168,8 +246,15 @@ stop_recording (sw_sample * sample)
   head_set_going (sample->rec_head, FALSE);
 }
 
+/*
+ * prepare_recording (sample, format)
+ *
+ * opens the device to capture in format. Captured frames are written
+ * into the sample as they come, so a device which runs at another rate,
+ * such as a JACK server, is refused rather than recording out of tune.
+ */
 static void
-prepare_recording (sw_format * format)
+prepare_recording (sw_sample * sample, sw_format * format)
 {
   rec_handle = device_open (0, O_RDONLY);
 
@@ -177,20 +262,112 @@ prepare_recording (sw_format * format)
 
   device_setup (rec_handle, format);
 
+  if (rec_handle->driver_rate > 0 &&
+      rec_handle->driver_rate != format->rate) {
+    sample_set_tmp_message (sample, _("Can't record at %d Hz: the device "
+				      "is running at %d Hz"),
+			    (int)format->rate, rec_handle->driver_rate);
+    device_close (rec_handle);
+    rec_handle = NULL;
+    return;
+  }
+
   rec_prepared = TRUE;
 }
 
-static struct timeval tv_instant = {0, 0};
+/*
+ * capture_thread (data)
+ *
+ * reads from the device into the capture ring until told to stop, and
+ * meters what it reads. This thread takes no locks, so that nothing the
+ * rest of sweep is doing can hold up the device; input which finds the
+ * ring full is dropped and counted.
+ */
+static gpointer
+capture_thread (gpointer data)
+{
+  sw_capture * cap = (sw_capture *)data;
+  gfloat * buf;
+  gsize count, space, n;
+
+  count = CAPTURE_FRAMES * cap->channels;
+  buf = g_malloc (count * sizeof (gfloat));
+
+  while (g_atomic_int_get (&cap->running)) {
+    if (device_read (cap->handle, buf, count) == -1) {
+      g_atomic_int_set (&cap->failed, TRUE);
+      break;
+    }
+
+    meter_update (cap->meter, buf, CAPTURE_FRAMES, cap->channels);
+
+    /* Only whole frames go into the ring */
+    space = ringbuffer_write_space (cap->ring);
+    n = MIN (count, space - space % cap->channels);
+
+    ringbuffer_write (cap->ring, buf, n);
+
+    if (n < count) {
+      g_atomic_int_inc (&cap->overruns);
+      g_atomic_int_add (&cap->dropped, (count - n) / cap->channels);
+    }
+  }
+
+  g_free (buf);
+
+  return NULL;
+}
+
+static GThread *
+capture_start (sw_format * f)
+{
+  capture.handle = rec_handle;
+  capture.ring =
+    ringbuffer_new (f->rate * f->channels * CAPTURE_RING_SECONDS);
+
+  if (rec_meter == NULL) rec_meter = meter_new ();
+  capture.meter = rec_meter;
+  capture.channels = f->channels;
+  capture.running = TRUE;
+  capture.failed = FALSE;
+  g_atomic_int_set (&capture.overruns, 0);
+  g_atomic_int_set (&capture.dropped, 0);
+
+  levelmeter_poll_start ();
+
+  return g_thread_new ("capture", capture_thread, &capture);
+}
 
+static void
+capture_stop (GThread * thread)
+{
+  g_atomic_int_set (&capture.running, FALSE);
+  g_thread_join (thread);
+
+  ringbuffer_free (capture.ring);
+  capture.ring = NULL;
+}
+
+/*
+ * do_record_regions (sample)
+ *
+ * starts a capture thread and writes what it captures into the sample.
+ * Waiting on ops_mutex here only lets the capture ring fill up.
+ *
+ * When overdubbing, ie. recording while the sample plays, what is
+ * played into the microphone reaches us a device latency after the
+ * sound it accompanies, so that much of the start of the recording is
+ * skipped to line the two up.
+ */
 static void
 do_record_regions (sw_sample * sample)
 {
   sw_head * head = sample->rec_head;
   sw_sounddata * sounddata = sample->sounddata;
   sw_format * f = sounddata->format;
-  fd_set fds;
+  GThread * thread;
   sw_framecount_t sel_total, run_total;
-  sw_framecount_t offset, remaining, n, count;
+  sw_framecount_t n, skip = 0;
   gint percent;
 
   float * rbuf;
@@ -198,51 +375,70 @@ do_record_regions (sw_sample * sample)
   gboolean active = TRUE;
 
   if (!rec_prepared)
-    prepare_recording (f);
+    prepare_recording (sample, f);
 
   if (rec_handle == NULL) goto done;
 
   head->restricted = TRUE;
 
+  /* Punch in afresh where this take starts */
+  head->punch_next = -1;
+
   sel_total = sounddata_selection_nr_frames (sounddata) / 100;
   if (sel_total == 0) sel_total = 1;
   run_total = 0;
 
-  rbuf = alloca (1024 * f->channels * sizeof (float));
+  rbuf = g_malloc (CAPTURE_FRAMES * f->channels * sizeof (float));
 
-  while (active) {
+  if (sample->play_head != NULL && sample->play_head->going)
+    skip = device_latency (rec_handle);
+
+  thread = capture_start (f);
 
-    FD_ZERO (&fds);
-    FD_SET (rec_handle->driver_fd, &fds);
+  while (active) {
+    n = ringbuffer_read_space (capture.ring) / f->channels;
+    n = MIN (n, CAPTURE_FRAMES);
 
-    if (select (rec_handle->driver_fd+1, &fds, NULL, NULL, &tv_instant) == 0);
+    if (n > 0)
+      ringbuffer_read (capture.ring, rbuf, n * f->channels);
 
-    n = 1024;
-    count = n * f->channels;
+    if (skip > 0 && n > 0) {
+      sw_framecount_t m = MIN (skip, n);
 
-    count = device_read (rec_handle, rbuf, count);
+      memmove (rbuf, rbuf + m * f->channels,
+	       (n - m) * f->channels * sizeof (float));
+      skip -= m;
+      n -= m;
+      if (n == 0) continue;
+    }
 
     g_mutex_lock (&sample->ops_mutex);
 
-    if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL || count == -1 ||
-	!head->going) {
+    if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL || !head->going ||
+	(n == 0 && g_atomic_int_get (&capture.failed))) {
       active = FALSE;
-    } else {
+    } else if (n > 0) {
       head_write (head, rbuf, n);
 
-      remaining -= n;
-      offset += n;
-
       run_total += n;
       percent = run_total / sel_total;
       percent = MIN (100, percent);
       sample_set_progress_percent (sample, percent);
-
     }
 
     g_mutex_unlock (&sample->ops_mutex);
+
+    if (active && n == 0)
+      g_usleep (CAPTURE_POLL_USEC);
   }
 
+  capture_stop (thread);
+  g_free (rbuf);
+
+  if (capture.dropped > 0)
+    sample_set_tmp_message (sample, _("Recording dropped %d frames"),
+			    capture.dropped);
+
  done:
   if (rec_handle != NULL) {
     device_close (rec_handle);
@@ -286,6 +482,207 @@ static sw_operation record_regions_op = {
   (SweepFunction)paste_over_data_destroy
 };
 
+/*
+ * record_file_format (pathname)
+ *
+ * chooses the libsndfile format to record to from the extension of
+ * pathname, as file_guess_method() does; WAV if it is not recognised.
+ */
+static int
+record_file_format (const gchar * pathname)
+{
+  SF_FORMAT_INFO info;
+  const gchar * ext;
+  int i, count;
+
+  if ((ext = strrchr (pathname, '.')) != NULL) {
+    ext++;
+
+    sf_command (NULL, SFC_GET_FORMAT_MAJOR_COUNT, &count, sizeof (int));
+
+    for (i = 0; i < count; i++) {
+      info.format = i;
+      sf_command (NULL, SFC_GET_FORMAT_MAJOR, &info, sizeof (info));
+
+      if (!g_ascii_strcasecmp (ext, info.extension))
+	return info.format;
+    }
+  }
+
+  return SF_FORMAT_WAV;
+}
+
+static gint
+record_file_done_cb (gpointer data)
+{
+  sw_sample * sample = (sw_sample *)data;
+
+  head_set_going (sample->rec_head, FALSE);
+
+  if (rec_dialog != NULL)
+    gtk_widget_set_sensitive (combo, TRUE);
+
+  if (take_frames > 0 && prefs_get_int (REC_FILE_OPEN_KEY, 1))
+    sample_load (take_pathname);
+
+  g_free (take_pathname);
+  take_pathname = NULL;
+
+  return FALSE;
+}
+
+/*
+ * record_file_thread (data)
+ *
+ * streams what is captured into a new file at take_pathname, rather
+ * than into the sample, so that a recording may be as long as the disk
+ * allows while memory use stays the same.
+ */
+static gpointer
+record_file_thread (gpointer data)
+{
+  sw_sample * sample = (sw_sample *)data;
+  sw_head * head = sample->rec_head;
+  sw_format * f = sample->sounddata->format;
+  SNDFILE * sndfile;
+  SF_INFO sfinfo;
+  GThread * thread;
+  sw_framecount_t n, total = 0, header_total = 0;
+  gfloat * rbuf, gain;
+  glong i;
+
+  /* Forget any previous take, so that a take which fails to start is
+   * not mistaken for it when done */
+  g_atomic_int_set (&take_seconds, 0);
+  take_frames = 0;
+
+  memset (&sfinfo, 0, sizeof (sfinfo));
+  sfinfo.samplerate = (int)f->rate;
+  sfinfo.channels = (int)f->channels;
+  sfinfo.format = record_file_format (take_pathname) | SF_FORMAT_PCM_24;
+  if (!sf_format_check (&sfinfo))
+    sfinfo.format = (sfinfo.format & SF_FORMAT_TYPEMASK) | SF_FORMAT_PCM_16;
+
+  if ((sndfile = sf_open (take_pathname, SFM_WRITE, &sfinfo)) == NULL) {
+    sample_set_tmp_message (sample, "%s: %s", take_pathname,
+			    sf_strerror (NULL));
+    goto done;
+  }
+
+  if (!rec_prepared)
+    prepare_recording (sample, f);
+
+  if (rec_handle == NULL) {
+    /* The device was refused; don't leave an empty file behind */
+    sf_close (sndfile);
+    unlink (take_pathname);
+    goto done;
+  }
+
+  rbuf = g_malloc (CAPTURE_FRAMES * f->channels * sizeof (gfloat));
+
+  thread = capture_start (f);
+
+  while (head->going) {
+    n = ringbuffer_read_space (capture.ring) / f->channels;
+    n = MIN (n, CAPTURE_FRAMES);
+
+    if (n == 0) {
+      if (g_atomic_int_get (&capture.failed)) break;
+      g_usleep (CAPTURE_POLL_USEC);
+      continue;
+    }
+
+    ringbuffer_read (capture.ring, rbuf, n * f->channels);
+
+    gain = head->gain;
+    if (gain != 1.0) {
+      for (i = 0; i < n * f->channels; i++) rbuf[i] *= gain;
+    }
+
+    if (sf_writef_float (sndfile, rbuf, n) != n) {
+      sample_set_tmp_message (sample, "%s: %s", take_pathname,
+			      sf_strerror (sndfile));
+      break;
+    }
+
+    total += n;
+
+    if (total - header_total >= f->rate * TAKE_HEADER_SECONDS) {
+      sf_command (sndfile, SFC_UPDATE_HEADER_NOW, NULL, 0);
+      header_total = total;
+      g_atomic_int_set (&take_seconds, (gint)(total / f->rate));
+    }
+  }
+
+  capture_stop (thread);
+  g_free (rbuf);
+
+  sf_close (sndfile);
+
+  take_frames = total;
+
+  if (capture.dropped > 0)
+    sample_set_tmp_message (sample, _("Recording dropped %d frames"),
+			    capture.dropped);
+
+ done:
+  if (rec_handle != NULL) {
+    device_close (rec_handle);
+    rec_handle = NULL;
+  }
+
+  rec_prepared = FALSE;
+
+  sweep_timeout_add ((guint32)0, (GtkFunction)record_file_done_cb, sample);
+
+  return NULL;
+}
+
+/*
+ * record_file_start (head)
+ *
+ * starts recording to the file named in the dialog, in which strftime
+ * conversions are replaced by the date and time of starting.
+ */
+static void
+record_file_start (sw_head * head)
+{
+  sw_sample * sample = head->sample;
+  const gchar * pattern;
+  gchar buf[512];
+  time_t now;
+
+  if (take_pathname != NULL) {
+    head_set_going (head, FALSE);
+    sample_set_tmp_message (sample, _("Already recording to %s"),
+			    take_pathname);
+    return;
+  }
+
+  pattern = gtk_entry_get_text (GTK_ENTRY(rec_file_entry));
+
+  now = time (NULL);
+  if (pattern[0] == '\0' ||
+      strftime (buf, sizeof (buf), pattern, localtime (&now)) == 0) {
+    head_set_going (head, FALSE);
+    sample_set_tmp_message (sample, _("No file to record to"));
+    return;
+  }
+
+  prefs_set_string (REC_FILE_KEY, (gchar *)pattern);
+  prefs_set_int (REC_FILE_OPEN_KEY, gtk_toggle_button_get_active
+		 (GTK_TOGGLE_BUTTON(rec_open_checkbox)));
+
+  take_pathname = g_strdup (buf);
+
+  head->going = TRUE;
+  gtk_widget_set_sensitive (combo, FALSE);
+  g_thread_unref (g_thread_new ("record to file", record_file_thread,
+				sample));
+  start_recmarker (head);
+}
+
 void
 record_cb (GtkWidget * widget, gpointer data)
 {
@@ -294,6 +691,9 @@ record_cb (GtkWidget * widget, gpointer data)
 
   if (head->going) {
     stop_recording (sample);
+  } else if (rec_dialog != NULL && gtk_toggle_button_get_active
+	     (GTK_TOGGLE_BUTTON(rec_file_checkbox))) {
+    record_file_start (head);
   } else {
     if (sounddata_selection_nr_frames (sample->sounddata) > 0) {
       head->going = TRUE;
@@ -410,11 +810,9 @@ rec_dialog_create (sw_sample * sample)
   GtkWidget * slider;
   GtkWidget * ebox;
   GtkWidget * hctl;
+  GtkWidget * checkbox, * entry;
   GtkTooltips * tooltips;
-
-#ifdef DEVEL_CODE
-  GtkWidget * levelmeter;
-#endif
+  gchar pattern[512];
 
   /*  GSList * group;*/
 
@@ -516,15 +914,52 @@ rec_dialog_create (sw_sample * sample)
 
     /* Level meters */
 
-#ifdef DEVEL_CODE
-    levelmeter = levelmeter_new (7);
-    gtk_box_pack_start (GTK_BOX(hbox), levelmeter, FALSE, TRUE, 3);
-    gtk_widget_show (levelmeter);
+    if (rec_meter == NULL) rec_meter = meter_new ();
+    meter_reset (rec_meter);
 
-    levelmeter = levelmeter_new (7);
-    gtk_box_pack_start (GTK_BOX(hbox), levelmeter, FALSE, TRUE, 3);
-    gtk_widget_show (levelmeter);
-#endif
+    ebox = levelmeter_box_new (rec_meter);
+    gtk_box_pack_start (GTK_BOX(hbox), ebox, FALSE, TRUE, 3);
+    gtk_widget_show (ebox);
+
+    /* Record to file */
+
+    hbox = gtk_hbox_new (FALSE, 8);
+    gtk_box_pack_start (GTK_BOX(main_vbox), hbox, FALSE, TRUE, 4);
+    gtk_widget_show (hbox);
+
+    checkbox = gtk_check_button_new_with_label (_("Record to file:"));
+    gtk_box_pack_start (GTK_BOX(hbox), checkbox, FALSE, FALSE, 8);
+    gtk_widget_show (checkbox);
+
+    rec_file_checkbox = checkbox;
+
+    gtk_tooltips_set_tip (tooltips, checkbox,
+			  _("Record straight into a new file rather than "
+			    "into the selection, so that recordings can be "
+			    "as long as the disk allows. %Y, %m, %d, %H, %M "
+			    "and %S in the file name are replaced by the "
+			    "date and time recording starts. WAV files "
+			    "cannot be longer than 4GB; use .w64 or .caf "
+			    "for longer recordings."), NULL);
+
+    entry = gtk_entry_new ();
+    prefs_get_string (REC_FILE_KEY, pattern, sizeof (pattern), "");
+    if (pattern[0] == '\0')
+      g_snprintf (pattern, sizeof (pattern), "%s/sweep-%%Y%%m%%d-%%H%%M%%S.wav",
+		  g_get_home_dir ());
+    gtk_entry_set_text (GTK_ENTRY(entry), pattern);
+    gtk_box_pack_start (GTK_BOX(hbox), entry, TRUE, TRUE, 0);
+    gtk_widget_show (entry);
+
+    rec_file_entry = entry;
+
+    checkbox = gtk_check_button_new_with_label (_("Open when done"));
+    gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(checkbox),
+				  prefs_get_int (REC_FILE_OPEN_KEY, 1));
+    gtk_box_pack_start (GTK_BOX(hbox), checkbox, FALSE, FALSE, 8);
+    gtk_widget_show (checkbox);
+
+    rec_open_checkbox = checkbox;
 
     hctl = head_controller_create (sample->rec_head, rec_dialog,
 				   &head_controller);
@@ -543,6 +978,13 @@ rec_dialog_create (sw_sample * sample)
     gtk_widget_show (label);
 
     rec_ind_label = label;
+
+    label = gtk_label_new (NULL);
+    gtk_box_pack_start (GTK_BOX(main_vbox), label, FALSE, TRUE, 4);
+    gtk_widget_show (label);
+
+    rec_overruns_label = label;
+    update_rec_overruns ();
   }
 
   rec_dialog_refresh_sample_list ();
@@ -0,0 +1,148 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Single producer, single consumer ring buffer.
+ *
+ * The writer only ever advances write_count and the reader only ever
+ * advances read_count. Both are free running and wrap around together,
+ * so their difference is the nr. of samples waiting, and the buffer
+ * size being a power of two makes the position of either a mask away.
+ * The atomic get and set of the counts order the copies of the data
+ * either side of them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "ringbuffer.h"
+
+struct _sw_ringbuffer {
+  gfloat * data;
+  guint size, mask;
+  gint write_count; /* set by the writer only */
+  gint read_count; /* set by the reader only */
+};
+
+/*
+ * ringbuffer_new (min_size)
+ *
+ * creates an empty ring buffer holding at least min_size samples.
+ */
+sw_ringbuffer *
+ringbuffer_new (gsize min_size)
+{
+  sw_ringbuffer * ring;
+  guint size = 1;
+
+  while (size < min_size) size <<= 1;
+
+  ring = g_malloc0 (sizeof (sw_ringbuffer));
+  ring->data = g_malloc0 (size * sizeof (gfloat));
+  ring->size = size;
+  ring->mask = size - 1;
+
+  return ring;
+}
+
+void
+ringbuffer_free (sw_ringbuffer * ring)
+{
+  if (ring == NULL) return;
+
+  g_free (ring->data);
+  g_free (ring);
+}
+
+gsize
+ringbuffer_read_space (sw_ringbuffer * ring)
+{
+  return (guint)g_atomic_int_get (&ring->write_count) -
+    (guint)g_atomic_int_get (&ring->read_count);
+}
+
+gsize
+ringbuffer_write_space (sw_ringbuffer * ring)
+{
+  return ring->size - ringbuffer_read_space (ring);
+}
+
+/*
+ * ringbuffer_write (ring, buf, count)
+ *
+ * copies as many of the count samples of buf into ring as will fit.
+ * Returns the nr. of samples written. Called from the writing thread only.
+ */
+gsize
+ringbuffer_write (sw_ringbuffer * ring, const gfloat * buf, gsize count)
+{
+  gsize space;
+  guint w, pos, n1;
+
+  /* The other side may change the space, so look at it only once */
+  space = ringbuffer_write_space (ring);
+  count = MIN (count, space);
+  if (count == 0) return 0;
+
+  w = (guint)g_atomic_int_get (&ring->write_count);
+  pos = w & ring->mask;
+  n1 = MIN (count, ring->size - pos);
+
+  memcpy (ring->data + pos, buf, n1 * sizeof (gfloat));
+  memcpy (ring->data, buf + n1, (count - n1) * sizeof (gfloat));
+
+  g_atomic_int_set (&ring->write_count, (gint)(w + count));
+
+  return count;
+}
+
+/*
+ * ringbuffer_read (ring, buf, count)
+ *
+ * moves up to count samples out of ring into buf. Returns the nr. of
+ * samples read. Called from the reading thread only.
+ */
+gsize
+ringbuffer_read (sw_ringbuffer * ring, gfloat * buf, gsize count)
+{
+  gsize space;
+  guint r, pos, n1;
+
+  /* The other side may change the space, so look at it only once */
+  space = ringbuffer_read_space (ring);
+  count = MIN (count, space);
+  if (count == 0) return 0;
+
+  r = (guint)g_atomic_int_get (&ring->read_count);
+  pos = r & ring->mask;
+  n1 = MIN (count, ring->size - pos);
+
+  memcpy (buf, ring->data + pos, n1 * sizeof (gfloat));
+  memcpy (buf + n1, ring->data, (count - n1) * sizeof (gfloat));
+
+  g_atomic_int_set (&ring->read_count, (gint)(r + count));
+
+  return count;
+}
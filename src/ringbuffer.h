@@ -0,0 +1,51 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __RINGBUFFER_H__
+#define __RINGBUFFER_H__
+
+#include <glib.h>
+
+/*
+ * sw_ringbuffer: a fixed size FIFO of samples between exactly one
+ * writing thread and one reading thread. Neither side takes a lock, so
+ * a realtime thread can write into it without waiting on the reader.
+ */
+typedef struct _sw_ringbuffer sw_ringbuffer;
+
+sw_ringbuffer *
+ringbuffer_new (gsize min_size);
+
+void
+ringbuffer_free (sw_ringbuffer * ring);
+
+gsize
+ringbuffer_read_space (sw_ringbuffer * ring);
+
+gsize
+ringbuffer_write_space (sw_ringbuffer * ring);
+
+gsize
+ringbuffer_write (sw_ringbuffer * ring, const gfloat * buf, gsize count);
+
+gsize
+ringbuffer_read (sw_ringbuffer * ring, gfloat * buf, gsize count);
+
+#endif /* __RINGBUFFER_H__ */
@@ -35,6 +35,8 @@
 #include <gtk/gtk.h>
 
 #include <sweep/sweep_i18n.h>
+#include <sweep/sweep_sounddata.h>
+#include <sweep/sweep_analysis.h>
 
 #include "sweep_app.h"
 #include "sample.h"
@@ -43,6 +45,7 @@
 #include "play.h"
 #include "callbacks.h"
 #include "edit.h"
+#include "peakcache.h"
 #include "undo_dialog.h"
 
 /*#define DEBUG*/
@@ -290,7 +293,8 @@ sample_display_refresh_play_marker (SampleDisplay *s)
   sample = s->view->sample;
   head = sample->play_head;
 
-  s->play_offset_x = OFFSET_TO_XPOS(head->offset);
+  s->play_offset_x =
+    OFFSET_TO_XPOS(head->going ? head->realoffset : head->offset);
 
   /* paint play offset */
   if (s->old_play_offset_x != s->play_offset_x) {
@@ -344,69 +348,6 @@ sample_display_refresh_rec_marker (SampleDisplay *s)
   }
 }
 
-static void
-sample_display_refresh_sels (SampleDisplay * s)
-{
-  int x, x2;
-  sw_sample * sample;
-  GList * gl;
-  sw_sel * sel;
-
-  g_return_if_fail(s != NULL);
-  g_return_if_fail(IS_SAMPLE_DISPLAY(s));
-
-  if(!IS_INITIALIZED(s))
-    return;
-
-  sample = s->view->sample;
-
-  /* paint marching ants */
-
-  /* real selection */
-  for (gl = sample->sounddata->sels; gl; gl = gl->next) {
-    sel = (sw_sel *)gl->data;
-
-    x = OFFSET_TO_XPOS(sel->sel_start);
-    x2 = OFFSET_TO_XPOS(sel->sel_end);
-
-    if ((x >= 0) && (x <= s->width)) {
-      gtk_widget_queue_draw_area (GTK_WIDGET(s), x, 0, 1, s->height);
-    }
-    if ((x2 >= 0) && (x2 <= s->width)) {
-      gtk_widget_queue_draw_area (GTK_WIDGET(s), x2, 0, 1, s->height);
-    }
-
-    if ((x <= s->width) && (x2 >= 0)) {
-      x = CLAMP (x, 0, s->width);
-      x2 = CLAMP (x2, 0, s->width);
-      gtk_widget_queue_draw_area (GTK_WIDGET(s), x, 0, x2 - x, 1);
-      gtk_widget_queue_draw_area (GTK_WIDGET(s), x, s->height - 1, x2 - x, 1);
-    }
-  }
-
-  /* temporary selection */
-  sel = sample->tmp_sel;
-
-  if (sel) {
-    x = OFFSET_TO_XPOS(sel->sel_start);
-    x2 = OFFSET_TO_XPOS(sel->sel_end);
-
-    if ((x >= 0) && (x <= s->width)) {
-      gtk_widget_queue_draw_area (GTK_WIDGET(s), x, 0, 1, s->height);
-    }
-    if ((x2 >= 0) && (x2 <= s->width)) {
-      gtk_widget_queue_draw_area (GTK_WIDGET(s), x2, 0, 1, s->height);
-    }
-
-    if ((x <= s->width) && (x2 >= 0)) {
-      x = CLAMP (x, 0, s->width);
-      x2 = CLAMP (x2, 0, s->width);
-      gtk_widget_queue_draw_area (GTK_WIDGET(s), x, 0, x2 - x, 1);
-      gtk_widget_queue_draw_area (GTK_WIDGET(s), x, s->height - 1, x2 - x, 1);
-    }
-  }
-}
-
 void
 sample_display_set_cursor (SampleDisplay * s, GdkCursor * cursor)
 {
@@ -723,6 +664,66 @@ sample_display_realize (GtkWidget *widget)
 }
 
 
+/*
+ * sd_first_sel_span (s, x_min)
+ *
+ * returns the first region of the real selection which could be visible
+ * at or right of pixel x_min. Regions left of it are never looked at.
+ */
+static GList *
+sd_first_sel_span (const SampleDisplay * s, int x_min)
+{
+  /* Back off a pixel, as a region ending just short of the frame at
+   * x_min can still round onto that pixel */
+  return sounddata_selection_seek (s->view->sample->sounddata,
+				   XPOS_TO_OFFSET(x_min - 1));
+}
+
+/*
+ * sd_next_sel_span (s, &gl, x_min, x_max, &x, &x2)
+ *
+ * walks the real selection from *gl, returning in x and x2 the pixel
+ * extent of the next run of regions visible within [x_min, x_max].
+ * Regions that touch or overlap in pixel space are merged into one span,
+ * so a dense selection costs at most one span per pixel however many
+ * regions it holds. Start *gl at sd_first_sel_span().
+ */
+static gboolean
+sd_next_sel_span (const SampleDisplay * s, GList ** glp,
+		  int x_min, int x_max, int * xp, int * x2p)
+{
+  GList * gl;
+  sw_sel * sel;
+  int x, x2, span_x = 0, span_x2 = 0;
+  gboolean found = FALSE;
+
+  for (gl = *glp; gl; gl = gl->next) {
+    sel = (sw_sel *)gl->data;
+
+    x = OFFSET_TO_XPOS(sel->sel_start);
+    x2 = OFFSET_TO_XPOS(sel->sel_end);
+
+    if (x > x_max) break;
+    if (x2 < x_min) continue;
+
+    if (!found) {
+      span_x = x;
+      span_x2 = x2;
+      found = TRUE;
+    } else if (x > span_x2) {
+      break;
+    } else if (x2 > span_x2) {
+      span_x2 = x2;
+    }
+  }
+
+  *glp = gl;
+  *xp = span_x;
+  *x2p = span_x2;
+
+  return found;
+}
+
 static void
 sample_display_draw_data_channel (GdkDrawable * win,
 				  const SampleDisplay * s,
@@ -742,6 +743,8 @@ sample_display_draw_data_channel (GdkDrawable * win,
   float prev_maxpos, prev_minneg;
   sw_framecount_t i, step, nr_frames, nr_pos, nr_neg;
   sw_sample * sample;
+  sw_peak peak;
+  gboolean use_peaks;
   const int channels = s->view->sample->sounddata->format->channels;
 
   sample = s->view->sample;
@@ -752,13 +755,9 @@ sample_display_draw_data_channel (GdkDrawable * win,
 		     TRUE, x, y, width, height);
 
   /* Draw real selection */
-  for (gl = sample->sounddata->sels; gl; gl = gl->next) {
-    sel = (sw_sel *)gl->data;
-
-    x1 = OFFSET_TO_XPOS(sel->sel_start);
+  gl = sd_first_sel_span (s, x);
+  while (sd_next_sel_span (s, &gl, x, x+width, &x1, &x2)) {
     x1 = CLAMP(x1, x, x+width);
-
-    x2 = OFFSET_TO_XPOS(sel->sel_end);
     x2 = CLAMP(x2, x, x+width);
 
     if (x2 - x1 > 1){
@@ -813,6 +812,9 @@ sample_display_draw_data_channel (GdkDrawable * win,
    * per pixel */
   step = MAX (1, PIXEL_TO_OFFSET(1)/STEP_MAX);
 
+  /* Use the peak summary, if any, once each pixel spans at least a bin */
+  use_peaks = (PIXEL_TO_OFFSET(1) >= PEAKS_BIN_FRAMES);
+
 #ifdef LEGACY_DRAW_MODE
   {
     int py, ty;
@@ -825,7 +827,7 @@ sample_display_draw_data_channel (GdkDrawable * win,
       for (i = OFFSET_RANGE(nr_frames, XPOS_TO_OFFSET(x));
 	   i < OFFSET_RANGE(nr_frames, XPOS_TO_OFFSET(x+1));
 	   i+=step) {
-	d = ((float *)sample->sounddata->data)[i*channels + channel];
+	d = sounddata_get_sample (sample->sounddata, i, channel);
 	if (fabs(d) > fabs(peak)) peak = d;
       }
 
@@ -845,7 +847,7 @@ sample_display_draw_data_channel (GdkDrawable * win,
   for (i = OFFSET_RANGE (nr_frames, XPOS_TO_OFFSET(x-1));
        i < OFFSET_RANGE (nr_frames, XPOS_TO_OFFSET(x));
        i += step) {
-    d = ((float *)sample->sounddata->data)[i*channels + channel];
+    d = sounddata_get_sample (sample->sounddata, i, channel);
     if (d >= 0) {
       if (d > prev_maxpos) prev_maxpos = d;
     } else {
@@ -863,18 +865,33 @@ sample_display_draw_data_channel (GdkDrawable * win,
      * sounddata->data doesn't change under us */
     g_mutex_lock (&sample->ops_mutex);
 
-    for (i = OFFSET_RANGE(nr_frames, XPOS_TO_OFFSET(x));
-	 i < OFFSET_RANGE(nr_frames, XPOS_TO_OFFSET(x+1));
-	 i+=step) {
-      d = ((float *)sample->sounddata->data)[i*channels + channel];
-      if (d >= 0) {
+    if (use_peaks && sample->sounddata->peaks &&
+	peaks_get_range (sample->sounddata->peaks, channel,
+			 OFFSET_RANGE(nr_frames, XPOS_TO_OFFSET(x)),
+			 OFFSET_RANGE(nr_frames, XPOS_TO_OFFSET(x+1)),
+			 &peak)) {
+      maxpos = MAX (peak.max, 0.0);
+      minneg = MIN (peak.min, 0.0);
+      totpos = peak.rms;
+      totneg = -peak.rms;
+      nr_pos = nr_neg = 1;
+    } else {
+      /* The body is the RMS level, as drawn from the peak cache, so
+       * that it looks the same at every zoom */
+      for (i = OFFSET_RANGE(nr_frames, XPOS_TO_OFFSET(x));
+	   i < OFFSET_RANGE(nr_frames, XPOS_TO_OFFSET(x+1));
+	   i+=step) {
+	d = sounddata_get_sample (sample->sounddata, i, channel);
 	if (d > maxpos) maxpos = d;
-	totpos += d;
-	nr_pos++;
-      } else {
 	if (d < minneg) minneg = d;
-	totneg += d;
-	nr_neg++;
+	totpos += d * d;
+	nr_pos++;
+      }
+
+      if (nr_pos > 0) {
+	totpos = sqrt (totpos / nr_pos);
+	totneg = -totpos;
+	nr_pos = nr_neg = 1;
       }
     }
 
@@ -1041,65 +1058,6 @@ sample_display_draw_crossing_vector (GdkDrawable * win,
 
 #endif
 
-/*** MARCHING ANTS ***/
-
-/*
- * sample_display_sel_box_march_ants ()
- *
- * gtk_idle function to move the marching ants used by
- * selections.
- */
-static gint
-sd_march_ants (gpointer data)
-{
-  SampleDisplay * s = (SampleDisplay *)data;
-  GdkGC * gc = s->sel_gc;
-  static int dash_offset = 0;
-
-  gdk_gc_set_dashes (gc, dash_offset, sel_dash_list, 2);
-
-  dash_offset++;
-  dash_offset %= 8;
-
-  sample_display_refresh_sels (s);
-
-  return TRUE;
-}
-
-static void
-sd_start_marching_ants_timeout (SampleDisplay * s)
-{
-  if (s->marching_tag > 0)
-    g_source_remove (s->marching_tag);
-
-  s->marching_tag = g_timeout_add (MARCH_INTERVAL,
-				     (GSourceFunc)sd_march_ants,
-				     s);
-}
-
-void
-sample_display_start_marching_ants (SampleDisplay * s)
-{
-  sd_start_marching_ants_timeout (s);
-  s->marching = TRUE;
-}
-
-static void
-sd_stop_marching_ants_timeout (SampleDisplay * s)
-{
-  if (s->marching_tag > 0)
-    g_source_remove (s->marching_tag);
-
-  s->marching_tag = 0;
-}
-
-void
-sample_display_stop_marching_ants (SampleDisplay * s)
-{
-  sd_stop_marching_ants_timeout (s);
-  s->marching = FALSE;
-}
-
 /*** SELECTION BOXES ***/
 
 static void
@@ -1149,26 +1107,17 @@ sample_display_draw_sel_box(GdkDrawable * win,
 }
 
 static void
-sample_display_draw_sel (GdkDrawable * win,
-			 const SampleDisplay * s,
-			 int x_min, int x_max)
+sample_display_draw_real_sel (GdkDrawable * win,
+			      const SampleDisplay * s,
+			      int x_min, int x_max)
 {
-  sw_sample * sample = s->view->sample;
   GList * gl;
-  sw_sel * sel;
   int x, x2;
   int l_end, r_end; /* draw left + right ends of sel */
 
-  /* Draw real selection */
-  for (gl = sample->sounddata->sels; gl; gl = gl->next) {
-    sel = (sw_sel *)gl->data;
-
-    x = OFFSET_TO_XPOS(sel->sel_start);
-    x2 = OFFSET_TO_XPOS(sel->sel_end);
-
-    if (x > x_max) break;
-    if (x2 < x_min) continue;
+  gl = sd_first_sel_span (s, x_min);
 
+  while (sd_next_sel_span (s, &gl, x_min, x_max, &x, &x2)) {
     l_end = (x >= x_min) && (x <= x_max);
     x = CLAMP (x, x_min, x_max);
 
@@ -1179,9 +1128,21 @@ sample_display_draw_sel (GdkDrawable * win,
     sample_display_draw_sel_box(win, s->sel_gc,
 				s, x, x2 - x - 1,
 				l_end, r_end /* draw_ends */);
+  }
+}
 
+static void
+sample_display_draw_sel (GdkDrawable * win,
+			 const SampleDisplay * s,
+			 int x_min, int x_max)
+{
+  sw_sample * sample = s->view->sample;
+  sw_sel * sel;
+  int x, x2;
+  int l_end, r_end; /* draw left + right ends of sel */
 
-  }
+  /* Draw real selection */
+  sample_display_draw_real_sel (win, s, x_min, x_max);
 
   /* Draw temporary selection */
   sel = sample->tmp_sel;
@@ -1227,15 +1188,15 @@ sample_display_start_cursor_pulse (SampleDisplay * s)
 
   sample_display_refresh_user_marker (s);
 
-  s->pulsing_tag = g_timeout_add (PULSE_INTERVAL,
-				    (GSourceFunc)sd_pulse_cursor, s);
+  s->pulsing_tag = sweep_timeout_add (PULSE_INTERVAL,
+				      (GtkFunction)sd_pulse_cursor, s);
 }
 
 void
 sample_display_stop_cursor_pulse (SampleDisplay * s)
 {
   if (s->pulsing_tag > 0)
-    g_source_remove (s->pulsing_tag);
+    sweep_timeout_remove (s->pulsing_tag);
 
   s->pulsing_tag = 0;
 
@@ -1463,6 +1424,137 @@ sample_display_draw (GtkWidget *widget, GdkRectangle *area)
   }
 }
 
+/*** MARCHING ANTS ***/
+
+/*
+ * sample_display_refresh_sels (s)
+ *
+ * moves the marching ants. The real selection is drawn with opaque
+ * double dashes, so its visible spans are repainted in place with the
+ * new dash offset rather than exposed, which would redraw the data
+ * beneath every region on every tick. Only the markers, which may cross
+ * the ants, and the XOR-drawn temporary selection are exposed.
+ */
+static void
+sample_display_refresh_sels (SampleDisplay * s)
+{
+  GtkWidget * widget;
+  GdkDrawable * drawable;
+  int x, x2;
+  sw_sample * sample;
+  sw_sel * sel;
+
+  g_return_if_fail(s != NULL);
+  g_return_if_fail(IS_SAMPLE_DISPLAY(s));
+
+  if(!IS_INITIALIZED(s))
+    return;
+
+  widget = GTK_WIDGET(s);
+  sample = s->view->sample;
+
+  /* real selection */
+  if (sample->sounddata->sels != NULL && GTK_WIDGET_DRAWABLE (widget)) {
+#ifdef DOUBLE_BUFFER
+    drawable = s->backing_pixmap;
+#else
+    drawable = widget->window;
+#endif
+
+    sample_display_draw_real_sel (drawable, s, 0, s->width);
+
+#ifdef DOUBLE_BUFFER
+    gdk_draw_pixmap(widget->window, s->fg_gc, s->backing_pixmap,
+		    0, 0, 0, 0, s->width, s->height);
+#endif
+
+    sample_display_refresh_user_marker (s);
+    if (sample->play_head->going)
+      sample_display_refresh_play_marker (s);
+    if (sample->rec_head)
+      sample_display_refresh_rec_marker (s);
+  }
+
+  /* temporary selection */
+  sel = sample->tmp_sel;
+
+  if (sel) {
+    x = OFFSET_TO_XPOS(sel->sel_start);
+    x2 = OFFSET_TO_XPOS(sel->sel_end);
+
+    if ((x >= 0) && (x <= s->width)) {
+      gtk_widget_queue_draw_area (GTK_WIDGET(s), x, 0, 1, s->height);
+    }
+    if ((x2 >= 0) && (x2 <= s->width)) {
+      gtk_widget_queue_draw_area (GTK_WIDGET(s), x2, 0, 1, s->height);
+    }
+
+    if ((x <= s->width) && (x2 >= 0)) {
+      x = CLAMP (x, 0, s->width);
+      x2 = CLAMP (x2, 0, s->width);
+      gtk_widget_queue_draw_area (GTK_WIDGET(s), x, 0, x2 - x, 1);
+      gtk_widget_queue_draw_area (GTK_WIDGET(s), x, s->height - 1, x2 - x, 1);
+    }
+  }
+}
+
+/*
+ * sample_display_sel_box_march_ants ()
+ *
+ * gtk_idle function to move the marching ants used by
+ * selections.
+ */
+static gint
+sd_march_ants (gpointer data)
+{
+  SampleDisplay * s = (SampleDisplay *)data;
+  GdkGC * gc = s->sel_gc;
+  static int dash_offset = 0;
+
+  gdk_gc_set_dashes (gc, dash_offset, sel_dash_list, 2);
+
+  dash_offset++;
+  dash_offset %= 8;
+
+  sample_display_refresh_sels (s);
+
+  return TRUE;
+}
+
+static void
+sd_start_marching_ants_timeout (SampleDisplay * s)
+{
+  if (s->marching_tag > 0)
+    sweep_timeout_remove (s->marching_tag);
+
+  s->marching_tag = sweep_timeout_add (MARCH_INTERVAL,
+				       (GtkFunction)sd_march_ants,
+				       s);
+}
+
+void
+sample_display_start_marching_ants (SampleDisplay * s)
+{
+  sd_start_marching_ants_timeout (s);
+  s->marching = TRUE;
+}
+
+static void
+sd_stop_marching_ants_timeout (SampleDisplay * s)
+{
+  if (s->marching_tag > 0)
+    sweep_timeout_remove (s->marching_tag);
+
+  s->marching_tag = 0;
+}
+
+void
+sample_display_stop_marching_ants (SampleDisplay * s)
+{
+  sd_stop_marching_ants_timeout (s);
+  s->marching = FALSE;
+}
+
 /*** EVENT HANDLERS ***/
 
 
@@ -1678,29 +1770,29 @@ sample_display_handle_sel_motion (SampleDisplay *s,
 
   if (scroll_left && s->scroll_left_tag == 0) {
     if (s->scroll_right_tag != 0) {
-      g_source_remove (s->scroll_right_tag);
+      sweep_timeout_remove (s->scroll_right_tag);
       s->scroll_right_tag = 0;
     }
 
-    s->scroll_left_tag = g_timeout_add (100, sample_display_scroll_left,
-					  (gpointer)s);
+    s->scroll_left_tag = sweep_timeout_add (100, sample_display_scroll_left,
+					      (gpointer)s);
 
   } else if (scroll_right && s->scroll_right_tag == 0) {
     if (s->scroll_left_tag != 0) {
-      g_source_remove (s->scroll_left_tag);
+      sweep_timeout_remove (s->scroll_left_tag);
       s->scroll_left_tag = 0;
     }
 
-    s->scroll_right_tag = g_timeout_add (100, sample_display_scroll_right,
-					   (gpointer)s);
+    s->scroll_right_tag = sweep_timeout_add (100, sample_display_scroll_right,
+					       (gpointer)s);
 
   } else if (!scroll_right && !scroll_left) {
     if (s->scroll_right_tag != 0) {
-      g_source_remove (s->scroll_right_tag);
+      sweep_timeout_remove (s->scroll_right_tag);
       s->scroll_right_tag = 0;
     }
     if (s->scroll_left_tag != 0) {
-      g_source_remove (s->scroll_left_tag);
+      sweep_timeout_remove (s->scroll_left_tag);
       s->scroll_left_tag = 0;
     }
   }
@@ -1750,6 +1842,9 @@ sample_display_handle_pencil_motion (SampleDisplay * s, int x, int y)
   if (offset < s->view->start || offset > s->view->end) return;
 
   sample = s->view->sample;
+  if (!sample_promote_data (sample)) return;
+  sample_drop_peaks (sample);
+  sounddata_invalidate_analysis (sample->sounddata, offset, offset + 1);
   sampledata = (float *)sample->sounddata->data;
   channels = sample->sounddata->format->channels;
 
@@ -1822,6 +1917,9 @@ sample_display_handle_noise_motion (SampleDisplay * s, int x, int y)
   if (offset < s->view->start || offset > s->view->end) return;
 
   sample = s->view->sample;
+  if (!sample_promote_data (sample)) return;
+  sample_drop_peaks (sample);
+  sounddata_invalidate_analysis (sample->sounddata, offset, offset + 1);
   sampledata = (float *)sample->sounddata->data;
 
   y = CLAMP (y, 0, s->height);
@@ -1967,10 +2065,19 @@ sample_display_on_sel (SampleDisplay * s, gint x, gint y)
   GList * gl;
   sw_sel * sel;
   int xss, xse;
+  sw_framecount_t near_start, near_end;
+
+  /* Only regions with an edge within 5 pixels of x can match */
+  near_start = XPOS_TO_OFFSET(x - 5);
+  near_end = XPOS_TO_OFFSET(x + 5);
 
-  for (gl = s->view->sample->sounddata->sels; gl; gl = gl->next) {
+  gl = sounddata_selection_seek (s->view->sample->sounddata, near_start);
+
+  for (; gl; gl = gl->next) {
     sel = (sw_sel *)gl->data;
 
+    if (sel->sel_start > near_end) break;
+
     xss = OFFSET_TO_XPOS(sel->sel_start);
     xse = OFFSET_TO_XPOS(sel->sel_end);
 
@@ -2086,7 +2193,7 @@ sample_display_button_press (GtkWidget      *widget,
 	    s->view->hand_offset = x;
 	    s->hand_scroll_delta = 0;
 	    if (s->hand_scroll_tag){
-		   g_source_remove (s->hand_scroll_tag);
+		   sweep_timeout_remove (s->hand_scroll_tag);
 		   s->hand_scroll_tag = 0;
 	    }
 	    SET_CURSOR(widget, HAND_CLOSE);
@@ -2138,11 +2245,11 @@ sample_display_sink_tmp_sel (SampleDisplay * s)
   s->selecting = SELECTING_NOTHING;
 
   if (s->scroll_right_tag != 0) {
-    g_source_remove (s->scroll_right_tag);
+    sweep_timeout_remove (s->scroll_right_tag);
     s->scroll_right_tag = 0;
   }
   if (s->scroll_left_tag != 0) {
-    g_source_remove (s->scroll_left_tag);
+    sweep_timeout_remove (s->scroll_left_tag);
     s->scroll_left_tag = 0;
   }
 
@@ -2231,8 +2338,8 @@ sample_display_button_release (GtkWidget      *widget,
   case TOOL_HAND:
     s->view->hand_offset = -1;
 
-    s->hand_scroll_tag = g_timeout_add (HAND_SCROLL_INTERVAL,
-		    (GSourceFunc)sample_display_hand_scroll,
+    s->hand_scroll_tag = sweep_timeout_add (HAND_SCROLL_INTERVAL,
+		    (GtkFunction)sample_display_hand_scroll,
 		    s);
 
     break;
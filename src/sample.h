@@ -30,6 +30,9 @@ create_sample_new_dialog_defaults (char * pathname);
 void
 create_sample_new_dialog_like (sw_sample * s);
 
+gboolean
+sample_promote_data (sw_sample * sample);
+
 void
 sample_add_view (sw_sample * s, sw_view * v);
 
@@ -0,0 +1,70 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Startup trace.
+ *
+ * With SWEEP_TRACE_STARTUP set in the environment, the time since
+ * startup_trace_init() of each startup milestone is printed to stderr,
+ * up to and including the first window being shown.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <glib.h>
+
+#include "startup.h"
+
+static gboolean tracing = FALSE;
+static gint64 start_time = 0;
+static gboolean first_window_shown = FALSE;
+
+void
+startup_trace_init (void)
+{
+  tracing = (getenv ("SWEEP_TRACE_STARTUP") != NULL);
+  start_time = g_get_monotonic_time ();
+}
+
+/*
+ * startup_trace (milestone)
+ *
+ * May be called from any thread.
+ */
+void
+startup_trace (const gchar * milestone)
+{
+  if (!tracing) return;
+
+  g_printerr ("startup: %9.3f ms  %s\n",
+	      (g_get_monotonic_time () - start_time) / 1000.0, milestone);
+}
+
+void
+startup_trace_first_window (void)
+{
+  if (first_window_shown) return;
+
+  first_window_shown = TRUE;
+  startup_trace ("first window shown");
+}
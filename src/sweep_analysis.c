@@ -0,0 +1,374 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Cached per-window analysis of sounddata.
+ *
+ * Each sounddata keeps a list of entries, one per window size asked for.
+ * An entry holds the latest complete sw_analysis and the range of windows
+ * edited since it was made. A returned sw_analysis is never modified:
+ * bringing an entry up to date makes a new one, copying the clean windows
+ * from the old and recomputing only the dirty ones, so callers can keep
+ * reading theirs while edits carry on.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include <sweep/sweep_types.h>
+#include <sweep/sweep_typeconvert.h>
+#include <sweep/sweep_sounddata.h>
+#include <sweep/sweep_analysis.h>
+
+/*#define DEBUG*/
+
+/* Nr. of samples summed in single precision before being flushed
+ * into the double precision totals */
+#define ANALYSIS_BLOCK 4096
+
+typedef struct _sw_analysis_entry sw_analysis_entry;
+
+struct _sw_analysis_entry {
+  sw_framecount_t window;
+  sw_analysis * analysis; /* latest complete analysis, or NULL */
+  sw_framecount_t dirty_start, dirty_end; /* windows edited since */
+  guint serial; /* bumped by every invalidation */
+};
+
+static sw_analysis *
+analysis_new (sw_framecount_t window, sw_framecount_t nr_frames)
+{
+  sw_analysis * analysis;
+
+  analysis = g_malloc (sizeof (sw_analysis));
+
+  analysis->refcount = 1;
+  analysis->window = window;
+  analysis->nr_frames = nr_frames;
+  analysis->nr_windows = (nr_frames + window - 1) / window;
+  analysis->windows =
+    g_malloc0 (MAX (analysis->nr_windows, 1) * sizeof (sw_analysis_window));
+
+  return analysis;
+}
+
+static sw_analysis *
+analysis_ref (sw_analysis * analysis)
+{
+  g_atomic_int_inc (&analysis->refcount);
+  return analysis;
+}
+
+void
+analysis_unref (sw_analysis * analysis)
+{
+  if (analysis == NULL) return;
+
+  if (g_atomic_int_dec_and_test (&analysis->refcount)) {
+    g_free (analysis->windows);
+    g_free (analysis);
+  }
+}
+
+/*
+ * analyse_window (d, n, channels, aw)
+ *
+ * measures n interleaved samples. The four partial sums of each kind
+ * carry no dependency from one iteration to the next, so the compiler
+ * can keep them in vector registers.
+ */
+static void
+analyse_window (const gfloat * d, glong n, gint channels,
+		sw_analysis_window * aw)
+{
+  gfloat a0, a1, a2, a3, q0, q1, q2, q3, p0, p1, p2, p3, x;
+  gdouble sum_abs = 0.0, sum_sq = 0.0;
+  gfloat peak = 0.0;
+  guint32 crossings = 0;
+  glong i = 0, block_end;
+
+  while (i < n) {
+    a0 = a1 = a2 = a3 = 0.0;
+    q0 = q1 = q2 = q3 = 0.0;
+    p0 = p1 = p2 = p3 = 0.0;
+    block_end = MIN (n, i + ANALYSIS_BLOCK);
+
+    for (; i + 4 <= block_end; i += 4) {
+      a0 += fabsf (d[i]);   q0 += d[i] * d[i];     p0 = MAX (p0, fabsf (d[i]));
+      a1 += fabsf (d[i+1]); q1 += d[i+1] * d[i+1]; p1 = MAX (p1, fabsf (d[i+1]));
+      a2 += fabsf (d[i+2]); q2 += d[i+2] * d[i+2]; p2 = MAX (p2, fabsf (d[i+2]));
+      a3 += fabsf (d[i+3]); q3 += d[i+3] * d[i+3]; p3 = MAX (p3, fabsf (d[i+3]));
+    }
+    for (; i < block_end; i++) {
+      x = d[i];
+      a0 += fabsf (x); q0 += x * x; p0 = MAX (p0, fabsf (x));
+    }
+
+    sum_abs += (gdouble)a0 + (gdouble)a1 + (gdouble)a2 + (gdouble)a3;
+    sum_sq += (gdouble)q0 + (gdouble)q1 + (gdouble)q2 + (gdouble)q3;
+    peak = MAX (peak, MAX (MAX (p0, p1), MAX (p2, p3)));
+  }
+
+  /* Sign changes between consecutive frames of each channel */
+  for (i = channels; i < n; i++) {
+    crossings += ((d[i] < 0.0) != (d[i - channels] < 0.0));
+  }
+
+  if (n > 0) {
+    aw->rms = (gfloat)sqrt (sum_sq / (gdouble)n);
+    aw->mean_abs = (gfloat)(sum_abs / (gdouble)n);
+  } else {
+    aw->rms = aw->mean_abs = 0.0;
+  }
+  aw->peak = peak;
+  aw->zero_crossings = crossings;
+}
+
+static void
+analysis_compute (sw_analysis * analysis, sw_sounddata * sounddata,
+		  sw_framecount_t w0, sw_framecount_t w1)
+{
+  sw_format * format = sounddata->format;
+  sw_framecount_t w, offset, n;
+  const gfloat * d;
+  gfloat * buf;
+
+  w1 = MIN (w1, analysis->nr_windows);
+  if (w0 >= w1) return;
+
+  buf = g_malloc (frames_to_bytes (format, analysis->window));
+
+  for (w = w0; w < w1; w++) {
+    offset = w * analysis->window;
+    n = MIN (analysis->window, analysis->nr_frames - offset);
+
+    d = sounddata_read_frames (sounddata, offset, n, buf);
+
+    analyse_window (d, frames_to_samples (format, n), format->channels,
+		    &analysis->windows[w]);
+  }
+
+  g_free (buf);
+
+#ifdef DEBUG
+  g_print ("analysis: computed windows [%ld, %ld) of %ld frames\n",
+	   (long)w0, (long)w1, (long)analysis->window);
+#endif
+}
+
+static sw_analysis_entry *
+analysis_entry_find (sw_sounddata * sounddata, sw_framecount_t window)
+{
+  GList * gl;
+  sw_analysis_entry * entry;
+
+  for (gl = sounddata->analyses; gl; gl = gl->next) {
+    entry = (sw_analysis_entry *)gl->data;
+    if (entry->window == window) return entry;
+  }
+
+  return NULL;
+}
+
+sw_analysis *
+sounddata_get_analysis (sw_sounddata * sounddata, sw_framecount_t window)
+{
+  sw_analysis_entry * entry;
+  sw_analysis * old = NULL, * analysis;
+  sw_framecount_t nr_frames, dirty_start, dirty_end;
+  guint serial;
+
+  g_return_val_if_fail (window > 0, NULL);
+
+  g_mutex_lock (&sounddata->analysis_mutex);
+
+  nr_frames = sounddata->nr_frames;
+
+  entry = analysis_entry_find (sounddata, window);
+  if (entry == NULL) {
+    entry = g_malloc0 (sizeof (sw_analysis_entry));
+    entry->window = window;
+    sounddata->analyses = g_list_prepend (sounddata->analyses, entry);
+  }
+
+  /* An edit which changed the length shifts every window after it */
+  if (entry->analysis && entry->analysis->nr_frames != nr_frames) {
+    analysis_unref (entry->analysis);
+    entry->analysis = NULL;
+  }
+
+  if (entry->analysis && entry->dirty_start >= entry->dirty_end) {
+    analysis = analysis_ref (entry->analysis);
+    g_mutex_unlock (&sounddata->analysis_mutex);
+    return analysis;
+  }
+
+  if (entry->analysis) old = analysis_ref (entry->analysis);
+  dirty_start = entry->dirty_start;
+  dirty_end = entry->dirty_end;
+  serial = entry->serial;
+
+  g_mutex_unlock (&sounddata->analysis_mutex);
+
+  /* Compute outside the lock, as this may read the whole sample */
+  analysis = analysis_new (window, nr_frames);
+
+  if (old != NULL) {
+    memcpy (analysis->windows, old->windows,
+	    analysis->nr_windows * sizeof (sw_analysis_window));
+    analysis_compute (analysis, sounddata, dirty_start, dirty_end);
+    analysis_unref (old);
+  } else {
+    analysis_compute (analysis, sounddata, 0, analysis->nr_windows);
+  }
+
+  /* Publish it, unless it was invalidated again in the meantime */
+  g_mutex_lock (&sounddata->analysis_mutex);
+
+  entry = analysis_entry_find (sounddata, window);
+  if (entry != NULL && entry->serial == serial) {
+    analysis_unref (entry->analysis);
+    entry->analysis = analysis_ref (analysis);
+    entry->dirty_start = entry->dirty_end = 0;
+  }
+
+  g_mutex_unlock (&sounddata->analysis_mutex);
+
+  return analysis;
+}
+
+sw_analysis *
+sounddata_get_cached_analysis (sw_sounddata * sounddata,
+			       sw_framecount_t window)
+{
+  GList * gl;
+  sw_analysis_entry * entry;
+  sw_analysis * analysis = NULL;
+
+  g_mutex_lock (&sounddata->analysis_mutex);
+
+  for (gl = sounddata->analyses; gl; gl = gl->next) {
+    entry = (sw_analysis_entry *)gl->data;
+
+    if (window != 0 && entry->window != window) continue;
+
+    if (entry->analysis &&
+	entry->analysis->nr_frames == sounddata->nr_frames &&
+	entry->dirty_start >= entry->dirty_end &&
+	(analysis == NULL || entry->window < analysis->window)) {
+      analysis = entry->analysis;
+    }
+  }
+
+  if (analysis != NULL) analysis_ref (analysis);
+
+  g_mutex_unlock (&sounddata->analysis_mutex);
+
+  return analysis;
+}
+
+void
+sounddata_invalidate_analysis (sw_sounddata * sounddata,
+			       sw_framecount_t start, sw_framecount_t end)
+{
+  GList * gl;
+  sw_analysis_entry * entry;
+  sw_framecount_t w0, w1;
+
+  if (end <= start) return;
+
+  g_mutex_lock (&sounddata->analysis_mutex);
+
+  sounddata->changed_start = MIN (sounddata->changed_start, MAX (start, 0));
+  sounddata->changed_tail =
+    MIN (sounddata->changed_tail, MAX (sounddata->nr_frames - end, 0));
+
+  for (gl = sounddata->analyses; gl; gl = gl->next) {
+    entry = (sw_analysis_entry *)gl->data;
+
+    w0 = MAX (start, 0) / entry->window;
+    w1 = (end + entry->window - 1) / entry->window;
+
+    if (entry->dirty_start >= entry->dirty_end) {
+      entry->dirty_start = w0;
+      entry->dirty_end = w1;
+    } else {
+      entry->dirty_start = MIN (entry->dirty_start, w0);
+      entry->dirty_end = MAX (entry->dirty_end, w1);
+    }
+
+    entry->serial++;
+  }
+
+  g_mutex_unlock (&sounddata->analysis_mutex);
+}
+
+void
+sounddata_drop_analysis (sw_sounddata * sounddata)
+{
+  GList * gl;
+  sw_analysis_entry * entry;
+
+  g_mutex_lock (&sounddata->analysis_mutex);
+
+  for (gl = sounddata->analyses; gl; gl = gl->next) {
+    entry = (sw_analysis_entry *)gl->data;
+    analysis_unref (entry->analysis);
+    g_free (entry);
+  }
+
+  g_list_free (sounddata->analyses);
+  sounddata->analyses = NULL;
+
+  g_mutex_unlock (&sounddata->analysis_mutex);
+}
+
+void
+sounddata_take_changes (sw_sounddata * sounddata, sw_framecount_t * start,
+			sw_framecount_t * tail)
+{
+  g_mutex_lock (&sounddata->analysis_mutex);
+
+  *start = sounddata->changed_start;
+  *tail = sounddata->changed_tail;
+
+  sounddata->changed_start = sounddata->nr_frames;
+  sounddata->changed_tail = sounddata->nr_frames;
+
+  g_mutex_unlock (&sounddata->analysis_mutex);
+}
+
+void
+sounddata_restore_changes (sw_sounddata * sounddata, sw_framecount_t start,
+			   sw_framecount_t tail)
+{
+  g_mutex_lock (&sounddata->analysis_mutex);
+
+  sounddata->changed_start = MIN (sounddata->changed_start, start);
+  sounddata->changed_tail = MIN (sounddata->changed_tail, tail);
+
+  g_mutex_unlock (&sounddata->analysis_mutex);
+}
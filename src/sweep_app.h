@@ -115,6 +115,9 @@ struct _sw_view {
   GtkWidget * channelops_submenu;
   GList * channelops_widgets;
 
+  GtkWidget * proc_menuitem; /* Process, in the menubar */
+  GtkWidget * proc_sel_menuitem; /* Process, in the selection menu */
+
   GtkWidget * follow_checkmenu;
   GtkWidget * color_menuitems[VIEW_COLOR_MAX];
   GtkWidget * loop_checkmenu;
@@ -165,7 +168,7 @@ struct _sw_head {
   /*  sw_transport_type transport_mode;*/
   sw_framecount_t stop_offset;
   gdouble offset;
-  sw_framecount_t realoffset; /* offset according to device */
+  sw_framecount_t realoffset; /* offset being heard, as last shown */
   gboolean going; /* stopped or going? */
   gboolean restricted; /* restricted to sample->sounddata->sels ? */
   gboolean looping;
@@ -178,11 +181,33 @@ struct _sw_head {
   gfloat rate;
   gfloat mix; /* record mixing level */
 
+  /* Record head only: where the current punch-in began, and where the
+   * last write ended so that a jump can be told from a continuation */
+  sw_framecount_t punch_in;
+  sw_framecount_t punch_next;
+  gboolean punch_reverse;
+
   sw_head * scrub_master; /* another head this is being scrubbed by */
   gboolean scrubbing; /* if this head is a scrub master, is it scrubbing ? */
 
   gint repeater_tag;
   GList * controllers;
+
+  /* Chain of sw_processor applied to audio read by this head */
+  GMutex chain_mutex;
+  GList * processors;
+
+  /* Playback clock, published by the player thread under clock_seq for
+   * the interface to place the play marker */
+  gint clock_seq; /* odd while being published */
+  gint64 clock_time; /* monotonic time, in us, at which ... */
+  gdouble clock_offset; /* ... this offset was being heard, */
+  gdouble clock_rate; /* moving this many frames per second */
+  gint clock_restart; /* set to forget the history below */
+
+  /* Player thread only: offsets of the blocks written to the device */
+  gdouble * clock_history;
+  glong clock_blocks; /* nr. of blocks written since restart */
 };
 
 typedef enum {
@@ -190,6 +215,7 @@ typedef enum {
   SWEEP_FILE_METHOD_LIBSNDFILE,
   SWEEP_FILE_METHOD_OGGVORBIS,
   SWEEP_FILE_METHOD_SPEEX,
+  SWEEP_FILE_METHOD_FLAC,
   SWEEP_FILE_METHOD_MP3=1000666 /* Random high number -- unsupported */
 } sw_file_method_t;
 
@@ -258,6 +284,14 @@ struct _sw_sample {
   gchar last_tmp_message [512];
   gint tmp_message_tag;
   gint progress_ready_tag;
+
+  /* Idle tracking, for compressing unused data in memory */
+  gint pack_accesses; /* sounddata->accesses when last checked */
+  gint pack_idle_checks; /* nr. of checks for which it was unchanged */
+  gboolean pack_refused; /* packing saved too little; cleared by edits */
+
+  struct _sw_journal * journal; /* crash recovery journal, or NULL */
+  GMutex journal_mutex; /* held while the journal is in use */
 };
 
 void
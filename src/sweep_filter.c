@@ -37,14 +37,110 @@
 #include "edit.h"
 
 
+/*#define DEBUG*/
+
+/* Nr. of frames each stage of a chain processes before the next stage
+ * takes over: 1024 frames of stereo float is 8kB, so a block stays in
+ * cache while every stage runs over it */
+#define FILTER_BLOCK_FRAMES 1024
+
+typedef struct _sw_filter_stage sw_filter_stage;
+
+struct _sw_filter_stage {
+  SweepFilterRegion func;
+  sw_param_set pset;
+  gpointer custom_data;
+  sw_processor * processor; /* used instead of func if not NULL */
+};
+
+struct _sw_filter_chain {
+  GList * stages;
+};
+
+/*
+ * filter_chain_new ()
+ *
+ * creates an empty chain of region filters, to be run over a sample
+ * in a single pass by perform_filter_chain_op().
+ */
+sw_filter_chain *
+filter_chain_new (void)
+{
+  return g_malloc0 (sizeof (sw_filter_chain));
+}
+
+/*
+ * filter_chain_append_region (chain, func, pset, custom_data)
+ *
+ * adds func to the end of chain. pset is not copied, and must remain
+ * valid until the chain has been run.
+ */
+void
+filter_chain_append_region (sw_filter_chain * chain, SweepFilterRegion func,
+			    sw_param_set pset, gpointer custom_data)
+{
+  sw_filter_stage * stage;
+
+  stage = g_malloc0 (sizeof (sw_filter_stage));
+  stage->func = func;
+  stage->pset = pset;
+  stage->custom_data = custom_data;
+
+  chain->stages = g_list_append (chain->stages, stage);
+}
+
+/*
+ * filter_chain_append_processor (chain, processor)
+ *
+ * adds processor to the end of chain. The chain takes ownership of the
+ * processor, which must have been created for the sample's format.
+ */
+void
+filter_chain_append_processor (sw_filter_chain * chain,
+			       sw_processor * processor)
+{
+  sw_filter_stage * stage;
+
+  stage = g_malloc0 (sizeof (sw_filter_stage));
+  stage->processor = processor;
+
+  chain->stages = g_list_append (chain->stages, stage);
+}
+
+void
+filter_chain_free (sw_filter_chain * chain)
+{
+  GList * gl;
+  sw_filter_stage * stage;
+
+  if (chain == NULL) return;
+
+  for (gl = chain->stages; gl; gl = gl->next) {
+    stage = (sw_filter_stage *)gl->data;
+    if (stage->processor != NULL)
+      stage->processor->destroy (stage->processor);
+    g_free (stage);
+  }
+
+  g_list_free (chain->stages);
+  g_free (chain);
+}
+
+/*
+ * do_filter_chain (sample, chain)
+ *
+ * runs every stage of chain over one block of the selection before
+ * moving on to the next, so that the data is read from and written
+ * back to memory only once however many stages there are.
+ */
 static void
-do_filter_regions (sw_sample * sample, SweepFilterRegion func,
-		   sw_param_set pset, gpointer custom_data)
+do_filter_chain (sw_sample * sample, sw_filter_chain * chain)
 {
   sw_sounddata * sounddata = sample->sounddata;
   sw_format * f = sounddata->format;
-  GList * gl;
+  GList * gl, * gs;
   sw_sel * sel;
+  sw_filter_stage * stage;
   sw_framecount_t sel_total, run_total;
   sw_framecount_t offset, remaining, n;
   gpointer d;
@@ -70,9 +166,17 @@ do_filter_regions (sw_sample * sample, SweepFilterRegion func,
       } else {
 	d = sounddata->data + (int)frames_to_bytes (f, sel->sel_start + offset);
 
-	n = MIN(remaining, 1024);
+	n = MIN(remaining, FILTER_BLOCK_FRAMES);
 
-	func (d, sounddata->format, n, pset, custom_data);
+	for (gs = chain->stages; gs; gs = gs->next) {
+	  stage = (sw_filter_stage *)gs->data;
+	  if (stage->processor != NULL) {
+	    stage->processor->process (stage->processor, (gfloat *)d, n);
+	  } else {
+	    stage->func (d, sounddata->format, n, stage->pset,
+			 stage->custom_data);
+	  }
+	}
 
 	remaining -= n;
 	offset += n;
@@ -93,10 +197,10 @@ do_filter_regions (sw_sample * sample, SweepFilterRegion func,
 }
 
 static void
-do_filter_regions_thread (sw_op_instance * inst)
+do_filter_chain_thread (sw_op_instance * inst)
 {
   sw_sample * sample = inst->sample;
-  sw_perform_data * pd = (sw_perform_data *)inst->do_data;
+  sw_filter_chain * chain = (sw_filter_chain *)inst->do_data;
 
   sw_edit_buffer * old_eb;
   paste_over_data * p;
@@ -110,8 +214,7 @@ do_filter_regions_thread (sw_op_instance * inst)
   inst->redo_data = inst->undo_data = p;
   set_active_op (sample, inst);
 
-  do_filter_regions (sample, (SweepFilterRegion)pd->func, pd->pset,
-		     pd->custom_data);
+  do_filter_chain (sample, chain);
 
   if (sample->edit_state == SWEEP_EDIT_STATE_BUSY) {
     p->new_eb = edit_buffer_from_sample (sample);
@@ -125,30 +228,43 @@ do_filter_regions_thread (sw_op_instance * inst)
   sample_set_tmp_message (sample, _("No selection to process"));
 }
 
-static sw_operation filter_regions_op = {
+static sw_operation filter_chain_op = {
   SWEEP_EDIT_MODE_FILTER,
-  (SweepCallback)do_filter_regions_thread,
-  (SweepFunction)g_free,
+  (SweepCallback)do_filter_chain_thread,
+  (SweepFunction)filter_chain_free,
   (SweepCallback)undo_by_paste_over,
   (SweepFunction)paste_over_data_destroy,
   (SweepCallback)redo_by_paste_over,
   (SweepFunction)paste_over_data_destroy
 };
 
+/*
+ * perform_filter_chain_op (sample, desc, chain)
+ *
+ * applies every stage of chain to the selection of sample in one pass,
+ * as a single undoable operation. The operation takes ownership of
+ * chain.
+ */
+sw_op_instance *
+perform_filter_chain_op (sw_sample * sample, char * desc,
+			 sw_filter_chain * chain)
+{
+  schedule_operation (sample, desc, &filter_chain_op, chain);
+
+  return NULL;
+}
+
 sw_op_instance *
 perform_filter_region_op (sw_sample * sample, char * desc,
 			  SweepFilterRegion func,
 			  sw_param_set pset, gpointer custom_data)
 {
-  sw_perform_data * pd = (sw_perform_data *)g_malloc (sizeof(*pd));
+  sw_filter_chain * chain;
 
-  pd->func = (SweepFunction)func;
-  pd->pset = pset;
-  pd->custom_data = custom_data;
-
-  schedule_operation (sample, desc, &filter_regions_op, pd);
+  chain = filter_chain_new ();
+  filter_chain_append_region (chain, func, pset, custom_data);
 
-  return NULL;
+  return perform_filter_chain_op (sample, desc, chain);
 }
 
 static void
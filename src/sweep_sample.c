@@ -51,6 +51,9 @@
 #include "record.h"
 #include "question_dialogs.h"
 #include "sw_chooser.h"
+#include "packed.h"
+#include "journal.h"
+#include "batch.h"
 
 #include "../pixmaps/new.xpm"
 
@@ -71,6 +74,19 @@ static GList * sample_bank = NULL;
 
 static int untitled_count = 0;
 
+/* Interval between checks for idle samples to compress (ms) */
+#define PACK_CHECK_INTERVAL 15000
+
+/* Nr. of consecutive idle checks before a sample is compressed */
+#define PACK_IDLE_CHECKS 4
+
+static gint pack_tag = 0;
+
+/* Interval between autosaves of edited samples into their journals (ms) */
+#define AUTOSAVE_INTERVAL 60000
+
+static gint autosave_tag = 0;
+
 static void
 sample_info_update (sw_sample * sample);
 
@@ -181,6 +197,13 @@ sample_new_empty(gchar * pathname,
   s->tmp_message_tag = -1;
   s->progress_ready_tag = -1;
 
+  s->pack_accesses = 0;
+  s->pack_idle_checks = 0;
+  s->pack_refused = FALSE;
+
+  s->journal = NULL;
+  g_mutex_init (&s->journal_mutex);
+
   return s;
 }
 
@@ -199,8 +222,8 @@ sample_new_copy(sw_sample * s)
     return NULL;
   }
 
-  memcpy(sn->sounddata->data, s->sounddata->data,
-	 frames_to_bytes(s->sounddata->format, s->sounddata->nr_frames));
+  sounddata_copy_frames (s->sounddata, 0, s->sounddata->nr_frames,
+			 sn->sounddata->data);
 
   sounddata_copyin_selection (s->sounddata, sn->sounddata);
 
@@ -209,6 +232,31 @@ sample_new_copy(sw_sample * s)
   return sn;
 }
 
+/*
+ * sample_promote_data (sample)
+ *
+ * make sure the data of sample is held as float, so that it can be
+ * modified in place. Returns FALSE if there was not enough memory.
+ */
+gboolean
+sample_promote_data (sw_sample * sample)
+{
+  gboolean ret;
+
+  if (sample->sounddata->storage == SW_STORAGE_FLOAT) return TRUE;
+
+  g_mutex_lock (&sample->ops_mutex);
+  ret = sounddata_promote (sample->sounddata);
+  g_mutex_unlock (&sample->ops_mutex);
+
+  if (!ret) {
+    sample_set_tmp_message (sample, _("Not enough memory to edit %s"),
+			    g_path_get_basename (sample->pathname));
+  }
+
+  return ret;
+}
+
 static void
 sample_new_dialog_ok_cb (GtkWidget * widget, gpointer data)
 {
@@ -634,6 +682,13 @@ sample_destroy (sw_sample * s)
 
   stop_playback (s);
 
+  play_release_head (s->play_head);
+  head_destroy (s->play_head);
+
+  /* XXX: The record dialog may still refer to s->rec_head */
+
+  journal_discard (s);
+
   sounddata_destroy (s->sounddata);
 
   /* XXX: Should do this: */
@@ -644,6 +699,7 @@ sample_destroy (sw_sample * s)
   g_mutex_clear (&s->ops_mutex);
   g_mutex_clear (&s->edit_mutex);
   g_mutex_clear (&s->play_mutex);
+  g_mutex_clear (&s->journal_mutex);
 
   /* XXX: Should do this, but GTK+ barfs. */
   /*
@@ -731,14 +787,106 @@ sample_bank_contains (sw_sample *s)
   return (g_list_find (sample_bank, s) != 0);
 }
 
+/*
+ * sample_bank_pack_idle (data)
+ *
+ * Timeout callback which compresses the data of samples that have been
+ * neither read nor modified for PACK_IDLE_CHECKS checks.
+ */
+static gint
+sample_bank_pack_idle (gpointer data)
+{
+  GList * gl;
+  sw_sample * s;
+  gboolean busy;
+
+  for (gl = sample_bank; gl; gl = gl->next) {
+    s = (sw_sample *)gl->data;
+
+    busy = (s->edit_state != SWEEP_EDIT_STATE_IDLE) ||
+      (s->pending_ops != NULL) ||
+      (s->play_head && s->play_head->going) ||
+      (s->rec_head && s->rec_head->going) ||
+      (g_atomic_int_get (&s->sounddata->accesses) != s->pack_accesses);
+
+    s->pack_accesses = g_atomic_int_get (&s->sounddata->accesses);
+
+    if (busy) {
+      s->pack_idle_checks = 0;
+    } else if (++s->pack_idle_checks == PACK_IDLE_CHECKS) {
+      sample_pack (s);
+    }
+  }
+
+  return TRUE;
+}
+
+/*
+ * sample_bank_autosave (data)
+ *
+ * Timeout callback which checkpoints the journal of each sample that
+ * has been edited since its last autosave.
+ */
+static gint
+sample_bank_autosave (gpointer data)
+{
+  GList * gl;
+  sw_sample * s;
+
+  for (gl = sample_bank; gl; gl = gl->next) {
+    s = (sw_sample *)gl->data;
+
+    if (s->edit_state == SWEEP_EDIT_STATE_IDLE && s->pending_ops == NULL &&
+	!(s->rec_head && s->rec_head->going)) {
+      journal_autosave (s);
+    }
+  }
+
+  return TRUE;
+}
+
+/*
+ * sample_bank_refresh_proc_menus ()
+ *
+ * rebuild the Process menus of all views, after the list of plugins
+ * has changed.
+ */
+void
+sample_bank_refresh_proc_menus (void)
+{
+  GList * gl, * vl;
+  sw_sample * s;
+
+  for (gl = sample_bank; gl; gl = gl->next) {
+    s = (sw_sample *)gl->data;
+
+    for (vl = s->views; vl; vl = vl->next) {
+      view_refresh_proc_menus ((sw_view *)vl->data);
+    }
+  }
+}
+
 void
 sample_bank_add (sw_sample * s)
 {
+  /* Batch mode has no windows, and its samples belong to their workers */
+  if (batch_mode) return;
+
   /* Check that sample is not already in sample_bank */
   if (g_list_find (sample_bank, s)) return;
 
   sample_bank = g_list_append (sample_bank, s);
 
+  if (pack_tag == 0) {
+    pack_tag = g_timeout_add ((guint32)PACK_CHECK_INTERVAL,
+			      (GSourceFunc)sample_bank_pack_idle, NULL);
+  }
+
+  if (autosave_tag == 0) {
+    autosave_tag = g_timeout_add ((guint32)AUTOSAVE_INTERVAL,
+				  (GSourceFunc)sample_bank_autosave, NULL);
+  }
+
   undo_dialog_refresh_sample_list ();
   rec_dialog_refresh_sample_list ();
 }
@@ -768,7 +916,15 @@ sample_bank_remove (sw_sample * s)
 void
 sweep_quit_ok_cb (GtkWidget * widget, gpointer data)
 {
+  GList * gl;
+
   stop_all_playback ();
+
+  /* Unsaved changes are being deliberately abandoned */
+  for (gl = sample_bank; gl; gl = gl->next) {
+    journal_discard ((sw_sample *)gl->data);
+  }
+
   gtk_main_quit ();
 }
 
@@ -933,7 +1089,7 @@ sample_refresh_playmode (sw_sample * s)
 
   if (!head->going) {
     if (s->playmarker_tag > 0) {
-      g_source_remove (s->playmarker_tag);
+      sweep_timeout_remove (s->playmarker_tag);
     }
   }
 
@@ -1313,7 +1469,7 @@ sample_offset_in_sel (sw_sample * s, sw_framecount_t offset)
 guint
 sample_sel_nr_regions (sw_sample * s)
 {
-  return g_list_length (s->sounddata->sels);
+  return sounddata_selection_nr_regions (s->sounddata);
 }
 
 void
@@ -1351,6 +1507,7 @@ sample_set_selection (sw_sample * s, GList * gl)
   sample_clear_selection(s);
 
   s->sounddata->sels = sels_copy (gl);
+  sounddata_selection_changed (s->sounddata);
 }
 
 sw_sel *
@@ -1366,6 +1523,7 @@ sample_selection_modify (sw_sample * s, sw_sel * sel,
   sel->sel_start = new_start;
   sel->sel_end = new_end;
 
+  sounddata_selection_changed (s->sounddata);
   sample_normalise_selection (s);
 }
 
@@ -1386,6 +1544,7 @@ ss_invert (sw_sample * s, sw_param_set unused, gpointer unused2)
 
   gl = osels = sounddata->sels;
   sounddata->sels = NULL;
+  sounddata_selection_changed (sounddata);
 
   sel = osel = (sw_sel *)gl->data;
   if (osel->sel_start > 0) {
@@ -1587,6 +1746,8 @@ sample_set_tmp_sel (sw_sample * s, sw_view * tview, sw_sel * tsel)
     }
   }
 
+  sounddata_selection_changed (s->sounddata);
+
   g_mutex_unlock (&s->sounddata->sels_mutex);
 }
 
@@ -1670,11 +1831,13 @@ sssts (sw_sample * s, sw_param_set unused, gpointer data)
 
   sels = sels_invert (sels, s->sounddata->nr_frames);
   s->sounddata->sels = sels_add_selection (sels, sel);
+  sounddata_selection_changed (s->sounddata);
 
   sample_normalise_selection (s);
   sels = s->sounddata->sels;
 
   s->sounddata->sels = sels_invert (sels, s->sounddata->nr_frames);
+  sounddata_selection_changed (s->sounddata);
 
   g_mutex_unlock (&s->sounddata->sels_mutex);
 
@@ -114,10 +114,11 @@ sels_copy (GList * sels)
   for (gl = sels; gl; gl = gl->next) {
     sel = (sw_sel *)gl->data;
     nsel = sel_copy (sel);
-    nsels = g_list_insert_sorted(nsels, nsel, (GCompareFunc)sel_cmp);
+    nsels = g_list_prepend(nsels, nsel);
   }
 
-  return nsels;
+  /* sels is already sorted, so keep its order */
+  return g_list_reverse (nsels);
 }
 
 GList *
@@ -159,23 +160,26 @@ sels_invert (GList * sels, sw_framecount_t nr_frames)
   gl = osels = sels;
   sels = NULL;
 
+  /* The inverse regions come out in order; build backwards and reverse */
   sel = osel = (sw_sel *)gl->data;
   if (osel->sel_start > 0) {
-    sels = sels_add_selection_1 (sels, 0, osel->sel_start - 1);
+    sels = g_list_prepend (sels, sel_new (0, osel->sel_start - 1));
   }
 
   gl = gl->next;
 
   for (; gl; gl = gl->next) {
     sel = (sw_sel *)gl->data;
-    sels = sels_add_selection_1 (sels, osel->sel_end, sel->sel_start - 1);
+    sels = g_list_prepend (sels, sel_new (osel->sel_end, sel->sel_start - 1));
     osel = sel;
   }
 
   if (sel->sel_end != nr_frames) {
-    sels = sels_add_selection_1 (sels, sel->sel_end, nr_frames);
+    sels = g_list_prepend (sels, sel_new (sel->sel_end, nr_frames));
   }
 
+  sels = g_list_reverse (sels);
+
   g_list_free (osels);
 
   return sels;
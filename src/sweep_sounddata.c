@@ -29,6 +29,8 @@
 
 #include <sweep/sweep_types.h>
 #include <sweep/sweep_typeconvert.h>
+#include <sweep/sweep_sounddata.h>
+#include <sweep/sweep_analysis.h>
 #include <sweep/sweep_selection.h>
 #include <sweep/sweep_undo.h>
 
@@ -37,6 +39,8 @@
 #include "view.h"
 #include "sample-display.h"
 #include "driver.h"
+#include "packed.h"
+#include "peakcache.h"
 
 sw_sounddata *
 sounddata_new_empty(gint nr_channels, gint sample_rate, gint sample_length)
@@ -72,13 +76,404 @@ sounddata_new_empty(gint nr_channels, gint sample_rate, gint sample_length)
     s->data = NULL;
   }
 
+  s->storage = SW_STORAGE_FLOAT;
+  s->compact = NULL;
+  s->accesses = 0;
+
   s->sels = NULL;
   g_mutex_init (&s->sels_mutex);
+  s->sels_index = NULL;
+  g_mutex_init (&s->sels_index_mutex);
+  s->peaks = NULL;
   g_mutex_init (&s->data_mutex);
+  s->analyses = NULL;
+  g_mutex_init (&s->analysis_mutex);
+  s->changed_start = 0;
+  s->changed_tail = 0;
+
+  return s;
+}
+
+static gint
+storage_sample_bytes (sw_storage_t storage)
+{
+  switch (storage) {
+  case SW_STORAGE_INT16:
+    return 2;
+  case SW_STORAGE_INT24:
+    return 3;
+  default:
+    return sizeof (gfloat);
+  }
+}
+
+sw_sounddata *
+sounddata_new_compact (gint nr_channels, gint sample_rate,
+		       gint sample_length, sw_storage_t storage)
+{
+  sw_sounddata * s;
+  size_t len;
+
+  if (storage == SW_STORAGE_FLOAT)
+    return sounddata_new_empty (nr_channels, sample_rate, sample_length);
+
+  s = sounddata_new_empty (nr_channels, sample_rate, 0);
+  if (!s)
+    return NULL;
+
+  len = (size_t)sample_length * nr_channels * storage_sample_bytes (storage);
+
+  if ((s->compact = g_try_malloc (len)) == NULL) {
+    fprintf(stderr, "Unable to allocate %lu bytes for sample data.\n",
+	    (unsigned long)len);
+    sounddata_destroy (s);
+    return NULL;
+  }
+
+  s->nr_frames = (sw_framecount_t) sample_length;
+  s->storage = storage;
 
   return s;
 }
 
+void
+sounddata_compact_store_int (sw_sounddata * sounddata, sw_framecount_t offset,
+			     const gint32 * ibuf, sw_framecount_t n)
+{
+  const gint channels = sounddata->format->channels;
+  sw_framecount_t i, len = n * channels;
+  gint16 * s16;
+  guint8 * u8;
+  guint32 v;
+
+  switch (sounddata->storage) {
+  case SW_STORAGE_INT16:
+    s16 = (gint16 *)sounddata->compact + offset * channels;
+    for (i = 0; i < len; i++) {
+      s16[i] = (gint16)(ibuf[i] >> 16);
+    }
+    break;
+  case SW_STORAGE_INT24:
+    u8 = (guint8 *)sounddata->compact + offset * channels * 3;
+    for (i = 0; i < len; i++) {
+      v = (guint32)ibuf[i];
+      *u8++ = (guint8)(v >> 8);
+      *u8++ = (guint8)(v >> 16);
+      *u8++ = (guint8)(v >> 24);
+    }
+    break;
+  default:
+    g_assert_not_reached ();
+    break;
+  }
+}
+
+void
+sounddata_peek_frames (sw_sounddata * sounddata, sw_framecount_t offset,
+		       sw_framecount_t n, gfloat * buf)
+{
+  const gint channels = sounddata->format->channels;
+  sw_framecount_t i, avail, len;
+  const gint16 * s16;
+  const guint8 * u8;
+  gint32 v;
+
+  avail = CLAMP (sounddata->nr_frames - offset, 0, n);
+  len = avail * channels;
+
+  switch (sounddata->storage) {
+  case SW_STORAGE_INT16:
+    s16 = (const gint16 *)sounddata->compact + offset * channels;
+    for (i = 0; i < len; i++) {
+      buf[i] = s16[i] / 32768.0f;
+    }
+    break;
+  case SW_STORAGE_INT24:
+    u8 = (const guint8 *)sounddata->compact + offset * channels * 3;
+    for (i = 0; i < len; i++) {
+      v = (gint32)(((guint32)u8[2] << 24) | ((guint32)u8[1] << 16) |
+		   ((guint32)u8[0] << 8)) >> 8;
+      buf[i] = v / 8388608.0f;
+      u8 += 3;
+    }
+    break;
+  case SW_STORAGE_PACKED:
+    packed_copy_frames ((sw_packed *)sounddata->compact, offset, avail, buf);
+    break;
+  default:
+    if (len > 0)
+      memcpy (buf, (gfloat *)sounddata->data + offset * channels,
+	      len * sizeof (gfloat));
+    break;
+  }
+
+  if (avail < n)
+    memset (buf + len, 0, (n - avail) * channels * sizeof (gfloat));
+}
+
+void
+sounddata_copy_frames (sw_sounddata * sounddata, sw_framecount_t offset,
+		       sw_framecount_t n, gfloat * buf)
+{
+  g_atomic_int_inc (&sounddata->accesses);
+
+  sounddata_peek_frames (sounddata, offset, n, buf);
+}
+
+gfloat
+sounddata_get_sample (sw_sounddata * sounddata, sw_framecount_t frame,
+		      gint channel)
+{
+  sw_framecount_t i = frame * sounddata->format->channels + channel;
+  const guint8 * u8;
+
+  g_atomic_int_inc (&sounddata->accesses);
+
+  switch (sounddata->storage) {
+  case SW_STORAGE_INT16:
+    return ((const gint16 *)sounddata->compact)[i] / 32768.0f;
+  case SW_STORAGE_INT24:
+    u8 = (const guint8 *)sounddata->compact + i * 3;
+    return ((gint32)(((guint32)u8[2] << 24) | ((guint32)u8[1] << 16) |
+		     ((guint32)u8[0] << 8)) >> 8) / 8388608.0f;
+  case SW_STORAGE_PACKED:
+    return packed_get_sample ((sw_packed *)sounddata->compact, frame,
+			      channel);
+  default:
+    return ((const gfloat *)sounddata->data)[i];
+  }
+}
+
+const gfloat *
+sounddata_read_frames (sw_sounddata * sounddata, sw_framecount_t offset,
+		       sw_framecount_t n, gfloat * buf)
+{
+  if (sounddata->storage == SW_STORAGE_FLOAT) {
+    g_atomic_int_inc (&sounddata->accesses);
+    return (gfloat *)sounddata->data + offset * sounddata->format->channels;
+  }
+
+  sounddata_copy_frames (sounddata, offset, n, buf);
+
+  return buf;
+}
+
+gboolean
+sounddata_promote (sw_sounddata * sounddata)
+{
+  gpointer data, compact;
+  sw_storage_t storage;
+
+  if (sounddata->storage == SW_STORAGE_FLOAT) return TRUE;
+
+  data = g_try_malloc (frames_to_bytes (sounddata->format,
+					sounddata->nr_frames));
+  if (data == NULL) return FALSE;
+
+  sounddata_copy_frames (sounddata, 0, sounddata->nr_frames, data);
+
+  g_mutex_lock (&sounddata->data_mutex);
+  sounddata->data = data;
+  storage = sounddata->storage;
+  sounddata->storage = SW_STORAGE_FLOAT;
+  compact = sounddata->compact;
+  sounddata->compact = NULL;
+  g_mutex_unlock (&sounddata->data_mutex);
+
+  if (storage == SW_STORAGE_PACKED) {
+    packed_free ((sw_packed *)compact);
+  } else {
+    g_free (compact);
+  }
+
+#ifdef DEBUG
+  g_print ("promoted sounddata %p to float\n", sounddata);
+#endif
+
+  return TRUE;
+}
+
+/*
+ * Selection index
+ *
+ * sels stays a plain sorted GList, as plugins walk it directly. Alongside
+ * it we keep an array with one node per region, in list order, holding the
+ * region start and the greatest sel_end seen up to and including that
+ * region. As the starts are sorted and the running maximum of the ends
+ * never decreases, both can be binary searched: this is an interval tree
+ * flattened into an array, and finds the regions overlapping any offset
+ * in O(log N) whether or not the selection is normalised.
+ *
+ * The index is built on demand and discarded by any change to sels made
+ * through the sounddata_*_selection functions; code which modifies sels
+ * itself must call sounddata_selection_changed() afterwards.
+ *
+ * The display reads the index without holding sels_mutex, so the index
+ * has a mutex of its own. It is only ever held within the functions
+ * below, which call nothing that could take another lock meanwhile.
+ */
+
+typedef struct _sw_sel_node sw_sel_node;
+
+struct _sw_sel_node {
+  sw_framecount_t start;
+  sw_framecount_t max_end;
+  GList * link;
+};
+
+struct _sw_sel_index {
+  GArray * nodes;        /* one sw_sel_node per region */
+  sw_framecount_t nr_frames; /* total length of all regions */
+  sw_framecount_t normal_frames; /* sounddata->nr_frames when normalised,
+				  * or -1 if the regions may overlap */
+};
+
+#define SEL_NODE(i,n) (&g_array_index ((i)->nodes, sw_sel_node, (n)))
+
+static void
+sel_index_free (sw_sel_index * index)
+{
+  if (index == NULL) return;
+
+  g_array_free (index->nodes, TRUE);
+  g_free (index);
+}
+
+static void
+sel_index_push (sw_sel_index * index, GList * link)
+{
+  sw_sel * sel = (sw_sel *)link->data;
+  sw_sel_node node;
+  guint n = index->nodes->len;
+
+  node.start = sel->sel_start;
+  node.max_end = sel->sel_end;
+  node.link = link;
+
+  if (n > 0 && SEL_NODE(index, n-1)->max_end > node.max_end)
+    node.max_end = SEL_NODE(index, n-1)->max_end;
+
+  g_array_append_val (index->nodes, node);
+
+  index->nr_frames += sel->sel_end - sel->sel_start;
+}
+
+/*
+ * sel_index_get (sounddata)
+ *
+ * returns the index of sounddata's selection, building it if need be.
+ * Call with sels_index_mutex held.
+ */
+static sw_sel_index *
+sel_index_get (sw_sounddata * sounddata)
+{
+  sw_sel_index * index = sounddata->sels_index;
+  GList * gl;
+
+  if (index != NULL) return index;
+
+  index = g_malloc (sizeof (sw_sel_index));
+  index->nodes = g_array_new (FALSE, FALSE, sizeof (sw_sel_node));
+  index->nr_frames = 0;
+  index->normal_frames = -1;
+
+  for (gl = sounddata->sels; gl; gl = gl->next)
+    sel_index_push (index, gl);
+
+  sounddata->sels_index = index;
+
+  return index;
+}
+
+/*
+ * sel_index_seek (index, offset)
+ *
+ * returns the index of the first region which could contain offset or any
+ * later frame, ie. the first node whose max_end is greater than offset.
+ */
+static guint
+sel_index_seek (sw_sel_index * index, sw_framecount_t offset)
+{
+  guint lo = 0, hi = index->nodes->len, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (SEL_NODE(index, mid)->max_end > offset) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+
+  return lo;
+}
+
+/*
+ * sounddata_selection_changed (sounddata)
+ *
+ * discards the cached selection index. Call this after modifying any
+ * region of sounddata->sels in place, or after replacing the list
+ * without going through the sounddata_*_selection functions.
+ */
+void
+sounddata_selection_changed (sw_sounddata * sounddata)
+{
+  g_mutex_lock (&sounddata->sels_index_mutex);
+  sel_index_free (sounddata->sels_index);
+  sounddata->sels_index = NULL;
+  g_mutex_unlock (&sounddata->sels_index_mutex);
+}
+
+/*
+ * sounddata_selection_seek (sounddata, offset)
+ *
+ * returns the first link of sounddata->sels whose region ends after
+ * offset, or NULL if there is none. To visit every region overlapping
+ * [start, end), seek to start and walk forward until sel_start >= end,
+ * skipping any regions with sel_end <= start (these can only occur if
+ * the selection is not normalised).
+ */
+GList *
+sounddata_selection_seek (sw_sounddata * sounddata, sw_framecount_t offset)
+{
+  sw_sel_index * index;
+  GList * link = NULL;
+  guint i;
+
+  g_mutex_lock (&sounddata->sels_index_mutex);
+
+  index = sel_index_get (sounddata);
+  i = sel_index_seek (index, offset);
+
+  if (i < index->nodes->len) link = SEL_NODE(index, i)->link;
+
+  g_mutex_unlock (&sounddata->sels_index_mutex);
+
+  return link;
+}
+
+/*
+ * sounddata_selection_find (sounddata, offset)
+ *
+ * returns the selected region containing offset, or NULL if offset is
+ * not selected.
+ */
+sw_sel *
+sounddata_selection_find (sw_sounddata * sounddata, sw_framecount_t offset)
+{
+  GList * gl;
+  sw_sel * sel;
+
+  for (gl = sounddata_selection_seek (sounddata, offset); gl; gl = gl->next) {
+    sel = (sw_sel *)gl->data;
+
+    if (sel->sel_start > offset) break;
+    if (sel->sel_end > offset) return sel;
+  }
+
+  return NULL;
+}
+
 void
 sounddata_clear_selection (sw_sounddata * sounddata)
 {
@@ -93,6 +488,8 @@ sounddata_clear_selection (sw_sounddata * sounddata)
   g_list_free(sounddata->sels);
 
   sounddata->sels = NULL;
+
+  sounddata_selection_changed (sounddata);
 };
 
 void
@@ -102,8 +499,17 @@ sounddata_destroy (sw_sounddata * sounddata)
 
   if (sounddata->refcount <= 0) {
     g_free (sounddata->data);
+    if (sounddata->storage == SW_STORAGE_PACKED) {
+      packed_free ((sw_packed *)sounddata->compact);
+    } else {
+      g_free (sounddata->compact);
+    }
+    peaks_free (sounddata->peaks);
     g_mutex_clear(&sounddata->data_mutex);
+    sounddata_drop_analysis (sounddata);
+    g_mutex_clear(&sounddata->analysis_mutex);
     sounddata_clear_selection (sounddata);
+    g_mutex_clear (&sounddata->sels_index_mutex);
     memset (sounddata, 0, sizeof (*sounddata));
     g_free (sounddata);
   }
@@ -124,7 +530,13 @@ sounddata_unlock_selection (sw_sounddata * sounddata)
 guint
 sounddata_selection_nr_regions (sw_sounddata * sounddata)
 {
-  return g_list_length (sounddata->sels);
+  guint n;
+
+  g_mutex_lock (&sounddata->sels_index_mutex);
+  n = sel_index_get (sounddata)->nodes->len;
+  g_mutex_unlock (&sounddata->sels_index_mutex);
+
+  return n;
 }
 
 static gint
@@ -133,22 +545,31 @@ sounddata_sel_needs_normalising (sw_sounddata *sounddata)
   GList * gl;
   sw_sel * osel = NULL, * sel;
   sw_framecount_t nr_frames;
+  gboolean normal;
 
   if(!sounddata->sels) return FALSE;
 
   nr_frames = sounddata->nr_frames;
 
+  g_mutex_lock (&sounddata->sels_index_mutex);
+  normal = (sel_index_get (sounddata)->normal_frames == nr_frames);
+  g_mutex_unlock (&sounddata->sels_index_mutex);
+
+  if (normal) return FALSE;
+
   /* Seed osel with 'fake' iteration of following loop */
   gl = sounddata->sels;
   osel = (sw_sel *)gl->data;
-  if (osel->sel_start < 0 || osel->sel_end > nr_frames)
+  if (osel->sel_start < 0 || osel->sel_end > nr_frames ||
+      osel->sel_start >= osel->sel_end)
     return TRUE;
 
   gl = gl->next;
   for(; gl; gl = gl->next) {
     sel = (sw_sel *)gl->data;
 
-    if (sel->sel_start < 0 || sel->sel_end > nr_frames)
+    if (sel->sel_start < 0 || sel->sel_end > nr_frames ||
+	sel->sel_start >= sel->sel_end)
       return TRUE;
 
     if(osel->sel_end >= sel->sel_start) {
@@ -160,6 +581,10 @@ sounddata_sel_needs_normalising (sw_sounddata *sounddata)
     }
   }
 
+  g_mutex_lock (&sounddata->sels_index_mutex);
+  sel_index_get (sounddata)->normal_frames = nr_frames;
+  g_mutex_unlock (&sounddata->sels_index_mutex);
+
   return FALSE;
 }
 
@@ -192,6 +617,8 @@ sounddata_normalise_selection (sw_sounddata * sounddata)
 
   gl = gl->next;
 
+  /* The merged regions come out in order, so build nsels backwards
+   * and reverse it at the end rather than inserting each in place. */
   for (; gl; gl = gl->next) {
     sel = (sw_sel *)gl->data;
     sel->sel_start = CLAMP(sel->sel_start, 0, nr_frames);
@@ -215,7 +642,7 @@ sounddata_normalise_selection (sw_sounddata * sounddata)
       if (osel->sel_start == osel->sel_end) {
 	g_free (osel);
       } else {
-	nsels = g_list_insert_sorted(nsels, osel, (GCompareFunc)sel_cmp);
+	nsels = g_list_prepend(nsels, osel);
       }
       osel = sel_copy(sel);
     }
@@ -225,22 +652,107 @@ sounddata_normalise_selection (sw_sounddata * sounddata)
   if (osel->sel_start == osel->sel_end) {
     g_free (osel);
   } else {
-    nsels = g_list_insert_sorted(nsels, osel, (GCompareFunc)sel_cmp);
+    nsels = g_list_prepend(nsels, osel);
   }
 
   /* Clear the old selection */
   sounddata_clear_selection (sounddata);
 
   /* Set the newly created (normalised) selection */
-  sounddata->sels = nsels;
+  sounddata->sels = g_list_reverse (nsels);
 
+  g_mutex_lock (&sounddata->sels_index_mutex);
+  sel_index_get (sounddata)->normal_frames = nr_frames;
+  g_mutex_unlock (&sounddata->sels_index_mutex);
 }
 
+/*
+ * sounddata_add_selection (sounddata, sel)
+ *
+ * inserts sel into the selection of sounddata, keeping it sorted by
+ * sel_start. Regions arriving in order, as from a detection pass over
+ * the data, are appended in constant time; others are placed by a binary
+ * search of the selection index.
+ */
 void
 sounddata_add_selection (sw_sounddata * sounddata, sw_sel * sel)
 {
-  sounddata->sels =
-    g_list_insert_sorted(sounddata->sels, sel, (GCompareFunc)sel_cmp);
+  sw_sel_index * index;
+  sw_sel_node * last, * node, nnode;
+  GList * link;
+  sw_framecount_t normal_frames;
+  guint n, i, lo, hi;
+
+  g_mutex_lock (&sounddata->sels_index_mutex);
+
+  index = sel_index_get (sounddata);
+  n = index->nodes->len;
+
+  if (n == 0 || sel->sel_start > SEL_NODE(index, n-1)->start) {
+    last = (n == 0) ? NULL : SEL_NODE(index, n-1);
+
+    /* Appending a disjoint, in-range region keeps a normalised
+     * selection normalised */
+    normal_frames = index->normal_frames;
+    if (n == 0) normal_frames = sounddata->nr_frames;
+    if (sel->sel_start >= sel->sel_end || sel->sel_start < 0 ||
+	sel->sel_end > sounddata->nr_frames ||
+	(last != NULL && sel->sel_start <= last->max_end))
+      normal_frames = -1;
+
+    link = g_list_alloc ();
+    link->data = sel;
+
+    if (last == NULL) {
+      sounddata->sels = link;
+    } else {
+      link->prev = last->link;
+      last->link->next = link;
+    }
+
+    index->normal_frames = normal_frames;
+    sel_index_push (index, link);
+
+    g_mutex_unlock (&sounddata->sels_index_mutex);
+
+    return;
+  }
+
+  /* Find the first region starting at or after sel, and insert before it */
+  lo = 0; hi = n;
+  while (lo < hi) {
+    i = lo + (hi - lo) / 2;
+    if (SEL_NODE(index, i)->start < sel->sel_start) {
+      lo = i + 1;
+    } else {
+      hi = i;
+    }
+  }
+
+  i = lo;
+  link = SEL_NODE(index, i)->link;
+  sounddata->sels = g_list_insert_before (sounddata->sels, link, sel);
+
+  nnode.start = sel->sel_start;
+  nnode.max_end = sel->sel_end;
+  nnode.link = link->prev;
+
+  if (i > 0 && SEL_NODE(index, i-1)->max_end > nnode.max_end)
+    nnode.max_end = SEL_NODE(index, i-1)->max_end;
+
+  g_array_insert_val (index->nodes, i, nnode);
+
+  /* Carry the running max forward until it no longer changes */
+  for (i++; i < index->nodes->len; i++) {
+    node = SEL_NODE(index, i);
+    if (node->max_end >= nnode.max_end) break;
+    node->max_end = nnode.max_end;
+  }
+
+  index->nr_frames += sel->sel_end - sel->sel_start;
+  index->normal_frames = -1;
+
+  g_mutex_unlock (&sounddata->sels_index_mutex);
 }
 
 sw_sel *
@@ -266,33 +778,33 @@ sounddata_set_selection_1 (sw_sounddata * sounddata, sw_framecount_t start, sw_f
 gint
 sounddata_selection_nr_frames (sw_sounddata * sounddata)
 {
-  gint nr_frames = 0;
-  GList * gl;
-  sw_sel * sel;
-
-  for (gl = sounddata->sels; gl; gl = gl->next) {
-    sel = (sw_sel *)gl->data;
+  sw_framecount_t nr_frames;
 
-    nr_frames += sel->sel_end - sel->sel_start;
-  }
+  g_mutex_lock (&sounddata->sels_index_mutex);
+  nr_frames = sel_index_get (sounddata)->nr_frames;
+  g_mutex_unlock (&sounddata->sels_index_mutex);
 
-  return nr_frames;
+  return (gint)nr_frames;
 }
 
 sw_framecount_t
 sounddata_selection_width (sw_sounddata * sounddata)
 {
-  GList * gl;
+  sw_sel_index * index;
   sw_sel * sel;
-  sw_framecount_t start, end;
+  sw_framecount_t start = 0, end = 0;
 
-  if ((gl = sounddata->sels) == NULL) return 0;
-  sel = (sw_sel *)gl->data;
-  start = sel->sel_start;
+  g_mutex_lock (&sounddata->sels_index_mutex);
 
-  gl = g_list_last (sounddata->sels);
-  sel = (sw_sel *)gl->data;
-  end = sel->sel_end;
+  index = sel_index_get (sounddata);
+  if (index->nodes->len > 0) {
+    start = SEL_NODE(index, 0)->start;
+
+    sel = (sw_sel *)SEL_NODE(index, index->nodes->len - 1)->link->data;
+    end = sel->sel_end;
+  }
+
+  g_mutex_unlock (&sounddata->sels_index_mutex);
 
   return (end - start);
 }
@@ -310,6 +822,8 @@ sounddata_selection_translate (sw_sounddata * sounddata, gint delta)
     sel->sel_end += delta;
   }
 
+  sounddata_selection_changed (sounddata);
+
   /* XXX: Crop any regions outside of [0, nr_frames] */
   sounddata_normalise_selection (sounddata);
 }
@@ -333,6 +847,8 @@ sounddata_selection_scale (sw_sounddata * sounddata, gfloat scale)
     sel->sel_end = sels_start + ((sel->sel_end - sels_start) * scale);
   }
 
+  sounddata_selection_changed (sounddata);
+
   /* XXX: Crop any regions outside of [0, nr_frames] */
   sounddata_normalise_selection (sounddata);
 }
@@ -33,6 +33,7 @@
 #include <sweep/sweep_undo.h>
 #include <sweep/sweep_sample.h>
 #include <sweep/sweep_sounddata.h>
+#include <sweep/sweep_analysis.h>
 #include <sweep/sweep_selection.h>
 
 #include "sweep_app.h"
@@ -41,7 +42,11 @@
 #include "head.h"
 #include "play.h"
 #include "file_dialogs.h"
+#include "journal.h"
+#include "peakcache.h"
 #include "question_dialogs.h"
+#include "sample.h"
+#include "batch.h"
 
 #ifdef LIMITED_UNDO
 /* Nr. of undo operations remembered */
@@ -55,6 +60,70 @@
 
 /*#define DEBUG*/
 
+static void
+sw_op_instance_clear (sw_op_instance * inst);
+
+/*
+ * op_do (sample, inst)
+ *
+ * runs the operation inst, once the sample's edit state is BUSY.
+ */
+static void
+op_do (sw_sample * sample, sw_op_instance * inst)
+{
+  gboolean was_going = FALSE;
+  gboolean runnable = TRUE;
+  gboolean modifies_data;
+  sw_edit_mode edit_mode;
+
+  if (inst->op->edit_mode == SWEEP_EDIT_MODE_ALLOC) {
+    g_mutex_lock (&sample->play_mutex);
+    if ((was_going = sample->play_head->going)) {
+      head_set_stop_offset (sample->play_head, sample->user_offset);
+      head_set_going (sample->play_head, FALSE);
+    }
+    g_mutex_unlock (&sample->play_mutex);
+  }
+
+  edit_mode = inst->op->edit_mode;
+  modifies_data = (edit_mode != SWEEP_EDIT_MODE_META && inst->op->undo != NULL);
+
+  /* Any undoable edit invalidates the peak summary made at load
+   * time, and needs the data as float to work on */
+  if (modifies_data) {
+    sample_drop_peaks (sample);
+    sample->pack_refused = FALSE;
+
+    runnable = sample_promote_data (sample);
+  }
+
+  /* XXX: this is fubar -- change to SweepFunction ?? or change all to
+   * have sample as first arg ... */
+  if (runnable) {
+    inst->op->_do_ ((sw_sample *)inst, (void *)inst);
+  } else {
+    sw_op_instance_clear (inst);
+  }
+
+  /* Filters only modify the selection (paste mix and xfade select
+   * what they paste over); anything else may have touched it all */
+  if (runnable && modifies_data) {
+    sw_sounddata * sounddata = sample->sounddata;
+    GList * sgl;
+    sw_sel * sel;
+
+    if (edit_mode == SWEEP_EDIT_MODE_FILTER) {
+      for (sgl = sounddata->sels; sgl; sgl = sgl->next) {
+	sel = (sw_sel *)sgl->data;
+	sounddata_invalidate_analysis (sounddata, sel->sel_start,
+				       sel->sel_end);
+      }
+    } else {
+      sounddata_invalidate_analysis (sounddata, 0, sounddata->nr_frames);
+    }
+  }
+}
+
 static void
 op_main (sw_sample * sample)
 {
@@ -81,8 +150,6 @@ op_main (sw_sample * sample)
       fflush (stdout);
 #endif
     } else {
-      gboolean was_going = FALSE;
-
       inst = (sw_op_instance *)gl->data;
 
       g_assert (sample->edit_state == SWEEP_EDIT_STATE_PENDING);
@@ -92,18 +159,7 @@ op_main (sw_sample * sample)
 
       g_mutex_unlock (&sample->edit_mutex);
 
-      if (inst->op->edit_mode == SWEEP_EDIT_MODE_ALLOC) {
-	g_mutex_lock (&sample->play_mutex);
-	if ((was_going = sample->play_head->going)) {
-	  head_set_stop_offset (sample->play_head, sample->user_offset);
-	  head_set_going (sample->play_head, FALSE);
-	}
-	g_mutex_unlock (&sample->play_mutex);
-      }
-
-      /* XXX: this is fubar -- change to SweepFunction ?? or change all to
-       * have sample as first arg ... */
-      inst->op->_do_ ((sw_sample *)inst, (void *)inst);
+      op_do (sample, inst);
 
       g_mutex_lock (&sample->edit_mutex);
 
@@ -279,8 +335,8 @@ schedule_operation_do (sw_op_instance * inst)
 
   if (sample->op_progress_tag == -1) {
     sample->op_progress_tag =
-      g_timeout_add (30, (GtkFunction)update_edit_progress,
-		       (gpointer)sample);
+      sweep_timeout_add (30, (GtkFunction)update_edit_progress,
+			 (gpointer)sample);
   }
 }
 
@@ -295,6 +351,29 @@ schedule_operation_ok_cb (GtkWidget * widget, gpointer data)
   schedule_operation_do (inst);
 }
 
+/*
+ * schedule_operation_now (inst)
+ *
+ * runs inst to completion in the calling thread, for batch mode where
+ * there is no main loop to hand it to the sample's ops thread.
+ */
+static void
+schedule_operation_now (sw_op_instance * inst)
+{
+  sw_sample * sample = inst->sample;
+
+  sample_set_edit_mode (sample, inst->op->edit_mode);
+  sample_set_progress_percent (sample, 0);
+
+  g_mutex_lock (&sample->edit_mutex);
+  sample->edit_state = SWEEP_EDIT_STATE_BUSY;
+  g_mutex_unlock (&sample->edit_mutex);
+
+  op_do (sample, inst);
+
+  sample_set_edit_state (sample, SWEEP_EDIT_STATE_IDLE);
+}
+
 void
 schedule_operation (sw_sample * sample, const char * description,
 		    sw_operation * operation, void * do_data)
@@ -305,7 +384,9 @@ schedule_operation (sw_sample * sample, const char * description,
   inst = sw_op_instance_new (sample, description, operation);
   inst->do_data = do_data;
 
-  if (operation->edit_mode != SWEEP_EDIT_MODE_META &&
+  if (batch_mode) {
+    schedule_operation_now (inst);
+  } else if (operation->edit_mode != SWEEP_EDIT_MODE_META &&
       !sample->edit_ignore_mtime && sample_mtime_changed (sample)) {
 
     snprintf (buf, sizeof (buf),
@@ -375,6 +456,10 @@ register_operation (sw_sample * s, sw_op_instance * inst)
   }
 
   g_mutex_unlock (&s->ops_mutex);
+
+  if (inst->op->edit_mode != SWEEP_EDIT_MODE_META) {
+    journal_record (s, inst->description);
+  }
 }
 
 static void
@@ -393,6 +478,39 @@ redo_operation (sw_sample * s, sw_op_instance * inst)
   }
 }
 
+/*
+ * prepare_revert (s, inst)
+ *
+ * readies s for undoing or redoing inst, as op_do () does before an
+ * edit: anything but a META op needs the data as float, and outdates
+ * the peak summary. Returns FALSE if the data could not be promoted.
+ */
+static gboolean
+prepare_revert (sw_sample * s, sw_op_instance * inst)
+{
+  if (inst->op->edit_mode == SWEEP_EDIT_MODE_META) return TRUE;
+
+  sample_drop_peaks (s);
+  s->pack_refused = FALSE;
+
+  return sample_promote_data (s);
+}
+
+/*
+ * revert_done (s, inst)
+ *
+ * outdates the analysis of s after undoing or redoing inst, which may
+ * have changed any of the data.
+ */
+static void
+revert_done (sw_sample * s, sw_op_instance * inst)
+{
+  if (inst->op->edit_mode == SWEEP_EDIT_MODE_META) return;
+
+  sample_drop_peaks (s);
+  sounddata_invalidate_analysis (s->sounddata, 0, s->sounddata->nr_frames);
+}
+
 static void
 do_undo_current_thread (sw_op_instance * inst)
 {
@@ -400,8 +518,12 @@ do_undo_current_thread (sw_op_instance * inst)
 
   if (s == NULL || s->current_undo == NULL) goto noop;
 
+  if (!prepare_revert (s, inst->do_data)) return;
+
   undo_operation (s, inst->do_data);
 
+  revert_done (s, inst->do_data);
+
   g_mutex_lock (&s->ops_mutex);
   if (s->edit_state == SWEEP_EDIT_STATE_BUSY) {
     s->current_redo = s->current_undo;
@@ -409,6 +531,8 @@ do_undo_current_thread (sw_op_instance * inst)
   }
   g_mutex_unlock (&s->ops_mutex);
 
+  journal_record (s, inst->description);
+
   return;
 
  noop:
@@ -479,8 +603,12 @@ do_redo_current_thread (sw_op_instance * inst)
 
   if (s == NULL || s->current_redo == NULL) goto noop;
 
+  if (!prepare_revert (s, inst->do_data)) return;
+
   redo_operation (s, inst->do_data);
 
+  revert_done (s, inst->do_data);
+
   g_mutex_lock (&s->ops_mutex);
   if (s->edit_state == SWEEP_EDIT_STATE_BUSY) {
     s->current_undo = s->current_redo;
@@ -488,6 +616,8 @@ do_redo_current_thread (sw_op_instance * inst)
   }
   g_mutex_unlock (&s->ops_mutex);
 
+  journal_record (s, inst->description);
+
   return;
 
  noop:
@@ -794,6 +924,7 @@ undo_by_splice_out (sw_sample * s, splice_data * sp)
   splice_out_sel (s);
 
   s->sounddata->sels = sels_copy (sp->sels);
+  sounddata_selection_changed (s->sounddata);
 }
 
 void
@@ -806,6 +937,7 @@ void
 undo_by_splice_over (sw_sample * s, splice_data * sp)
 {
   s->sounddata->sels = sels_copy (sp->sels);
+  sounddata_selection_changed (s->sounddata);
   paste_over (s, sp->eb);
 }
 
@@ -813,6 +945,7 @@ void
 redo_by_splice_over (sw_sample * s, splice_data * sp)
 {
   s->sounddata->sels = sels_copy (sp->sels);
+  sounddata_selection_changed (s->sounddata);
   paste_over (s, sp->eb);
 }
 
@@ -18,6 +18,22 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+/*
+ * The frame clock.
+ *
+ * Every timed refresh in sweep -- play and record markers, marching
+ * ants, the cursor pulse, progress and level meters, autoscrolling --
+ * is a timeout on this one clock rather than a GLib timeout of its own.
+ * The clock is a single main loop source whose ready time is that of
+ * the earliest timeout due, and which is never ready when there are
+ * none, so sweep sleeps when nothing is moving. Due times are rounded
+ * to the display frame, so that timeouts of different samples and
+ * views which fall in the same frame are dispatched together.
+ *
+ * Timeouts may be added and removed from any thread; they are always
+ * run in the main thread.
+ */
+
 #ifdef HAVE_CONFIG_H
 #  include <config.h>
 #endif
@@ -33,67 +49,132 @@
 #include <sweep/sweep_types.h>
 #include <sweep/sweep_sample.h>
 
+/*#define DEBUG*/
+
+/* Display frames per second */
+#define FRAME_CLOCK_RATE 60
+
+#define FRAME_CLOCK_PERIOD (G_USEC_PER_SEC / FRAME_CLOCK_RATE)
+
+/* Round t to the nearest frame */
+#define FRAME_CLOCK_ALIGN(t) \
+  ((((t) + FRAME_CLOCK_PERIOD / 2) / FRAME_CLOCK_PERIOD) * FRAME_CLOCK_PERIOD)
+
 static GMutex timeouts_mutex;
 
 static GList * timeouts = NULL;
 
 static guint sweep_tag = 0;
 
+static GSource * frame_clock = NULL;
+
+/* Nesting of dispatches, as a timeout may run a main loop of its own */
+static gint dispatch_depth = 0;
+
 typedef struct {
   guint sweep_tag;
-  guint gtk_tag;
-  guint32 interval;
+  gint64 interval; /* usec */
+  gint64 due;      /* monotonic time, usec */
+  gboolean removed;
   GtkFunction function;
   gpointer data;
 } sweep_timeout_data;
 
-static gint
-sweep_timeout_wrapper (gpointer data)
+/*
+ * frame_clock_next ()
+ *
+ * frees removed timeouts, unless a dispatch further out may still hold
+ * them, and sets the clock to wake for the earliest one left, if any.
+ * Called with timeouts_mutex held.
+ */
+static void
+frame_clock_next (void)
 {
-  sweep_timeout_data * td = (sweep_timeout_data *)data;
+  GList * gl, * gl_next;
+  sweep_timeout_data * td;
+  gint64 next = -1;
 
-  if (td->function (td->data)) {
-    return TRUE;
-  } else {
-    g_mutex_lock (&timeouts_mutex);
-    timeouts = g_list_remove (timeouts, td);
-    g_mutex_unlock (&timeouts_mutex);
+  for (gl = timeouts; gl; gl = gl_next) {
+    td = (sweep_timeout_data *)gl->data;
 
-    g_free (td);
+    gl_next = gl->next;
 
-    return FALSE;
+    if (td->removed) {
+      if (dispatch_depth > 0) continue;
+      timeouts = g_list_delete_link (timeouts, gl);
+      g_free (td);
+    } else if (next == -1 || td->due < next) {
+      next = td->due;
+    }
   }
+
+  g_source_set_ready_time (frame_clock, next);
 }
 
-static gint
-sweep_timeouts_handle_pending (gpointer data)
+static gboolean
+frame_clock_dispatch (GSource * source, GSourceFunc callback, gpointer data)
 {
-  GList * gl, * gl_next;
+  GList * gl, * due = NULL;
   sweep_timeout_data * td;
+  gint64 now;
+  gboolean removed;
+
+  now = g_source_get_time (source);
 
   g_mutex_lock (&timeouts_mutex);
 
-  for (gl = timeouts; gl; gl = gl_next) {
+  for (gl = timeouts; gl; gl = gl->next) {
     td = (sweep_timeout_data *)gl->data;
 
-    gl_next = gl->next;
+    if (!td->removed && td->due <= now) {
+      due = g_list_prepend (due, td);
+    }
+  }
 
-    if (td->sweep_tag == -1) {
-      g_assert (td->gtk_tag != -1);
+  dispatch_depth++;
 
-      g_source_remove (td->gtk_tag);
-      timeouts = g_list_remove_link (timeouts, gl);
-      g_free (td);
-    } else if (td->gtk_tag == -1) {
-      td->gtk_tag = g_timeout_add (td->interval, sweep_timeout_wrapper, td);
+  g_mutex_unlock (&timeouts_mutex);
+
+#ifdef DEBUG
+  g_print ("frame clock: %d due\n", g_list_length (due));
+#endif
+
+  /* Only this thread frees timeouts, so those found due remain valid;
+   * but they may be removed while earlier ones are running */
+  for (gl = g_list_reverse (due); gl; gl = gl->next) {
+    td = (sweep_timeout_data *)gl->data;
+
+    g_mutex_lock (&timeouts_mutex);
+    removed = td->removed;
+    g_mutex_unlock (&timeouts_mutex);
+
+    if (removed) continue;
+
+    if (td->function (td->data)) {
+      td->due = FRAME_CLOCK_ALIGN (td->due + td->interval);
+      if (td->due <= now)
+	td->due = FRAME_CLOCK_ALIGN (now + td->interval + FRAME_CLOCK_PERIOD/2);
+    } else {
+      g_mutex_lock (&timeouts_mutex);
+      td->removed = TRUE;
+      g_mutex_unlock (&timeouts_mutex);
     }
   }
 
+  g_list_free (due);
+
+  g_mutex_lock (&timeouts_mutex);
+  dispatch_depth--;
+  frame_clock_next ();
   g_mutex_unlock (&timeouts_mutex);
 
   return TRUE;
 }
 
+static GSourceFuncs frame_clock_funcs = {
+  NULL, NULL, frame_clock_dispatch, NULL
+};
+
 void
 sweep_timeouts_init (void)
 {
@@ -109,24 +190,51 @@ sweep_timeouts_init (void)
   timeouts = NULL;
   g_mutex_unlock (&timeouts_mutex);
 
-  g_timeout_add ((guint32)500, sweep_timeouts_handle_pending, NULL);
+  if (frame_clock == NULL) {
+    frame_clock = g_source_new (&frame_clock_funcs, sizeof (GSource));
+    g_source_set_ready_time (frame_clock, -1);
+    g_source_set_can_recurse (frame_clock, TRUE);
+    g_source_attach (frame_clock, NULL);
+  }
 }
 
+/*
+ * sweep_timeout_add (interval, function, data)
+ *
+ * arranges for function to be called in the main thread after interval
+ * milliseconds, and then every interval for as long as it returns TRUE.
+ * Returns a tag for sweep_timeout_remove (), or 0 if there is no frame
+ * clock to run it, as in batch mode, which has nothing to refresh.
+ */
 guint
 sweep_timeout_add (guint32 interval, GtkFunction function, gpointer data)
 {
   sweep_timeout_data * td;
+  gint64 ready;
+
+  if (frame_clock == NULL) return 0;
 
   td = g_malloc (sizeof (sweep_timeout_data));
 
-  td->sweep_tag = ++sweep_tag;
-  td->gtk_tag = -1;
-  td->interval = interval;
+  td->interval = (gint64)interval * 1000;
+  td->due = g_get_monotonic_time () + td->interval;
+  td->removed = FALSE;
   td->function = function;
   td->data = data;
 
+  /* Deferred calls go as soon as possible, timed ones on a frame */
+  if (interval > 0)
+    td->due = FRAME_CLOCK_ALIGN (td->due + FRAME_CLOCK_PERIOD / 2);
+
   g_mutex_lock (&timeouts_mutex);
+
+  td->sweep_tag = ++sweep_tag;
   timeouts = g_list_append (timeouts, td);
+
+  ready = g_source_get_ready_time (frame_clock);
+  if (ready == -1 || td->due < ready)
+    g_source_set_ready_time (frame_clock, td->due);
+
   g_mutex_unlock (&timeouts_mutex);
 
   return td->sweep_tag;
@@ -135,28 +243,20 @@ sweep_timeout_add (guint32 interval, GtkFunction function, gpointer data)
 void
 sweep_timeout_remove (guint sweep_timeout_handler_id)
 {
-  GList * gl, * gl_next;
+  GList * gl;
   sweep_timeout_data * td;
 
-  if (sweep_timeout_handler_id == -1)
+  if (sweep_timeout_handler_id == 0 || sweep_timeout_handler_id == -1)
     return;
 
   g_mutex_lock (&timeouts_mutex);
 
-  for (gl = timeouts; gl; gl = gl_next) {
+  for (gl = timeouts; gl; gl = gl->next) {
     td = (sweep_timeout_data *)gl->data;
 
-    gl_next = gl->next;
-
+    /* The main thread frees it, as it may be running now */
     if (td->sweep_tag == sweep_timeout_handler_id) {
-      if (td->gtk_tag == -1) {
-	/* gtk_timeout not yet started */
-	timeouts = g_list_remove_link (timeouts, gl);
-	g_free (td);
-      } else {
-	/* need to remove gtk_timeout -- mark this for pending thread */
-	td->sweep_tag = -1;
-      }
+      td->removed = TRUE;
       break;
     }
   }
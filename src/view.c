@@ -59,6 +59,10 @@
 #include "time_ruler.h"
 #include "cursors.h"
 #include "head.h"
+#include "levelmeter.h"
+#include "play.h"
+#include "plugin.h"
+#include "startup.h"
 #include "view_pixmaps.h"
 
 /*#define DEBUG*/
@@ -135,7 +139,6 @@ sw_proc_instance_new (sw_procedure * proc, sw_view * view)
 {
   sw_proc_instance * pi;
 
-  /* XXX: where to clean this up? */
   pi = g_malloc (sizeof (sw_proc_instance));
   pi->proc = proc;
   pi->view = view;
@@ -143,14 +146,26 @@ sw_proc_instance_new (sw_procedure * proc, sw_view * view)
   return pi;
 }
 
+/* Freed with the menu item it was made for */
+static void
+proc_instance_destroy_cb (GtkWidget * widget, gpointer data)
+{
+  sw_proc_instance * pi = (sw_proc_instance *)data;
+
+  g_free (pi);
+}
+
 static void
 apply_procedure_cb (GtkWidget * widget, gpointer data)
 {
   sw_proc_instance * pi = (sw_proc_instance *)data;
-  sw_procedure * proc = pi->proc;
+  sw_procedure * proc = plugin_procedure_resolve (pi->proc);
   sw_sample * sample = pi->view->sample;
   sw_param_set pset;
 
+  /* The plugin providing it was removed since the menu was built */
+  if (proc == NULL) return;
+
   if (proc->nr_params == 0) {
     pset = NULL;
     proc->apply (sample, pset, proc->custom_data);
@@ -176,6 +191,8 @@ create_proc_menuitem (sw_procedure * proc, sw_view * view,
   gtk_menu_append(GTK_MENU(submenu), menuitem);
   g_signal_connect (G_OBJECT(menuitem), "activate",
 		     G_CALLBACK(apply_procedure_cb), pi);
+  g_signal_connect (G_OBJECT(menuitem), "destroy",
+		     G_CALLBACK(proc_instance_destroy_cb), pi);
   gtk_widget_show(menuitem);
 /* these accels are not editable */
  /*   gtk_widget_add_accelerator (menuitem, "activate", accel_group,
@@ -255,6 +272,48 @@ create_proc_menu (sw_view * view, GtkAccelGroup * accel_group)
   return menu;
 }
 
+/*
+ * view_replace_submenu (menuitem, submenu)
+ *
+ * gives menuitem a new submenu. The old one is destroyed rather than
+ * just detached, so that it and the sw_proc_instance of each of its
+ * items are freed.
+ */
+static void
+view_replace_submenu (GtkWidget * menuitem, GtkWidget * submenu)
+{
+  GtkWidget * old_submenu;
+
+  old_submenu = gtk_menu_item_get_submenu (GTK_MENU_ITEM(menuitem));
+  if (old_submenu != NULL)
+    gtk_widget_destroy (old_submenu);
+
+  gtk_menu_item_set_submenu (GTK_MENU_ITEM(menuitem), submenu);
+}
+
+/*
+ * view_refresh_proc_menus (view)
+ *
+ * rebuild the Process menus of view from the current list of plugins.
+ */
+void
+view_refresh_proc_menus (sw_view * view)
+{
+  GtkAccelGroup * accel_group;
+
+  if (view->proc_menuitem != NULL) {
+    accel_group = GTK_ACCEL_GROUP(g_object_get_data(G_OBJECT(view->window),
+						    "accel_group"));
+    view_replace_submenu (view->proc_menuitem,
+			  create_proc_menu (view, accel_group));
+  }
+
+  if (view->proc_sel_menuitem != NULL) {
+    view_replace_submenu (view->proc_sel_menuitem,
+			  create_proc_menu (view, NULL));
+  }
+}
+
 static void view_store_cb (GtkWidget * widget, gpointer data);
 static void view_retrieve_cb (GtkWidget * widget, gpointer data);
 
@@ -883,6 +942,7 @@ create_view_menu (sw_view * view, GtkWidget * m)
   gtk_widget_show(menuitem);
   submenu = create_proc_menu (view, accel_group);
   gtk_menu_item_set_submenu(GTK_MENU_ITEM(menuitem), submenu);
+  view->proc_menuitem = menuitem;
 
   NOMODIFY(menuitem);
 
@@ -1167,6 +1227,7 @@ create_context_menu_sel (sw_view * view)
   gtk_widget_show(menuitem);
   submenu = create_proc_menu (view, NULL);
   gtk_menu_item_set_submenu(GTK_MENU_ITEM(menuitem), submenu);
+  view->proc_sel_menuitem = menuitem;
 
   NOMODIFY(menuitem);
 
@@ -1295,7 +1356,7 @@ view_destroy_cb (GtkWidget * widget, gpointer data)
   sample_display_stop_marching_ants (SAMPLE_DISPLAY(view->display));
 
   if (view->sample->op_progress_tag != -1)
-    g_source_remove(view->sample->op_progress_tag);
+    sweep_timeout_remove (view->sample->op_progress_tag);
   view->sample->op_progress_tag = -1;
   cancel_active_op (view->sample);
   sample_remove_view(view->sample, view);
@@ -1924,6 +1985,12 @@ view_new(sw_sample * sample, sw_framecount_t start, sw_framecount_t end,
 
   view->follow_toggle = button;
 
+  /* Output levels */
+
+  ebox = levelmeter_box_new (play_get_meter ());
+  gtk_box_pack_end (GTK_BOX (hbox), ebox, FALSE, TRUE, 4);
+  gtk_widget_show (ebox);
+
 #ifdef DEVEL_CODE
   button = gtk_hseparator_new ();
   gtk_box_pack_start (GTK_BOX(main_vbox), button, FALSE, TRUE, 0);
@@ -2551,6 +2618,8 @@ view_new(sw_sample * sample, sw_framecount_t start, sw_framecount_t end,
 
   gtk_widget_show(window);
 
+  startup_trace_first_window ();
+
   view_zoom_normal (view);
 
   return view;
@@ -3092,7 +3161,7 @@ view_refresh_offset_indicators (sw_view * view)
   char buf[16];
 
   offset = (sample->play_head->going ?
-	    (sw_framecount_t)sample->play_head->offset :
+	    sample->play_head->realoffset :
 	    sample->user_offset);
 
   snprint_time (buf, sizeof (buf),
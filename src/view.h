@@ -86,6 +86,9 @@ view_set_user_marker (sw_view * view, int user_offset);
 void
 view_refresh_playmode (sw_view * view);
 
+void
+view_refresh_proc_menus (sw_view * view);
+
 void
 view_set_following (sw_view * view, gboolean following);
 